@@ -0,0 +1,563 @@
+/*
+ * This file is part of QWiimote.
+ *
+ * QWiimote is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QWiimote is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QWiimote. If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+  * @file qevdevwiimote.cpp
+  *
+  * Source file for the QEvdevWiimote class.
+  */
+
+#include <QDir>
+#include <QFile>
+#include <QSocketNotifier>
+#include <cstring>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/input.h>
+#include "qevdevwiimote.h"
+#include "qwiimote.h"
+#include "debugcheck.h"
+
+/* Older kernel headers only have the timeval member. */
+#if !defined(input_event_sec)
+#	define input_event_sec time.tv_sec
+#	define input_event_usec time.tv_usec
+#endif
+
+#define EVDEV_ACCELERATION_ZERO 0x200  ///< hid-wiimote reports accelerometer values relative to this raw value.
+#define EVDEV_MOTIONPLUS_ZERO   0x2000 ///< hid-wiimote reports MotionPlus values relative to this raw value.
+#define EVDEV_MOTIONPLUS_SLOW   9      ///< hid-wiimote multiplies slow MotionPlus values by this factor.
+
+/**
+ * Button codes of the hid-wiimote key device and their #QWiimote::WiimoteButton flags.
+ */
+static const struct {
+	quint16 code;
+	quint16 flag;
+} EvdevButtons[] = {
+	{KEY_LEFT,     QWiimote::ButtonLeft},
+	{KEY_RIGHT,    QWiimote::ButtonRight},
+	{KEY_DOWN,     QWiimote::ButtonDown},
+	{KEY_UP,       QWiimote::ButtonUp},
+	{KEY_NEXT,     QWiimote::ButtonPlus},
+	{BTN_2,        QWiimote::ButtonTwo},
+	{BTN_1,        QWiimote::ButtonOne},
+	{BTN_B,        QWiimote::ButtonB},
+	{BTN_A,        QWiimote::ButtonA},
+	{KEY_PREVIOUS, QWiimote::ButtonMinus},
+	{BTN_MODE,     QWiimote::ButtonHome},
+};
+
+/**
+ * Names given by hid-wiimote to the input devices of each #QEvdevWiimote::EventSource.
+ */
+static const char * const EvdevNames[] = {
+	"Nintendo Wii Remote",
+	"Nintendo Wii Remote Accelerometer",
+	"Nintendo Wii Remote Motion Plus",
+};
+
+/**
+ * Orders replayed events by time.
+ */
+static bool EvdevEventBefore(const QEvdevEvent &a, const QEvdevEvent &b)
+{
+	return a.time < b.time;
+}
+
+/* Public functions */
+
+/**
+ * Creates a new QEvdevWiimote object.
+ * @param parent The parent of this instance. Usually it will be a #QWiimote.
+ */
+QEvdevWiimote::QEvdevWiimote(QObject * parent) : QLoopbackWiimote(parent), replay_timer(this)
+{
+	this->device_directory = "/dev/input";
+	for (int i = 0; i < SourceCount; i++) {
+		this->descriptors[i] = -1;
+		this->notifiers[i] = NULL;
+		this->dropping[i] = false;
+	}
+	this->dropped_batches = 0;
+	this->time_offset = 0;
+	this->motionplus_present = false;
+	this->buttons_changed = false;
+	this->rumble_effect = -1;
+	this->applied_leds = 0;
+	this->replay_position = 0;
+
+	this->sample.buttons = 0;
+	for (int i = 0; i < 3; i++) {
+		this->sample.acceleration[i] = EVDEV_ACCELERATION_ZERO;
+		this->sample.motionplus[i] = EVDEV_MOTIONPLUS_ZERO;
+		this->sample.motionplus_slow[i] = true;
+	}
+
+	/* Input reports are only generated from events. */
+	this->setReportRate(0);
+
+	this->replay_timer.setSingleShot(true);
+	connect(&this->replay_timer, SIGNAL(timeout()), this, SLOT(replayEvents()));
+}
+
+/**
+ * Ensures that the evdev nodes are closed before destroying the object.
+ */
+QEvdevWiimote::~QEvdevWiimote()
+{
+	this->close();
+}
+
+/**
+ * Opens the evdev nodes of the first wiimote handled by hid-wiimote.
+ * The accelerometer and MotionPlus nodes must belong to the same device as the buttons node.
+ * @return true if at least the buttons node was opened. false otherwise.
+ */
+bool QEvdevWiimote::open()
+{
+	this->close();
+
+	QDir device_dir(this->device_directory);
+	QStringList nodes = device_dir.entryList(QStringList("event*"), QDir::System | QDir::Files, QDir::Name);
+
+	/* Find the name and physical location of every input device. */
+	QStringList names, locations;
+	for (int i = 0; i < nodes.size(); i++) {
+		char name[256] = "";
+		char location[256] = "";
+		int descriptor = ::open(QFile::encodeName(device_dir.filePath(nodes[i])).constData(), O_RDONLY | O_NONBLOCK);
+		if (descriptor >= 0) {
+			ioctl(descriptor, EVIOCGNAME(sizeof(name) - 1), name);
+			ioctl(descriptor, EVIOCGPHYS(sizeof(location) - 1), location);
+			::close(descriptor);
+		}
+		names.append(QString::fromLatin1(name));
+		locations.append(QString::fromLatin1(location));
+	}
+
+	for (int i = 0; i < nodes.size() && this->descriptors[SourceButtons] < 0; i++) {
+		if (names[i] != EvdevNames[SourceButtons] ||
+				!this->openNode(SourceButtons, device_dir.filePath(nodes[i]))) continue;
+		this->event_nodes[SourceButtons] = nodes[i];
+
+		/* The other nodes of the same wiimote share its physical location. */
+		for (int j = 0; j < nodes.size(); j++) {
+			if (locations[j] != locations[i]) continue;
+			for (int source = SourceAccelerometer; source < SourceCount; source++) {
+				if (names[j] == EvdevNames[source] && this->descriptors[source] < 0 &&
+						this->openNode((EventSource)source, device_dir.filePath(nodes[j]))) {
+					this->event_nodes[source] = nodes[j];
+				}
+			}
+		}
+	}
+
+	if (this->descriptors[SourceButtons] < 0) return false;
+
+	/* hid-wiimote publishes the Bluetooth address of the wiimote as the unique identifier of its nodes. */
+	char identity[64] = "";
+	if (ioctl(this->descriptors[SourceButtons], EVIOCGUNIQ(sizeof(identity) - 1), identity) >= 0) {
+		this->device_identity = QString::fromLatin1(identity);
+	}
+
+	/* Event timestamps use the monotonic clock if the kernel allows it. Otherwise, they are realtime. */
+	struct timespec monotonic, realtime;
+	clock_gettime(CLOCK_MONOTONIC, &monotonic);
+	clock_gettime(CLOCK_REALTIME, &realtime);
+	int clock_id = CLOCK_MONOTONIC;
+	if (ioctl(this->descriptors[SourceButtons], EVIOCSCLOCKID, &clock_id) < 0) {
+		this->time_offset = ((qint64)monotonic.tv_sec - realtime.tv_sec) * Q_INT64_C(1000000000) +
+				(monotonic.tv_nsec - realtime.tv_nsec);
+	}
+
+	/* Prepare a rumble effect, which is played while the rumble flag is set. */
+	struct ff_effect effect;
+	memset(&effect, 0, sizeof(effect));
+	effect.type = FF_RUMBLE;
+	effect.id = -1;
+	effect.u.rumble.strong_magnitude = 0xFFFF;
+	if (ioctl(this->descriptors[SourceButtons], EVIOCSFF, &effect) >= 0) this->rumble_effect = effect.id;
+
+	/* Start from the current state of every node. */
+	for (int source = 0; source < SourceCount; source++) {
+		if (this->descriptors[source] >= 0) this->resynchronize((EventSource)source);
+	}
+
+	this->motionplus_present = (this->descriptors[SourceMotionPlus] >= 0);
+	this->setMotionPlusConnected(this->motionplus_present);
+	return QLoopbackWiimote::open();
+}
+
+/**
+ * Replays recordings of the events of the hid-wiimote nodes.
+ * Each file is a sequence of struct input_event, as read from the node. Events are delivered
+ * at the pace given by their timestamps, starting now.
+ * @param buttons_path Recording of the buttons node.
+ * @param accelerometer_path Recording of the accelerometer node. May be empty.
+ * @param motionplus_path Recording of the MotionPlus node. May be empty.
+ * @return true if the recordings were loaded. false otherwise.
+ */
+bool QEvdevWiimote::openReplay(const QString &buttons_path, const QString &accelerometer_path,
+							   const QString &motionplus_path)
+{
+	this->close();
+
+	if (!this->loadReplay(SourceButtons, buttons_path)) return false;
+	if (!accelerometer_path.isEmpty() && !this->loadReplay(SourceAccelerometer, accelerometer_path)) return false;
+	if (!motionplus_path.isEmpty() && !this->loadReplay(SourceMotionPlus, motionplus_path)) return false;
+	qStableSort(this->replay_events.begin(), this->replay_events.end(), EvdevEventBefore);
+
+	/* Recorded timestamps are moved so the first event happens now. */
+	this->replay_start = QPreciseTime::currentTime();
+	if (!this->replay_events.isEmpty()) {
+		this->time_offset = this->replay_start.nanoseconds() - this->replay_events.first().time;
+	}
+	this->replay_position = 0;
+	this->replay_timer.start(0);
+
+	this->motionplus_present = !motionplus_path.isEmpty();
+	this->setMotionPlusConnected(this->motionplus_present);
+	return QLoopbackWiimote::open();
+}
+
+/**
+ * Closes every evdev node, or stops the replay.
+ */
+void QEvdevWiimote::close()
+{
+	if (!this->isOpened()) return;
+
+	/* Turn the leds and the rumble off. */
+	char led_report[] = {0x11, 0x00};
+	this->writeReport(led_report, 2);
+
+	for (int source = 0; source < SourceCount; source++) {
+		if (this->notifiers[source] != NULL) {
+			/* This may be called from a slot connected to reportReady. */
+			this->notifiers[source]->setEnabled(false);
+			this->notifiers[source]->deleteLater();
+			this->notifiers[source] = NULL;
+		}
+		if (this->descriptors[source] >= 0) {
+			if (source == SourceButtons && this->rumble_effect >= 0) {
+				ioctl(this->descriptors[source], EVIOCRMFF, this->rumble_effect);
+			}
+			::close(this->descriptors[source]);
+			this->descriptors[source] = -1;
+		}
+		this->event_nodes[source].clear();
+		this->dropping[source] = false;
+	}
+	this->rumble_effect = -1;
+	this->time_offset = 0;
+	this->device_identity.clear();
+
+	this->replay_timer.stop();
+	this->replay_events.clear();
+
+	QLoopbackWiimote::close();
+}
+
+/**
+ * Receives a report sent to the wiimote. Requests are answered as #QLoopbackWiimote does;
+ * LED and rumble changes are applied through the driver.
+ * @param data Report sent to the wiimote.
+ * @param max_size Size of the report. Using a size greater than #MAX_REPORT_SIZE is not allowed.
+ * @return true if the connection is opened.
+ */
+bool QEvdevWiimote::writeReport(const char * data, const qint64 max_size)
+{
+	bool result = QLoopbackWiimote::writeReport(data, max_size);
+	this->applyLeds();
+	return result;
+}
+
+/**
+ * Changes the directory where evdev nodes are looked for. Used the next time the connection is opened.
+ * @param directory New device directory.
+ */
+void QEvdevWiimote::setDeviceDirectory(const QString &directory)
+{
+	this->device_directory = directory;
+}
+
+/* Protected functions */
+
+/**
+ * Button state reported by status reports and memory replies.
+ * @return Button flags of the last events.
+ */
+quint16 QEvdevWiimote::currentButtons() const
+{
+	return this->sample.buttons;
+}
+
+/* Private functions */
+
+/**
+ * Opens an evdev node and starts waiting for its events.
+ * @param source Kind of node.
+ * @param path Path of the node.
+ * @return true if the node was opened.
+ */
+bool QEvdevWiimote::openNode(EventSource source, const QString &path)
+{
+	/* Write access is only needed for force feedback. */
+	QByteArray encoded_path = QFile::encodeName(path);
+	int descriptor = ::open(encoded_path.constData(), O_RDWR | O_NONBLOCK);
+	if (descriptor < 0) descriptor = ::open(encoded_path.constData(), O_RDONLY | O_NONBLOCK);
+	if (descriptor < 0) return false;
+
+	int clock_id = CLOCK_MONOTONIC;
+	ioctl(descriptor, EVIOCSCLOCKID, &clock_id);
+
+	this->descriptors[source] = descriptor;
+	this->notifiers[source] = new QSocketNotifier(descriptor, QSocketNotifier::Read, this);
+	connect(this->notifiers[source], SIGNAL(activated(int)), this, SLOT(readEvents(int)));
+	return true;
+}
+
+/**
+ * Loads the events of a recording.
+ * @param source Node which was recorded.
+ * @param path Path of the recording.
+ * @return true if the file could be read.
+ */
+bool QEvdevWiimote::loadReplay(EventSource source, const QString &path)
+{
+	QFile file(path);
+	if (!file.open(QIODevice::ReadOnly)) return false;
+	QByteArray data = file.readAll();
+
+	const struct input_event * events = (const struct input_event *)data.constData();
+	int count = data.size() / sizeof(struct input_event);
+	for (int i = 0; i < count; i++) {
+		QEvdevEvent event;
+		event.source = source;
+		event.time = (qint64)events[i].input_event_sec * Q_INT64_C(1000000000) + (qint64)events[i].input_event_usec * 1000;
+		event.type = events[i].type;
+		event.code = events[i].code;
+		event.value = events[i].value;
+		this->replay_events.append(event);
+	}
+
+	return true;
+}
+
+/**
+ * Updates the state of the wiimote with an event. When a SYN_REPORT closes a batch of events,
+ * an input report is emitted if the reporting mode requires it.
+ * @param event Event to process.
+ */
+void QEvdevWiimote::processEvent(const QEvdevEvent &event)
+{
+	if (event.type == EV_SYN && event.code == SYN_DROPPED) {
+		/* The kernel buffer overflowed. Events are invalid until the next SYN_REPORT. */
+		this->dropping[event.source] = true;
+		this->dropped_batches++;
+		return;
+	}
+
+	if (this->dropping[event.source]) {
+		if (event.type != EV_SYN || event.code != SYN_REPORT) return;
+		this->dropping[event.source] = false;
+		this->resynchronize((EventSource)event.source);
+	}
+
+	switch (event.type) {
+		case EV_KEY:
+			for (uint i = 0; i < sizeof(EvdevButtons) / sizeof(EvdevButtons[0]); i++) {
+				if (EvdevButtons[i].code != event.code) continue;
+				quint16 buttons = (event.value != 0) ? (this->sample.buttons | EvdevButtons[i].flag) :
+													   (this->sample.buttons & ~EvdevButtons[i].flag);
+				if (buttons != this->sample.buttons) {
+					this->sample.buttons = buttons;
+					this->buttons_changed = true;
+				}
+			}
+			break;
+
+		case EV_ABS: {
+			if (event.code < ABS_RX || event.code > ABS_RZ) break;
+			int axis = event.code - ABS_RX;
+
+			if (event.source == SourceAccelerometer) {
+				this->sample.acceleration[axis] = qBound(0, event.value + EVDEV_ACCELERATION_ZERO, 0x3FF);
+			} else if (event.source == SourceMotionPlus) {
+				/* Yaw, roll and pitch. Fast values were scaled further by the driver, so they can't fit in slow mode. */
+				if (qAbs(event.value) < EVDEV_MOTIONPLUS_ZERO * EVDEV_MOTIONPLUS_SLOW) {
+					this->sample.motionplus[axis] = event.value / EVDEV_MOTIONPLUS_SLOW + EVDEV_MOTIONPLUS_ZERO;
+					this->sample.motionplus_slow[axis] = true;
+				} else {
+					this->sample.motionplus[axis] = qBound(0, (int)((qint64)event.value * 440 / (2000 * EVDEV_MOTIONPLUS_SLOW)) +
+														   EVDEV_MOTIONPLUS_ZERO, 0x3FFF);
+					this->sample.motionplus_slow[axis] = false;
+				}
+			}
+			break;
+		}
+
+		case EV_SYN:
+			if (event.code == SYN_REPORT) {
+				/*
+				 * A 0x35 report updates both the accelerometer and the MotionPlus nodes, so only the
+				 * last node updated by the reporting mode produces continuous reports.
+				 */
+				int continuous_source = (this->reportingMode() == 0x35 && this->motionplus_present) ?
+							SourceMotionPlus : SourceAccelerometer;
+
+				if (this->buttons_changed || (this->isContinuous() && event.source == continuous_source)) {
+					this->buttons_changed = false;
+					this->emitInputReport(this->sample, QPreciseTime::fromNanoseconds(event.time + this->time_offset));
+				}
+			}
+			break;
+	}
+}
+
+/**
+ * Reads the whole state of a node, after its events have been dropped or when it is opened.
+ * @param source Node to read.
+ */
+void QEvdevWiimote::resynchronize(EventSource source)
+{
+	int descriptor = this->descriptors[source];
+	if (descriptor < 0) return;
+
+	QEvdevEvent event;
+	event.source = source;
+	event.time = 0;
+
+	if (source == SourceButtons) {
+		quint8 keys[KEY_MAX / 8 + 1];
+		memset(keys, 0, sizeof(keys));
+		if (ioctl(descriptor, EVIOCGKEY(sizeof(keys)), keys) < 0) return;
+
+		event.type = EV_KEY;
+		for (uint i = 0; i < sizeof(EvdevButtons) / sizeof(EvdevButtons[0]); i++) {
+			event.code = EvdevButtons[i].code;
+			event.value = (keys[event.code / 8] >> (event.code % 8)) & 0x01;
+			this->processEvent(event);
+		}
+	} else {
+		event.type = EV_ABS;
+		for (int code = ABS_RX; code <= ABS_RZ; code++) {
+			struct input_absinfo info;
+			if (ioctl(descriptor, EVIOCGABS(code), &info) < 0) continue;
+			event.code = code;
+			event.value = info.value;
+			this->processEvent(event);
+		}
+	}
+}
+
+/**
+ * Applies the LED and rumble state of the emulated wiimote to the driver.
+ * LEDs are set through the LED class devices of the wiimote, and rumble through force feedback.
+ */
+void QEvdevWiimote::applyLeds()
+{
+	quint8 leds = this->leds();
+	quint8 changed = leds ^ this->applied_leds;
+	if (changed == 0) return;
+	this->applied_leds = leds;
+
+	if ((changed & QWiimote::Rumble) && this->rumble_effect >= 0) {
+		struct input_event play;
+		memset(&play, 0, sizeof(play));
+		play.type = EV_FF;
+		play.code = this->rumble_effect;
+		play.value = (leds & QWiimote::Rumble) ? 1 : 0;
+		ssize_t written = ::write(this->descriptors[SourceButtons], &play, sizeof(play));
+		Q_UNUSED(written);
+	}
+
+	if (this->event_nodes[SourceButtons].isEmpty()) return;
+
+	/* hid-wiimote names its LEDs <device>:blue:p0 to <device>:blue:p3. */
+	QDir led_dir("/sys/class/input/" + this->event_nodes[SourceButtons] + "/device/device/leds");
+	QStringList led_names = led_dir.entryList(QStringList("*:blue:p*"), QDir::Dirs | QDir::NoDotAndDotDot, QDir::Name);
+	for (int i = 0; i < led_names.size() && i < 4; i++) {
+		quint8 flag = QWiimote::Led1 << i;
+		if (!(changed & flag)) continue;
+
+		QFile brightness(led_dir.filePath(led_names[i]) + "/brightness");
+		if (brightness.open(QIODevice::WriteOnly)) {
+			brightness.write((leds & flag) ? "1" : "0", 1);
+		}
+	}
+}
+
+/* Private slots */
+
+/**
+ * Reads every event available at an evdev node, in batches.
+ * @param descriptor Descriptor of the node.
+ */
+void QEvdevWiimote::readEvents(int descriptor)
+{
+	int source = 0;
+	while (source < SourceCount && this->descriptors[source] != descriptor) source++;
+	if (source == SourceCount) return;
+
+	struct input_event events[EVENT_BATCH_SIZE];
+	while (this->isOpened() && this->descriptors[source] == descriptor) {
+		ssize_t bytes_transferred = ::read(descriptor, events, sizeof(events));
+
+		if (bytes_transferred < 0 && errno == EINTR) continue;
+		if (bytes_transferred < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+		if (bytes_transferred <= 0) {
+			/* The wiimote has been disconnected. */
+			this->notifiers[source]->setEnabled(false);
+			emit this->reportError();
+			return;
+		}
+
+		int count = bytes_transferred / sizeof(struct input_event);
+		for (int i = 0; i < count && this->isOpened(); i++) {
+			QEvdevEvent event;
+			event.source = source;
+			event.time = (qint64)events[i].input_event_sec * Q_INT64_C(1000000000) + (qint64)events[i].input_event_usec * 1000;
+			event.type = events[i].type;
+			event.code = events[i].code;
+			event.value = events[i].value;
+			this->processEvent(event);
+		}
+	}
+}
+
+/**
+ * Delivers the replayed events which are due, and schedules the next ones.
+ */
+void QEvdevWiimote::replayEvents()
+{
+	qint64 now = QPreciseTime::currentTime().nanoseconds() - this->time_offset;
+
+	while (this->isOpened() && this->replay_position < this->replay_events.size() &&
+		   this->replay_events[this->replay_position].time <= now) {
+		this->processEvent(this->replay_events[this->replay_position]);
+		this->replay_position++;
+	}
+
+	if (this->isOpened() && this->replay_position < this->replay_events.size()) {
+		qint64 delay = (this->replay_events[this->replay_position].time - now) / 1000000;
+		this->replay_timer.start((int)qMax<qint64>(delay, 1));
+	}
+}
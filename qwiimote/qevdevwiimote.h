@@ -0,0 +1,135 @@
+/*
+ * This file is part of QWiimote.
+ *
+ * QWiimote is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QWiimote is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QWiimote. If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file qevdevwiimote.h
+ *
+ * Header file for the QEvdevWiimote class.
+ *
+ * QEvdevWiimote reads a wiimote through the evdev nodes of the Linux hid-wiimote driver.
+ */
+
+#ifndef QEVDEVWIIMOTE_H
+#define QEVDEVWIIMOTE_H
+
+#include <QList>
+#include <QTimer>
+#include "qloopbackwiimote.h"
+
+class QSocketNotifier;
+
+/**
+ * Event read from an evdev node, or from a recording of one.
+ */
+struct QEvdevEvent {
+	int source;    ///< Node which produced the event, as in #QEvdevWiimote::EventSource.
+	qint64 time;   ///< Kernel timestamp of the event, in nanoseconds.
+	quint16 type;  ///< Event type.
+	quint16 code;  ///< Event code.
+	qint32 value;  ///< Event value.
+};
+
+/**
+ * Transport which reads a wiimote through the evdev nodes created by the hid-wiimote kernel driver.
+ *
+ * The driver decodes the wiimote into separate input devices for the buttons, the accelerometer
+ * and the MotionPlus. Their events are read in batches, and whenever a SYN_REPORT closes a batch,
+ * an input report of the requested reporting mode is synthesized, so #QWiimote does not need to
+ * know where its reports come from. Reports carry the kernel timestamp of the SYN_REPORT instead
+ * of the time when they were read.
+ *
+ * Requests sent to the wiimote (calibration reads, MotionPlus activation, status requests) are
+ * answered as #QLoopbackWiimote does, since the driver does not expose the wiimote memory. The
+ * accelerometer calibration is the nominal one, which can be changed with setAccelerationCalibration().
+ * LEDs are set through the LED class devices of the driver, and rumble through force feedback.
+ *
+ * Recordings of input_event streams (for example, made with cat from the evdev nodes) can be
+ * replayed with openReplay(), which paces them according to their timestamps.
+ */
+class QEvdevWiimote : public QLoopbackWiimote
+{
+	Q_OBJECT
+public:
+	/** Input devices created by hid-wiimote for a wiimote. */
+	enum EventSource {
+		SourceButtons,       ///< "Nintendo Wii Remote" node.
+		SourceAccelerometer, ///< "Nintendo Wii Remote Accelerometer" node.
+		SourceMotionPlus,    ///< "Nintendo Wii Remote Motion Plus" node.
+		SourceCount          ///< Number of sources.
+	};
+
+	QEvdevWiimote(QObject * parent = NULL);
+	~QEvdevWiimote();
+
+	bool open();
+	bool openReplay(const QString &buttons_path, const QString &accelerometer_path,
+					const QString &motionplus_path = QString());
+	void close();
+	bool writeReport(const char * data, const qint64 max_size);
+	using QWiimoteTransport::writeReport;
+
+	void setDeviceDirectory(const QString &directory);
+
+	/**
+	 * Directory where evdev nodes are looked for.
+	 * @return Device directory.
+	 */
+	QString deviceDirectory() const { return this->device_directory; }
+
+	/**
+	 * Number of times the kernel dropped events because they were not read in time.
+	 * @return Number of SYN_DROPPED events.
+	 */
+	quint32 droppedBatches() const { return this->dropped_batches; }
+
+protected:
+	quint16 currentButtons() const;
+
+private:
+	static const int EVENT_BATCH_SIZE = 64; ///< Maximum number of events read at once.
+
+	QString device_directory;               ///< Directory where evdev nodes are looked for.
+	int descriptors[SourceCount];           ///< Descriptor of each node, or -1.
+	QString event_nodes[SourceCount];       ///< Name of each node (eventN), used to find its sysfs directory.
+	QSocketNotifier * notifiers[SourceCount]; ///< Notify when each node has events to be read.
+	bool dropping[SourceCount];             ///< True while events are discarded after a SYN_DROPPED.
+	quint32 dropped_batches;                ///< Number of SYN_DROPPED events.
+
+	qint64 time_offset;                     ///< Added to event timestamps to get monotonic clock nanoseconds.
+	bool motionplus_present;                ///< True if MotionPlus events are available.
+
+	QLoopbackSample sample;                 ///< Current state of the wiimote.
+	bool buttons_changed;                   ///< True if the buttons changed since the last report.
+	int rumble_effect;                      ///< Force feedback effect used for rumble, or -1.
+	quint8 applied_leds;                    ///< LED and rumble state applied to the driver.
+
+	QList<QEvdevEvent> replay_events;       ///< Events of a replay, sorted by time.
+	int replay_position;                    ///< Next event of the replay.
+	QPreciseTime replay_start;              ///< Time when the replay started.
+	QTimer replay_timer;                    ///< Schedules the next events of the replay. A child, so it follows moveToThread().
+
+	bool openNode(EventSource source, const QString &path);
+	bool loadReplay(EventSource source, const QString &path);
+	void processEvent(const QEvdevEvent &event);
+	void resynchronize(EventSource source);
+	void applyLeds();
+
+private slots:
+	void readEvents(int descriptor);
+	void replayEvents();
+};
+
+#endif // QEVDEVWIIMOTE_H
@@ -0,0 +1,145 @@
+/*
+ * This file is part of QWiimote.
+ *
+ * QWiimote is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QWiimote is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QWiimote. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file qgyrocalibrator.cpp
+ *
+ * Source file for the QGyroCalibrator class.
+ */
+
+#include <cmath>
+#include "qgyrocalibrator.h"
+
+const qreal QGyroCalibrator::RATE_STILL_VARIANCE = 16.0;
+const qreal QGyroCalibrator::ACCELERATION_STILL_VARIANCE = 4e-4;
+const qreal QGyroCalibrator::CONVERGED_ERROR = 0.5;
+const qreal QGyroCalibrator::TRACKING_DEVIATIONS = 3.0;
+const qreal QGyroCalibrator::QUANTIZATION_VARIANCE = 1.0 / 12.0;
+const qreal QGyroCalibrator::TRACKING_WEIGHT = 0.05;
+const qreal QGyroCalibrator::RAW_MIN = 7000.0;
+const qreal QGyroCalibrator::RAW_MAX = 9000.0;
+
+/**
+ * Creates a new uncalibrated calibrator.
+ */
+QGyroCalibrator::QGyroCalibrator()
+{
+	this->reset();
+}
+
+/**
+ * Forgets the zero estimate and every sample.
+ */
+void QGyroCalibrator::reset()
+{
+	for (int axis = 0; axis < 3; axis++) {
+		this->block_rates[axis].reset();
+		this->block_accelerations[axis].reset();
+		this->calibration[axis].reset();
+		this->zeros[axis] = 0;
+	}
+	this->block_slow = true;
+	this->calibrated = false;
+	this->provisional = false;
+	this->still = false;
+}
+
+/**
+ * Sets a provisional zero estimate, such as one stored in a previous session. The calibrator is calibrated
+ * from now on, but the estimate is still checked against the samples, and replaced by the measured one
+ * as soon as it converges.
+ * @param zeros Raw pitch, roll and yaw values when not rotating.
+ */
+void QGyroCalibrator::setZeros(const qreal zeros[3])
+{
+	for (int axis = 0; axis < 3; axis++) {
+		this->zeros[axis] = zeros[axis];
+		this->calibration[axis].reset();
+	}
+	this->calibrated = true;
+	this->provisional = true;
+}
+
+/**
+ * Adds a MotionPlus sample.
+ * @param rate Raw pitch, roll and yaw rates.
+ * @param slow True if every axis is in slow mode.
+ * @param acceleration Calibrated acceleration at the time of the sample.
+ * @return True if this sample completed the calibration, or confirmed a provisional zero estimate.
+ */
+bool QGyroCalibrator::addSample(const qreal rate[3], bool slow, const QVector3D &acceleration)
+{
+	qreal accelerations[3] = {acceleration.x(), acceleration.y(), acceleration.z()};
+	for (int axis = 0; axis < 3; axis++) {
+		this->block_rates[axis].add(rate[axis]);
+		this->block_accelerations[axis].add(accelerations[axis]);
+	}
+	this->block_slow = this->block_slow && slow;
+
+	if (this->block_rates[0].count() < BLOCK_SIZE) return false;
+	return this->finishBlock();
+}
+
+/* Private functions */
+
+/**
+ * Checks if the current block is still, updates the zero estimate with it and starts a new block.
+ * @return True if the block completed the calibration.
+ */
+bool QGyroCalibrator::finishBlock()
+{
+	this->still = this->block_slow;
+	for (int axis = 0; axis < 3 && this->still; axis++) {
+		qreal mean = this->block_rates[axis].mean();
+		qreal error = sqrt(qMax(this->block_rates[axis].variance(), QUANTIZATION_VARIANCE) / BLOCK_SIZE);
+		bool plausible = (this->calibrated && !this->provisional) ? fabs(mean - this->zeros[axis]) < TRACKING_DEVIATIONS * error :
+														mean > RAW_MIN && mean < RAW_MAX;
+		this->still = plausible &&
+						  this->block_rates[axis].variance() < RATE_STILL_VARIANCE &&
+						  this->block_accelerations[axis].variance() < ACCELERATION_STILL_VARIANCE;
+	}
+
+	bool converged = false;
+	if (this->still) {
+		if (this->calibrated && !this->provisional) {
+			for (int axis = 0; axis < 3; axis++) {
+				this->zeros[axis] += TRACKING_WEIGHT * (this->block_rates[axis].mean() - this->zeros[axis]);
+			}
+		} else {
+			converged = true;
+			for (int axis = 0; axis < 3; axis++) {
+				this->calibration[axis].add(this->block_rates[axis].mean());
+				qreal error = sqrt(this->calibration[axis].variance() / this->calibration[axis].count());
+				converged = converged && this->calibration[axis].count() >= MIN_CALIBRATION_BLOCKS && error < CONVERGED_ERROR;
+			}
+
+			if (converged) {
+				for (int axis = 0; axis < 3; axis++) this->zeros[axis] = this->calibration[axis].mean();
+				this->calibrated = true;
+				this->provisional = false;
+			}
+		}
+	}
+
+	for (int axis = 0; axis < 3; axis++) {
+		this->block_rates[axis].reset();
+		this->block_accelerations[axis].reset();
+	}
+	this->block_slow = true;
+
+	return converged;
+}
@@ -0,0 +1,142 @@
+/*
+ * This file is part of QWiimote.
+ *
+ * QWiimote is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QWiimote is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QWiimote. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file qgyrocalibrator.h
+ *
+ * Header file for the QRunningStatistics and QGyroCalibrator classes.
+ *
+ * QGyroCalibrator estimates the zero rate of the MotionPlus while the wiimote is still.
+ */
+
+#ifndef QGYROCALIBRATOR_H
+#define QGYROCALIBRATOR_H
+
+#include <QVector3D>
+
+/**
+ * Mean and variance of a sequence of values, updated one value at a time with Welford's algorithm.
+ */
+class QRunningStatistics
+{
+public:
+	QRunningStatistics() { this->reset(); }
+
+	/** Forgets every value. */
+	void reset() { this->values = 0; this->average = 0; this->squares = 0; }
+
+	/**
+	 * Adds a new value.
+	 * @param value New value.
+	 */
+	void add(qreal value)
+	{
+		this->values++;
+		qreal difference = value - this->average;
+		this->average += difference / this->values;
+		this->squares += difference * (value - this->average);
+	}
+
+	/** @return Number of values added. */
+	int count() const { return this->values; }
+	/** @return Mean of the values added. */
+	qreal mean() const { return this->average; }
+	/** @return Sample variance of the values added, or 0 if there are less than two. */
+	qreal variance() const { return (this->values > 1) ? this->squares / (this->values - 1) : 0; }
+
+private:
+	int values;    ///< Number of values added.
+	qreal average; ///< Mean of the values added.
+	qreal squares; ///< Sum of squared differences from the mean.
+};
+
+/**
+ * Estimates the raw value reported by the MotionPlus when it is not rotating.
+ *
+ * Samples are grouped in blocks of #BLOCK_SIZE. A block is still if every gyroscope sample is in slow mode,
+ * the variance of each gyroscope and accelerometer axis is low, and the mean rate is close to the current
+ * zero estimate. Blocks of a constant slow rotation have a low variance too, so once calibrated the mean
+ * must be within #TRACKING_DEVIATIONS standard errors of the block from the zero estimate. A rotation that
+ * stands out from the noise of the block, however slow, is never tracked. Before that, the mean must be in
+ * the range expected for a MotionPlus at rest.
+ *
+ * While uncalibrated, the means of still blocks are averaged until their standard error is below
+ * #CONVERGED_ERROR, which usually takes well under a second. After that, every still block moves the
+ * zero estimate slightly towards its mean, so drift is tracked in the background.
+ * A zero estimate can also be given in advance with setZeros(). It is used at once, and replaced when the
+ * calibration converges.
+ */
+class QGyroCalibrator
+{
+public:
+	QGyroCalibrator();
+
+	void reset();
+	void setZeros(const qreal zeros[3]);
+	bool addSample(const qreal rate[3], bool slow, const QVector3D &acceleration);
+
+	/**
+	 * Checks if the zero estimate has converged or has been set.
+	 * @return True iff the calibrator is calibrated.
+	 */
+	bool isCalibrated() const { return this->calibrated; }
+
+	/**
+	 * Checks if the zero estimate was set with setZeros() and it has not been measured yet.
+	 * @return True iff the zero estimate is provisional.
+	 */
+	bool isProvisional() const { return this->provisional; }
+
+	/**
+	 * Checks if the last complete block of samples was still.
+	 * @return True iff the wiimote was still.
+	 */
+	bool isStill() const { return this->still; }
+
+	/**
+	 * Raw value of an axis when it is not rotating.
+	 * @param axis 0 for pitch, 1 for roll and 2 for yaw.
+	 * @return Zero estimate. Only meaningful once calibrated.
+	 */
+	qreal zero(int axis) const { return this->zeros[axis]; }
+
+private:
+	static const int BLOCK_SIZE = 16;                ///< Samples per block.
+	static const int MIN_CALIBRATION_BLOCKS = 3;     ///< Still blocks required before the calibration can converge.
+	static const qreal RATE_STILL_VARIANCE;          ///< Highest raw gyroscope variance of a still block.
+	static const qreal ACCELERATION_STILL_VARIANCE;  ///< Highest acceleration variance of a still block, in g².
+	static const qreal CONVERGED_ERROR;              ///< Standard error of the zero estimate needed to finish calibrating.
+	static const qreal TRACKING_DEVIATIONS;          ///< Largest difference between a still block mean and the zero estimate, in standard errors of the mean.
+	static const qreal QUANTIZATION_VARIANCE;        ///< Lowest raw gyroscope variance assumed for a block, that of rounding to integers.
+	static const qreal TRACKING_WEIGHT;              ///< Weight of each still block once calibrated.
+	static const qreal RAW_MIN;                      ///< Lowest raw mean accepted before calibrating.
+	static const qreal RAW_MAX;                      ///< Highest raw mean accepted before calibrating.
+
+	QRunningStatistics block_rates[3];               ///< Gyroscope statistics of the current block.
+	QRunningStatistics block_accelerations[3];       ///< Accelerometer statistics of the current block.
+	bool block_slow;                                 ///< False if a sample of the current block was in fast mode.
+
+	QRunningStatistics calibration[3];               ///< Statistics of the means of still blocks while calibrating.
+	bool calibrated;                                 ///< True once the zero estimate has converged or has been set.
+	bool provisional;                                ///< True if the zero estimate was set and it has not been confirmed yet.
+	bool still;                                      ///< True if the last complete block was still.
+	qreal zeros[3];                                  ///< Zero estimate of each axis.
+
+	bool finishBlock();
+};
+
+#endif // QGYROCALIBRATOR_H
@@ -26,43 +26,67 @@
 #ifndef QIOWIIMOTE_H
 #define QIOWIIMOTE_H
 
-#include <QObject>
-#include <windows.h>
-#include <setupapi.h>
-#if defined(__MINGW32__)
-#	include <ddk/hidsdi.h>
-#else
+#include "qwiimotetransport.h"
+#if defined(Q_OS_WIN)
+#	include <windows.h>
+#	include <setupapi.h>
+#	if defined(__MINGW32__)
+#		include <ddk/hidsdi.h>
+#	else
 extern "C"{
-	#include <api/hidsdi.h>
+		#include <api/hidsdi.h>
 }
+#	endif
 #endif
-#include "qwiimotereport.h"
-
-#define MAX_REPORT_SIZE 22 ///< Maximum size of a report.
 
 class QIOWiimote;
+class QSocketNotifier;
 
+#if defined(Q_OS_WIN)
 /**
  * Struct used with asynchronous reading from the wiimote.
  */
 struct OverlappedQIOWiimote {
-	OVERLAPPED overlapped;  ///< Used for asynchronous reading.
-	QIOWiimote * iowiimote; ///< Pointer to the QIOWiimote instance that should receive this reading.
+	OVERLAPPED overlapped;             ///< Used for asynchronous reading.
+	QIOWiimote * iowiimote;            ///< Pointer to the QIOWiimote instance that should receive this reading.
+	QWiimoteReportHandle report;       ///< Pool slot used by this read.
+	char fallback_buffer[MAX_REPORT_SIZE]; ///< Used instead of report when the pool is exhausted.
+	QPreciseTime time;                 ///< Time when the read was completed.
+	DWORD error_code;                  ///< I/O completion status.
+	DWORD bytes_transferred;           ///< Number of bytes read.
+	bool completed;                    ///< True if the read has completed but it has not been processed yet.
 };
+#endif
 
 /**
- * Class that handles asynchronous reading and synchronous writing to a wiimote.
- * @see #OverlappedQIOWiimote.
+ * Transport that handles asynchronous reading and synchronous writing to a real wiimote.
+ *
+ * Under Windows, reports are read with overlapped I/O and completion routines
+ * (see #OverlappedQIOWiimote). Under Linux, the wiimote is accessed through its
+ * hidraw node, which is read without blocking whenever a QSocketNotifier
+ * signals that data is available.
+ *
+ * Several reads are kept outstanding at the same time, each one with its own slot of the
+ * report pool (see #setReadQueueDepth). Data is read straight into the slot, and a slot
+ * is reused for the next read unless the receiver kept its handle.
+ * Reports are always emitted in the order they were read.
+ *
+ * open() tries the wiimotes known by #QWiimoteDiscovery first, and only scans for devices
+ * if none of them can be opened.
  *
  * @todo Using more than one instance of this class is untested.
  */
-class QIOWiimote : public QObject
+class QIOWiimote : public QWiimoteTransport
 {
 	Q_OBJECT
 public:
 	QIOWiimote(QObject * parent = NULL);
 	~QIOWiimote();
 	bool open();
+	bool open(const QString &device_path);
+#if !defined(Q_OS_WIN)
+	bool openDescriptor(int descriptor);
+#endif
 
 	/**
 	 * Checks if communication with the Wiimote is opened.
@@ -71,25 +95,72 @@ public:
 	bool isOpened() { return this->opened; }
 	void close();
 	bool writeReport(const char * data, const qint64 max_size);
-	bool writeReport(const QByteArray data);
+	using QWiimoteTransport::writeReport;
+
+	/**
+	 * Writes wait until the report has been sent to the device.
+	 * @return True.
+	 */
+	bool writesBlock() const { return true; }
+
+	/**
+	 * Reads are always started from the thread of this object, so open() can be called from any thread.
+	 * @return True.
+	 */
+	bool opensFromAnyThread() const { return true; }
+
+	void setReadQueueDepth(int depth);
+
+	/**
+	 * Number of reads which are kept outstanding at the same time.
+	 * @return Depth of the read queue.
+	 */
+	int readQueueDepth() const { return this->read_queue_depth; }
+
+	/**
+	 * Every outstanding read holds a pool slot.
+	 * @return Depth of the read queue.
+	 */
+	int readBatchSize() const { return this->read_queue_depth; }
+
+	/**
+	 * Number of times every buffer of the read queue was filled before the reports
+	 * were processed, so new reports had to wait in the operating system.
+	 * A depth which is too small shows up as a growing count.
+	 * @return Number of overruns since the object was created.
+	 */
+	quint32 readQueueOverruns() const { return this->read_queue_overruns; }
 
 private:
+	friend class QWiimoteDiscovery;
+
 	static const quint16 WIIMOTE_VENDOR_ID;  ///< Wiimote vendor ID.
 	static const quint16 WIIMOTE_PRODUCT_ID; ///< Wiimote product ID.
-	HANDLE wiimote_handle;                   ///< Handle to send / receive data from the wiimote.
-	char read_buffer[MAX_REPORT_SIZE];       ///< Buffer used for asynchronous read.
 	bool opened;                             ///< True only if the connection is opened.
+	int read_queue_depth;                    ///< Number of outstanding reads.
+	quint32 read_queue_overruns;             ///< Number of times every buffer of the read queue was filled.
 
-	void readBegin();
+#if defined(Q_OS_WIN)
+	HANDLE wiimote_handle;                   ///< Handle to send / receive data from the wiimote.
+	OverlappedQIOWiimote * overlapped;       ///< One entry for each outstanding read.
+	int outstanding_reads;                   ///< Number of reads queued and not completed yet.
+	int next_read;                           ///< Entry of the next report to be processed.
+	bool read_failed;                        ///< True once a read failed, until the connection is opened again.
+	void readBegin(int index);
 	static void CALLBACK readCallback(DWORD error_code, DWORD bytes_transferred, LPOVERLAPPED overlapped);
-	void readEnd(DWORD error_code, DWORD bytes_transferred);
-	OverlappedQIOWiimote * overlapped;
-
-signals:
-	/** This signal is emmited whenever a new report is ready for being processed. */
-	void reportReady(QWiimoteReport *report);
-	/** This signal is emmited whenever an error is found at a received report. */
-	void reportError();
+	void readEnd();
+#else
+	int wiimote_descriptor;                  ///< hidraw file descriptor used to send / receive data.
+	QSocketNotifier * read_notifier;         ///< Notifies when wiimote_descriptor has data to be read.
+	QWiimoteReportHandle * read_reports;     ///< One pool slot for each report read in a single batch.
+	char discard_buffer[MAX_REPORT_SIZE];    ///< Used to drop reports when the pool is exhausted.
+	void readBegin();
+	void readEnd(int count);
+#endif
+
+private slots:
+	void startReading();
+	void readAvailable();
 };
 
 #endif // QIOWIIMOTE_H
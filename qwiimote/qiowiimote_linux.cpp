@@ -0,0 +1,243 @@
+/*
+ * This file is part of QWiimote.
+ *
+ * QWiimote is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QWiimote is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QWiimote. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+  * @file qiowiimote_linux.cpp
+  *
+  * Linux implementation of the QIOWiimote class, based on hidraw.
+  */
+
+#include <QFile>
+#include <QFileInfo>
+#include <QStringList>
+#include <QSocketNotifier>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/hidraw.h>
+#include "qiowiimote.h"
+#include "debugcheck.h"
+
+/* Public functions */
+
+/**
+ * Opens the connection to the wiimote found at a specific device node.
+ * If the node is a hidraw device, its vendor and product IDs must match those of a wiimote.
+ * Other kinds of nodes are accepted as they are, so fake devices can be used for testing.
+ * @param device_path Path of the device node.
+ * @return true if the connection was successfully opened. false otherwise.
+ */
+bool QIOWiimote::open(const QString &device_path)
+{
+	int descriptor = ::open(QFile::encodeName(device_path).constData(), O_RDWR | O_NONBLOCK);
+	if (descriptor < 0) return false;
+
+	struct hidraw_devinfo info;
+	bool wiimote = ioctl(descriptor, HIDIOCGRAWINFO, &info) < 0 ||
+			((quint16)info.vendor == WIIMOTE_VENDOR_ID && (quint16)info.product == WIIMOTE_PRODUCT_ID);
+
+	if (!wiimote || !this->openDescriptor(descriptor)) {
+		::close(descriptor);
+		return false;
+	}
+
+	/* The unique ID of a Bluetooth HID device is its address. It is published in sysfs. */
+	QFile uevent(QString("/sys/class/hidraw/%1/device/uevent").arg(QFileInfo(device_path).fileName()));
+	if (uevent.open(QIODevice::ReadOnly)) {
+		QStringList lines = QString::fromLatin1(uevent.readAll().constData()).split("\n");
+		for (int i = 0; i < lines.size(); i++) {
+			if (lines[i].startsWith("HID_UNIQ=")) this->device_identity = lines[i].mid(9).trimmed();
+		}
+	}
+
+	return true;
+}
+
+/**
+ * Opens the connection using an already opened file descriptor.
+ * Any descriptor that delivers one report per read() and accepts one report per write() can be used,
+ * such as a hidraw node or one end of a socketpair.
+ * @param descriptor Descriptor to use. QIOWiimote takes ownership of it only if this call succeeds.
+ * @return true if the connection was successfully opened. false otherwise.
+ */
+bool QIOWiimote::openDescriptor(int descriptor)
+{
+	this->close();
+
+	/* Reads are always done without blocking. */
+	int flags = fcntl(descriptor, F_GETFL);
+	if (flags < 0 || fcntl(descriptor, F_SETFL, flags | O_NONBLOCK) < 0) return false;
+
+	QMutexLocker locker(&this->write_mutex);
+
+	this->wiimote_descriptor = descriptor;
+
+	/* To test if the wiimote is really connected, an empty LED report is sent. */
+	char led_report[] = {0x11, 0x00};
+	if (!(this->opened = this->writeReport(led_report, 2))) {
+		this->wiimote_descriptor = -1;
+		return false;
+	}
+
+	/* Prepare one report handle for each report read in a single batch. */
+	this->read_reports = new QWiimoteReportHandle[this->read_queue_depth];
+
+	/* Schedule the first read. The notifier belongs to the thread of this object, which may not be the calling thread. */
+	QMetaObject::invokeMethod(this, "startReading");
+	return true;
+}
+
+/**
+ * Closes the connection to the Wiimote.
+ */
+void QIOWiimote::close()
+{
+	/* The writer thread must not write to a descriptor which is being closed. */
+	this->waitForWrites();
+	QMutexLocker locker(&this->write_mutex);
+
+	if (opened) {
+		/* Send an empty LED report to the wiimote. */
+		char led_report[] = {0x11, 0x00};
+		this->writeReport(led_report, 2);
+
+		/* Stop waiting for data from the wiimote. This may be called from a slot connected to reportReady. */
+		if (this->read_notifier != NULL) {
+			this->read_notifier->setEnabled(false);
+			this->read_notifier->deleteLater();
+			this->read_notifier = NULL;
+		}
+
+		/* Close the device descriptor. */
+		::close(this->wiimote_descriptor);
+		this->device_identity.clear();
+		this->wiimote_descriptor = -1;
+		delete[] this->read_reports;
+		this->read_reports = NULL;
+
+		/* Mark the connection as not open. */
+		opened = false;
+	}
+}
+
+/**
+ * Sends a report to the Wiimote. Writing is done synchronously.
+ * @param data Report that will be sent to the wiimote.
+ * @param max_size Size of the report. Using a size greater than #MAX_REPORT_SIZE is not allowed.
+ */
+bool QIOWiimote::writeReport(const char * data, const qint64 max_size)
+{
+	Q_ASSERT_X(max_size <= MAX_REPORT_SIZE, "QIOWiimote::writeReport", "A report can't have a size greater than 22.");
+
+	if (this->wiimote_descriptor < 0) return false;
+
+	/* hidraw sends exactly the given bytes, so no padding is needed. */
+	ssize_t written;
+	do {
+		written = ::write(this->wiimote_descriptor, data, max_size);
+	} while (written < 0 && errno == EINTR);
+
+	return written == max_size;
+}
+
+/* Private functions */
+
+/**
+ * Starts reading once the connection has been opened. Always runs in the thread of this object.
+ */
+void QIOWiimote::startReading()
+{
+	if (this->opened) this->readBegin();
+}
+
+/**
+ * Starts waiting for data from the wiimote.
+ */
+void QIOWiimote::readBegin()
+{
+	if (this->read_notifier == NULL) {
+		this->read_notifier = new QSocketNotifier(this->wiimote_descriptor, QSocketNotifier::Read, this);
+		connect(this->read_notifier, SIGNAL(activated(int)), this, SLOT(readAvailable()));
+	}
+	this->read_notifier->setEnabled(true);
+}
+
+/**
+ * Reads every report available at the wiimote descriptor.
+ * Called from the event loop whenever the descriptor becomes readable.
+ * Reports are read in batches of up to #readQueueDepth reports, and each batch is
+ * emitted in order once it has been read.
+ */
+void QIOWiimote::readAvailable()
+{
+	bool pending = true;
+	while (this->opened && pending) {
+		int count = 0;
+		bool error = false;
+
+		while (count < this->read_queue_depth) {
+			/* Reuse the previous slot unless the receiver of the last report kept it. */
+			QWiimoteReportHandle &report = this->read_reports[count];
+			if (!report.isDetached()) report = this->report_pool->acquire();
+			char * buffer = report.isNull() ? this->discard_buffer : report->data;
+
+			ssize_t bytes_transferred = ::read(this->wiimote_descriptor, buffer, MAX_REPORT_SIZE);
+
+			if (bytes_transferred > 0) {
+				/* Reports read while the pool is exhausted are dropped. */
+				if (report.isNull()) continue;
+				report->time = QPreciseTime::currentTime();
+				report->size = bytes_transferred;
+				count++;
+			} else if (bytes_transferred < 0 && errno == EINTR) {
+				continue;
+			} else if (bytes_transferred < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+				/* Everything has been read. */
+				pending = false;
+				break;
+			} else {
+				/* The device has been disconnected or the descriptor is no longer valid. */
+				error = true;
+				pending = false;
+				break;
+			}
+		}
+
+		/* Every buffer is full, so more reports may be waiting in the kernel. */
+		if (count == this->read_queue_depth) this->read_queue_overruns++;
+
+		this->readEnd(count);
+
+		if (error && this->opened) {
+			this->read_notifier->setEnabled(false);
+			emit this->reportError();
+		}
+	}
+}
+
+/**
+ * Emits the reports of a batch.
+ * The report format is time|report.
+ * @param count The number of reports read into read_reports.
+ */
+void QIOWiimote::readEnd(int count)
+{
+	for (int i = 0; i < count && this->opened; i++) {
+		emit this->reportReady(this->read_reports[i]);
+	}
+}
@@ -0,0 +1,252 @@
+/*
+ * This file is part of QWiimote.
+ *
+ * QWiimote is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QWiimote is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QWiimote. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+  * @file qiowiimote_win.cpp
+  *
+  * Windows implementation of the QIOWiimote class.
+  */
+
+#include "qiowiimote.h"
+#include "debugcheck.h"
+
+/* HidD_SetOutputReport is not defined in MinGW w32api. */
+#if defined(__MINGW32__) && defined(_WIN32)
+extern "C"{
+	WINHIDSDI BOOL WINAPI HidD_SetOutputReport (HANDLE, PVOID, ULONG);
+}
+#endif
+
+/* Public functions */
+
+/**
+ * Opens the connection to the wiimote found at a specific HID device interface.
+ * @param device_path Device interface path, as found by #QWiimoteDiscovery.
+ * @return true if the connection was successfully opened. false otherwise.
+ */
+bool QIOWiimote::open(const QString &device_path)
+{
+	this->close();
+	QMutexLocker locker(&this->write_mutex);
+
+	/* Create a handle to the device. */
+	wiimote_handle = CreateFile((LPCTSTR)device_path.utf16(),
+							   (GENERIC_READ | GENERIC_WRITE),
+							   (FILE_SHARE_READ | FILE_SHARE_WRITE),
+							   NULL,
+							   OPEN_EXISTING,
+							   FILE_FLAG_OVERLAPPED,
+							   NULL);
+	if (wiimote_handle == INVALID_HANDLE_VALUE) return false;
+
+	/* Check if the device is actually a wiimote. */
+	HIDD_ATTRIBUTES attributes;
+	attributes.Size = sizeof(attributes);
+	if (HidD_GetAttributes(wiimote_handle, &attributes) &&
+			(attributes.VendorID == WIIMOTE_VENDOR_ID) && (attributes.ProductID == WIIMOTE_PRODUCT_ID)) {
+		/* To test if the wiimote is really connected, an empty LED report is sent. */
+		char led_report[] = {0x11, 0x00};
+		if ((this->opened = this->writeReport(led_report, 2))) {
+			/* The Bluetooth stack reports the address of the wiimote as its serial number. */
+			WCHAR serial[128];
+			if (HidD_GetSerialNumberString(wiimote_handle, serial, sizeof(serial))) {
+				this->device_identity = QString::fromUtf16((const ushort *)serial);
+			}
+
+			// Prepare one overlapped structure for each outstanding read.
+			this->overlapped = new OverlappedQIOWiimote[this->read_queue_depth];
+			this->outstanding_reads = 0;
+			this->next_read = 0;
+			this->read_failed = false;
+
+			/* Schedule the first reads. Completion routines run in the thread which queued the read,
+			   so they are queued by the thread of this object, which may not be the calling thread. */
+			for (int i = 0; i < this->read_queue_depth; i++) this->overlapped[i].iowiimote = this;
+			QMetaObject::invokeMethod(this, "startReading");
+		}
+	}
+
+	/* The device is not a wiimote. */
+	if (!this->opened) {
+		CloseHandle(wiimote_handle);
+		wiimote_handle = INVALID_HANDLE_VALUE;
+	}
+
+	return this->opened;
+}
+
+/**
+ * Closes the connection to the Wiimote.
+ * @todo Change reporting type before closing the connection. Does not seem necessary, though.
+ */
+void QIOWiimote::close()
+{
+	/* The writer thread must not write to a handle which is being closed. */
+	this->waitForWrites();
+	QMutexLocker locker(&this->write_mutex);
+
+	if (opened) {
+		/* Send an empty LED report to the wiimote. */
+		char led_report[] = {0x11, 0x00};
+		this->writeReport(led_report, 2);
+
+		/* Mark the connection as not open, so completed reads are not processed anymore. */
+		opened = false;
+
+		/* Cancel pending data reads from the wiimote, and wait until their completion routines have run. */
+		CancelIo(this->wiimote_handle);
+		while (this->outstanding_reads > 0) SleepEx(INFINITE, TRUE);
+
+		/* Close device handle. */
+		CloseHandle(this->wiimote_handle);
+		this->wiimote_handle = INVALID_HANDLE_VALUE;
+		this->device_identity.clear();
+		delete[] this->overlapped;
+		this->overlapped = NULL;
+	}
+}
+
+/**
+ * Sends a report to the Wiimote. Writing is done synchronously.
+ * @param data Report that will be sent to the wiimote.
+ * @param max_size Size of the report. Using a size greater than #MAX_REPORT_SIZE is not allowed.
+ */
+bool QIOWiimote::writeReport(const char * data, const qint64 max_size)
+{
+	Q_ASSERT_X(max_size <= MAX_REPORT_SIZE, "QIOWiimote::writeReport", "A report can't have a size greater than 22.");
+
+	if (this->wiimote_handle == INVALID_HANDLE_VALUE) return false;
+
+	char data_copy[MAX_REPORT_SIZE];
+
+	for(register int i = 0; i < max_size; i++) data_copy[i] = data[i];
+	/* Pad the rest of the report with zeroes just to be sure. */
+	for(register int i = max_size; i < MAX_REPORT_SIZE; i++) data_copy[i] = 0;
+	return (HidD_SetOutputReport(this->wiimote_handle, data_copy, MAX_REPORT_SIZE) == (BOOLEAN)true);
+}
+
+/* Private functions */
+
+/**
+ * Queues the first reads once the connection has been opened. Always runs in the thread of this object.
+ */
+void QIOWiimote::startReading()
+{
+	if (!this->opened) return;
+	for (int i = 0; i < this->read_queue_depth; i++) this->readBegin(i);
+}
+
+/**
+ * Starts asynchronous reading of data from the wiimote.
+ * @param index Entry of the read queue which will receive the data.
+ */
+void QIOWiimote::readBegin(int index)
+{
+	OverlappedQIOWiimote * entry = &this->overlapped[index];
+	ZeroMemory(&entry->overlapped, sizeof(OVERLAPPED));
+	entry->completed = false;
+
+	/* Reuse the previous slot unless the receiver of the last report kept it. */
+	if (!entry->report.isDetached()) entry->report = this->report_pool->acquire();
+	char * buffer = entry->report.isNull() ? entry->fallback_buffer : entry->report->data;
+
+	if (ReadFileEx(this->wiimote_handle,
+				   buffer,
+				   MAX_REPORT_SIZE,
+				   (LPOVERLAPPED)entry,
+				   QIOWiimote::readCallback)) {
+		this->outstanding_reads++;
+	} else {
+		/* The read could not be queued, so it is reported as a failed read. */
+		entry->error_code = GetLastError();
+		entry->bytes_transferred = 0;
+		entry->completed = true;
+	}
+}
+
+/**
+ * Unused under Windows; completed reads are delivered through #readCallback.
+ */
+void QIOWiimote::readAvailable()
+{
+}
+
+/**
+ * This callback is called whenever a read operation is finished.
+ * @param error_code The I/O completion status. This parameter can be one of the system error codes.
+ * @param bytes_transferred The number of bytes transferred. If an error occurs, this parameter is zero.
+ * @param overlapped A pointer to the OVERLAPPED structure specified by the asynchronous I/O function.
+ */
+void CALLBACK QIOWiimote::readCallback(DWORD error_code,
+									   DWORD bytes_transferred,
+									   LPOVERLAPPED overlapped)
+{
+	/* Store the result; reports are processed in the same order in which reads were queued. */
+	OverlappedQIOWiimote * entry = (OverlappedQIOWiimote *)overlapped;
+	entry->time = QPreciseTime::currentTime();
+	entry->error_code = error_code;
+	entry->bytes_transferred = bytes_transferred;
+	entry->completed = true;
+
+	/* Get the QIOWiimote object that should receive this report. */
+	entry->iowiimote->readEnd();
+}
+
+/**
+ * Takes every completed raw report, in queue order, and makes it ready for processing.
+ * The report format is time|report. Each read is queued again once its report has been emitted.
+ */
+void QIOWiimote::readEnd()
+{
+	this->outstanding_reads--;
+
+	/* After a failed read, nothing is processed until the connection is opened again. */
+	if (!this->opened || this->read_failed) return;
+
+	/* Every queued read has been filled, so new reports wait until more reads are queued. */
+	if (this->outstanding_reads == 0) this->read_queue_overruns++;
+
+	while (this->opened && this->overlapped[this->next_read].completed) {
+		int index = this->next_read;
+		OverlappedQIOWiimote * entry = &this->overlapped[index];
+		this->next_read = (this->next_read + 1) % this->read_queue_depth;
+
+		if (entry->error_code == 0) {
+			if (entry->report.isNull()) {
+				/* The pool was exhausted when the read was queued; the report is dropped if it still is. */
+				entry->report = this->report_pool->acquire();
+				if (!entry->report.isNull()) {
+					CopyMemory(entry->report->data, entry->fallback_buffer, entry->bytes_transferred);
+				}
+			}
+			if (!entry->report.isNull()) {
+				entry->report->time = entry->time;
+				entry->report->size = entry->bytes_transferred;
+				/* Emit this report. */
+				emit this->reportReady(entry->report);
+			}
+			/* Schedule the next read, unless the connection was closed. */
+			if (this->opened) this->readBegin(index);
+		} else {
+			/* The error is reported once. The remaining reads complete without being processed. */
+			entry->completed = false;
+			this->read_failed = true;
+			emit this->reportError();
+			break;
+		}
+	}
+}
@@ -0,0 +1,158 @@
+/*
+ * This file is part of QWiimote.
+ *
+ * QWiimote is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QWiimote is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QWiimote. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file qkalmanfilter.cpp
+ *
+ * Source file for the QKalmanFilter class.
+ */
+
+#include "qkalmanfilter.h"
+
+const qreal QKalmanFilter::STILL_WEIGHT = 0.02;
+
+/**
+ * Creates a new filter.
+ * @param process_noise Spectral density of the changes of the rate, in units² per second³.
+ * @param measurement_noise Initial variance of the measurements, in units².
+ */
+QKalmanFilter::QKalmanFilter(qreal process_noise, qreal measurement_noise)
+{
+	this->process_noise = process_noise;
+	this->setMeasurementNoise(measurement_noise);
+	this->still_samples = 0;
+	this->reset();
+}
+
+/**
+ * Changes the process noise. Higher values follow changes faster, lower values remove more noise.
+ * @param process_noise Spectral density of the changes of the rate, in units² per second³. Must be positive.
+ */
+void QKalmanFilter::setProcessNoise(qreal process_noise)
+{
+	if (process_noise > 0) this->process_noise = process_noise;
+}
+
+/**
+ * Changes the measurement noise of every axis. It is replaced by the estimated one once enough still samples have been observed.
+ * @param variance Variance of the measurements, in units². Must be positive.
+ */
+void QKalmanFilter::setMeasurementNoise(qreal variance)
+{
+	if (variance <= 0) return;
+	for (int axis = 0; axis < 3; axis++) this->measurement_noise[axis] = variance;
+}
+
+/**
+ * Forgets the filtered state. The next value will be returned unfiltered.
+ * The estimated measurement noise is kept.
+ */
+void QKalmanFilter::reset()
+{
+	this->valid = false;
+}
+
+/**
+ * Filters a new value.
+ * @param value New measurement.
+ * @param elapsed Seconds since the previous measurement. Measurements with no elapsed time are ignored.
+ * @return Estimated value.
+ */
+QVector3D QKalmanFilter::filter(const QVector3D &value, qreal elapsed)
+{
+	qreal measurement[3] = {value.x(), value.y(), value.z()};
+
+	if (!this->valid) {
+		for (int axis = 0; axis < 3; axis++) {
+			this->values[axis] = measurement[axis];
+			this->rates[axis] = 0;
+			this->covariance[axis][0] = this->measurement_noise[axis];
+			this->covariance[axis][1] = 0;
+			this->covariance[axis][2] = this->measurement_noise[axis];
+		}
+		this->valid = true;
+		return value;
+	}
+
+	if (elapsed <= 0) return QVector3D(this->values[0], this->values[1], this->values[2]);
+
+	qreal q = this->process_noise;
+	qreal dt = elapsed;
+	qreal dt2 = dt * dt;
+
+	for (int axis = 0; axis < 3; axis++) {
+		qreal *p = this->covariance[axis];
+
+		/* Predict with the constant rate model. */
+		this->values[axis] += dt * this->rates[axis];
+		qreal p00 = p[0] + dt * (2 * p[1] + dt * p[2]) + q * dt2 * dt / 3;
+		qreal p01 = p[1] + dt * p[2] + q * dt2 / 2;
+		qreal p11 = p[2] + q * dt;
+
+		/* Correct with the measurement. */
+		qreal innovation = measurement[axis] - this->values[axis];
+		qreal gain_value = p00 / (p00 + this->measurement_noise[axis]);
+		qreal gain_rate  = p01 / (p00 + this->measurement_noise[axis]);
+
+		this->values[axis] += gain_value * innovation;
+		this->rates[axis]  += gain_rate * innovation;
+		p[0] = (1 - gain_value) * p00;
+		p[1] = (1 - gain_value) * p01;
+		p[2] = p11 - gain_rate * p01;
+	}
+
+	return QVector3D(this->values[0], this->values[1], this->values[2]);
+}
+
+/**
+ * Updates the estimated measurement noise with a measurement taken while the real value was not changing.
+ * The estimate is only used after #MIN_STILL_SAMPLES consecutive still measurements.
+ * @param value Measurement.
+ * @param min_variance Lowest measurement variance accepted for each axis, such as the quantization noise of the sensor.
+ */
+void QKalmanFilter::observeStill(const QVector3D &value, const QVector3D &min_variance)
+{
+	qreal measurement[3] = {value.x(), value.y(), value.z()};
+	qreal minimum[3] = {min_variance.x(), min_variance.y(), min_variance.z()};
+
+	for (int axis = 0; axis < 3; axis++) {
+		if (this->still_samples == 0) {
+			this->still_mean[axis] = measurement[axis];
+			this->still_variance[axis] = 0;
+			continue;
+		}
+
+		/* Exponentially weighted mean and variance. */
+		qreal difference = measurement[axis] - this->still_mean[axis];
+		this->still_mean[axis] += STILL_WEIGHT * difference;
+		this->still_variance[axis] = (1 - STILL_WEIGHT) * (this->still_variance[axis] + STILL_WEIGHT * difference * difference);
+
+		if (this->still_samples >= MIN_STILL_SAMPLES) {
+			this->measurement_noise[axis] = qMax(this->still_variance[axis], minimum[axis]);
+		}
+	}
+
+	if (this->still_samples < MIN_STILL_SAMPLES) this->still_samples++;
+}
+
+/**
+ * Notifies that the value is changing, so the following still measurements start a new estimate.
+ */
+void QKalmanFilter::interruptStill()
+{
+	this->still_samples = 0;
+}
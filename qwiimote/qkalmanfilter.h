@@ -0,0 +1,80 @@
+/*
+ * This file is part of QWiimote.
+ *
+ * QWiimote is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QWiimote is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QWiimote. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file qkalmanfilter.h
+ *
+ * Header file for the QKalmanFilter class.
+ *
+ * QKalmanFilter smooths noisy vectors using a constant velocity model for each axis.
+ */
+
+#ifndef QKALMANFILTER_H
+#define QKALMANFILTER_H
+
+#include <QVector3D>
+
+/**
+ * Kalman filter applied independently to each axis of a vector.
+ * The state of each axis is its value and its rate of change, which is assumed to be constant
+ * between measurements except for white noise of spectral density #processNoise. The measurement
+ * noise is estimated from consecutive measurements taken while the value is known to be still
+ * (see #observeStill).
+ * Every update uses a fixed number of operations on fixed-size arrays.
+ */
+class QKalmanFilter
+{
+public:
+	QKalmanFilter(qreal process_noise = 1.0, qreal measurement_noise = 4e-4);
+
+	void setProcessNoise(qreal process_noise);
+
+	/** @return Spectral density of the changes of the rate, in units² per second³. */
+	qreal processNoise() const { return this->process_noise; }
+
+	void setMeasurementNoise(qreal variance);
+
+	/**
+	 * Variance of the measurements of an axis.
+	 * @param axis 0 for x, 1 for y and 2 for z.
+	 * @return Measurement variance, in units².
+	 */
+	qreal measurementNoise(int axis) const { return this->measurement_noise[axis]; }
+
+	void reset();
+	QVector3D filter(const QVector3D &value, qreal elapsed);
+	void observeStill(const QVector3D &value, const QVector3D &min_variance);
+	void interruptStill();
+
+private:
+	static const int MIN_STILL_SAMPLES = 50; ///< Consecutive still samples needed before they update the measurement noise.
+	static const qreal STILL_WEIGHT;         ///< Weight of each still sample in the noise estimate.
+
+	qreal process_noise;        ///< Spectral density of the changes of the rate.
+	qreal measurement_noise[3]; ///< Variance of the measurements of each axis.
+
+	bool valid;                 ///< False until the first value has been filtered.
+	qreal values[3];            ///< Estimated value of each axis.
+	qreal rates[3];             ///< Estimated rate of change of each axis, in units per second.
+	qreal covariance[3][3];     ///< Covariance of each axis: value variance, covariance and rate variance.
+
+	int still_samples;          ///< Number of consecutive still samples observed, up to #MIN_STILL_SAMPLES.
+	qreal still_mean[3];        ///< Exponentially weighted mean of still samples.
+	qreal still_variance[3];    ///< Exponentially weighted variance of still samples.
+};
+
+#endif // QKALMANFILTER_H
@@ -0,0 +1,551 @@
+/*
+ * This file is part of QWiimote.
+ *
+ * QWiimote is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QWiimote is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QWiimote. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file qloopbackwiimote.cpp
+ *
+ * Source file for the QLoopbackWiimote class.
+ */
+
+#include <cmath>
+#include <cstring>
+#include "qloopbackwiimote.h"
+#include "debugcheck.h"
+
+/*
+ * QWiimote requests its calibration data from 0x0016, and the zero / gravity records
+ * it decodes start six bytes after that.
+ */
+#define LOOPBACK_CALIBRATION_ADDRESS 0x001C ///< EEPROM address of the accelerometer zero record.
+
+#define LOOPBACK_ERROR_NO_REGISTER   0x07   ///< Error code for reads / writes to unavailable registers.
+#define LOOPBACK_ERROR_NO_MEMORY     0x08   ///< Error code for reads / writes outside of the EEPROM.
+
+/**
+ * Writes a 10-bit acceleration record in the EEPROM format, where z is stored before y.
+ * @param record Destination of the four record bytes.
+ * @param value Raw x, y and z values, in the axis order of QWiimote.
+ */
+static void WriteAccelerationRecord(quint8 * record, const quint16 value[3])
+{
+	record[0] = value[0] >> 2;
+	record[1] = value[2] >> 2;
+	record[2] = value[1] >> 2;
+	record[3] = ((value[0] & 0x03) << 4) | ((value[2] & 0x03) << 2) | (value[1] & 0x03);
+}
+
+/* Public functions */
+
+/**
+ * Creates a new QLoopbackWiimote object.
+ * It starts with a MotionPlus connected and a single sample of a still wiimote lying face up.
+ * @param parent The parent of this instance. Usually it will be a #QWiimote.
+ */
+QLoopbackWiimote::QLoopbackWiimote(QObject * parent) : QWiimoteTransport(parent), stream_timer(this), reply_timer(this)
+{
+	this->opened = false;
+	this->led_data = 0;
+	this->reporting_mode = 0x30;
+	this->continuous = false;
+	this->battery_level = 0xC0;
+	this->motionplus_connected = true;
+	this->motionplus_active = false;
+	this->script_position = 0;
+	this->report_rate = 100;
+	this->stream_reports = 0;
+	this->generated_reports = 0;
+	this->reply_latency = 0;
+
+	memset(this->eeprom, 0, sizeof(this->eeprom));
+	memset(this->extension_registers, 0, sizeof(this->extension_registers));
+	memset(this->motionplus_registers, 0, sizeof(this->motionplus_registers));
+	this->updateExtensionRegisters();
+
+	quint16 zero[3] = {512, 512, 512};
+	quint16 gravity[3] = {616, 616, 616};
+	this->setAccelerationCalibration(zero, gravity);
+
+	QLoopbackSample still;
+	still.buttons = 0;
+	still.acceleration[0] = 512;
+	still.acceleration[1] = 512;
+	still.acceleration[2] = 616;
+	for (int i = 0; i < 3; i++) {
+		still.motionplus[i] = 8000;
+		still.motionplus_slow[i] = true;
+	}
+	this->script.append(still);
+
+	connect(&this->stream_timer, SIGNAL(timeout()), this, SLOT(streamReports()));
+	this->reply_timer.setSingleShot(true);
+	connect(&this->reply_timer, SIGNAL(timeout()), this, SLOT(deliverReplies()));
+}
+
+/**
+ * Ensures that the emulated connection is closed before destroying the object.
+ */
+QLoopbackWiimote::~QLoopbackWiimote()
+{
+	this->close();
+}
+
+/**
+ * Opens the emulated connection. It always succeeds.
+ * @return true.
+ */
+bool QLoopbackWiimote::open()
+{
+	this->opened = true;
+	this->restartStream();
+	return true;
+}
+
+/**
+ * Closes the emulated connection.
+ */
+void QLoopbackWiimote::close()
+{
+	this->opened = false;
+	this->stream_timer.stop();
+	this->reply_timer.stop();
+	this->pending_replies.clear();
+	this->reply_times.clear();
+}
+
+/**
+ * Receives a report sent to the emulated wiimote and queues the replies it would produce.
+ * @param data Report sent to the wiimote.
+ * @param max_size Size of the report. Using a size greater than #MAX_REPORT_SIZE is not allowed.
+ * @return true if the connection is opened.
+ */
+bool QLoopbackWiimote::writeReport(const char * data, const qint64 max_size)
+{
+	Q_ASSERT_X(max_size <= MAX_REPORT_SIZE, "QLoopbackWiimote::writeReport", "A report can't have a size greater than 22.");
+
+	if (!this->opened || max_size < 2) return this->opened;
+
+	char report[MAX_REPORT_SIZE];
+	memset(report, 0, MAX_REPORT_SIZE);
+	memcpy(report, data, max_size);
+
+	/* Every output report carries the rumble flag. */
+	this->led_data = (this->led_data & 0xFE) | (report[1] & 0x01);
+
+	switch (report[0] & 0xFF) {
+		case 0x11: // LEDs.
+			this->led_data = report[1] & 0xF1;
+			break;
+
+		case 0x12: // Reporting mode.
+			this->continuous = (report[1] & 0x04) != 0;
+			this->reporting_mode = report[2] & 0xFF;
+			this->restartStream();
+			if (!this->continuous) {
+				/* A report of the new type is sent right away. */
+				char input[MAX_REPORT_SIZE];
+				int size = 0;
+				this->buildInputReport(this->script[this->script_position], input, size);
+				this->queueReply(QByteArray(input, size));
+			}
+			break;
+
+		case 0x15: { // Status request.
+			QByteArray status(7, 0);
+			this->setButtons(status.data());
+			status[0] = 0x20;
+			status[3] = (this->led_data & 0xF0) |
+					(this->motionplus_active ? 0x02 : 0x00) |
+					(this->battery_level < 0x20 ? 0x01 : 0x00);
+			status[6] = this->battery_level;
+			this->queueReply(status);
+			break;
+		}
+
+		case 0x16: // Memory write.
+			this->writeMemory(report);
+			break;
+
+		case 0x17: // Memory read.
+			this->readMemory(report);
+			break;
+	}
+
+	return true;
+}
+
+/**
+ * Sets the samples used for generating input reports. The script is repeated forever.
+ * @param samples New script. It must not be empty.
+ */
+void QLoopbackWiimote::setScript(const QList<QLoopbackSample> &samples)
+{
+	Q_ASSERT_X(!samples.isEmpty(), "QLoopbackWiimote::setScript", "The script can't be empty.");
+
+	this->script = samples;
+	this->script_position = 0;
+}
+
+/**
+ * Sets the rate at which continuous input reports are generated.
+ * Reports are generated in batches, so rates above 1000 reports per second are possible.
+ * @param reports_per_second New rate. 0 stops continuous input reports.
+ */
+void QLoopbackWiimote::setReportRate(quint32 reports_per_second)
+{
+	this->report_rate = reports_per_second;
+	this->restartStream();
+}
+
+/**
+ * Sets the time between a report sent to the emulated wiimote and the delivery of its replies.
+ * Replies are always delivered in order. Replies already queued keep their delivery time.
+ * @param milliseconds New latency. 0 delivers replies from the next iteration of the event loop.
+ */
+void QLoopbackWiimote::setReplyLatency(int milliseconds)
+{
+	this->reply_latency = qMax(milliseconds, 0);
+}
+
+/**
+ * Changes the accelerometer calibration stored in the emulated EEPROM.
+ * @param zero Raw x, y and z values at zero acceleration, in the axis order of QWiimote.
+ * @param gravity Raw x, y and z values when the axis points against gravity, in the axis order of QWiimote.
+ */
+void QLoopbackWiimote::setAccelerationCalibration(const quint16 zero[3], const quint16 gravity[3])
+{
+	WriteAccelerationRecord(&this->eeprom[LOOPBACK_CALIBRATION_ADDRESS], zero);
+	WriteAccelerationRecord(&this->eeprom[LOOPBACK_CALIBRATION_ADDRESS + 4], gravity);
+}
+
+/**
+ * Plugs or unplugs the emulated MotionPlus.
+ * @param connected True if the MotionPlus is plugged in.
+ */
+void QLoopbackWiimote::setMotionPlusConnected(bool connected)
+{
+	this->motionplus_connected = connected;
+	if (!connected) this->motionplus_active = false;
+	this->updateExtensionRegisters();
+}
+
+/**
+ * Sets the battery level reported by status reports.
+ * @param level New battery level.
+ */
+void QLoopbackWiimote::setBatteryLevel(quint8 level)
+{
+	this->battery_level = level;
+}
+
+/**
+ * Generates input reports synchronously, ignoring the report rate.
+ * @param count Number of input reports to generate.
+ */
+void QLoopbackWiimote::pump(quint32 count)
+{
+	for (quint32 i = 0; i < count && this->opened; i++) this->emitInputReport();
+}
+
+/* Protected functions */
+
+/**
+ * Button state reported by status reports, memory replies and input reports.
+ * @return Button flags of the current sample of the script.
+ */
+quint16 QLoopbackWiimote::currentButtons() const
+{
+	return this->script[this->script_position].buttons;
+}
+
+/**
+ * Emits an input report of the current reporting mode built from a given sample instead of the script.
+ * @param sample State of the wiimote.
+ * @param time Time of arrival of the report.
+ */
+void QLoopbackWiimote::emitInputReport(const QLoopbackSample &sample, const QPreciseTime &time)
+{
+	if (!this->opened) return;
+
+	char report[MAX_REPORT_SIZE];
+	int size = 0;
+	this->buildInputReport(sample, report, size);
+	this->generated_reports++;
+	this->emitReport(report, size, time);
+}
+
+/* Private functions */
+
+/**
+ * Queues a reply, which will be delivered from the event loop once #replyLatency has passed.
+ * @param reply Reply to queue.
+ */
+void QLoopbackWiimote::queueReply(const QByteArray &reply)
+{
+	if (this->pending_replies.isEmpty()) {
+		QMetaObject::invokeMethod(this, "deliverReplies", Qt::QueuedConnection);
+	}
+	this->pending_replies.append(reply);
+	this->reply_times.append(QPreciseTime::currentTime() + QPreciseDuration::fromMilliseconds(this->reply_latency));
+}
+
+/**
+ * Answers a 0x17 memory read with one 0x21 report for every 16 bytes.
+ * @param data Read request.
+ */
+void QLoopbackWiimote::readMemory(const char * data)
+{
+	bool registers = (data[1] & 0x04) != 0;
+	quint32 address = ((data[2] & 0xFF) << 16) | ((data[3] & 0xFF) << 8) | (data[4] & 0xFF);
+	quint16 size = ((data[5] & 0xFF) << 8) | (data[6] & 0xFF);
+
+	quint8 error = 0;
+	const quint8 * source = this->memory(address, registers, size, error);
+
+	do {
+		quint16 chunk = qMin<quint16>(size, 16);
+		QByteArray reply(MAX_REPORT_SIZE, 0);
+		this->setButtons(reply.data());
+		reply[0] = 0x21;
+		reply[3] = ((qMax<quint16>(chunk, 1) - 1) << 4) | error;
+		reply[4] = (address >> 8) & 0xFF;
+		reply[5] = address & 0xFF;
+		if (source != NULL) {
+			memcpy(reply.data() + 6, source, chunk);
+			source += chunk;
+		}
+		this->queueReply(reply);
+
+		address += chunk;
+		size -= chunk;
+	} while (size > 0 && error == 0);
+}
+
+/**
+ * Answers a 0x16 memory write with a 0x22 acknowledgement.
+ * Writing 0x04 to 0xA600FE activates the MotionPlus; writing 0x55 to 0xA400F0 deactivates it.
+ * @param data Write request.
+ */
+void QLoopbackWiimote::writeMemory(const char * data)
+{
+	bool registers = (data[1] & 0x04) != 0;
+	quint32 address = ((data[2] & 0xFF) << 16) | ((data[3] & 0xFF) << 8) | (data[4] & 0xFF);
+	quint8 size = qMin<quint8>(data[5] & 0xFF, 16);
+
+	quint8 error = 0;
+	quint8 * destination = this->memory(address, registers, size, error);
+	if (destination != NULL) memcpy(destination, data + 6, size);
+
+	bool extension_changed = false;
+	if (registers && error == 0) {
+		if (address == 0xA600FE && data[6] == 0x04 && !this->motionplus_active) {
+			this->motionplus_active = true;
+			extension_changed = true;
+		} else if (address == 0xA400F0 && data[6] == 0x55 && this->motionplus_active) {
+			this->motionplus_active = false;
+			extension_changed = true;
+		}
+	}
+
+	QByteArray ack(5, 0);
+	this->setButtons(ack.data());
+	ack[0] = 0x22;
+	ack[3] = 0x16;
+	ack[4] = error;
+	this->queueReply(ack);
+
+	if (extension_changed) {
+		/* The wiimote sends an unsolicited status report when an extension appears or disappears. */
+		this->updateExtensionRegisters();
+		char status_request[] = {0x15, 0x00};
+		this->writeReport(status_request, 2);
+	}
+}
+
+/**
+ * Finds the emulated memory for an address.
+ * @param address Address to access.
+ * @param registers True for the register space, false for the EEPROM.
+ * @param size Number of bytes that will be accessed.
+ * @param error Set to the error code of the wiimote if the memory is not available.
+ * @return Pointer to the memory, or NULL if it is not available.
+ */
+quint8 * QLoopbackWiimote::memory(quint32 address, bool registers, quint16 size, quint8 &error)
+{
+	if (!registers) {
+		/* The high address byte is ignored by the EEPROM. */
+		quint32 offset = address & 0xFFFF;
+		if (offset + size <= EEPROM_SIZE) return &this->eeprom[offset];
+		error = LOOPBACK_ERROR_NO_MEMORY;
+		return NULL;
+	}
+
+	quint32 offset = address & 0xFF;
+	if ((address & 0xFFFF00) == 0xA60000 && this->motionplus_connected && !this->motionplus_active &&
+			offset + size <= 0x100) {
+		return &this->motionplus_registers[offset];
+	}
+	if ((address & 0xFFFF00) == 0xA40000 && this->motionplus_active && offset + size <= 0x100) {
+		return &this->extension_registers[offset];
+	}
+
+	error = LOOPBACK_ERROR_NO_REGISTER;
+	return NULL;
+}
+
+/**
+ * Updates the extension identifiers, which change when the MotionPlus is activated.
+ */
+void QLoopbackWiimote::updateExtensionRegisters()
+{
+	const quint8 inactive_id[6] = {0x00, 0x00, 0xA6, 0x20, 0x00, 0x05};
+	const quint8 active_id[6]   = {0x00, 0x00, 0xA4, 0x20, 0x04, 0x05};
+
+	memcpy(&this->motionplus_registers[0xFA], inactive_id, 6);
+	memcpy(&this->extension_registers[0xFA], active_id, 6);
+}
+
+/**
+ * Writes the current button state into a report.
+ * @param report Report whose bytes 1 and 2 will be written.
+ */
+void QLoopbackWiimote::setButtons(char * report) const
+{
+	quint16 buttons = this->currentButtons() & 0x9F1F;
+	report[1] = buttons & 0xFF;
+	report[2] = buttons >> 8;
+}
+
+/**
+ * Builds an input report of the current reporting mode from a sample.
+ * Buttons are taken from currentButtons(). Modes other than 0x31 and 0x35 are sent as 0x30 reports.
+ * @param sample State of the wiimote.
+ * @param report Buffer of at least #MAX_REPORT_SIZE bytes.
+ * @param size Set to the size of the report.
+ */
+void QLoopbackWiimote::buildInputReport(const QLoopbackSample &sample, char * report, int &size)
+{
+	memset(report, 0, MAX_REPORT_SIZE);
+	this->setButtons(report);
+
+	switch (this->reporting_mode) {
+		case 0x35: {
+			/* MotionPlus data is only present once it has been activated. */
+			if (this->motionplus_active) {
+				quint8 * extension = (quint8 *)report + 6;
+				extension[0] = sample.motionplus[0] & 0xFF;
+				extension[1] = sample.motionplus[1] & 0xFF;
+				extension[2] = sample.motionplus[2] & 0xFF;
+				extension[3] = ((sample.motionplus[0] >> 6) & 0xFC) |
+						(sample.motionplus_slow[0] ? 0x02 : 0x00) | (sample.motionplus_slow[2] ? 0x01 : 0x00);
+				extension[4] = ((sample.motionplus[1] >> 6) & 0xFC) |
+						(sample.motionplus_slow[1] ? 0x02 : 0x00) | 0x01;
+				extension[5] = ((sample.motionplus[2] >> 6) & 0xFC) | 0x02;
+			}
+			size = 22;
+		}
+			/* FALL THROUGH */
+		case 0x31:
+			report[0] = this->reporting_mode;
+			/* z is sent before y. Only bit 1 of y and z fits in the button bytes. */
+			report[1] |= (sample.acceleration[0] & 0x03) << 5;
+			report[2] |= ((sample.acceleration[1] & 0x02) << 5) | ((sample.acceleration[2] & 0x02) << 4);
+			report[3] = sample.acceleration[0] >> 2;
+			report[4] = sample.acceleration[2] >> 2;
+			report[5] = sample.acceleration[1] >> 2;
+			if (this->reporting_mode == 0x31) size = 6;
+			break;
+
+		default:
+			report[0] = 0x30;
+			size = 3;
+			break;
+	}
+}
+
+/**
+ * Emits a report right away. The report is dropped if the report pool is exhausted.
+ * @param data Report data.
+ * @param size Report size.
+ * @param time Time of arrival of the report.
+ */
+void QLoopbackWiimote::emitReport(const char * data, int size, const QPreciseTime &time)
+{
+	QWiimoteReportHandle report = this->report_pool->acquire();
+	if (report.isNull()) return;
+
+	memcpy(report->data, data, size);
+	report->size = size;
+	report->time = time;
+	emit this->reportReady(report);
+}
+
+/**
+ * Emits the next input report of the script.
+ */
+void QLoopbackWiimote::emitInputReport()
+{
+	char report[MAX_REPORT_SIZE];
+	int size = 0;
+	this->buildInputReport(this->script[this->script_position], report, size);
+	this->script_position = (this->script_position + 1) % this->script.size();
+	this->generated_reports++;
+	this->emitReport(report, size);
+}
+
+/**
+ * Starts or stops continuous input reports depending on the current state.
+ */
+void QLoopbackWiimote::restartStream()
+{
+	this->stream_timer.stop();
+	if (this->opened && this->continuous && this->report_rate > 0) {
+		this->stream_start = QPreciseTime::currentTime();
+		this->stream_reports = 0;
+		this->stream_timer.start(qMax<quint32>(1, 1000 / this->report_rate));
+	}
+}
+
+/* Private slots */
+
+/**
+ * Delivers every queued reply which is due, and waits for the next one.
+ */
+void QLoopbackWiimote::deliverReplies()
+{
+	while (this->opened && !this->pending_replies.isEmpty() && this->reply_times.first() <= QPreciseTime::currentTime()) {
+		QByteArray reply = this->pending_replies.takeFirst();
+		this->reply_times.removeFirst();
+		this->emitReport(reply.constData(), reply.size());
+	}
+
+	if (this->opened && !this->pending_replies.isEmpty()) {
+		qreal remaining = (this->reply_times.first() - QPreciseTime::currentTime()).milliseconds();
+		this->reply_timer.start(qMax((int)ceil(remaining), 0));
+	}
+}
+
+/**
+ * Generates every continuous input report due since the stream started.
+ */
+void QLoopbackWiimote::streamReports()
+{
+	quint64 due = (quint64)(this->stream_start.elapsed() * this->report_rate / 1000.0);
+	while (this->opened && this->continuous && this->stream_reports < due) {
+		this->emitInputReport();
+		this->stream_reports++;
+	}
+}
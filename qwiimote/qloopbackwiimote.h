@@ -0,0 +1,164 @@
+/*
+ * This file is part of QWiimote.
+ *
+ * QWiimote is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QWiimote is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QWiimote. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file qloopbackwiimote.h
+ *
+ * Header file for the QLoopbackWiimote class.
+ *
+ * QLoopbackWiimote emulates a wiimote in memory, so QWiimote can be used without hardware.
+ */
+
+#ifndef QLOOPBACKWIIMOTE_H
+#define QLOOPBACKWIIMOTE_H
+
+#include <QList>
+#include <QTimer>
+#include "qwiimotetransport.h"
+
+/**
+ * Raw state of the emulated wiimote for a single input report.
+ */
+struct QLoopbackSample {
+	quint16 buttons;            ///< Button flags, as in #QWiimote::WiimoteButton.
+	quint16 acceleration[3];    ///< Raw 10-bit acceleration for x, y and z, in the axis order of QWiimote::rawAcceleration(). The lowest bit of y and z is not sent.
+	quint16 motionplus[3];      ///< Raw 14-bit MotionPlus speed for yaw, roll and pitch.
+	bool    motionplus_slow[3]; ///< True if the yaw, roll or pitch speed is in slow mode.
+};
+
+/**
+ * Transport which emulates a wiimote in memory.
+ *
+ * Memory reads (0x17), memory writes (0x16), status requests (0x15) and reporting mode
+ * changes (0x12) are answered the way a real wiimote would. When continuous reporting
+ * is requested, 0x31 and 0x35 reports are generated at a configurable rate by cycling
+ * through a script of #QLoopbackSample. Replies are delivered from the event loop, never
+ * from inside writeReport(), and can be delayed like the replies of a wiimote over Bluetooth
+ * (see #setReplyLatency). pump() generates reports synchronously for load testing.
+ * @see #QWiimoteTransport.
+ */
+class QLoopbackWiimote : public QWiimoteTransport
+{
+	Q_OBJECT
+public:
+	QLoopbackWiimote(QObject * parent = NULL);
+	~QLoopbackWiimote();
+
+	bool open();
+
+	/**
+	 * Checks if communication with the Wiimote is opened.
+	 * @return True iff the Wiimote can be accessed.
+	 */
+	bool isOpened() { return this->opened; }
+	void close();
+	bool writeReport(const char * data, const qint64 max_size);
+	using QWiimoteTransport::writeReport;
+
+	void setScript(const QList<QLoopbackSample> &samples);
+	void setReportRate(quint32 reports_per_second);
+	void setReplyLatency(int milliseconds);
+	void setAccelerationCalibration(const quint16 zero[3], const quint16 gravity[3]);
+	void setMotionPlusConnected(bool connected);
+	void setBatteryLevel(quint8 level);
+	void pump(quint32 count);
+
+	/**
+	 * Rate at which continuous input reports are generated.
+	 * @return Reports per second.
+	 */
+	quint32 reportRate() const { return this->report_rate; }
+
+	/**
+	 * Time between a report sent to the emulated wiimote and the delivery of its replies.
+	 * @return Latency in milliseconds.
+	 */
+	int replyLatency() const { return this->reply_latency; }
+
+	/**
+	 * Current LED and rumble state, as last sent in a 0x11 report.
+	 * @return Flags as in #QWiimote::WiimoteLed.
+	 */
+	quint8 leds() const { return this->led_data; }
+
+	/**
+	 * Current reporting mode, as last sent in a 0x12 report.
+	 * @return Report type of the input reports.
+	 */
+	quint8 reportingMode() const { return this->reporting_mode; }
+
+	/**
+	 * Total number of input reports generated.
+	 * @return Number of reports.
+	 */
+	quint64 generatedReports() const { return this->generated_reports; }
+
+protected:
+	/**
+	 * Checks if the emulated wiimote was asked to send input reports continuously.
+	 * @return True iff continuous reporting is enabled.
+	 */
+	bool isContinuous() const { return this->continuous; }
+
+	virtual quint16 currentButtons() const;
+	void emitInputReport(const QLoopbackSample &sample, const QPreciseTime &time);
+
+private:
+	static const quint32 EEPROM_SIZE = 0x1700; ///< Size of the emulated EEPROM.
+
+	bool opened;                        ///< True only if the connection is opened.
+	quint8 led_data;                    ///< LED and rumble state.
+	quint8 reporting_mode;              ///< Input report type being generated.
+	bool continuous;                    ///< True if input reports must be generated continuously.
+	quint8 battery_level;               ///< Battery level reported by 0x20 status reports.
+	bool motionplus_connected;          ///< True if a MotionPlus is plugged in.
+	bool motionplus_active;             ///< True if the MotionPlus has been activated by writing to 0xA600FE.
+
+	quint8 eeprom[EEPROM_SIZE];         ///< Emulated EEPROM.
+	quint8 extension_registers[0x100];  ///< Emulated registers at 0xA400xx.
+	quint8 motionplus_registers[0x100]; ///< Emulated registers at 0xA600xx.
+
+	QList<QLoopbackSample> script;      ///< Samples cycled through by input reports.
+	int script_position;                ///< Next sample of the script to use.
+	quint32 report_rate;                ///< Input reports per second.
+	QTimer stream_timer;                ///< Drives continuous input reports. A child, so it follows moveToThread().
+	QPreciseTime stream_start;          ///< Time when continuous reporting started.
+	quint64 stream_reports;             ///< Input reports generated since stream_start.
+	quint64 generated_reports;          ///< Total number of input reports generated.
+
+	QList<QByteArray> pending_replies;  ///< Replies waiting to be delivered from the event loop.
+	QList<QPreciseTime> reply_times;    ///< Time when each pending reply is due.
+	int reply_latency;                  ///< Milliseconds between a report and its replies.
+	QTimer reply_timer;                 ///< Delivers the replies which are not due yet. A child, so it follows moveToThread().
+
+	void queueReply(const QByteArray &reply);
+	void readMemory(const char * data);
+	void writeMemory(const char * data);
+	quint8 * memory(quint32 address, bool registers, quint16 size, quint8 &error);
+	void updateExtensionRegisters();
+	void setButtons(char * report) const;
+	void buildInputReport(const QLoopbackSample &sample, char * report, int &size);
+	void emitReport(const char * data, int size, const QPreciseTime &time = QPreciseTime::currentTime());
+	void emitInputReport();
+	void restartStream();
+
+private slots:
+	void deliverReplies();
+	void streamReports();
+};
+
+#endif // QLOOPBACKWIIMOTE_H
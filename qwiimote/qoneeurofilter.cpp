@@ -0,0 +1,108 @@
+/*
+ * This file is part of QWiimote.
+ *
+ * QWiimote is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QWiimote is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QWiimote. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file qoneeurofilter.cpp
+ *
+ * Source file for the QOneEuroFilter class.
+ */
+
+#include <cmath>
+#include "qoneeurofilter.h"
+
+#define QW_PI (3.141592653589793238462643) ///< Pi constant.
+
+/**
+ * Creates a new filter.
+ * @param min_cutoff Cutoff frequency when the value does not change, in Hz.
+ * @param beta Increase of the cutoff frequency per unit of speed.
+ * @param derivative_cutoff Cutoff frequency used for filtering the speed, in Hz.
+ */
+QOneEuroFilter::QOneEuroFilter(qreal min_cutoff, qreal beta, qreal derivative_cutoff)
+{
+	this->setParameters(min_cutoff, beta, derivative_cutoff);
+	this->reset();
+}
+
+/**
+ * Changes the parameters of the filter. The filtered state is kept.
+ * Lower minimum cutoffs remove more jitter, and higher betas reduce the lag of fast movements.
+ * @param min_cutoff Cutoff frequency when the value does not change, in Hz. Must be positive.
+ * @param beta Increase of the cutoff frequency per unit of speed. Must not be negative.
+ * @param derivative_cutoff Cutoff frequency used for filtering the speed, in Hz. Must be positive.
+ */
+void QOneEuroFilter::setParameters(qreal min_cutoff, qreal beta, qreal derivative_cutoff)
+{
+	if (min_cutoff > 0) this->min_cutoff = min_cutoff;
+	if (beta >= 0) this->speed_coefficient = beta;
+	if (derivative_cutoff > 0) this->derivative_cutoff = derivative_cutoff;
+}
+
+/**
+ * Forgets the filtered state. The next value will be returned unfiltered.
+ */
+void QOneEuroFilter::reset()
+{
+	this->valid = false;
+}
+
+/**
+ * Filters a new value.
+ * @param value New value.
+ * @param elapsed Seconds since the previous value. Values with no elapsed time are ignored.
+ * @return Filtered value.
+ */
+QVector3D QOneEuroFilter::filter(const QVector3D &value, qreal elapsed)
+{
+	qreal input[3] = {value.x(), value.y(), value.z()};
+
+	if (!this->valid) {
+		for (int axis = 0; axis < 3; axis++) {
+			this->values[axis] = input[axis];
+			this->speeds[axis] = 0;
+		}
+		this->valid = true;
+		return value;
+	}
+
+	if (elapsed <= 0) return QVector3D(this->values[0], this->values[1], this->values[2]);
+
+	qreal speed_alpha = smoothingFactor(this->derivative_cutoff, elapsed);
+	for (int axis = 0; axis < 3; axis++) {
+		qreal speed = (input[axis] - this->values[axis]) / elapsed;
+		this->speeds[axis] += speed_alpha * (speed - this->speeds[axis]);
+
+		qreal cutoff = this->min_cutoff + this->speed_coefficient * fabs(this->speeds[axis]);
+		this->values[axis] += smoothingFactor(cutoff, elapsed) * (input[axis] - this->values[axis]);
+	}
+
+	return QVector3D(this->values[0], this->values[1], this->values[2]);
+}
+
+/* Private functions */
+
+/**
+ * Weight of a new value in a first order low-pass filter.
+ * @param cutoff Cutoff frequency, in Hz.
+ * @param elapsed Seconds since the previous value.
+ * @return Smoothing factor, between 0 and 1.
+ */
+qreal QOneEuroFilter::smoothingFactor(qreal cutoff, qreal elapsed)
+{
+	qreal tau = 1.0 / (2 * QW_PI * cutoff);
+	return 1.0 / (1.0 + tau / elapsed);
+}
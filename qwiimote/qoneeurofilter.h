@@ -0,0 +1,68 @@
+/*
+ * This file is part of QWiimote.
+ *
+ * QWiimote is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QWiimote is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QWiimote. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file qoneeurofilter.h
+ *
+ * Header file for the QOneEuroFilter class.
+ *
+ * QOneEuroFilter smooths noisy vectors with a cutoff frequency which adapts to their speed.
+ */
+
+#ifndef QONEEUROFILTER_H
+#define QONEEUROFILTER_H
+
+#include <QVector3D>
+
+/**
+ * One Euro filter applied independently to each axis of a vector.
+ * Each axis is smoothed by a first order low-pass filter whose cutoff frequency grows with the speed of
+ * that axis: cutoff = min_cutoff + beta * |speed|. Slow changes are strongly smoothed, removing jitter,
+ * while fast changes get a high cutoff and very little lag. The speed is itself low-pass filtered
+ * at a fixed derivative cutoff.
+ * @see http://www.lifl.fr/~casiez/1euro/
+ */
+class QOneEuroFilter
+{
+public:
+	QOneEuroFilter(qreal min_cutoff = 1.0, qreal beta = 1.0, qreal derivative_cutoff = 1.0);
+
+	void setParameters(qreal min_cutoff, qreal beta, qreal derivative_cutoff);
+
+	/** @return Cutoff frequency when the value does not change, in Hz. */
+	qreal minCutoff() const { return this->min_cutoff; }
+	/** @return Increase of the cutoff frequency per unit of speed. */
+	qreal beta() const { return this->speed_coefficient; }
+	/** @return Cutoff frequency used for filtering the speed, in Hz. */
+	qreal derivativeCutoff() const { return this->derivative_cutoff; }
+
+	void reset();
+	QVector3D filter(const QVector3D &value, qreal elapsed);
+
+private:
+	qreal min_cutoff;        ///< Cutoff frequency when the value does not change, in Hz.
+	qreal speed_coefficient; ///< Increase of the cutoff frequency per unit of speed.
+	qreal derivative_cutoff; ///< Cutoff frequency of the speed, in Hz.
+
+	bool valid;              ///< False until the first value has been filtered.
+	qreal values[3];         ///< Filtered value of each axis.
+	qreal speeds[3];         ///< Filtered speed of each axis, in units per second.
+
+	static qreal smoothingFactor(qreal cutoff, qreal elapsed);
+};
+
+#endif // QONEEUROFILTER_H
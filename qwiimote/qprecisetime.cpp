@@ -14,59 +14,76 @@
  * You should have received a copy of the GNU General Public License
  * along with QWiimote. If not, see <http://www.gnu.org/licenses/>.
  */
-
 /**
- * @file qiowiimote.cpp
+ * @file qprecisetime.cpp
  *
  * Source file for the QPreciseTime class.
  */
 
 #include "qprecisetime.h"
+#if defined(Q_OS_WIN)
+#	include <windows.h>
+#else
+#	include <time.h>
+#endif
 
-/* Public functions. */
-
+#if defined(Q_OS_WIN)
 /**
- * Creates a new #QPreciseTime object.
+ * Frequency of QueryPerformanceCounter. It is fixed at boot, so it is only queried once.
+ * @return Counter ticks per second.
  */
-QPreciseTime::QPreciseTime()
+static qint64 PerformanceFrequency()
 {
-	this->starting_time = -1;
+	static qint64 ticks_per_second = 0;
+	if (ticks_per_second == 0) {
+		qint64 frequency;
+		QueryPerformanceFrequency((LARGE_INTEGER *) &frequency);
+		ticks_per_second = frequency;
+	}
+	return ticks_per_second;
 }
+#endif
+
+/* Public functions. */
 
 /**
  * Allows to know the elapsed time since this #QPreciseTime instance was started.
  *
  * @return Number of milliseconds elapsed since start.
  */
-qreal QPreciseTime::elapsed()
+qreal QPreciseTime::elapsed() const
 {
-	__int64 ticks_per_second;
-	QueryPerformanceFrequency((LARGE_INTEGER *) &ticks_per_second);
-	qreal ticks_per_millisecond = ((qreal)ticks_per_second) / 1000.0;
-
-	return (double)(QPreciseTime::currentTime().starting_time - this->starting_time) / ticks_per_millisecond;
+	return (QPreciseTime::currentTime() - *this).milliseconds();
 }
 
 /**
- * Gets the current time.
+ * Allows to know the elapsed time since this #QPreciseTime instance was started, without losing precision.
  *
- * @return #QPreciseTime starting at the current time.
+ * @return Duration elapsed since start.
  */
-QPreciseTime QPreciseTime::currentTime()
+QPreciseDuration QPreciseTime::elapsedDuration() const
 {
-	QPreciseTime current_time;
-	QueryPerformanceCounter((LARGE_INTEGER *) &current_time.starting_time);
-	return current_time;
+	return QPreciseTime::currentTime() - *this;
 }
 
 /**
- * Copies another #QPreciseTime instance.
- * @param other Instance to be copied.
+ * Gets the current time.
  *
- * @return Reference to the copy.
+ * @return #QPreciseTime starting at the current time.
  */
-QPreciseTime &QPreciseTime::operator=(const QPreciseTime &other)
+QPreciseTime QPreciseTime::currentTime()
 {
-	 this->starting_time = other.starting_time;
-	 return *this;
+#if defined(Q_OS_WIN)
+	qint64 ticks;
+	QueryPerformanceCounter((LARGE_INTEGER *) &ticks);
+
+	/* Whole seconds and the remainder are converted separately, so the product can't overflow. */
+	qint64 frequency = PerformanceFrequency();
+	return QPreciseTime::fromNanoseconds((ticks / frequency) * Q_INT64_C(1000000000) +
+										 (ticks % frequency) * Q_INT64_C(1000000000) / frequency);
+#else
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return QPreciseTime::fromNanoseconds((qint64)now.tv_sec * Q_INT64_C(1000000000) + now.tv_nsec);
+#endif
 }
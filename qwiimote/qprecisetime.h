@@ -14,11 +14,10 @@
  * You should have received a copy of the GNU General Public License
  * along with QWiimote. If not, see <http://www.gnu.org/licenses/>.
  */
-
 /**
  * @file qprecisetime.h
  *
- * Header file for the QPreciseTime class.
+ * Header file for the QPreciseTime and QPreciseDuration classes.
  *
  * This class allows to measure time more precisely.
  */
@@ -27,18 +26,125 @@
 #define QPRECISETIME_H
 
 #include <QtGlobal>
-#include <windows.h>
+
+/* Arithmetic is evaluated at compile time by compilers which support it. */
+#if defined(__cplusplus) && __cplusplus >= 201103L
+#	define QPRECISETIME_CONSTEXPR constexpr
+#else
+#	define QPRECISETIME_CONSTEXPR
+#endif
+
+/**
+ * Span of time, stored as integer nanoseconds.
+ */
+class QPreciseDuration
+{
+public:
+	/**
+	 * Creates a duration.
+	 * @param nanoseconds Length of the duration in nanoseconds.
+	 */
+	QPRECISETIME_CONSTEXPR explicit QPreciseDuration(qint64 nanoseconds = 0) : duration(nanoseconds) {}
+
+	/** @param microseconds Length. @return Duration of the given length. */
+	static QPRECISETIME_CONSTEXPR QPreciseDuration fromMicroseconds(qint64 microseconds) { return QPreciseDuration(microseconds * Q_INT64_C(1000)); }
+	/** @param milliseconds Length. @return Duration of the given length. */
+	static QPRECISETIME_CONSTEXPR QPreciseDuration fromMilliseconds(qint64 milliseconds) { return QPreciseDuration(milliseconds * Q_INT64_C(1000000)); }
+
+	/** @return Length of the duration in nanoseconds. */
+	QPRECISETIME_CONSTEXPR qint64 nanoseconds() const { return this->duration; }
+	/** @return Length of the duration in microseconds, rounded towards zero. */
+	QPRECISETIME_CONSTEXPR qint64 microseconds() const { return this->duration / Q_INT64_C(1000); }
+	/** @return Length of the duration in milliseconds, with decimals. */
+	QPRECISETIME_CONSTEXPR qreal milliseconds() const { return this->duration / 1000000.0; }
+	/** @return Length of the duration in seconds, with decimals. */
+	QPRECISETIME_CONSTEXPR qreal seconds() const { return this->duration / 1000000000.0; }
+
+	/** @param other Duration to add. @return Sum of both durations. */
+	QPRECISETIME_CONSTEXPR QPreciseDuration operator+(const QPreciseDuration &other) const { return QPreciseDuration(this->duration + other.duration); }
+	/** @param other Duration to subtract. @return Difference of both durations. */
+	QPRECISETIME_CONSTEXPR QPreciseDuration operator-(const QPreciseDuration &other) const { return QPreciseDuration(this->duration - other.duration); }
+	/** @param factor Integer factor. @return Scaled duration. */
+	QPRECISETIME_CONSTEXPR QPreciseDuration operator*(qint64 factor) const { return QPreciseDuration(this->duration * factor); }
+	/** @param divisor Integer divisor. @return Scaled duration, rounded towards zero. */
+	QPRECISETIME_CONSTEXPR QPreciseDuration operator/(qint64 divisor) const { return QPreciseDuration(this->duration / divisor); }
+
+	/** @param other Instance to be compared. @return Comparison result. */
+	QPRECISETIME_CONSTEXPR bool operator==(const QPreciseDuration &other) const { return this->duration == other.duration; }
+	/** @param other Instance to be compared. @return Comparison result. */
+	QPRECISETIME_CONSTEXPR bool operator!=(const QPreciseDuration &other) const { return this->duration != other.duration; }
+	/** @param other Instance to be compared. @return Comparison result. */
+	QPRECISETIME_CONSTEXPR bool operator< (const QPreciseDuration &other) const { return this->duration <  other.duration; }
+	/** @param other Instance to be compared. @return Comparison result. */
+	QPRECISETIME_CONSTEXPR bool operator<=(const QPreciseDuration &other) const { return this->duration <= other.duration; }
+	/** @param other Instance to be compared. @return Comparison result. */
+	QPRECISETIME_CONSTEXPR bool operator> (const QPreciseDuration &other) const { return this->duration >  other.duration; }
+	/** @param other Instance to be compared. @return Comparison result. */
+	QPRECISETIME_CONSTEXPR bool operator>=(const QPreciseDuration &other) const { return this->duration >= other.duration; }
+
+private:
+	qint64 duration; ///< Length in nanoseconds.
+};
 
 /**
  * This class is a simplified rewrite of QTime with increased precision.
+ * Times are integer nanoseconds of a monotonic clock: clock_gettime(CLOCK_MONOTONIC), which is also
+ * the clock of evdev timestamps, or QueryPerformanceCounter under Windows. The counter frequency
+ * is only queried once, so taking a timestamp never allocates memory nor divides in floating point.
  */
 class QPreciseTime
 {
 public:
-	QPreciseTime();
-	qreal elapsed();
+	/** Creates a null #QPreciseTime. */
+	QPRECISETIME_CONSTEXPR QPreciseTime() : starting_time(-1) {}
+
+	qreal elapsed() const;
+	QPreciseDuration elapsedDuration() const;
 	static QPreciseTime currentTime();
-	QPreciseTime &operator=(const QPreciseTime &other);
+
+	/**
+	 * Creates a #QPreciseTime from a time of the monotonic clock, such as a kernel event timestamp.
+	 * @param nanoseconds Nanoseconds of the monotonic clock.
+	 *
+	 * @return #QPreciseTime starting at the given time.
+	 */
+	static QPRECISETIME_CONSTEXPR QPreciseTime fromNanoseconds(qint64 nanoseconds) { return QPreciseTime(nanoseconds, 0); }
+
+	/**
+	 * Time of this instance as read from the monotonic clock.
+	 * @return Nanoseconds of the monotonic clock.
+	 */
+	QPRECISETIME_CONSTEXPR qint64 nanoseconds() const { return this->starting_time; }
+
+	/**
+	 * Checks if this instance has been set to a time.
+	 * @return True iff this instance was created by the default constructor and never assigned.
+	 */
+	QPRECISETIME_CONSTEXPR bool isNull() const { return this->starting_time < 0; }
+
+	/**
+	 * Time between two instances.
+	 * @param other Earlier time.
+	 *
+	 * @return Duration from other to this instance.
+	 */
+	QPRECISETIME_CONSTEXPR QPreciseDuration operator-(const QPreciseTime &other) const { return QPreciseDuration(this->starting_time - other.starting_time); }
+
+	/**
+	 * Moves this time forward.
+	 * @param duration Duration to add.
+	 *
+	 * @return Later time.
+	 */
+	QPRECISETIME_CONSTEXPR QPreciseTime operator+(const QPreciseDuration &duration) const { return QPreciseTime(this->starting_time + duration.nanoseconds(), 0); }
+
+	/**
+	 * Moves this time backward.
+	 * @param duration Duration to subtract.
+	 *
+	 * @return Earlier time.
+	 */
+	QPRECISETIME_CONSTEXPR QPreciseTime operator-(const QPreciseDuration &duration) const { return QPreciseTime(this->starting_time - duration.nanoseconds(), 0); }
 
 	/**
 	 * Equality operator.
@@ -46,7 +152,7 @@ public:
 	 *
 	 * @return Comparison result.
 	 */
-	bool operator==(const QPreciseTime &other) const { return starting_time == other.starting_time; }
+	QPRECISETIME_CONSTEXPR bool operator==(const QPreciseTime &other) const { return starting_time == other.starting_time; }
 
 	/**
 	 * Unequality operator.
@@ -54,7 +160,7 @@ public:
 	 *
 	 * @return Comparison result.
 	 */
-	bool operator!=(const QPreciseTime &other) const { return starting_time != other.starting_time; }
+	QPRECISETIME_CONSTEXPR bool operator!=(const QPreciseTime &other) const { return starting_time != other.starting_time; }
 
 	/**
 	 * Lesser than operator.
@@ -62,7 +168,7 @@ public:
 	 *
 	 * @return Comparison result.
 	 */
-	bool operator< (const QPreciseTime &other) const { return starting_time <  other.starting_time; }
+	QPRECISETIME_CONSTEXPR bool operator< (const QPreciseTime &other) const { return starting_time <  other.starting_time; }
 
 	/**
 	 * Lesser or equal than operator.
@@ -70,7 +176,7 @@ public:
 	 *
 	 * @return Comparison result.
 	 */
-	bool operator<=(const QPreciseTime &other) const { return starting_time <= other.starting_time; }
+	QPRECISETIME_CONSTEXPR bool operator<=(const QPreciseTime &other) const { return starting_time <= other.starting_time; }
 
 	/**
 	 * Greater than operator.
@@ -78,7 +184,7 @@ public:
 	 *
 	 * @return Comparison result.
 	 */
-	bool operator> (const QPreciseTime &other) const { return starting_time >  other.starting_time; }
+	QPRECISETIME_CONSTEXPR bool operator> (const QPreciseTime &other) const { return starting_time >  other.starting_time; }
 
 	/**
 	 * Greater or equal than operator.
@@ -86,10 +192,13 @@ public:
 	 *
 	 * @return Comparison result.
 	 */
-	bool operator>=(const QPreciseTime &other) const { return starting_time >= other.starting_time; }
+	QPRECISETIME_CONSTEXPR bool operator>=(const QPreciseTime &other) const { return starting_time >= other.starting_time; }
 
 private:
-	__int64 starting_time; ///< Starting time for this instance.
+	/** Creates a #QPreciseTime from nanoseconds. The second parameter only tells it apart from the default constructor. */
+	QPRECISETIME_CONSTEXPR QPreciseTime(qint64 nanoseconds, int) : starting_time(nanoseconds) {}
+
+	qint64 starting_time; ///< Starting time for this instance, in nanoseconds of the monotonic clock.
 };
 
 #endif // QPRECISETIME_H
@@ -22,25 +22,36 @@
  */
 
 #include <cmath>
+#include <QThread>
+#include <QtConcurrentRun>
 #include "qwiimote.h"
 #include "debugcheck.h"
 #include "qprecisetime.h"
 #include "qiowiimote.h"
 #include "qwiimotereport.h"
-
-/**
- * Stores an acceleration sample.
- * @see #QPreciseTime.
- */
-struct QAccelerationSample
-{
-	QPreciseTime time;                  ///< Time of arrival of the report.
-	QVector3D calibrated_acceleration;  ///< Acceleration values.
-};
+#include "qwiimotereportring.h"
+#include "qwiimotereportclock.h"
+#include "qwiimotesamplering.h"
+#include "qoneeurofilter.h"
+#include "qkalmanfilter.h"
+#include "qgyrocalibrator.h"
+#include "qwiimotecalibrationcache.h"
+#include "qwiimotememoryrequests.h"
+#include "qwiimotereportlayout.h"
+#include "qwiimoteextension.h"
 
 const quint8  QWiimote::SMOOTHING_NONE_THRESHOLD = 3;
 const qreal   QWiimote::SMOOTHING_EMA_THRESHOLD = 0.01;
-const quint16 QWiimote::MOTIONPLUS_TIME = 8000;
+const int     QWiimote::REPORT_BATCH_SIZE = 64;
+const int     QWiimote::ACCELERATION_SAMPLES = 24;
+const int     QWiimote::CONTINUOUS_INTERVAL = 10;
+const int     QWiimote::STATUS_POLLING_INTERVAL = 12000;
+const int     QWiimote::STALL_PERIODS = 5;
+const int     QWiimote::FIRST_REPORT_GRACE = 200;
+const int     QWiimote::STARTUP_RETRY_INTERVAL = 250;
+const int     QWiimote::RECONNECT_MIN_DELAY = 100;
+const int     QWiimote::RECONNECT_MAX_DELAY = 5000;
+const int     QWiimote::CALIBRATION_STORE_DELAY = 10000;
 const qreal   QWiimote::DEGREES_PER_SECOND_SLOW = 8192.0 / 595.0;
 const qreal   QWiimote::DEGREES_PER_SECOND_FAST = QWiimote::DEGREES_PER_SECOND_SLOW / 2000 / 440;
 
@@ -54,7 +65,63 @@ const qreal   QWiimote::DEGREES_PER_SECOND_FAST = QWiimote::DEGREES_PER_SECOND_S
 QWiimote::QWiimote(QObject * parent) : QObject(parent)
 {
 	io_wiimote  = new QIOWiimote(this);
-	last_report = new QPreciseTime();
+	this->initialize();
+}
+
+/**
+ * Creates a new QWiimote instance which uses a custom transport.
+ * @param transport Transport used to communicate with the wiimote. If it has no parent, this instance takes ownership of it.
+ * @param parent The parent of this instance.
+ */
+QWiimote::QWiimote(QWiimoteTransport * transport, QObject * parent) : QObject(parent)
+{
+	if (transport->parent() == NULL) transport->setParent(this);
+	io_wiimote  = transport;
+	this->initialize();
+}
+
+/**
+ * Initializes the members shared by every constructor.
+ */
+void QWiimote::initialize()
+{
+	threaded_io = false;
+	report_ring_capacity = 1024;
+	io_thread   = NULL;
+	report_ring = NULL;
+	report_clock = new QWiimoteReportClock(QPreciseDuration::fromMilliseconds(QWiimote::CONTINUOUS_INTERVAL));
+	sample_ring = new QWiimoteSampleRing(QWiimote::ACCELERATION_SAMPLES);
+	ema_alpha = 0.1;
+	/* Same smoothing as alpha = 0.1 at the continuous reporting rate. */
+	ema_time_constant = QPreciseDuration::fromMicroseconds(94912);
+	ema_valid = false;
+	orientation_rate_valid = false;
+	orientation_matrix_valid = false;
+	fusion_proportional_gain = 0.5;
+	fusion_integral_gain = 0.01;
+	one_euro_filter = new QOneEuroFilter();
+	kalman_filter = new QKalmanFilter();
+	gyro_calibrator = new QGyroCalibrator();
+	for (int axis = 0; axis < 3; axis++) interleaved_acceleration[axis] = 0;
+	memory_requests = new QWiimoteMemoryRequests();
+	continuous_reporting = false;
+	reporting_mode = -1;
+	auto_reconnect = true;
+	calibration_cache_enabled = true;
+	calibration_cached = false;
+	startup_pending = 0;
+	stalled = false;
+	reconnect_delay = QWiimote::RECONNECT_MIN_DELAY;
+	qRegisterMetaType<QWiimote::DataTypes>("QWiimote::DataTypes");
+	qRegisterMetaType<QWiimoteState>("QWiimoteState");
+
+	connect(&watchdog, SIGNAL(timeout()), this, SLOT(checkStall()));
+	reconnect_timer.setSingleShot(true);
+	connect(&reconnect_timer, SIGNAL(timeout()), this, SLOT(attemptReconnect()));
+	cached_calibration = new QWiimoteCalibration();
+	calibration_store_timer.setSingleShot(true);
+	connect(&calibration_store_timer, SIGNAL(timeout()), this, SLOT(storeCalibration()));
+	connect(io_wiimote, SIGNAL(reopened(bool)), this, SLOT(finishReconnect(bool)));
 }
 
 /**
@@ -63,6 +130,107 @@ QWiimote::QWiimote(QObject * parent) : QObject(parent)
 QWiimote::~QWiimote()
 {
 	this->stop();
+
+	if (this->io_thread != NULL) {
+		/* The transport was moved to the I/O thread, so it has no parent. */
+		this->io_thread->quit();
+		this->io_thread->wait();
+		delete this->io_wiimote;
+		delete this->report_ring;
+	}
+
+	delete this->report_clock;
+	delete this->sample_ring;
+	delete this->one_euro_filter;
+	delete this->kalman_filter;
+	delete this->gyro_calibrator;
+	delete this->memory_requests;
+	delete this->cached_calibration;
+}
+
+/**
+ * Runs the transport in its own thread. Received reports are timestamped and stored
+ * in a bounded single-producer / single-consumer ring by the I/O thread, and processed
+ * in batches by the thread which owns this QWiimote. Output reports are written by the I/O thread
+ * too; without threaded I/O they are written by the thread which owns this QWiimote.
+ * Must be called before start(); threaded I/O can't be disabled once the QWiimote has been started with it.
+ * @param threaded True to use a dedicated I/O thread.
+ * @param ring_capacity Number of reports which can wait to be processed. Further reports are dropped.
+ * The report pool of the transport is enlarged to hold them.
+ */
+void QWiimote::setThreadedIO(bool threaded, int ring_capacity)
+{
+	if (this->io_thread != NULL) return;
+
+	this->threaded_io = threaded;
+	this->report_ring_capacity = ring_capacity;
+}
+
+/**
+ * Number of reports dropped because the thread which owns this QWiimote could not keep up
+ * with the I/O thread.
+ * @return Number of dropped reports. Always 0 without threaded I/O.
+ */
+quint32 QWiimote::reportRingOverflows() const
+{
+	return (this->report_ring != NULL) ? this->report_ring->overflows() : 0;
+}
+
+/**
+ * Number of reports dropped by the transport because every slot of its report pool was in use.
+ * With threaded I/O the pool is sized so that reportRingOverflows() counts the drops instead.
+ * @return Number of dropped reports.
+ */
+quint32 QWiimote::reportPoolExhaustions() const
+{
+	return this->io_wiimote->reportPool()->exhaustions();
+}
+
+/**
+ * Enables or disables automatic reconnection. When enabled, the transport is reopened after
+ * a stall, with an increasing delay between attempts, and the data types, leds, orientation mode
+ * and calibration in use are restored. Enabled by default.
+ * Reconnecting never blocks the thread which owns this QWiimote: the transport is reopened by the
+ * I/O thread, or by a worker thread if the transport can be opened from any thread.
+ * @param enabled True to reconnect automatically.
+ */
+void QWiimote::setAutoReconnect(bool enabled)
+{
+	this->auto_reconnect = enabled;
+	if (!enabled) this->reconnect_timer.stop();
+}
+
+/**
+ * Enables or disables the calibration cache. When enabled, the accelerometer calibration and the
+ * MotionPlus zeros of each wiimote are stored on disk, keyed by its device identity. start() then uses
+ * the stored accelerometer calibration at once and checks it against the wiimote in the background,
+ * and the MotionPlus is usable as soon as it is detected. Enabled by default.
+ * Wiimotes whose transport gives no identity are never cached.
+ * @param enabled True to use the calibration cache.
+ */
+void QWiimote::setCalibrationCacheEnabled(bool enabled)
+{
+	this->calibration_cache_enabled = enabled;
+}
+
+/**
+ * Time between reports expected for the current reporting mode. Without continuous reporting,
+ * only the replies to status requests are guaranteed to arrive.
+ * @return Expected milliseconds between reports.
+ */
+int QWiimote::expectedReportInterval() const
+{
+	return this->continuous_reporting ? QWiimote::CONTINUOUS_INTERVAL : QWiimote::STATUS_POLLING_INTERVAL;
+}
+
+/**
+ * Time between continuous reports, as estimated from their arrival times.
+ * MotionPlus data is integrated using this period instead of the time between arrivals.
+ * @return Estimated period. Until enough reports have arrived, the nominal period is returned.
+ */
+QPreciseDuration QWiimote::reportPeriod() const
+{
+	return this->report_clock->period();
 }
 
 /**
@@ -72,33 +240,94 @@ QWiimote::~QWiimote()
  */
 bool QWiimote::start(QWiimote::DataTypes new_data_types)
 {
-	if (this->io_wiimote->open()) {
-		/* All reports are ignored until the calibration data is received. */
-		connect(io_wiimote, SIGNAL(reportReady(QWiimoteReport *)), this, SLOT(getCalibrationReport(QWiimoteReport *)));
-		this->requestCalibrationData();
+	if (this->threaded_io && this->io_thread == NULL) {
+		/* Move the transport to its own thread. */
+		this->report_ring = new QWiimoteReportRing(this->report_ring_capacity);
+		/* A full ring must not exhaust the pool, so reports are only dropped by the ring, where they are counted.
+		 * The pool also holds the reports being read and the one being processed. */
+		this->io_wiimote->setReportPoolCapacity(qMin(this->report_ring->capacity() + this->io_wiimote->readBatchSize() + 1, 0xFFFF));
+		this->io_thread = new QThread(this);
+		this->io_wiimote->setParent(NULL);
+		this->io_wiimote->moveToThread(this->io_thread);
+		this->io_thread->start();
+	}
+
+	/* Without a thread of its own, the transport writes from a writer thread, so writes never block this thread. */
+	this->io_wiimote->setWriterThread(this->io_thread == NULL);
+
+	bool opened = false;
+	if (this->io_thread != NULL) {
+		QMetaObject::invokeMethod(this->io_wiimote, "open", Qt::BlockingQueuedConnection, Q_RETURN_ARG(bool, opened));
+	} else {
+		opened = this->io_wiimote->open();
+	}
+
+	if (opened) {
+		/* Input data is ignored until the calibration data is received, unless it is cached. */
+		this->calibration_received = false;
+		this->calibration_cached = false;
+		this->device_identity = this->io_wiimote->deviceIdentity();
+		this->io_wiimote->invalidateReportingMode();
+		if (this->io_thread != NULL) {
+			/* Reports are stored in the ring by the I/O thread itself. */
+			this->drain_scheduled = 0;
+			connect(io_wiimote, SIGNAL(reportReady(QWiimoteReportHandle)), this, SLOT(enqueueReport(QWiimoteReportHandle)), Qt::DirectConnection);
+		} else {
+			connect(io_wiimote, SIGNAL(reportReady(QWiimoteReportHandle)), this, SLOT(processReport(QWiimoteReportHandle)));
+		}
+		connect(io_wiimote, SIGNAL(reportError()), this, SLOT(handleStall()));
 		/* Initialize internal values. */
 		data_types = 0;
 		this->status_requested = false;
 		this->battery_level = 0;
 		this->battery_empty = false;
 		this->acceleration_smoothing = QWiimote::SmoothingEMA;
-		this->max_acceleration_samples = 24;
 		this->motionplus_threshold = 30;
 		this->max_polling = 5;
 
 		this->orientation_mode = QWiimote::OrientationModeNone;
-		this->orientation_matrix = NULL;
+		this->orientation_quaternion = QQuaternion();
+		this->orientation_rate_valid = false;
+		this->orientation_matrix_valid = false;
 		this->pitch_orientation = 0;
 		this->roll_orientation = 0;
 		this->yaw_orientation = 0;
 
 		this->motionplus_state = QWiimote::MotionPlusInactive;
+		this->motionplus_passthrough = false;
+		this->motionplus_extension = -1;
+		this->extension_connected = false;
+		this->extension_type = QWiimoteExtension::None;
 		this->pitch_speed = 0;
 		this->roll_speed = 0;
 		this->yaw_speed = 0;
 
+		this->stalled = false;
+		this->continuous_reporting = false;
+		this->reporting_mode = -1;
+
+		/* The cache is only read here; the MotionPlus zeros are taken from memory whenever the MotionPlus is enabled.
+		 * A cached calibration is used at once. The calibration data requested below still verifies it. */
+		*this->cached_calibration = QWiimoteCalibration();
+		if (this->calibration_cache_enabled) QWiimoteCalibrationCache::load(this->device_identity, *this->cached_calibration);
+		if (this->cached_calibration->has_acceleration) {
+			this->setAccelerationCalibration(this->cached_calibration->zero_acceleration, this->cached_calibration->gravity);
+			this->calibration_cached = true;
+			this->calibration_received = true;
+		}
+
+		/* The start-up requests are sent together, without waiting for any reply.
+		 * Their replies are matched to them as they arrive. */
+		this->startup_pending = QWiimote::StartupCalibration | QWiimote::StartupStatus;
+		this->startup_sent = QPreciseTime::currentTime();
+		this->requestCalibrationData();
+		this->startStatusPolling();
 		this->setDataTypes(new_data_types);
 
+		/* Start checking that reports keep arriving. */
+		this->last_arrival = QPreciseTime::currentTime();
+		this->watchdog.start(QWiimote::STALL_PERIODS * QWiimote::CONTINUOUS_INTERVAL);
+
 		return true;
 	}
 
@@ -110,6 +339,21 @@ bool QWiimote::start(QWiimote::DataTypes new_data_types)
  */
 void QWiimote::stop()
 {
+	this->watchdog.stop();
+	this->reconnect_timer.stop();
+	this->stalled = false;
+
+	/* The transport can't be closed while a worker thread is opening it. */
+	this->reconnect_future.waitForFinished();
+	this->startup_pending = 0;
+
+	/* Keep the MotionPlus zeros tracked during this session for the next one, before the MotionPlus is disabled. */
+	if (this->calibration_store_timer.isActive() ||
+		 (this->gyro_calibrator->isCalibrated() && !this->gyro_calibrator->isProvisional())) {
+		this->calibration_store_timer.stop();
+		this->storeCalibration();
+	}
+
 	this->setDataTypes(QWiimote::DefaultData);
 	if (this->motionplus_polling.isActive()) {
 		disconnect(&motionplus_polling, SIGNAL(timeout()), this, SLOT(pollMotionPlus()));
@@ -121,10 +365,23 @@ void QWiimote::stop()
 		this->status_polling.stop();
 	}
 
-	disconnect(io_wiimote, SIGNAL(reportReady(QWiimoteReport *)), this, SLOT(getCalibrationReport(QWiimoteReport *)));
-	disconnect(io_wiimote, SIGNAL(reportReady(QWiimoteReport *)), this, SLOT(getReport(QWiimoteReport *)));
+	disconnect(io_wiimote, SIGNAL(reportReady(QWiimoteReportHandle)), this, SLOT(processReport(QWiimoteReportHandle)));
+	disconnect(io_wiimote, SIGNAL(reportReady(QWiimoteReportHandle)), this, SLOT(enqueueReport(QWiimoteReportHandle)));
+	disconnect(io_wiimote, SIGNAL(reportError()), this, SLOT(handleStall()));
+
+	/* Write the queued reports before closing the connection. */
+	if (this->io_thread != NULL) {
+		QMetaObject::invokeMethod(this->io_wiimote, "flushWriteQueue", Qt::BlockingQueuedConnection);
+		QMetaObject::invokeMethod(this->io_wiimote, "close", Qt::BlockingQueuedConnection);
+		/* Discard reports which were not processed. */
+		QWiimoteReportHandle report;
+		while (this->report_ring->pop(report)) {}
+	} else {
+		this->io_wiimote->flushWriteQueue();
+		this->io_wiimote->close();
+	}
 
-	this->io_wiimote->close();
+	this->abortMemoryRequests();
 }
 
 /**
@@ -138,10 +395,24 @@ QWiimote::DataTypes QWiimote::dataTypes() const
 
 /**
  * Sets what data types will be reported.
+ * Can be called from any thread; the change is applied in the thread which owns this QWiimote.
  * @param new_data_types Flags of the data types to report.
  */
 void QWiimote::setDataTypes(QWiimote::DataTypes new_data_types)
 {
+	if (QThread::currentThread() != this->thread()) {
+		/* The MotionPlus state and the polling timers belong to the owner thread. */
+		QMetaObject::invokeMethod(this, "setDataTypes", Qt::QueuedConnection, Q_ARG(QWiimote::DataTypes, new_data_types));
+		return;
+	}
+
+	bool extension_requested = (new_data_types & QWiimote::ExtensionData) && !(this->data_types & QWiimote::ExtensionData);
+	if (extension_requested && (new_data_types & QWiimote::MotionPlusData) &&
+		 (this->motionplus_state == QWiimote::MotionPlusWorking || this->motionplus_state == QWiimote::MotionPlusCalibrated)) {
+		/* The MotionPlus must be activated again, in passthrough mode. */
+		this->motionplus_state = QWiimote::MotionPlusInactive;
+	}
+
 	if (new_data_types & QWiimote::MotionPlusData && this->motionplus_state == QWiimote::MotionPlusInactive) {
 		/* MotionPlus always activates AccelerometerData. */
 		new_data_types |= QWiimote::AccelerometerData;
@@ -151,7 +422,11 @@ void QWiimote::setDataTypes(QWiimote::DataTypes new_data_types)
 		/* Make sure that the MotionPlus is in the correct state. */
 		this->disableMotionPlus();
 
-		/* Start MotionPlus polling. */
+		/* An extension plugged into the MotionPlus is only visible while the MotionPlus is not active. */
+		if (new_data_types & QWiimote::ExtensionData) this->identifyExtension();
+
+		/* Look for the MotionPlus at once. Polling only repeats the check if there is no reply. */
+		this->requestMotionPlusIdentifier();
 		if (!this->motionplus_polling.isActive()) {
 			connect(&motionplus_polling, SIGNAL(timeout()), this, SLOT(pollMotionPlus()));
 			motionplus_polling.start(1000);
@@ -168,43 +443,58 @@ void QWiimote::setDataTypes(QWiimote::DataTypes new_data_types)
 			this->disableMotionPlus();
 		}
 	}
+	if (extension_requested && !(new_data_types & QWiimote::MotionPlusData)) this->identifyExtension();
 	this->data_types = new_data_types;
 
-	send_buffer[0] = 0x12;
+	/* Use the smallest reporting mode which carries the requested data. Extensions need 6 extension bytes. */
+	bool motionplus_working = (this->data_types & QWiimote::MotionPlusData) != 0 &&
+									  (this->motionplus_state == QWiimote::MotionPlusWorking ||
+										this->motionplus_state == QWiimote::MotionPlusCalibrated);
+	bool extension_decoded = (this->data_types & QWiimote::ExtensionData) != 0 &&
+									 (this->extension_type == QWiimoteExtension::Nunchuk || this->extension_type == QWiimoteExtension::Classic);
+	const QWiimoteReportLayout * layout = QWiimoteReportLayout::select((this->data_types & QWiimote::AccelerometerData) != 0,
+																							 (motionplus_working || extension_decoded) ? 6 : 0);
 
-	if ((this->data_types & QWiimote::MotionPlusData) != 0 &&
-		(this->motionplus_state == QWiimote::MotionPlusWorking ||
-		 this->motionplus_state == QWiimote::MotionPlusCalibrated)) {
-		/* Continuous reporting required. */
-		send_buffer[1] = 0x04;
-		send_buffer[2] = 0x35;
-	} else if ((this->data_types & QWiimote::AccelerometerData) != 0 && this->motionplus_state != QWiimote::MotionPlusWorking) {
+	char command[3];
+	command[0] = 0x12;
+	command[2] = layout->type;
+
+	if (layout->isContinuous()) {
 		/* Continuous reporting required. */
-		send_buffer[1] = 0x04;
-		send_buffer[2] = 0x31;
-	}
-	else {
+		command[1] = 0x04;
+	} else {
 		/* Continuous reporting not required. */
-		send_buffer[1] = 0x00;
-		send_buffer[2] = 0x30;
+		command[1] = 0x00;
 		resetAccelerationData();
 	}
 
-	send_buffer[1] |= this->led_data & QWiimote::Rumble;
-
-	this->io_wiimote->writeReport(send_buffer, 3);
+	command[1] |= this->led_data & QWiimote::Rumble;
+	this->continuous_reporting = (command[1] & 0x04) != 0;
+
+	/* The same reporting mode is sent again after unsolicited status reports, and it must not disturb the report clock. */
+	int new_reporting_mode = (command[1] & 0x04) << 8 | layout->type;
+	if (this->sendReport(command, 3) && new_reporting_mode != this->reporting_mode) {
+		this->reporting_mode = new_reporting_mode;
+		/* The wiimote restarts its reports when the reporting mode changes. */
+		this->report_clock->reset();
+		/* Reports may be expected more often from now on, so the stall detection starts over. */
+		this->last_arrival = QPreciseTime::currentTime();
+		this->reporting_mode_changed = this->last_arrival;
+	}
 }
 
 /**
- * Sets what leds will be turned on.
+ * Sets what leds will be turned on, and whether the wiimote rumbles. Can be called from any thread.
  * @param leds Flags of the leds to turn on.
  */
 void QWiimote::setLeds(QWiimote::WiimoteLeds leds)
 {
-	this->led_data = leds;
-	send_buffer[0] = 0x11; // LED report.
-	send_buffer[1] = leds; // LED status.
-	this->io_wiimote->writeReport(send_buffer, 2);
+	this->led_data.fetchAndStoreOrdered(leds);
+
+	char command[2];
+	command[0] = 0x11; // LED report.
+	command[1] = leds; // LED status.
+	this->sendReport(command, 2);
 }
 
 /**
@@ -226,10 +516,107 @@ void QWiimote::setAccelerationSmoothing(QWiimote::AccelerationSmoothing acc_s)
 {
 	if (this->acceleration_smoothing == acc_s) return;
 
-	this->sample_list.clear();
+	this->sample_ring->clear();
+	this->ema_valid = false;
+	this->one_euro_filter->reset();
+	this->kalman_filter->reset();
 	this->acceleration_smoothing = acc_s;
 }
 
+/**
+ * Changes the number of recent acceleration samples kept. A longer window needs the wiimote
+ * to stay still for longer before isStill() is true. Every stored sample is removed, and the ring
+ * is reallocated, so it should be called before start().
+ * @param samples Number of samples. It must be at least 1.
+ */
+void QWiimote::setAccelerationSamples(int samples)
+{
+	Q_ASSERT_X(samples >= 1, "QWiimote::setAccelerationSamples", "At least one sample must be kept.");
+	this->sample_ring->setCapacity(samples);
+}
+
+/**
+ * Number of recent acceleration samples kept. The oldest one tells if the wiimote is still.
+ * @return Capacity of the sample ring.
+ */
+int QWiimote::accelerationSamples() const
+{
+	return this->sample_ring->capacity();
+}
+
+/**
+ * Changes the weight of each new sample when using #SmoothingEMA.
+ * The average behaves like a moving window of about 2 / alpha - 1 samples.
+ * @param alpha Weight of the new sample, between 0 (never changes) and 1 (no smoothing).
+ */
+void QWiimote::setEMAAlpha(qreal alpha)
+{
+	this->ema_alpha = qBound((qreal)0.0, alpha, (qreal)1.0);
+}
+
+/**
+ * Changes the time constant used by #SmoothingTimeEMA. Each sample is weighted by
+ * 1 - exp(-elapsed / time_constant), where elapsed is the device time since the previous sample,
+ * so the smoothing does not depend on the report rate. Defaults to the equivalent of an alpha
+ * of 0.1 at the continuous reporting rate.
+ * @param time_constant Time needed for the average to cover 63% of a step change. Must be positive.
+ */
+void QWiimote::setEMATimeConstant(const QPreciseDuration &time_constant)
+{
+	if (time_constant.nanoseconds() > 0) this->ema_time_constant = time_constant;
+}
+
+/**
+ * Changes the parameters of #SmoothingOneEuro. Acceleration is measured in g, so its speed is in g per second.
+ * The defaults remove the jitter of a still wiimote while following fast movements with a lag of a few reports.
+ * @param min_cutoff Cutoff frequency when the acceleration does not change, in Hz. Lower values remove more jitter. Defaults to 1.
+ * @param beta Increase of the cutoff frequency per g/s of speed. Higher values reduce lag. Defaults to 1.
+ * @param derivative_cutoff Cutoff frequency used for filtering the speed, in Hz. Defaults to 1.
+ */
+void QWiimote::setOneEuroParameters(qreal min_cutoff, qreal beta, qreal derivative_cutoff)
+{
+	this->one_euro_filter->setParameters(min_cutoff, beta, derivative_cutoff);
+}
+
+/**
+ * Get the minimum cutoff frequency of #SmoothingOneEuro.
+ * @return Cutoff frequency when the acceleration does not change, in Hz.
+ */
+qreal QWiimote::oneEuroMinCutoff() const
+{
+	return this->one_euro_filter->minCutoff();
+}
+
+/**
+ * Get the speed coefficient of #SmoothingOneEuro.
+ * @return Increase of the cutoff frequency per g/s of speed.
+ */
+qreal QWiimote::oneEuroBeta() const
+{
+	return this->one_euro_filter->beta();
+}
+
+/**
+ * Changes the process noise of #SmoothingKalman. The measurement noise is not configured: it is estimated
+ * from the samples received while the wiimote is still, and never assumed lower than the quantization
+ * noise of the accelerometer.
+ * @param process_noise Spectral density of the changes of the acceleration rate, in g² / s³.
+ * Higher values follow movements faster, lower values remove more noise. Defaults to 1.
+ */
+void QWiimote::setKalmanProcessNoise(qreal process_noise)
+{
+	this->kalman_filter->setProcessNoise(process_noise);
+}
+
+/**
+ * Get the process noise of #SmoothingKalman.
+ * @return Spectral density of the changes of the acceleration rate, in g² / s³.
+ */
+qreal QWiimote::kalmanProcessNoise() const
+{
+	return this->kalman_filter->processNoise();
+}
+
 
 /**
  * Check what buttons are pressed now.
@@ -246,7 +633,7 @@ QWiimote::WiimoteButtons QWiimote::buttonData() const
  */
 QWiimote::WiimoteLeds QWiimote::leds() const
 {
-	return this->led_data;
+	return QWiimote::WiimoteLeds(QFlag(this->led_data));
 }
 
 /**
@@ -294,10 +681,9 @@ bool QWiimote::isStill() const
 	/* We cannot know if the Wiimote is still in this mode. */
 	if (this->acceleration_smoothing == QWiimote::SmoothingNone) return false;
 
-	QAccelerationSampleList::const_iterator last = this->sample_list.end();
-	last--;
+	if (this->sample_ring->isEmpty()) return false;
 
-	QVector3D still = this->calibrated_acceleration - last->calibrated_acceleration;
+	QVector3D still = this->calibrated_acceleration - this->sample_ring->last().calibrated_acceleration;
 
 	return (abs(still.x()) <= QWiimote::SMOOTHING_EMA_THRESHOLD &&
 			abs(still.y()) <= QWiimote::SMOOTHING_EMA_THRESHOLD &&
@@ -305,50 +691,285 @@ bool QWiimote::isStill() const
 }
 
 /**
- * Request the calibration data from the Wiimote.
- * @return True if the report was sent correctly.
+ * Get the extension identified at the extension port, or at the MotionPlus passthrough port.
+ * Extensions are only identified while #ExtensionData is active.
+ * @return Type of the extension.
+ */
+QWiimoteExtension::Type QWiimote::extensionType() const
+{
+	return this->extension_type;
+}
+
+/**
+ * Get the last state of the Nunchuk or Classic Controller.
+ * @return State of the extension.
+ */
+QWiimoteExtensionState QWiimote::extensionState() const
+{
+	return this->extension_state;
+}
+
+/**
+ * Sends a report to the wiimote without blocking.
+ * The report is queued in the transport, and written from the transport's thread.
+ * @param data Report to send.
+ * @param size Size of the report.
+ * @return True if the report was queued.
+ */
+bool QWiimote::sendReport(const char * data, int size)
+{
+	return this->io_wiimote->queueReport(data, size) != 0;
+}
+
+/**
+ * Request the calibration data from the Wiimote. The reply is handled by finishMemoryRequest().
+ */
+void QWiimote::requestCalibrationData()
+{
+	this->readInternalMemory(QWiimote::CalibrationRead, 0x0016, 0x20, QWiimote::MemoryEeprom);
+}
+
+/**
+ * Starts reading the memory of the wiimote. Must be called from the thread which owns this QWiimote.
+ * Several reads and writes can be in flight at once. The wiimote answers with 16 bytes per report,
+ * so large reads take one report interval for every 16 bytes. A read whose replies could be mistaken
+ * for those of an earlier read is only sent once that read finishes. Requests which get no answer
+ * finish with #MemoryTimeout. The data is only given to #memoryRead, even when this QWiimote reads
+ * the same address for itself.
+ * @param address First address to read. Only its low 24 bits are used.
+ * @param size Number of bytes to read.
+ * @param space Address space to read.
+ * @return Identifier of the read, given again by #memoryRead when it finishes.
+ */
+int QWiimote::readMemory(quint32 address, quint16 size, QWiimote::MemorySpace space)
+{
+	int request_id = this->memory_requests->read(space == QWiimote::MemoryRegisters, address, size);
+	this->sendMemoryReports();
+	return request_id;
+}
+
+/**
+ * Starts writing the memory of the wiimote. Must be called from the thread which owns this QWiimote.
+ * The data is sent in reports of up to 16 bytes, without waiting for their acknowledgements.
+ * @param address First address to write. Only its low 24 bits are used.
+ * @param data Data to write.
+ * @param space Address space to write.
+ * @return Identifier of the write, given again by #memoryWritten when it finishes.
  */
-bool QWiimote::requestCalibrationData()
+int QWiimote::writeMemory(quint32 address, const QByteArray &data, QWiimote::MemorySpace space)
 {
-	send_buffer[0] = 0x17; // Report type.
-	send_buffer[1] = 0x00 | (this->led_data & QWiimote::Rumble); // Read from the EEPROM.
-	send_buffer[2] = 0x16; // Memory position.
-	send_buffer[3] = 0x00;
-	send_buffer[4] = 0x00;
-	send_buffer[5] = 0x00; // Data size.
-	send_buffer[6] = 0x20;
+	int request_id = this->memory_requests->write(space == QWiimote::MemoryRegisters, address, data);
+	this->sendMemoryReports();
+	return request_id;
+}
 
-	return this->io_wiimote->writeReport(send_buffer, 7);
+/**
+ * Starts a memory read of this QWiimote itself. Its result is handled by finishMemoryRequest() and not emitted,
+ * so the reads of the user never reach the handlers, even at the same address.
+ * @param request Kind of read, which selects the handler of the reply.
+ * @param address First address to read.
+ * @param size Number of bytes to read.
+ * @param space Address space to read.
+ */
+void QWiimote::readInternalMemory(QWiimote::InternalRequest request, quint32 address, quint16 size, QWiimote::MemorySpace space)
+{
+	/* The identifier is kept before anything is sent, since a failed send finishes the request at once. */
+	this->internal_requests.insert(this->memory_requests->read(space == QWiimote::MemoryRegisters, address, size), request);
+	this->sendMemoryReports();
+}
+
+/**
+ * Starts a memory write of this QWiimote itself. Its result is not emitted.
+ * @param address First address to write.
+ * @param data Data to write.
+ * @param space Address space to write.
+ */
+void QWiimote::writeInternalMemory(quint32 address, const QByteArray &data, QWiimote::MemorySpace space)
+{
+	this->internal_requests.insert(this->memory_requests->write(space == QWiimote::MemoryRegisters, address, data), QWiimote::InternalWrite);
+	this->sendMemoryReports();
 }
 
 /**
- * This function processes all incoming reports until a report with the acceleration data is received.
+ * Sends the reports of the memory reads and writes which can be sent, keeping the wiimote rumbling if it was.
+ * A request whose report can't be sent fails with #MemorySendFailed.
+ */
+void QWiimote::sendMemoryReports()
+{
+	QByteArray command;
+	while (this->memory_requests->nextReport(command)) {
+		command[1] = (char)(command[1] | (this->led_data & QWiimote::Rumble));
+
+		QWiimoteMemoryResult result;
+		if (this->memory_requests->reportSent(this->sendReport(command.constData(), command.size()), result)) {
+			this->finishMemoryRequest(result);
+		}
+	}
+}
+
+/**
+ * Handles a finished memory read or write. The replies to the reads of this QWiimote are used,
+ * identified by the request, and the results of the requests of the user are emitted.
+ * @param result Finished read or write.
+ */
+void QWiimote::finishMemoryRequest(const QWiimoteMemoryResult &result)
+{
+	/* Reads held back by this one can be sent now. */
+	this->sendMemoryReports();
+
+	if (!this->internal_requests.contains(result.id)) {
+		if (result.write) {
+			emit this->memoryWritten(result.id, result.error);
+		} else {
+			emit this->memoryRead(result.id, result.error, result.data);
+		}
+		return;
+	}
+
+	QWiimote::InternalRequest request = this->internal_requests.take(result.id);
+	const QByteArray &data = result.data;
+	if (request == QWiimote::CalibrationRead && data.size() >= 14) {
+		/* Reply to requestCalibrationData(). */
+		this->applyCalibrationData(data);
+	} else if (request == QWiimote::ExtensionRead) {
+		/* Reply to identifyExtension(). An active MotionPlus is handled as a MotionPlus, not as an extension. */
+		QWiimoteExtension::Type type = (result.error == QWiimote::MemoryNoError) ? QWiimoteExtension::identify(data) :
+																										QWiimoteExtension::None;
+		this->setExtensionType(type == QWiimoteExtension::MotionPlus ? QWiimoteExtension::None : type);
+	} else if (request == QWiimote::MotionPlusIdentifierRead &&
+				  result.error == QWiimote::MemoryNoError && data.size() >= 6 && //There are no errors.
+				  ((data[0] & 0xFF) == 0x00) && //There is a MotionPlus plugged in.
+				  ((data[1] & 0xFF) == 0x00) &&
+				  ((data[2] & 0xFF) == 0xA6) &&
+				  ((data[3] & 0xFF) == 0x20) &&
+				  ((data[5] & 0xFF) == 0x05)) {
+		/* Reply to requestMotionPlusIdentifier(). */
+		if (this->motionplus_state == QWiimote::MotionPlusActivated) {
+			/* The MotionPlus has been found, so it is not looked for anymore. */
+			disconnect(&motionplus_polling, SIGNAL(timeout()), this, SLOT(pollMotionPlus()));
+			this->motionplus_polling.stop();
+
+			this->enableMotionPlus();
+			this->motionplus_state = QWiimote::MotionPlusWorking;
+			/* Set calibration values to zero. */
+			this->pitch_zero_orientation = 0;
+			this->roll_zero_orientation  = 0;
+			this->yaw_zero_orientation   = 0;
+			this->last_report = QPreciseTime();
+			emit motionPlusState(this->motionplus_state);
+
+			/* Switch to a reporting mode which carries the MotionPlus data. */
+			this->setDataTypes(this->data_types);
+		}
+	}
+}
+
+/**
+ * Ends every memory read and write still in flight with #MemoryAborted.
+ */
+void QWiimote::abortMemoryRequests()
+{
+	QList<QWiimoteMemoryResult> aborted = this->memory_requests->abort();
+	for (int i = 0; i < aborted.size(); i++) this->finishMemoryRequest(aborted[i]);
+}
+
+/**
+ * Uses the calibration values read by requestCalibrationData(). Input data is used from now on.
+ * The values are stored in the calibration cache unless the cached values were the same.
+ * @param data Data read from the EEPROM at 0x0016.
+ */
+void QWiimote::applyCalibrationData(const QByteArray &data)
+{
+	this->startup_pending &= ~QWiimote::StartupCalibration;
+	/* Get the required calibration values from the data. */
+	QVector3D zero_acc(((data[6] & 0xFF) << 2) + ((data[9] & 0x30) >> 4),
+							 ((data[8] & 0xFF) << 2) +  (data[9] & 0x03),
+							 ((data[7] & 0xFF) << 2) + ((data[9] & 0x0C) >> 2));
+
+	QVector3D grav(((data[10] & 0xFF) << 2) + ((data[13] & 0x30) >> 4),
+						((data[12] & 0xFF) << 2) +  (data[13] & 0x03),
+						((data[11] & 0xFF) << 2) + ((data[13] & 0x0C) >> 2));
+	grav -= zero_acc;
+
+	bool changed = !this->calibration_cached || zero_acc != this->zero_acceleration || grav != this->gravity;
+	this->setAccelerationCalibration(zero_acc, grav);
+	this->calibration_cached = false;
+	this->calibration_received = true;
+
+	if (changed && this->calibration_cache_enabled) {
+		this->cached_calibration->has_acceleration = true;
+		this->cached_calibration->zero_acceleration = zero_acc;
+		this->cached_calibration->gravity = grav;
+		if (!this->calibration_store_timer.isActive()) this->calibration_store_timer.start(QWiimote::CALIBRATION_STORE_DELAY);
+	}
+}
+
+/**
+ * Stores the cached calibration, with the current MotionPlus zeros if they have been measured.
+ * Writes to disk, so it is scheduled with calibration_store_timer instead of being called while reports are processed.
+ */
+void QWiimote::storeCalibration()
+{
+	if (!this->calibration_cache_enabled) return;
+
+	if (this->gyro_calibrator->isCalibrated() && !this->gyro_calibrator->isProvisional()) {
+		this->cached_calibration->has_gyro = true;
+		for (int axis = 0; axis < 3; axis++) this->cached_calibration->gyro_zeros[axis] = this->gyro_calibrator->zero(axis);
+		this->cached_calibration->gyro_time = QDateTime::currentDateTimeUtc();
+	}
+	QWiimoteCalibrationCache::store(this->device_identity, *this->cached_calibration);
+}
+
+/**
+ * Starts polling status reports.
+ */
+void QWiimote::startStatusPolling()
+{
+	connect(&status_polling, SIGNAL(timeout()), this, SLOT(pollStatusReport()));
+	status_polling.start(QWiimote::STATUS_POLLING_INTERVAL);
+	this->pollStatusReport();
+}
+
+/**
+ * Sends a received report to the right handler.
  * @param report Received report.
  */
-void QWiimote::getCalibrationReport(QWiimoteReport *report)
+void QWiimote::processReport(const QWiimoteReportHandle &report)
 {
-	if (report->data[0] == (char)0x21) {
-		/* Get the required calibration values from the report. */
-		this->zero_acceleration.setX(((report->data[12] & 0xFF) << 2) + ((report->data[15] & 0x30) >> 4));
-		this->zero_acceleration.setY(((report->data[14] & 0xFF) << 2) +  (report->data[15] & 0x03));
-		this->zero_acceleration.setZ(((report->data[13] & 0xFF) << 2) + ((report->data[15] & 0x0C) >> 2));
+	this->last_arrival = report->time;
+	this->getReport(report);
+}
 
-		this->gravity.setX(((report->data[16] & 0xFF) << 2) + ((report->data[19] & 0x30) >> 4));
-		this->gravity.setY(((report->data[18] & 0xFF) << 2) +  (report->data[19] & 0x03));
-		this->gravity.setZ(((report->data[17] & 0xFF) << 2) + ((report->data[19] & 0x0C) >> 2));
-		this->gravity -= this->zero_acceleration;
+/**
+ * Stores a report in the report ring. Runs in the I/O thread.
+ * @param report Received report.
+ */
+void QWiimote::enqueueReport(const QWiimoteReportHandle &report)
+{
+	this->report_ring->push(report);
 
-		/* Stop checking only calibration reports. */
-		disconnect(io_wiimote, SIGNAL(reportReady(QWiimoteReport *)), this, SLOT(getCalibrationReport(QWiimoteReport *)));
-		// Start checking all other reports.
-		connect(io_wiimote, SIGNAL(reportReady(QWiimoteReport *)), this, SLOT(getReport(QWiimoteReport *)));
+	/* Wake up the owner thread unless it has already been told to drain the ring. */
+	if (this->drain_scheduled.testAndSetOrdered(0, 1)) {
+		QMetaObject::invokeMethod(this, "drainReports", Qt::QueuedConnection);
+	}
+}
 
-		/* Start status report polling. */
-		connect(&status_polling, SIGNAL(timeout()), this, SLOT(pollStatusReport()));
-		status_polling.start(12000);
-		this->pollStatusReport();
-	} else {
-		this->requestCalibrationData();
+/**
+ * Processes a batch of reports from the report ring. Runs in the thread which owns this QWiimote.
+ */
+void QWiimote::drainReports()
+{
+	/* Reports pushed from now on schedule a new batch. */
+	this->drain_scheduled.fetchAndStoreOrdered(0);
+
+	QWiimoteReportHandle report;
+	for (int i = 0; i < QWiimote::REPORT_BATCH_SIZE && this->report_ring->pop(report); i++) {
+		this->processReport(report);
+	}
+
+	/* Yield to the event loop between batches. */
+	if (!this->report_ring->isEmpty() && this->drain_scheduled.testAndSetOrdered(0, 1)) {
+		QMetaObject::invokeMethod(this, "drainReports", Qt::QueuedConnection);
 	}
 }
 
@@ -357,173 +978,51 @@ void QWiimote::getCalibrationReport(QWiimoteReport *report)
  * @param report Received report.
  * @todo Check possible report errors.
  */
-void QWiimote::getReport(QWiimoteReport *report)
+void QWiimote::getReport(const QWiimoteReportHandle &report)
 {
 	int report_type = report->data[0] & 0xFF;
 
-	switch (report_type) {
-		case 0x35: // Acceleration + Extension report.
-			if (this->data_types & QWiimote::MotionPlusData) {
-				qint16 raw_pitch,  raw_roll,  raw_yaw;
-				bool   fast_pitch, fast_roll, fast_yaw;
-
-				raw_yaw  =   (report->data[6]  & 0xFF);
-				raw_yaw +=   (report->data[9]  & 0xFC) << 6;
-				fast_yaw =   (report->data[9]  & 0x02) == 0;
-
-				raw_roll  =  (report->data[7]  & 0xFF);
-				raw_roll +=  (report->data[10] & 0xFC) << 6;
-				fast_roll =  (report->data[10] & 0x02) == 0;
-
-				raw_pitch  = (report->data[8]  & 0xFF);
-				raw_pitch += (report->data[11] & 0xFC) << 6;
-				fast_pitch = (report->data[9]  & 0x01) == 0;
-
-				if (this->motionplus_state == QWiimote::MotionPlusWorking) {
-					/* Calibrate orientation. Only take into account "still" samples. */
-					/** @todo This needs a better method to check that the Wiimote is not moving. */
-					if (!fast_pitch &&
-						 !fast_roll &&
-						 !fast_yaw &&
-						 raw_pitch > 7000 && raw_pitch < 9000 &&
-						 raw_roll > 7000 && raw_roll < 9000 &&
-						 raw_yaw > 7000 && raw_yaw < 9000
-						 ) {
-						this->pitch_zero_orientation += raw_pitch;
-						this->roll_zero_orientation  += raw_roll;
-						this->yaw_zero_orientation   += raw_yaw;
-						this->motionplus_calibration_samples++;
-
-						if (this->motionplus_calibration_time.elapsed() > QWiimote::MOTIONPLUS_TIME) {
-
-							this->motionplus_state = QWiimote::MotionPlusCalibrated;
-
-							this->pitch_zero_orientation /= this->motionplus_calibration_samples;
-							this->roll_zero_orientation  /= this->motionplus_calibration_samples;
-							this->yaw_zero_orientation   /= this->motionplus_calibration_samples;
-
-							emit motionPlusState(this->motionplus_state);
-						}
-					}
-				} else if (this->motionplus_state == QWiimote::MotionPlusCalibrated) {
-					pitch_speed = abs(raw_pitch - this->pitch_zero_orientation) > this->GetMotionPlusThreshold() ?
-									  raw_pitch - this->pitch_zero_orientation : 0;
-					pitch_speed /= (fast_pitch) ?	QWiimote::DEGREES_PER_SECOND_FAST :
-															QWiimote::DEGREES_PER_SECOND_SLOW;
-
-					roll_speed = abs(raw_roll - this->roll_zero_orientation) > this->GetMotionPlusThreshold() ?
-									 raw_roll - this->roll_zero_orientation : 0;
-					roll_speed /= (fast_roll) ?	QWiimote::DEGREES_PER_SECOND_FAST :
-															QWiimote::DEGREES_PER_SECOND_SLOW;
-
-					yaw_speed = abs(raw_yaw - this->yaw_zero_orientation) > this->GetMotionPlusThreshold() ?
-									raw_yaw - this->yaw_zero_orientation : 0;
-					yaw_speed /= (fast_yaw) ?		QWiimote::DEGREES_PER_SECOND_FAST :
-															QWiimote::DEGREES_PER_SECOND_SLOW;
-
-					this->elapsed_time = this->last_report->elapsed() - report->time.elapsed();
-					(*this->last_report) = report->time;
-				}
-			}
-			/* FALL THROUGH */
-		case 0x31: // Acceleration report.
-			if (this->data_types & QWiimote::AccelerometerData) {
-				quint16 x_new, y_new, z_new;
-				x_new =  (report->data[3] & 0xFF) << 2;
-				x_new += (report->data[1] & 0x60) >> 5;
-				y_new =  (report->data[5] & 0xFF) << 2;
-				y_new += (report->data[2] & 0x40) >> 5;
-				z_new =  (report->data[4] & 0xFF) << 2;
-				z_new += (report->data[2] & 0x20) >> 4;
-
-				if (this->acceleration_smoothing != QWiimote::SmoothingNone) {
-					this->raw_acceleration = QVector3D(x_new, y_new, z_new);
-					/* Add the new sample to the beginning of the list of samples. */
-					QAccelerationSample sample;
-					sample.time = report->time;
-					/* Calibrated values. */
-					sample.calibrated_acceleration = this->raw_acceleration - this->zero_acceleration;
-					sample.calibrated_acceleration.setX(sample.calibrated_acceleration.x() / this->gravity.x());
-					sample.calibrated_acceleration.setY(sample.calibrated_acceleration.y() / this->gravity.y());
-					sample.calibrated_acceleration.setZ(sample.calibrated_acceleration.z() / this->gravity.z());
-					this->sample_list.prepend(sample);
-
-					/* Remove the last sample if required. */
-					if (this->sample_list.size() > this->max_acceleration_samples) this->sample_list.removeLast();
-				}
-
+	/* Continuous reports are sampled at a fixed rate, so their arrival jitter can be removed. */
+	QPreciseTime device_time = report->time;
+	if (this->continuous_reporting && report_type >= 0x30 && report_type <= 0x3F) {
+		device_time = this->report_clock->deviceTime(report->time);
+	}
 
-				switch (this->acceleration_smoothing) {
-					case QWiimote::SmoothingNone:
-						/* Process acceleration info only if the new values are different than the old ones. */
-						if (	(abs(x_new - this->raw_acceleration.x()) > QWiimote::SMOOTHING_NONE_THRESHOLD) ||
-								(abs(y_new - this->raw_acceleration.y()) > QWiimote::SMOOTHING_NONE_THRESHOLD) ||
-								(abs(z_new - this->raw_acceleration.z()) > QWiimote::SMOOTHING_NONE_THRESHOLD)) {
-							this->raw_acceleration = QVector3D(x_new, y_new, z_new);
-							this->calibrated_acceleration = this->raw_acceleration - this->zero_acceleration;
-							this->calibrated_acceleration.setX(this->calibrated_acceleration.x() / this->gravity.x());
-							this->calibrated_acceleration.setY(this->calibrated_acceleration.y() / this->gravity.y());
-							this->calibrated_acceleration.setZ(this->calibrated_acceleration.z() / this->gravity.z());
-
-							emit this->updatedAcceleration();
-						}
-						break;
-
-					case QWiimote::SmoothingEMA:
-						/* Exponential Moving Average method. */
-						qreal alpha = 0.1;
-						qreal one_minus_alpha = 1.0 - alpha;
-						qreal alpha_pow = 1;
-
-						QVector3D EMA_acceleration(0.0, 0.0, 0.0);
-
-						for (QAccelerationSampleList::iterator i = this->sample_list.begin();
-								i != this->sample_list.end();
-								i++) {
-							EMA_acceleration += i->calibrated_acceleration * alpha_pow;
-							alpha_pow *= one_minus_alpha;
-						}
-
-						EMA_acceleration *= alpha;
-						EMA_acceleration.normalize();
-
-						if (	(fabs(EMA_acceleration.x() - this->calibrated_acceleration.x()) > QWiimote::SMOOTHING_EMA_THRESHOLD) ||
-								(fabs(EMA_acceleration.y() - this->calibrated_acceleration.y()) > QWiimote::SMOOTHING_EMA_THRESHOLD) ||
-								(fabs(EMA_acceleration.z() - this->calibrated_acceleration.z()) > QWiimote::SMOOTHING_EMA_THRESHOLD)) {
-							this->calibrated_acceleration = EMA_acceleration;
-							emit this->updatedAcceleration();
-						}
-						break;
-				}
+	/* Input data can't be used until the calibration is known. Buttons can. */
+	const QWiimoteReportLayout * layout = QWiimoteReportLayout::find(report_type);
+	if (layout != NULL && this->calibration_received) this->getInputData(report->data, *layout, device_time);
 
-				this->processOrientationData();
-			}
+	switch (report_type) {
+		case 0x21: { // Read memory data. Replies are matched to their reads by address.
+			QWiimoteMemoryResult result;
+			if (this->memory_requests->readReply(report->data, result)) this->finishMemoryRequest(result);
+		}
 		break;
 
-	case 0x21: // Read memory data, assumed to be a MotionPlus check.
-			if (((report->data[3] & 0xF0)  != 0xF0) && //There are no errors.
-					((report->data[6] & 0xFF)  == 0x00) && //There is a MotionPlus plugged in.
-					((report->data[7] & 0xFF)  == 0x00) &&
-					((report->data[8] & 0xFF)  == 0xA6) &&
-					((report->data[9] & 0xFF)  == 0x20) &&
-					((report->data[11] & 0xFF) == 0x05)) {
-
-				if (this->motionplus_state == QWiimote::MotionPlusActivated) {
-					this->enableMotionPlus();
-					this->motionplus_state = QWiimote::MotionPlusWorking;
-					/* Set calibration values to zero. */
-					this->pitch_zero_orientation = 0;
-					this->roll_zero_orientation  = 0;
-					this->yaw_zero_orientation   = 0;
-					(*this->last_report) = QPreciseTime::currentTime();
-					emit motionPlusState(this->motionplus_state);
-				}
-			}
+		case 0x22: { // Acknowledgement of an output report.
+			QWiimoteMemoryResult result;
+			if (this->memory_requests->writeAcknowledged(report->data, result)) this->finishMemoryRequest(result);
+		}
 		break;
 
 		case 0x20: // Status report.
+			this->startup_pending &= ~QWiimote::StartupStatus;
 			quint8 new_battery_level = (report->data[6] & 0xFF);
 			bool new_battery_empty = ((report->data[3] & 0x01) == 0x01);
+			bool new_extension_connected = ((report->data[3] & 0x02) == 0x02);
+
+			/* Check if an extension has been plugged or unplugged. An active MotionPlus is reported as an extension too. */
+			if (new_extension_connected != this->extension_connected) {
+				this->extension_connected = new_extension_connected;
+				if ((this->data_types & QWiimote::ExtensionData) && this->motionplus_state == QWiimote::MotionPlusInactive) {
+					if (new_extension_connected) {
+						this->identifyExtension();
+					} else {
+						this->setExtensionType(QWiimoteExtension::None);
+					}
+				}
+			}
+
 			/* Check if the battery level has changed. */
 			if (new_battery_level != this->battery_level) {
 				this->battery_level = new_battery_level;
@@ -538,6 +1037,7 @@ void QWiimote::getReport(QWiimoteReport *report)
 
 			/* If the status request was not requested, the data reporting mode must be changed. */
 			if (!this->status_requested) {
+				this->io_wiimote->invalidateReportingMode();
 				this->setDataTypes(this->data_types);
 			}
 			this->status_requested = false;
@@ -545,13 +1045,264 @@ void QWiimote::getReport(QWiimoteReport *report)
 		break;
 	}
 
-	/* Button data is present in every received report for now. */
-	QWiimote::WiimoteButtons button_new = QFlag(report->data[2] * 0x100 + report->data[1]);
+	/* Button data is present in every received report but 0x3d. */
+	if (layout != NULL && layout->buttons < 0) return;
+	QWiimote::WiimoteButtons button_new = QFlag(((report->data[2] & 0xFF) << 8 | (report->data[1] & 0xFF)) & QWiimoteReportLayout::BUTTON_MASK);
 	if (this->button_data != button_new) {
 		button_data = button_new;
 		emit this->updatedButtons();
 	}
-	(*this->last_report) = QPreciseTime::currentTime();
+}
+
+/**
+ * Gets the input data of a data report, as described by its layout.
+ * @param report Received data report.
+ * @param layout Layout of the report.
+ * @param device_time Time when the wiimote sampled the data.
+ */
+void QWiimote::getInputData(const char * report, const QWiimoteReportLayout &layout, const QPreciseTime &device_time)
+{
+	/* The acceleration is decoded first, so the MotionPlus is checked for stillness with the unsmoothed acceleration of the same report. */
+	bool acceleration = (this->data_types & QWiimote::AccelerometerData) &&
+							  layout.decodeAcceleration(report, this->interleaved_acceleration);
+	if (acceleration) {
+		this->report_acceleration = QVector3D(this->interleaved_acceleration[0],
+														  this->interleaved_acceleration[1],
+														  this->interleaved_acceleration[2]) - this->zero_acceleration;
+		this->report_acceleration.setX(this->report_acceleration.x() / this->gravity.x());
+		this->report_acceleration.setY(this->report_acceleration.y() / this->gravity.y());
+		this->report_acceleration.setZ(this->report_acceleration.z() / this->gravity.z());
+	}
+
+	/* The MotionPlus speeds must be known when the acceleration updates the orientation. */
+	if (layout.extension_size >= 6) {
+		const char * extension = report + layout.extension;
+		bool motionplus_active = (this->data_types & QWiimote::MotionPlusData) &&
+										 (this->motionplus_state == QWiimote::MotionPlusWorking ||
+										  this->motionplus_state == QWiimote::MotionPlusCalibrated);
+
+		if (motionplus_active && (!this->motionplus_passthrough || QWiimoteExtension::isMotionPlusFrame(extension))) {
+			this->getMotionPlusData(extension, device_time);
+		} else if (this->data_types & QWiimote::ExtensionData) {
+			/* In passthrough mode, the MotionPlus speeds of the previous frame are kept for this report. */
+			if (motionplus_active) this->advanceMotionPlusTime(device_time);
+			this->getExtensionData(extension, motionplus_active);
+		}
+	}
+
+	if (acceleration) this->getAccelerationData(this->interleaved_acceleration, device_time);
+}
+
+/**
+ * Gets the MotionPlus data of a report.
+ * @param extension The 6 extension bytes written by the MotionPlus.
+ * @param device_time Time when the wiimote sampled the data.
+ */
+void QWiimote::getMotionPlusData(const char * extension, const QPreciseTime &device_time)
+{
+	qint16 raw_pitch,  raw_roll,  raw_yaw;
+	bool   fast_pitch, fast_roll, fast_yaw;
+
+	raw_yaw  =   (extension[0] & 0xFF);
+	raw_yaw +=   (extension[3] & 0xFC) << 6;
+	fast_yaw =   (extension[3] & 0x02) == 0;
+
+	raw_roll  =  (extension[1] & 0xFF);
+	raw_roll +=  (extension[4] & 0xFC) << 6;
+	fast_roll =  (extension[4] & 0x02) == 0;
+
+	raw_pitch  = (extension[2] & 0xFF);
+	raw_pitch += (extension[5] & 0xFC) << 6;
+	fast_pitch = (extension[3] & 0x01) == 0;
+
+	if (this->motionplus_state == QWiimote::MotionPlusWorking ||
+		 this->motionplus_state == QWiimote::MotionPlusCalibrated) {
+		/* Estimate the zero angles whenever the Wiimote is still. The acceleration is the one of this report, before smoothing. */
+		qreal raw_rates[3] = {(qreal)raw_pitch, (qreal)raw_roll, (qreal)raw_yaw};
+		bool slow = !fast_pitch && !fast_roll && !fast_yaw;
+		bool converged = this->gyro_calibrator->addSample(raw_rates, slow, this->report_acceleration);
+
+		if (this->gyro_calibrator->isCalibrated()) {
+			this->pitch_zero_orientation = this->gyro_calibrator->zero(0);
+			this->roll_zero_orientation  = this->gyro_calibrator->zero(1);
+			this->yaw_zero_orientation   = this->gyro_calibrator->zero(2);
+		}
+
+		/* Zeros converging several times in a row are stored once. */
+		if (converged && !this->calibration_store_timer.isActive()) this->calibration_store_timer.start(QWiimote::CALIBRATION_STORE_DELAY);
+
+		/* Cached zeros are used at once. They are replaced when new ones converge. */
+		if (this->motionplus_state == QWiimote::MotionPlusWorking && this->gyro_calibrator->isCalibrated()) {
+			this->motionplus_state = QWiimote::MotionPlusCalibrated;
+			emit motionPlusState(this->motionplus_state);
+		}
+	}
+
+	if (this->motionplus_state == QWiimote::MotionPlusCalibrated) {
+		pitch_speed = fabs(raw_pitch - this->pitch_zero_orientation) > this->GetMotionPlusThreshold() ?
+						  raw_pitch - this->pitch_zero_orientation : 0;
+		pitch_speed /= (fast_pitch) ?	QWiimote::DEGREES_PER_SECOND_FAST :
+												QWiimote::DEGREES_PER_SECOND_SLOW;
+
+		roll_speed = fabs(raw_roll - this->roll_zero_orientation) > this->GetMotionPlusThreshold() ?
+						 raw_roll - this->roll_zero_orientation : 0;
+		roll_speed /= (fast_roll) ?	QWiimote::DEGREES_PER_SECOND_FAST :
+												QWiimote::DEGREES_PER_SECOND_SLOW;
+
+		yaw_speed = fabs(raw_yaw - this->yaw_zero_orientation) > this->GetMotionPlusThreshold() ?
+						raw_yaw - this->yaw_zero_orientation : 0;
+		yaw_speed /= (fast_yaw) ?		QWiimote::DEGREES_PER_SECOND_FAST :
+												QWiimote::DEGREES_PER_SECOND_SLOW;
+
+		this->advanceMotionPlusTime(device_time);
+	}
+
+	/* An extension plugged into or unplugged from the MotionPlus can only be identified by activating the MotionPlus again. */
+	int extension_connected = (extension[4] & 0x01) ? 1 : 0;
+	if (this->motionplus_extension >= 0 && this->motionplus_extension != extension_connected &&
+		 (this->data_types & QWiimote::ExtensionData)) {
+		this->motionplus_state = QWiimote::MotionPlusInactive;
+		emit motionPlusState(this->motionplus_state);
+		this->setDataTypes(this->data_types);
+		return;
+	}
+	this->motionplus_extension = extension_connected;
+}
+
+/**
+ * Moves the MotionPlus time to a new report, so orientation is integrated up to that report with the
+ * last MotionPlus speeds. Used for every MotionPlus frame, and for the extension frames of the
+ * passthrough modes, so the orientation keeps being updated at the full report rate.
+ * @param device_time Time when the wiimote sampled the report.
+ */
+void QWiimote::advanceMotionPlusTime(const QPreciseTime &device_time)
+{
+	if (this->motionplus_state != QWiimote::MotionPlusCalibrated) return;
+
+	/* The first calibrated report has no previous report to integrate from. */
+	this->elapsed_time = this->last_report.isNull() ? 0 : (device_time - this->last_report).milliseconds();
+	this->last_report = device_time;
+}
+
+/**
+ * Gets the data of a Nunchuk or a Classic Controller.
+ * @param extension The 6 extension bytes of a report.
+ * @param passthrough True if the bytes are an extension frame of a MotionPlus passthrough mode.
+ */
+void QWiimote::getExtensionData(const char * extension, bool passthrough)
+{
+	if (QWiimoteExtension::decode(this->extension_type, extension, passthrough, this->extension_state)) {
+		emit this->updatedExtension();
+	}
+}
+
+/**
+ * Changes the identified extension, and the reporting mode if needed.
+ * @param type Extension now plugged in.
+ */
+void QWiimote::setExtensionType(QWiimoteExtension::Type type)
+{
+	if (type == this->extension_type) return;
+
+	this->extension_type = type;
+	emit this->extensionChanged(type);
+	this->setDataTypes(this->data_types);
+}
+
+/**
+ * Gets the acceleration data of a report.
+ * @param acceleration Raw x, y and z acceleration, with a 10-bit scale.
+ * @param device_time Time when the wiimote sampled the data.
+ */
+void QWiimote::getAccelerationData(const quint16 acceleration[3], const QPreciseTime &device_time)
+{
+	quint16 x_new = acceleration[0];
+	quint16 y_new = acceleration[1];
+	quint16 z_new = acceleration[2];
+
+	if (this->acceleration_smoothing != QWiimote::SmoothingNone) {
+		this->raw_acceleration = QVector3D(x_new, y_new, z_new);
+		/* Add the new sample to the beginning of the ring, replacing the oldest one if it is full. */
+		QAccelerationSample sample;
+		sample.time = device_time;
+		/* Calibrated values. */
+		sample.calibrated_acceleration = this->raw_acceleration - this->zero_acceleration;
+		sample.calibrated_acceleration.setX(sample.calibrated_acceleration.x() / this->gravity.x());
+		sample.calibrated_acceleration.setY(sample.calibrated_acceleration.y() / this->gravity.y());
+		sample.calibrated_acceleration.setZ(sample.calibrated_acceleration.z() / this->gravity.z());
+		this->sample_ring->prepend(sample);
+	}
+
+
+	switch (this->acceleration_smoothing) {
+		case QWiimote::SmoothingNone:
+			/* Process acceleration info only if the new values are different than the old ones. */
+			if (	(abs(x_new - this->raw_acceleration.x()) > QWiimote::SMOOTHING_NONE_THRESHOLD) ||
+					(abs(y_new - this->raw_acceleration.y()) > QWiimote::SMOOTHING_NONE_THRESHOLD) ||
+					(abs(z_new - this->raw_acceleration.z()) > QWiimote::SMOOTHING_NONE_THRESHOLD)) {
+				this->raw_acceleration = QVector3D(x_new, y_new, z_new);
+				this->calibrated_acceleration = this->raw_acceleration - this->zero_acceleration;
+				this->calibrated_acceleration.setX(this->calibrated_acceleration.x() / this->gravity.x());
+				this->calibrated_acceleration.setY(this->calibrated_acceleration.y() / this->gravity.y());
+				this->calibrated_acceleration.setZ(this->calibrated_acceleration.z() / this->gravity.z());
+
+				emit this->updatedAcceleration();
+			}
+			break;
+
+		case QWiimote::SmoothingEMA:
+		case QWiimote::SmoothingTimeEMA: {
+			/* Recursive Exponential Moving Average method. */
+			const QAccelerationSample &sample = this->sample_ring->first();
+
+			if (!this->ema_valid) {
+				this->ema_acceleration = sample.calibrated_acceleration;
+				this->ema_valid = true;
+			} else {
+				qreal alpha = this->ema_alpha;
+				if (this->acceleration_smoothing == QWiimote::SmoothingTimeEMA) {
+					qreal elapsed = (sample.time - this->ema_time).seconds();
+					alpha = 1.0 - exp(-elapsed / this->ema_time_constant.seconds());
+				}
+				this->ema_acceleration += (sample.calibrated_acceleration - this->ema_acceleration) * alpha;
+			}
+			this->ema_time = sample.time;
+
+			this->updateSmoothedAcceleration(this->ema_acceleration);
+			break;
+		}
+
+		case QWiimote::SmoothingOneEuro: {
+			/* One Euro filter, driven by the device time between samples. */
+			const QAccelerationSample &sample = this->sample_ring->first();
+			qreal elapsed = (this->sample_ring->size() > 1) ? (sample.time - this->sample_ring->at(1).time).seconds() : 0;
+
+			this->updateSmoothedAcceleration(this->one_euro_filter->filter(sample.calibrated_acceleration, elapsed));
+			break;
+		}
+
+		case QWiimote::SmoothingKalman: {
+			/* Kalman filter, driven by the device time between samples. */
+			const QAccelerationSample &sample = this->sample_ring->first();
+			qreal elapsed = (this->sample_ring->size() > 1) ? (sample.time - this->sample_ring->at(1).time).seconds() : 0;
+
+			/* Estimate the measurement noise while still. It is never lower than the quantization noise of the 10-bit samples. */
+			if (this->isStill()) {
+				QVector3D quantization(1.0 / (12 * this->gravity.x() * this->gravity.x()),
+											  1.0 / (12 * this->gravity.y() * this->gravity.y()),
+											  1.0 / (12 * this->gravity.z() * this->gravity.z()));
+				this->kalman_filter->observeStill(sample.calibrated_acceleration, quantization);
+			} else {
+				this->kalman_filter->interruptStill();
+			}
+
+			this->updateSmoothedAcceleration(this->kalman_filter->filter(sample.calibrated_acceleration, elapsed));
+			break;
+		}
+	}
+
+	this->processOrientationData();
+	this->recordState(device_time);
 }
 
 /**
@@ -561,9 +1312,24 @@ void QWiimote::getReport(QWiimoteReport *report)
 void QWiimote::setOrientationMode(QWiimote::OrientationMode new_mode)
 {
 	this->orientation_mode = new_mode;
+	this->fusion_integral = QVector3D(0.0, 0.0, 0.0);
 	this->resetAccelerationData();
 }
 
+/**
+ * Changes the gains of the complementary filter used by #OrientationModeFusion.
+ * Higher proportional gains trust the accelerometer more, correcting drift faster but letting more
+ * accelerometer noise and linear acceleration through. The integral gain estimates the remaining
+ * bias of the MotionPlus.
+ * @param proportional Proportional gain, in radians per second per unit of error. Defaults to 0.5.
+ * @param integral Integral gain, in radians per second² per unit of error. Defaults to 0.01.
+ */
+void QWiimote::setFusionGains(qreal proportional, qreal integral)
+{
+	this->fusion_proportional_gain = qMax(proportional, (qreal)0.0);
+	this->fusion_integral_gain = qMax(integral, (qreal)0.0);
+}
+
 /**
  * Allows to know the current #OrientationMode.
  * @return #OrientationMode currently in use.
@@ -575,14 +1341,42 @@ QWiimote::OrientationMode QWiimote::getOrientationMode() const
 
 
 /**
- * If necessary, prepare the orientation matrix for being used.
+ * Derivative of an orientation quaternion rotating at a certain angular rate.
+ * @param orientation Current orientation.
+ * @param rate Angular rate around the axes of the wiimote, in radians per second.
+ * @return Derivative of the orientation, per second.
  */
-void QWiimote::PrepareOrientationMatrix()
+QQuaternion OrientationDerivative(const QQuaternion &orientation, const QVector3D &rate)
 {
-	if (this->orientation_matrix != NULL) return;
+	return 0.5 * (orientation * QQuaternion(0.0, rate));
+}
 
-	this->orientation_matrix = new QMatrix4x4();
-	this->orientation_matrix->setToIdentity();
+/**
+ * Integrates the angular rate measured by the MotionPlus into the orientation, using a fourth order
+ * Runge-Kutta step. The rate is assumed to change linearly from the previous report to this one.
+ * The quaternion is then renormalized with a first order correction, which is enough because
+ * each step only moves it slightly away from unit length.
+ * @param rate Angular rate around the axes of the wiimote, in radians per second.
+ * @param elapsed Seconds since the previous report.
+ */
+void QWiimote::integrateOrientation(const QVector3D &rate, qreal elapsed)
+{
+	QVector3D start_rate = this->orientation_rate_valid ? this->orientation_rate : rate;
+	QVector3D middle_rate = (start_rate + rate) * 0.5;
+	this->orientation_rate = rate;
+	this->orientation_rate_valid = true;
+
+	if (elapsed <= 0) return;
+
+	const QQuaternion &q = this->orientation_quaternion;
+	QQuaternion k1 = OrientationDerivative(q, start_rate);
+	QQuaternion k2 = OrientationDerivative(q + k1 * (elapsed / 2), middle_rate);
+	QQuaternion k3 = OrientationDerivative(q + k2 * (elapsed / 2), middle_rate);
+	QQuaternion k4 = OrientationDerivative(q + k3 * elapsed, rate);
+	QQuaternion result = q + (k1 + 2 * k2 + 2 * k3 + k4) * (elapsed / 6);
+
+	this->orientation_quaternion = result * ((3.0 - result.lengthSquared()) / 2);
+	this->orientation_matrix_valid = false;
 }
 
 /**
@@ -600,6 +1394,21 @@ void UpdateOrientationMatrix(QMatrix4x4 &matrix, qreal pitch_change, qreal roll_
 	matrix.rotate(-roll_change,  0.0, 0.0, 1.0);
 }
 
+/**
+ * Build the quaternion of the rotation applied by UpdateOrientationMatrix, without building the matrix.
+ * @param pitch_change Rotation change for pitch.
+ * @param roll_change Rotation change for roll.
+ * @param yaw_change Rotation change for yaw.
+ * @return Quaternion with the same rotation.
+ */
+QQuaternion OrientationQuaternion(qreal pitch_change, qreal roll_change, qreal yaw_change)
+{
+	/* Same order of application as UpdateOrientationMatrix. */
+	return QQuaternion::fromAxisAndAngle(0.0, 1.0, 0.0, -yaw_change) *
+		   QQuaternion::fromAxisAndAngle(1.0, 0.0, 0.0,  pitch_change) *
+		   QQuaternion::fromAxisAndAngle(0.0, 0.0, 1.0, -roll_change);
+}
+
 /**
  * Get the pitch and roll angles from accelerometer data.
  * @param final_pitch Pitch calculated from accelerometer data.
@@ -647,6 +1456,31 @@ void QWiimote::GetAnglesFromAccelerometer(qreal &final_pitch, qreal &final_roll)
 	}
 }
 
+/**
+ * Corrects the angular rate measured by the MotionPlus with the direction of gravity, and integrates it.
+ * Mahony complementary filter: the error is the cross product between the measured direction of gravity and
+ * the one expected from the current orientation. The accelerometer is only trusted while the magnitude of its
+ * acceleration is close to 1g; otherwise only the integrated error is applied.
+ * @param rate Angular rate around the axes of the wiimote, in radians per second.
+ * @param elapsed Seconds since the previous report.
+ */
+void QWiimote::fuseOrientation(const QVector3D &rate, qreal elapsed)
+{
+	QVector3D measured = this->calibrated_acceleration;
+	qreal magnitude = measured.length();
+
+	if (elapsed > 0 && magnitude > 0.8 && magnitude < 1.2) {
+		/* The accelerometer measures the reaction to gravity, which points up (y). */
+		QVector3D expected = this->orientation_quaternion.conjugate().rotatedVector(QVector3D(0.0, 1.0, 0.0));
+		QVector3D error = QVector3D::crossProduct(measured / magnitude, expected);
+
+		this->fusion_integral += error * (this->fusion_integral_gain * elapsed);
+		this->integrateOrientation(rate + error * this->fusion_proportional_gain + this->fusion_integral, elapsed);
+	} else {
+		this->integrateOrientation(rate + this->fusion_integral, elapsed);
+	}
+}
+
 /**
  * Turns raw data into a matrix that measures current orientation of the wiimote.
  * @todo The constant 0.65 has just been tweaked until it seems to work, but it is not exact at all. Proper measurements should be made.
@@ -659,48 +1493,63 @@ void QWiimote::processOrientationData()
 	/* Do nothing. */
 	if (this->orientation_mode == QWiimote::OrientationModeNone) return;
 
-	qreal pitch_change = 0;
-	qreal roll_change  = 0;
-	qreal yaw_change   = 0;
-
-	if (this->motionplus_state == QWiimote::MotionPlusCalibrated) {
-		pitch_change = -0.65 * (elapsed_time * this->pitch_speed) / 1000;
-		roll_change  = -0.65 * (elapsed_time * this->roll_speed)  / 1000;
-		yaw_change   = -0.65 * (elapsed_time * this->yaw_speed)   / 1000;
+	/* Angular rate around the axes of the wiimote. */
+	bool rotating = this->motionplus_state == QWiimote::MotionPlusCalibrated;
+	QVector3D rate;
+	if (rotating) {
+		rate = QVector3D(-0.65 * this->pitch_speed, 0.65 * this->yaw_speed, 0.65 * this->roll_speed) * (QW_PI / 180);
+	} else {
+		this->orientation_rate_valid = false;
 	}
 
-	this->PrepareOrientationMatrix();
-
 	switch (this->orientation_mode) {
 		case QWiimote::OrientationModeRaw:
-			if (this->motionplus_state == QWiimote::MotionPlusCalibrated) {
-				UpdateOrientationMatrix(*this->orientation_matrix, pitch_change, roll_change, yaw_change);
+			if (rotating) {
+				this->integrateOrientation(rate, this->elapsed_time / 1000);
 			} else if (!(this->data_types & QWiimote::MotionPlusData)) {
 				this->GetAnglesFromAccelerometer(this->pitch_orientation, this->roll_orientation);
 			}
 			break;
 
 		case QWiimote::OrientationModeMixed: {
-			if (this->motionplus_state != QWiimote::MotionPlusCalibrated) return;
+			if (!rotating) return;
 			this->GetAnglesFromAccelerometer(this->pitch_orientation, this->roll_orientation);
-			UpdateOrientationMatrix(*this->orientation_matrix, pitch_change, roll_change, yaw_change);
+			this->integrateOrientation(rate, this->elapsed_time / 1000);
 			/* Conversion from matrix to angles: http://www.euclideanspace.com/maths/geometry/rotations/conversions/matrixToEuler/index.htm */
-			const qreal *matrix_data = this->orientation_matrix->constData();
-			qreal m10 = matrix_data[0 + 1 * 4];
+			/* Only the required elements of the rotation matrix are computed from the quaternion. */
+			const QQuaternion &q = this->orientation_quaternion;
+			qreal m10 = 2 * (q.x() * q.y() - q.scalar() * q.z());
 
 			if (m10 > 0.998 || m10 < -0.998) {
-				qreal m02 = matrix_data[2 + 0 * 4];
-				qreal m22 = matrix_data[2 + 2 * 4];
+				qreal m02 = 2 * (q.x() * q.z() - q.scalar() * q.y());
+				qreal m22 = 1 - 2 * (q.x() * q.x() + q.y() * q.y());
 				this->yaw_orientation = atan2( m02, m22);
 			} else {
-				qreal m20 = matrix_data[0 + 2 * 4];
-				qreal m00 = matrix_data[0 + 0 * 4];
+				qreal m20 = 2 * (q.x() * q.z() + q.scalar() * q.y());
+				qreal m00 = 1 - 2 * (q.y() * q.y() + q.z() * q.z());
 				this->yaw_orientation = atan2(-m20, m00);
 			}
 
 			this->yaw_orientation = QW_RAD_TO_DEGREES(this->yaw_orientation);
 			break;
 		}
+
+		case QWiimote::OrientationModeFusion: {
+			if (!rotating || !(this->data_types & QWiimote::AccelerometerData)) return;
+			this->fuseOrientation(rate, this->elapsed_time / 1000);
+			/* Angles in the same order used by orientation() for #OrientationModeMixed: yaw, pitch and then roll. */
+			const QQuaternion &q = this->orientation_quaternion;
+			qreal m12 = 2 * (q.y() * q.z() - q.scalar() * q.x());
+			qreal m10 = 2 * (q.x() * q.y() + q.scalar() * q.z());
+			qreal m11 = 1 - 2 * (q.x() * q.x() + q.z() * q.z());
+			qreal m02 = 2 * (q.x() * q.z() + q.scalar() * q.y());
+			qreal m22 = 1 - 2 * (q.x() * q.x() + q.y() * q.y());
+
+			this->pitch_orientation = QW_RAD_TO_DEGREES(asin(qBound((qreal)-1.0, -m12, (qreal)1.0)));
+			this->roll_orientation  = QW_RAD_TO_DEGREES(atan2(m10, m11));
+			this->yaw_orientation   = QW_RAD_TO_DEGREES(atan2(-m02, m22));
+			break;
+		}
 	}
 
 	emit this->updatedOrientation();
@@ -712,12 +1561,18 @@ void QWiimote::processOrientationData()
  */
 QMatrix4x4 QWiimote::orientation() const
 {
-	if (this->orientation_matrix == NULL ||
-		this->orientation_mode == QWiimote::OrientationModeNone) return QMatrix4x4();
+	if (this->orientation_mode == QWiimote::OrientationModeNone) return QMatrix4x4();
 
 	switch (this->orientation_mode) {
 		case QWiimote::OrientationModeRaw:
-			return QMatrix4x4(*this->orientation_matrix);
+		case QWiimote::OrientationModeFusion:
+			/* The matrix is only built when it is requested. */
+			if (!this->orientation_matrix_valid) {
+				this->orientation_matrix.setToIdentity();
+				this->orientation_matrix.rotate(this->orientation_quaternion);
+				this->orientation_matrix_valid = true;
+			}
+			return this->orientation_matrix;
 
 		case QWiimote::OrientationModeMixed:
 			QMatrix4x4 calculated_matrix;
@@ -728,17 +1583,101 @@ QMatrix4x4 QWiimote::orientation() const
 	return QMatrix4x4();
 }
 
+/**
+ * Changes the number of states kept in the history. Every stored state is removed.
+ * @param states Maximum number of states. With continuous reporting, about 100 states are stored per second.
+ */
+void QWiimote::setHistoryLength(int states)
+{
+	this->state_history.setCapacity(states);
+	this->next_resample = QPreciseTime();
+}
+
+/**
+ * Get the state of the wiimote at a certain time, interpolated from the history.
+ * Times outside of the history get the oldest or the newest state; they are never extrapolated.
+ * @param time Device time, in the same clock as #QPreciseTime::currentTime.
+ * @return State at the requested time. Its time is null if no state has been recorded.
+ */
+QWiimoteState QWiimote::stateAt(const QPreciseTime &time) const
+{
+	return this->state_history.stateAt(time);
+}
+
+/**
+ * Enables emitting the states of the wiimote at a fixed rate, using #resampledState.
+ * Resampled states are interpolated from the history, so each one is emitted as soon as a
+ * newer report arrives, with the same latency as the reports.
+ * @param rate States per second. 0 disables resampling.
+ */
+void QWiimote::setResampleRate(int rate)
+{
+	this->resample_period = QPreciseDuration(rate > 0 ? Q_INT64_C(1000000000) / rate : 0);
+	this->next_resample = QPreciseTime();
+}
+
+/**
+ * Get the rate at which #resampledState is emitted.
+ * @return States per second, or 0 if resampling is disabled.
+ */
+int QWiimote::resampleRate() const
+{
+	return this->resample_period.nanoseconds() > 0 ? (int)(Q_INT64_C(1000000000) / this->resample_period.nanoseconds()) : 0;
+}
+
 /**
  * Resets the MotionPlus orientation data.
  */
 void QWiimote::resetOrientation()
 {
-	if (this->orientation_matrix == NULL) return;
-	this->orientation_matrix->setToIdentity();
+	this->orientation_quaternion = QQuaternion();
+	this->orientation_rate_valid = false;
+	this->orientation_matrix_valid = false;
+	this->fusion_integral = QVector3D(0.0, 0.0, 0.0);
+}
+
+/**
+ * Changes the acceleration to a smoothed value, if it is different enough from the current one.
+ * @param smoothed New smoothed acceleration.
+ */
+void QWiimote::updateSmoothedAcceleration(const QVector3D &smoothed)
+{
+	if (	(fabs(smoothed.x() - this->calibrated_acceleration.x()) > QWiimote::SMOOTHING_EMA_THRESHOLD) ||
+			(fabs(smoothed.y() - this->calibrated_acceleration.y()) > QWiimote::SMOOTHING_EMA_THRESHOLD) ||
+			(fabs(smoothed.z() - this->calibrated_acceleration.z()) > QWiimote::SMOOTHING_EMA_THRESHOLD)) {
+		this->calibrated_acceleration = smoothed;
+		emit this->updatedAcceleration();
+	}
+}
+
+/**
+ * Stores the current orientation and acceleration in the history, and emits the resampled states it completes.
+ * @param time Device time of the report which produced the state.
+ */
+void QWiimote::recordState(const QPreciseTime &time)
+{
+	QWiimoteState state;
+	state.time = time;
+	state.orientation = (this->orientation_mode != QWiimote::OrientationModeMixed) ? this->orientation_quaternion :
+							  OrientationQuaternion(this->pitch_orientation, -this->roll_orientation, this->yaw_orientation);
+	state.acceleration = this->calibrated_acceleration;
+	if (!this->state_history.append(state)) return;
+
+	if (this->resample_period.nanoseconds() <= 0) return;
+
+	/* Restart the resampled stream if it was not started or it fell out of the history. */
+	if (this->next_resample.isNull() || this->next_resample < this->state_history.oldest().time) {
+		this->next_resample = time;
+	}
+
+	while (this->next_resample <= time) {
+		emit this->resampledState(this->state_history.stateAt(this->next_resample));
+		this->next_resample = this->next_resample + this->resample_period;
+	}
 }
 
 /**
- * Checks if a MotionPlus is connected.
+ * Checks if a MotionPlus is connected. Polling stops once the MotionPlus has been found.
  */
 void QWiimote::pollMotionPlus()
 {
@@ -752,16 +1691,16 @@ void QWiimote::pollMotionPlus()
 		}
 	}
 
-	send_buffer[0] = (char)0x17; // Report type.
-	send_buffer[1] = (char)0x04 | (this->led_data & QWiimote::Rumble); // Read from the registers.
-	send_buffer[2] = (char)0xA6; // Memory position.
-	send_buffer[3] = (char)0x00;
-	send_buffer[4] = (char)0xFA;
-	send_buffer[5] = (char)0x00; // Data size.
-	send_buffer[6] = (char)0x06;
+	this->requestMotionPlusIdentifier();
+}
 
-	this->io_wiimote->writeReport(send_buffer, 7);
-	this->setDataTypes(this->data_types);
+/**
+ * Reads the extension identifier at 0xA600FA, where an inactive MotionPlus can be found.
+ * The reply is handled by finishMemoryRequest().
+ */
+void QWiimote::requestMotionPlusIdentifier()
+{
+	this->readInternalMemory(QWiimote::MotionPlusIdentifierRead, 0xA600FA, 6, QWiimote::MemoryRegisters);
 }
 
 /**
@@ -769,21 +1708,134 @@ void QWiimote::pollMotionPlus()
  */
 void QWiimote::pollStatusReport()
 {
-	send_buffer[0] = (char)0x15; // Report type.
-	send_buffer[1] = (char)0x00 | (this->led_data & QWiimote::Rumble);
+	char command[2];
+	command[0] = (char)0x15; // Report type.
+	command[1] = (char)0x00 | (this->led_data & QWiimote::Rumble);
 
-	this->io_wiimote->writeReport(send_buffer, 2);
+	this->sendReport(command, 2);
 	this->status_requested = true;
 }
 
+/**
+ * Checks if reports stopped arriving for several report intervals.
+ */
+void QWiimote::checkStall()
+{
+	if (this->stalled) return;
+
+	if (this->startup_pending != 0 && this->startup_sent.elapsed() > QWiimote::STARTUP_RETRY_INTERVAL) {
+		this->resendStartupRequests();
+	}
+
+	/* A lost reply must not keep its request pending forever. */
+	QList<QWiimoteMemoryResult> expired = this->memory_requests->expire();
+	for (int i = 0; i < expired.size(); i++) this->finishMemoryRequest(expired[i]);
+
+	/* The first report of a new reporting mode is given some extra time. */
+	qreal timeout = QWiimote::STALL_PERIODS * this->expectedReportInterval();
+	if (this->last_arrival.elapsed() > timeout &&
+		 (this->reporting_mode_changed.isNull() || this->reporting_mode_changed.elapsed() > timeout + QWiimote::FIRST_REPORT_GRACE)) {
+		this->handleStall();
+	}
+}
+
+/**
+ * Sends again the start-up requests whose replies have not arrived.
+ */
+void QWiimote::resendStartupRequests()
+{
+	if (this->startup_pending & QWiimote::StartupCalibration) this->requestCalibrationData();
+	if (this->startup_pending & QWiimote::StartupStatus) this->pollStatusReport();
+	this->startup_sent = QPreciseTime::currentTime();
+}
+
+/**
+ * The connection has been lost. Schedules the first reconnection attempt.
+ */
+void QWiimote::handleStall()
+{
+	if (this->stalled) return;
+
+	this->stalled = true;
+	emit this->connectionLost();
+
+	if (this->auto_reconnect) {
+		this->reconnect_delay = QWiimote::RECONNECT_MIN_DELAY;
+		this->reconnect_timer.start(this->reconnect_delay);
+	}
+}
+
+/**
+ * Reopens the transport without blocking the thread of this object. The result is received by finishReconnect().
+ * Without threaded I/O, finding and opening the device is left to a worker thread, after the
+ * transport has been closed from the thread which owns it.
+ */
+void QWiimote::attemptReconnect()
+{
+	if (!this->stalled) return;
+
+	if (this->io_thread == NULL && this->io_wiimote->opensFromAnyThread()) {
+		this->io_wiimote->close();
+		this->reconnect_future = QtConcurrent::run(this->io_wiimote, &QWiimoteTransport::reopen);
+	} else {
+		QMetaObject::invokeMethod(this->io_wiimote, "reopen", Qt::QueuedConnection);
+	}
+}
+
+/**
+ * Restores the state of the wiimote after a reconnection attempt, or schedules the next attempt.
+ * @param success True if the transport was reopened.
+ */
+void QWiimote::finishReconnect(bool success)
+{
+	if (!this->stalled) {
+		/* The QWiimote was stopped while reconnecting. */
+		if (success) QMetaObject::invokeMethod(this->io_wiimote, "close", Qt::QueuedConnection);
+		return;
+	}
+
+	if (!success) {
+		/* Try again later, waiting longer each time. */
+		this->reconnect_delay = qMin(2 * this->reconnect_delay, QWiimote::RECONNECT_MAX_DELAY);
+		if (this->auto_reconnect) this->reconnect_timer.start(this->reconnect_delay);
+		return;
+	}
+
+	this->stalled = false;
+	this->last_arrival = QPreciseTime::currentTime();
+
+	/* The wiimote forgot its leds, its reporting mode and the MotionPlus activation. */
+	this->io_wiimote->invalidateReportingMode();
+	this->reporting_mode = -1;
+	this->setLeds(this->leds());
+	if (this->motionplus_state != QWiimote::MotionPlusInactive) {
+		this->motionplus_state = QWiimote::MotionPlusInactive;
+		emit this->motionPlusState(this->motionplus_state);
+	}
+	this->abortMemoryRequests();
+	this->setDataTypes(this->data_types);
+
+	/* An extension may have been swapped while disconnected. Through the MotionPlus, it is identified again by setDataTypes(). */
+	if ((this->data_types & QWiimote::ExtensionData) && !(this->data_types & QWiimote::MotionPlusData)) this->identifyExtension();
+
+	/* Calibration and orientation are kept. Start-up requests are only sent again if they were not answered. */
+	this->resendStartupRequests();
+
+	emit this->reconnected();
+}
+
 /**
  * Resets all stored acceleration data.
  */
 void QWiimote::resetAccelerationData()
 {
-	this->sample_list.clear();
+	this->sample_ring->clear();
+	this->ema_valid = false;
+	this->one_euro_filter->reset();
+	this->kalman_filter->reset();
 	this->raw_acceleration = QVector3D(0.0, 0.0, 0.0);
 	this->calibrated_acceleration = QVector3D(0.0, 0.0, 0.0);
+	for (int axis = 0; axis < 3; axis++) this->interleaved_acceleration[axis] = 0;
 }
 
 /**
@@ -791,19 +1843,18 @@ void QWiimote::resetAccelerationData()
  */
 void QWiimote::enableMotionPlus()
 {
-	send_buffer[0] = (char)0x16;									   // Report type.
-	send_buffer[1] = (char)0x04 | (this->led_data & QWiimote::Rumble); // Write to the registers.
-	send_buffer[2] = (char)0xA6;									   // Memory position.
-	send_buffer[3] = (char)0x00;
-	send_buffer[4] = (char)0xFE;
-	send_buffer[5] = (char)0x01;									   // Data size.
-	send_buffer[6] = (char)0x04;									   // Activate the MotionPlus.
+	// Write 0x04 to register 0xA600FE, or 0x05 / 0x07 for the Nunchuk / Classic Controller passthrough modes.
+	quint8 mode = (this->data_types & QWiimote::ExtensionData) ? QWiimoteExtension::passthroughMode(this->extension_type) : 0x04;
+	this->motionplus_passthrough = mode != 0x04;
+	this->motionplus_extension = -1;
+	this->writeInternalMemory(0xA600FE, QByteArray(1, (char)mode), QWiimote::MemoryRegisters);
 
-	// Write 0x04 to register 0xA600FE.
-	this->io_wiimote->writeReport(send_buffer, 7);
+	this->gyro_calibrator->reset();
 
-	this->motionplus_calibration_samples = 0;
-	this->motionplus_calibration_time = QTime::currentTime();
+	/* Zeros stored in a previous session, or measured before a reconnection, are used until new ones are measured. */
+	if (this->calibration_cache_enabled && this->cached_calibration->has_gyro) {
+		this->gyro_calibrator->setZeros(this->cached_calibration->gyro_zeros);
+	}
 }
 
 /**
@@ -811,14 +1862,17 @@ void QWiimote::enableMotionPlus()
  */
 void QWiimote::disableMotionPlus()
 {
-	send_buffer[0] = (char)0x16;									   // Report type.
-	send_buffer[1] = (char)0x04 | (this->led_data & QWiimote::Rumble); // Write to the registers.
-	send_buffer[2] = (char)0xA4;									   // Memory position.
-	send_buffer[3] = (char)0x00;
-	send_buffer[4] = (char)0xF0;
-	send_buffer[5] = (char)0x01;									   // Data size.
-	send_buffer[6] = (char)0x55;									   // Disable the MotionPlus.
-
 	// Write 0x55 to register 0xA400F0.
-	this->io_wiimote->writeReport(send_buffer, 7);
+	this->writeInternalMemory(0xA400F0, QByteArray(1, 0x55), QWiimote::MemoryRegisters);
+}
+
+/**
+ * Initializes the extension without encryption and reads its identifier.
+ * The reply is handled by finishMemoryRequest().
+ */
+void QWiimote::identifyExtension()
+{
+	this->writeInternalMemory(0xA400F0, QByteArray(1, 0x55), QWiimote::MemoryRegisters);
+	this->writeInternalMemory(0xA400FB, QByteArray(1, 0x00), QWiimote::MemoryRegisters);
+	this->readInternalMemory(QWiimote::ExtensionRead, 0xA400FA, 6, QWiimote::MemoryRegisters);
 }
@@ -28,22 +28,38 @@
 #define QWIIMOTE_H
 
 #include <QObject>
+#include <QAtomicInt>
 #include <QFlags>
 #include <QTimer>
 #include <QTime>
 #include <QMatrix4x4>
 #include <QList>
-
-class  QPreciseTime;
-struct QAccelerationSample;
-class  QIOWiimote;
-class  QWiimoteReport;
-
-typedef QList<QAccelerationSample> QAccelerationSampleList; ///< List of acceleration samples.
+#include <QHash>
+#include <QFuture>
+#include "qprecisetime.h"
+#include "qwiimotehistory.h"
+#include "qwiimoteextension.h"
+
+class  QWiimoteTransport;
+class  QWiimoteReportHandle;
+class  QWiimoteReportRing;
+class  QWiimoteReportClock;
+class  QWiimoteSampleRing;
+class  QOneEuroFilter;
+class  QKalmanFilter;
+class  QGyroCalibrator;
+class  QWiimoteMemoryRequests;
+struct QWiimoteReportLayout;
+struct QWiimoteMemoryResult;
+struct QWiimoteCalibration;
+class  QThread;
 
 /**
  * QWiimote represents the state of a Wiimote and any connected extensions.
- * @see #QIOWiimote.
+ * Reports are exchanged through a #QWiimoteTransport, which is a #QIOWiimote unless another one is given.
+ * The transport can run in its own thread (see #setThreadedIO), so report intake never waits for the
+ * thread which owns the QWiimote.
+ * @see #QIOWiimote and #QLoopbackWiimote.
  *
  * @todo Using more than one instance of this class is untested.
  */
@@ -56,6 +72,7 @@ public:
 		DefaultData       = 0x00, ///< Get only default data (buttons).
 		AccelerometerData = 0x01, ///< Get Accelerometer data.
 		MotionPlusData    = 0x02, ///< MotionPlus always activates AccelerometerData.
+		ExtensionData     = 0x04, ///< Nunchuk or Classic Controller data. With MotionPlusData, the passthrough modes are used.
 	};
 
 	Q_DECLARE_FLAGS(DataTypes, DataType)
@@ -79,8 +96,11 @@ public:
 
 	/** Smoothing method used for determining acceleration. */
 	enum AccelerationSmoothing {
-		SmoothingNone, ///< Use the last sample.
-		SmoothingEMA,  ///< Apply Exponential Moving Average to the list of samples.
+		SmoothingNone,    ///< Use the last sample.
+		SmoothingEMA,     ///< Apply a recursive Exponential Moving Average with a fixed weight per sample. See #setEMAAlpha.
+		SmoothingTimeEMA, ///< Apply a recursive Exponential Moving Average weighted by the time between samples. See #setEMATimeConstant.
+		SmoothingOneEuro, ///< Apply a One Euro filter, which adapts its smoothing to the speed of each axis. See #setOneEuroParameters.
+		SmoothingKalman,  ///< Apply a Kalman filter whose measurement noise is estimated while the wiimote is still. See #setKalmanProcessNoise.
 	};
 
 	Q_DECLARE_FLAGS(AccSmoothing, AccelerationSmoothing)
@@ -100,18 +120,26 @@ public:
 		/** Orientation is not processed at all. */
 		OrientationModeNone,
 		/**
-		 * If the MotionPlus is being used, a matrix is used for storing
+		 * If the MotionPlus is being used, a quaternion is used for integrating
 		 * angle changes. Otherwise, pitch_orientation and roll_orientation
 		 * will contain angles measured by the accelerometer.
 		 */
 		OrientationModeRaw,
 		/**
-		 * This mode requires MotionPlus. It maintains a matrix for
-		 * storing MotionPlus angle changes. Absolute yaw is calculated
-		 * from this matrix. The other two angles are taken from
+		 * This mode requires MotionPlus. It maintains a quaternion for
+		 * integrating MotionPlus angle changes. Absolute yaw is calculated
+		 * from this quaternion. The other two angles are taken from
 		 * acceleration data.
 		 */
 		OrientationModeMixed,
+		/**
+		 * This mode requires MotionPlus. MotionPlus angle changes are integrated
+		 * into a quaternion, and a Mahony complementary filter corrects their drift
+		 * in pitch and roll using the direction of gravity measured by the
+		 * accelerometer. Yaw can't be corrected, so it drifts slowly. All angles
+		 * are calculated from the quaternion. See #setFusionGains.
+		 */
+		OrientationModeFusion,
 	};
 
 	/** Flags that show if the Wiimote leds / rumble are active. */
@@ -125,16 +153,96 @@ public:
 
 	Q_DECLARE_FLAGS(WiimoteLeds, WiimoteLed)
 
+	/** Address space of memory reads and writes. */
+	enum MemorySpace {
+		MemoryEeprom,    ///< EEPROM of the wiimote.
+		MemoryRegisters, ///< Control registers of the speaker, the extensions and the IR camera.
+	};
+
+	/** Error codes of memory reads and writes. */
+	enum MemoryError {
+		MemoryNoError     = 0x00, ///< The transfer succeeded.
+		MemoryWriteOnly   = 0x07, ///< The address can't be read, or no extension is connected.
+		MemoryNonexistent = 0x08, ///< The address does not exist.
+		MemorySendFailed  = 0xFD, ///< A report of the transfer could not be sent.
+		MemoryTimeout     = 0xFE, ///< The wiimote did not answer in time.
+		MemoryAborted     = 0xFF, ///< The connection was closed or lost before the transfer finished.
+	};
+
 	QWiimote(QObject * parent = NULL);
+	QWiimote(QWiimoteTransport * transport, QObject * parent = NULL);
 	~QWiimote();
 	bool start(QWiimote::DataTypes new_data_types = QWiimote::DefaultData);
 	void stop();
 
-	void setDataTypes(QWiimote::DataTypes new_data_types);
+	void setThreadedIO(bool threaded, int ring_capacity = 1024);
+
+	/**
+	 * Checks if the transport runs in its own thread.
+	 * @return True iff threaded I/O is enabled.
+	 */
+	bool threadedIO() const { return this->threaded_io; }
+
+	quint32 reportRingOverflows() const;
+	quint32 reportPoolExhaustions() const;
+
+	void setAutoReconnect(bool enabled);
+
+	/**
+	 * Checks if the connection is restored automatically when the wiimote stops sending reports.
+	 * @return True iff automatic reconnection is enabled.
+	 */
+	bool autoReconnect() const { return this->auto_reconnect; }
+
+	/**
+	 * Checks if the connection has been lost and it has not been restored yet.
+	 * @return True iff the wiimote is stalled.
+	 */
+	bool isStalled() const { return this->stalled; }
+
+	void setCalibrationCacheEnabled(bool enabled);
+
+	/**
+	 * Checks if calibrations are stored on disk and reused by start().
+	 * @return True iff the calibration cache is enabled.
+	 */
+	bool calibrationCacheEnabled() const { return this->calibration_cache_enabled; }
+
+	int expectedReportInterval() const;
+	QPreciseDuration reportPeriod() const;
+
+	Q_INVOKABLE void setDataTypes(QWiimote::DataTypes new_data_types);
 	void setLeds(QWiimote::WiimoteLeds leds);
 
+	int readMemory(quint32 address, quint16 size, QWiimote::MemorySpace space = QWiimote::MemoryEeprom);
+	int writeMemory(quint32 address, const QByteArray &data, QWiimote::MemorySpace space = QWiimote::MemoryEeprom);
+
 	void setAccelerationCalibration(QVector3D zero_acc, QVector3D grav);
 	void setAccelerationSmoothing(QWiimote::AccelerationSmoothing acc_s);
+	void setAccelerationSamples(int samples);
+	int accelerationSamples() const;
+	void setEMAAlpha(qreal alpha);
+
+	/**
+	 * Weight of each new sample when using #SmoothingEMA.
+	 * @return Alpha, between 0 and 1.
+	 */
+	qreal emaAlpha() const { return this->ema_alpha; }
+
+	void setEMATimeConstant(const QPreciseDuration &time_constant);
+
+	/**
+	 * Time constant used by #SmoothingTimeEMA.
+	 * @return Time constant.
+	 */
+	QPreciseDuration emaTimeConstant() const { return this->ema_time_constant; }
+
+	void setOneEuroParameters(qreal min_cutoff, qreal beta, qreal derivative_cutoff = 1.0);
+	qreal oneEuroMinCutoff() const;
+	qreal oneEuroBeta() const;
+
+	void setKalmanProcessNoise(qreal process_noise);
+	qreal kalmanProcessNoise() const;
 
 	QWiimote::DataTypes dataTypes() const;
 	QWiimote::WiimoteLeds leds() const;
@@ -147,8 +255,33 @@ public:
 	void setOrientationMode(QWiimote::OrientationMode new_mode);
 	QWiimote::OrientationMode getOrientationMode() const;
 
+	void setFusionGains(qreal proportional, qreal integral);
+
+	/** Get the proportional gain of #OrientationModeFusion. */
+	qreal fusionProportionalGain() const { return this->fusion_proportional_gain; }
+	/** Get the integral gain of #OrientationModeFusion. */
+	qreal fusionIntegralGain() const { return this->fusion_integral_gain; }
+
 	QMatrix4x4 orientation() const;
 
+	void setHistoryLength(int states);
+
+	/**
+	 * Maximum number of states kept in the history.
+	 * @return Length of the history.
+	 */
+	int historyLength() const { return this->state_history.capacity(); }
+
+	/**
+	 * Recent states of the wiimote, indexed by device time. See #QWiimoteHistory.
+	 * @return History of states.
+	 */
+	const QWiimoteHistory &history() const { return this->state_history; }
+
+	QWiimoteState stateAt(const QPreciseTime &time) const;
+	void setResampleRate(int rate);
+	int resampleRate() const;
+
 	/** Get euler angle for pitch. See #OrientationMode. */
 	qreal orientationPitch() const { return this->pitch_orientation; }
 	/** Get euler angle for roll. See #OrientationMode. */
@@ -173,6 +306,9 @@ public:
 	bool batteryEmpty() const;
 	bool isStill() const;
 
+	QWiimoteExtension::Type extensionType() const;
+	QWiimoteExtensionState extensionState() const;
+
 public slots:
 	void resetOrientation();
 
@@ -191,61 +327,162 @@ signals:
 	void motionPlusTimeout();
 	/** Emitted when the orientation values change. */
 	void updatedOrientation();
+	/** Emitted when the wiimote stops sending reports, or the transport reports an error. */
+	void connectionLost();
+	/** Emitted when the connection has been restored after being lost. */
+	void reconnected();
+	/** Emitted for each state resampled at the rate given by #setResampleRate. */
+	void resampledState(const QWiimoteState &state);
+	/** Emitted when a read started with #readMemory finishes. The error is a #MemoryError code. */
+	void memoryRead(int request_id, quint8 error, const QByteArray &data);
+	/** Emitted when a write started with #writeMemory finishes. The error is a #MemoryError code. */
+	void memoryWritten(int request_id, quint8 error);
+	/** Emitted when an extension is identified, plugged or unplugged. Requires #ExtensionData. */
+	void extensionChanged(QWiimoteExtension::Type type);
+	/** Emitted when the state of the Nunchuk or Classic Controller changes. */
+	void updatedExtension();
 private:
-	bool requestCalibrationData();
+	/** Requests sent by start() whose replies are still expected. */
+	enum StartupRequest {
+		StartupCalibration = 0x01, ///< Calibration data read by requestCalibrationData().
+		StartupStatus      = 0x02  ///< Status report requested by pollStatusReport().
+	};
+
+	/** Memory reads and writes made by this QWiimote itself. Their results are used instead of being emitted. */
+	enum InternalRequest {
+		CalibrationRead,          ///< Read by requestCalibrationData().
+		ExtensionRead,            ///< Read by identifyExtension().
+		MotionPlusIdentifierRead, ///< Read by requestMotionPlusIdentifier().
+		InternalWrite             ///< Write whose result is not needed.
+	};
+
+	void initialize();
+	bool sendReport(const char * data, int size);
+	void requestCalibrationData();
+	void readInternalMemory(QWiimote::InternalRequest request, quint32 address, quint16 size, QWiimote::MemorySpace space);
+	void writeInternalMemory(quint32 address, const QByteArray &data, QWiimote::MemorySpace space);
+	void sendMemoryReports();
+	void finishMemoryRequest(const QWiimoteMemoryResult &result);
+	void abortMemoryRequests();
 	void resetAccelerationData();
 	void enableMotionPlus();
 	void disableMotionPlus();
+	void identifyExtension();
+	void setExtensionType(QWiimoteExtension::Type type);
 	void processOrientationData();
-	void PrepareOrientationMatrix();
+	void integrateOrientation(const QVector3D &rate, qreal elapsed);
+	void fuseOrientation(const QVector3D &rate, qreal elapsed);
+	void recordState(const QPreciseTime &time);
+	void updateSmoothedAcceleration(const QVector3D &smoothed);
 	void GetAnglesFromAccelerometer(qreal &final_pitch, qreal &final_roll);
 
 	static const quint8  SMOOTHING_NONE_THRESHOLD; ///< Raw acceleration threshold for non-smoothed data.
 	static const qreal   SMOOTHING_EMA_THRESHOLD;  ///< Calibrated acceleration threshold for EMA.
-	static const quint16 MOTIONPLUS_TIME;          ///< Time required to calibrate the MotionPlus.
+	static const int     REPORT_BATCH_SIZE;        ///< Maximum number of reports processed per batch with threaded I/O.
+	static const int     ACCELERATION_SAMPLES;     ///< Default number of acceleration samples used for smoothing.
+	static const int     CONTINUOUS_INTERVAL;      ///< Milliseconds between reports with continuous reporting.
+	static const int     STATUS_POLLING_INTERVAL;  ///< Milliseconds between status report requests.
+	static const int     STALL_PERIODS;            ///< Missed report intervals before the wiimote is considered stalled.
+	static const int     FIRST_REPORT_GRACE;       ///< Extra milliseconds given to the first report after a reporting mode change.
+	static const int     STARTUP_RETRY_INTERVAL;   ///< Milliseconds before unanswered start-up requests are sent again.
+	static const int     RECONNECT_MIN_DELAY;      ///< Milliseconds before the first reconnection attempt.
+	static const int     RECONNECT_MAX_DELAY;      ///< Maximum milliseconds between reconnection attempts.
+	static const int     CALIBRATION_STORE_DELAY;  ///< Milliseconds between a new calibration and its storage.
 	static const qreal   DEGREES_PER_SECOND_SLOW;  ///< MotionPlus speed (slow).
 	static const qreal   DEGREES_PER_SECOND_FAST;  ///< MotionPlus speed (fast).
 
-	QIOWiimote *io_wiimote;                 ///< Instance of QIOWiimote used to send / receive wiimote data.
-	char send_buffer[22];                   ///< Buffer used to send reports to the wiimote.
+	QWiimoteTransport *io_wiimote;          ///< Transport used to send / receive wiimote data.
+
+	bool threaded_io;                       ///< True if the transport must run in its own thread.
+	int report_ring_capacity;               ///< Capacity of report_ring.
+	QThread *io_thread;                     ///< Thread of the transport when threaded I/O is used.
+	QWiimoteReportRing *report_ring;        ///< Reports waiting to be processed when threaded I/O is used.
+	QAtomicInt drain_scheduled;             ///< 1 if drainReports() has been scheduled and has not started yet.
+	bool calibration_received;              ///< False while input data is ignored until calibration data arrives.
+	bool calibration_cache_enabled;         ///< True if calibrations are stored and reused.
+	bool calibration_cached;                ///< True if the accelerometer calibration in use was loaded from the cache.
+	QWiimoteCalibration *cached_calibration; ///< Calibration loaded from the cache by start(), and updated with the calibrations to store.
+	QTimer calibration_store_timer;         ///< Defers storing new calibrations, so the cache is not written from the report path.
+	QString device_identity;                ///< Identity of the opened wiimote, used as the calibration cache key.
+	quint8 startup_pending;                 ///< Start-up requests still waiting for a reply, as #StartupRequest flags.
+	QPreciseTime startup_sent;              ///< Time when the pending start-up requests were last sent.
+	QWiimoteMemoryRequests *memory_requests; ///< Memory reads and writes waiting for the wiimote to answer.
+	QHash<int, QWiimote::InternalRequest> internal_requests; ///< Identifiers of the requests of this QWiimote itself still in flight.
+
+	bool continuous_reporting;              ///< True if the wiimote was asked to send reports continuously.
+	int reporting_mode;                     ///< Last reporting mode sent, as continuous flag << 8 | report type. -1 if unknown.
+	QPreciseTime last_arrival;              ///< Time of arrival of the last report of any type.
+	QPreciseTime reporting_mode_changed;    ///< Time when the last reporting mode change was sent.
+	QTimer watchdog;                        ///< Periodically checks that reports keep arriving.
+	bool auto_reconnect;                    ///< True if the connection must be restored after a stall.
+	bool stalled;                           ///< True while the connection is lost.
+	QTimer reconnect_timer;                 ///< Schedules the next reconnection attempt.
+	int reconnect_delay;                    ///< Milliseconds before the next reconnection attempt.
+	QFuture<void> reconnect_future;         ///< Reconnection attempt run by a worker thread when there is no I/O thread.
 
 	QWiimote::DataTypes data_types;         ///< Current data type status.
 	QWiimote::WiimoteButtons button_data;   ///< Button status.
-	QWiimote::WiimoteLeds led_data;         ///< Led status.
+	QAtomicInt led_data;                    ///< Led status, as #QWiimote::WiimoteLeds flags. Written from any thread.
 
-	QPreciseTime *last_report;              ///< Time when the last report was received.
+	QWiimoteReportClock *report_clock;      ///< Reconstructs the device time of continuous reports.
+	QPreciseTime last_report;               ///< Device time of the last MotionPlus report.
 
 	/* Raw acceleration values. */
 	QVector3D raw_acceleration;             ///< Raw acceleration vector.
+	quint16 interleaved_acceleration[3];    ///< Raw acceleration being decoded, which is split between 0x3e and 0x3f reports.
+	QVector3D report_acceleration;          ///< Calibrated acceleration of the last report which had one, before smoothing.
 	/* Acceleration calibration values. */
 	QVector3D zero_acceleration;            ///< Zero position for the accelerometer.
 	QVector3D gravity;                      ///< Gravity calibration for the accelerometer.
 	/* Acceleration samples. */
-	QAccelerationSampleList sample_list;    ///< List of acceleration samples.
+	QWiimoteSampleRing *sample_ring;        ///< Most recent acceleration samples, newest first.
 	QWiimote::AccelerationSmoothing
 					acceleration_smoothing; ///< Method used for smoothing the acceleration value.
-	quint8 max_acceleration_samples;        ///< Maximum number of acceleration samples to store.
 	/* Current acceleration values. */
 	QVector3D calibrated_acceleration;      ///< Acceleration vector.
+	/* Exponential Moving Average state. */
+	qreal ema_alpha;                        ///< Weight of each new sample with #SmoothingEMA.
+	QPreciseDuration ema_time_constant;     ///< Time constant of #SmoothingTimeEMA.
+	bool ema_valid;                         ///< False until the first sample has been averaged.
+	QVector3D ema_acceleration;             ///< Current average.
+	QPreciseTime ema_time;                  ///< Device time of the last averaged sample.
+	QOneEuroFilter *one_euro_filter;        ///< Filter used by #SmoothingOneEuro.
+	QKalmanFilter *kalman_filter;           ///< Filter used by #SmoothingKalman.
 
 	QTimer motionplus_polling;              ///< Timer that checks the MotionPlus state.
 	QWiimote::MotionPlusStates
 					motionplus_state;       ///< Current state of the MotionPlus.
 	quint8 max_polling;                     ///< Number of polling attempts before giving up.
 	quint8 current_polling;                 ///< Current number of polling attempts.
+	bool motionplus_passthrough;            ///< True if the MotionPlus interleaves its frames with extension frames.
+	int motionplus_extension;               ///< Extension bit of the last MotionPlus frame, or -1 if unknown.
+
+	QWiimoteExtension::Type extension_type; ///< Extension identified at the extension port.
+	bool extension_connected;               ///< True if the last status report showed an extension.
+	QWiimoteExtensionState extension_state; ///< Last decoded Nunchuk or Classic Controller state.
 
 	OrientationMode orientation_mode;       ///< Orientation mode being used.
 
-	QMatrix4x4 *orientation_matrix;         ///< Orientation matrix of the Wiimote.
+	QWiimoteHistory state_history;          ///< Recent orientation and acceleration states.
+	QPreciseDuration resample_period;       ///< Time between resampled states. Zero if resampling is disabled.
+	QPreciseTime next_resample;             ///< Time of the next resampled state.
+
+	QQuaternion orientation_quaternion;     ///< Orientation of the Wiimote integrated from MotionPlus data.
+	QVector3D orientation_rate;             ///< Angular rate of the previous MotionPlus report, in radians per second.
+	bool orientation_rate_valid;            ///< False if there is no previous angular rate to integrate from.
+	mutable QMatrix4x4 orientation_matrix;  ///< Orientation matrix built from orientation_quaternion when needed.
+	mutable bool orientation_matrix_valid;  ///< False if orientation_matrix must be built again.
+	qreal fusion_proportional_gain;         ///< Proportional gain of #OrientationModeFusion.
+	qreal fusion_integral_gain;             ///< Integral gain of #OrientationModeFusion.
+	QVector3D fusion_integral;              ///< Integrated error of #OrientationModeFusion, in radians per second.
 
 	qreal   pitch_orientation;              ///< Pitch angle of the Wiimote.
 	qreal   roll_orientation;               ///< Roll angle of the Wiimote.
 	qreal   yaw_orientation;                ///< Yaw angle of the Wiimote.
-	QTime   motionplus_calibration_time;    ///< Used to calibrate orientation for a certain amount of time.
-	quint16 motionplus_calibration_samples; ///< Number of samples taken for calibrating the orientation.
-	qint32  pitch_zero_orientation;         ///< Zero angle for pitch.
-	qint32  roll_zero_orientation;          ///< Zero angle for roll.
-	qint32  yaw_zero_orientation;           ///< Zero angle for yaw.
+	QGyroCalibrator *gyro_calibrator;       ///< Estimates the zero angles while the Wiimote is still.
+	qreal   pitch_zero_orientation;         ///< Zero angle for pitch.
+	qreal   roll_zero_orientation;          ///< Zero angle for roll.
+	qreal   yaw_zero_orientation;           ///< Zero angle for yaw.
 	qreal   pitch_speed;                    ///< Pitch speed (in degrees per second).
 	qreal   roll_speed;                     ///< Roll speed (in degrees per second).
 	qreal   yaw_speed;                      ///< Yaw speed (in degrees per second).
@@ -258,11 +495,28 @@ private:
 	quint8 battery_level;                   ///< Battery level of the wiimote.
 	bool battery_empty;                     ///< True if the battery is almost empty.
 
+	void applyCalibrationData(const QByteArray &data);
+	void startStatusPolling();
+	void requestMotionPlusIdentifier();
+	void resendStartupRequests();
+	void getReport(const QWiimoteReportHandle &report);
+	void getInputData(const char * report, const QWiimoteReportLayout &layout, const QPreciseTime &device_time);
+	void getMotionPlusData(const char * extension, const QPreciseTime &device_time);
+	void advanceMotionPlusTime(const QPreciseTime &device_time);
+	void getExtensionData(const char * extension, bool passthrough);
+	void getAccelerationData(const quint16 acceleration[3], const QPreciseTime &device_time);
+
 private slots:
-	void getCalibrationReport(QWiimoteReport *report);
-	void getReport(QWiimoteReport *report);
+	void processReport(const QWiimoteReportHandle &report);
+	void enqueueReport(const QWiimoteReportHandle &report);
+	void drainReports();
 	void pollMotionPlus();
 	void pollStatusReport();
+	void checkStall();
+	void handleStall();
+	void attemptReconnect();
+	void finishReconnect(bool success);
+	void storeCalibration();
 };
 
 Q_DECLARE_OPERATORS_FOR_FLAGS(QWiimote::DataTypes)
@@ -273,4 +527,6 @@ Q_DECLARE_OPERATORS_FOR_FLAGS(QWiimote::WiimoteLeds)
 
 Q_DECLARE_OPERATORS_FOR_FLAGS(QWiimote::MotionPlusStates)
 
+Q_DECLARE_METATYPE(QWiimote::DataTypes)
+
 #endif // QWIIMOTE_H
@@ -22,24 +22,63 @@ CONFIG += debug_and_release
 CONFIG += build_all
 TARGET = $$qtLibraryTarget(QWiimote)
 
-INCLUDEPATH += C:/WinDDK/inc
-
 SOURCES += \
     qwiimote.cpp \
+    qwiimotecalibrationcache.cpp \
+    qgyrocalibrator.cpp \
     qiowiimote.cpp \
-    qprecisetime.cpp
+    qkalmanfilter.cpp \
+    qwiimotecommandqueue.cpp \
+    qwiimotediscovery.cpp \
+    qwiimotememoryrequests.cpp \
+    qloopbackwiimote.cpp \
+    qoneeurofilter.cpp \
+    qprecisetime.cpp \
+    qwiimotehistory.cpp \
+    qwiimotereport.cpp \
+    qwiimotereportclock.cpp \
+    qwiimotereportlayout.cpp \
+    qwiimoteextension.cpp \
+    qwiimotereportring.cpp \
+    qwiimotesamplering.cpp \
+    qwiimotetransport.cpp
+
+win32 {
+    INCLUDEPATH += C:/WinDDK/inc
+    SOURCES += qiowiimote_win.cpp qwiimotediscovery_win.cpp
+    LIBS += C:/WinDDK/lib/wxp/i386/setupapi.lib
+    LIBS += C:/WinDDK/lib/wxp/i386/hid.lib
+}
+
+linux-* {
+    SOURCES += qiowiimote_linux.cpp qwiimotediscovery_linux.cpp qevdevwiimote.cpp
+    HEADERS += qevdevwiimote.h
+}
 
 HEADERS += \
     qwiimote.h \
+    qwiimotecalibrationcache.h \
     debugcheck.h \
+    qgyrocalibrator.h \
     qiowiimote.h \
+    qkalmanfilter.h \
+    qwiimotecommandqueue.h \
+    qwiimotediscovery.h \
+    qwiimotememoryrequests.h \
+    qloopbackwiimote.h \
+    qwiimotehistory.h \
     qwiimotereport.h \
+    qwiimotereportclock.h \
+    qwiimotereportlayout.h \
+    qwiimoteextension.h \
+    qwiimotereportring.h \
+    qwiimotesamplering.h \
+    qwiimotetransport.h \
+    qoneeurofilter.h \
     qprecisetime.h
 
-LIBS += C:/WinDDK/lib/wxp/i386/setupapi.lib
-LIBS += C:/WinDDK/lib/wxp/i386/hid.lib
-
-headers.files = qwiimote.h
+headers.files = qwiimote.h qwiimotehistory.h qwiimoteextension.h qwiimotediscovery.h qwiimotetransport.h qwiimotereport.h qprecisetime.h qloopbackwiimote.h
+linux-*: headers.files += qevdevwiimote.h
 headers.path = $$[QT_INSTALL_HEADERS]/qwiimote
 INSTALLS += headers
 
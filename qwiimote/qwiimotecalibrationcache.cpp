@@ -0,0 +1,119 @@
+/*
+ * This file is part of QWiimote.
+ *
+ * QWiimote is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QWiimote is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QWiimote. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file qwiimotecalibrationcache.cpp
+ *
+ * Source file for the QWiimoteCalibrationCache class.
+ */
+
+#include <QSettings>
+#include "qwiimotecalibrationcache.h"
+
+/**
+ * Creates an empty calibration.
+ */
+QWiimoteCalibration::QWiimoteCalibration()
+{
+	this->has_acceleration = false;
+	this->has_gyro = false;
+	for (int axis = 0; axis < 3; axis++) this->gyro_zeros[axis] = 0;
+}
+
+/* Public functions */
+
+/**
+ * Loads the stored calibration of a wiimote.
+ * MotionPlus zeros older than #GYRO_MAX_AGE are not loaded.
+ * @param identity Identity of the wiimote, as given by QWiimoteTransport::deviceIdentity().
+ * @param calibration Calibration to fill. Parts which are not stored are left unchanged.
+ * @return True if any calibration was found.
+ */
+bool QWiimoteCalibrationCache::load(const QString &identity, QWiimoteCalibration &calibration)
+{
+	if (identity.isEmpty()) return false;
+
+	QSettings settings(QSettings::IniFormat, QSettings::UserScope, "QWiimote", "calibration");
+	settings.beginGroup(QWiimoteCalibrationCache::group(identity));
+
+	if (settings.contains("acceleration/zero_x")) {
+		calibration.zero_acceleration = QVector3D(settings.value("acceleration/zero_x").toDouble(),
+												  settings.value("acceleration/zero_y").toDouble(),
+												  settings.value("acceleration/zero_z").toDouble());
+		calibration.gravity = QVector3D(settings.value("acceleration/gravity_x").toDouble(),
+										settings.value("acceleration/gravity_y").toDouble(),
+										settings.value("acceleration/gravity_z").toDouble());
+		calibration.has_acceleration = true;
+	}
+
+	QDateTime gyro_time = settings.value("motionplus/time").toDateTime();
+	if (gyro_time.isValid() && gyro_time.secsTo(QDateTime::currentDateTimeUtc()) < GYRO_MAX_AGE) {
+		calibration.gyro_zeros[0] = settings.value("motionplus/zero_pitch").toDouble();
+		calibration.gyro_zeros[1] = settings.value("motionplus/zero_roll").toDouble();
+		calibration.gyro_zeros[2] = settings.value("motionplus/zero_yaw").toDouble();
+		calibration.gyro_time = gyro_time;
+		calibration.has_gyro = true;
+	}
+
+	settings.endGroup();
+	return calibration.has_acceleration || calibration.has_gyro;
+}
+
+/**
+ * Stores the calibration of a wiimote. Only the known parts of the calibration are written.
+ * @param identity Identity of the wiimote, as given by QWiimoteTransport::deviceIdentity().
+ * @param calibration Calibration to store.
+ */
+void QWiimoteCalibrationCache::store(const QString &identity, const QWiimoteCalibration &calibration)
+{
+	if (identity.isEmpty()) return;
+
+	QSettings settings(QSettings::IniFormat, QSettings::UserScope, "QWiimote", "calibration");
+	settings.beginGroup(QWiimoteCalibrationCache::group(identity));
+
+	if (calibration.has_acceleration) {
+		settings.setValue("acceleration/zero_x", calibration.zero_acceleration.x());
+		settings.setValue("acceleration/zero_y", calibration.zero_acceleration.y());
+		settings.setValue("acceleration/zero_z", calibration.zero_acceleration.z());
+		settings.setValue("acceleration/gravity_x", calibration.gravity.x());
+		settings.setValue("acceleration/gravity_y", calibration.gravity.y());
+		settings.setValue("acceleration/gravity_z", calibration.gravity.z());
+	}
+
+	if (calibration.has_gyro) {
+		settings.setValue("motionplus/zero_pitch", calibration.gyro_zeros[0]);
+		settings.setValue("motionplus/zero_roll", calibration.gyro_zeros[1]);
+		settings.setValue("motionplus/zero_yaw", calibration.gyro_zeros[2]);
+		settings.setValue("motionplus/time", calibration.gyro_time);
+	}
+
+	settings.endGroup();
+}
+
+/* Private functions */
+
+/**
+ * Converts a device identity to a group name. Separators used by QSettings are replaced.
+ * @param identity Identity of the wiimote.
+ * @return Group holding the calibration of the wiimote.
+ */
+QString QWiimoteCalibrationCache::group(const QString &identity)
+{
+	QString group = identity;
+	group.replace("/", "_").replace("\\", "_").replace(":", "-");
+	return group;
+}
@@ -0,0 +1,68 @@
+/*
+ * This file is part of QWiimote.
+ *
+ * QWiimote is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QWiimote is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QWiimote. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file qwiimotecalibrationcache.h
+ *
+ * Header file for the QWiimoteCalibrationCache class.
+ *
+ * QWiimoteCalibrationCache stores the calibration of each wiimote on disk, so it does not have to be
+ * read or measured again every time the wiimote is started.
+ */
+
+#ifndef QWIIMOTECALIBRATIONCACHE_H
+#define QWIIMOTECALIBRATIONCACHE_H
+
+#include <QDateTime>
+#include <QString>
+#include <QVector3D>
+
+/**
+ * Calibration of a single wiimote.
+ */
+struct QWiimoteCalibration {
+	QWiimoteCalibration();
+
+	bool has_acceleration;        ///< True if zero_acceleration and gravity are known.
+	QVector3D zero_acceleration;  ///< Zero position for the accelerometer.
+	QVector3D gravity;            ///< Gravity calibration for the accelerometer.
+
+	bool has_gyro;                ///< True if gyro_zeros are known.
+	qreal gyro_zeros[3];          ///< Raw MotionPlus pitch, roll and yaw values when not rotating.
+	QDateTime gyro_time;          ///< Time when gyro_zeros were measured, in UTC.
+};
+
+/**
+ * On-disk store of wiimote calibrations, keyed by device identity.
+ * The accelerometer calibration is read from the wiimote EEPROM, so it is only cached to avoid waiting
+ * for the memory read. The MotionPlus zeros are measured, and drift with temperature. The wiimote has no
+ * temperature sensor, so only the time of the measurement is stored, and stale zeros are not used.
+ * The store is an INI file in the user scope, with one group per wiimote.
+ */
+class QWiimoteCalibrationCache
+{
+public:
+	static const int GYRO_MAX_AGE = 86400; ///< Age in seconds after which stored MotionPlus zeros are ignored.
+
+	static bool load(const QString &identity, QWiimoteCalibration &calibration);
+	static void store(const QString &identity, const QWiimoteCalibration &calibration);
+
+private:
+	static QString group(const QString &identity);
+};
+
+#endif // QWIIMOTECALIBRATIONCACHE_H
@@ -0,0 +1,106 @@
+/*
+ * This file is part of QWiimote.
+ *
+ * QWiimote is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QWiimote is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QWiimote. If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file qwiimotecommandqueue.cpp
+ *
+ * Source file for the QWiimoteCommandQueue class.
+ */
+
+#include "qwiimotecommandqueue.h"
+
+/**
+ * Creates a new empty queue.
+ * @param capacity Requested capacity. It is rounded up to a power of two.
+ */
+QWiimoteCommandQueue::QWiimoteCommandQueue(int capacity) : enqueue_position(0), dequeue_position(0)
+{
+	int size = 1;
+	while (size < capacity) size <<= 1;
+
+	this->mask = size - 1;
+	this->cells = new Cell[size];
+	for (int i = 0; i < size; i++) {
+		this->cells[i].sequence = i;
+		this->cells[i].id = 0;
+	}
+}
+
+/**
+ * Releases every command still stored in the queue.
+ */
+QWiimoteCommandQueue::~QWiimoteCommandQueue()
+{
+	delete[] this->cells;
+}
+
+/**
+ * Adds a command at the end of the queue. Can be called from any thread.
+ * @param command Encoded output report.
+ * @param id Identifier of the command, returned by pop().
+ * @return false if the queue was full and the command was not added.
+ */
+bool QWiimoteCommandQueue::push(const QWiimoteReportHandle &command, quint32 id)
+{
+	Cell * cell;
+	int position = this->enqueue_position;
+
+	forever {
+		cell = &this->cells[position & this->mask];
+		/* Positions wrap around, so differences are computed without sign. */
+		int difference = (int)((uint)cell->sequence.fetchAndAddAcquire(0) - (uint)position);
+
+		if (difference == 0) {
+			/* The cell is free. Claim its position. */
+			if (this->enqueue_position.testAndSetRelaxed(position, (int)((uint)position + 1))) break;
+			position = this->enqueue_position;
+		} else if (difference < 0) {
+			/* The cell still holds a command from the previous lap, so the queue is full. */
+			return false;
+		} else {
+			/* Another producer claimed this position first. */
+			position = this->enqueue_position;
+		}
+	}
+
+	cell->command = command;
+	cell->id = id;
+	/* Publish the command to the consumer. */
+	cell->sequence.fetchAndStoreRelease((int)((uint)position + 1));
+	return true;
+}
+
+/**
+ * Takes the first command of the queue. Must only be called by the consumer thread.
+ * @param command Set to the first command.
+ * @param id Set to the identifier of the first command.
+ * @return false if the queue was empty, or if the first command is still being pushed.
+ */
+bool QWiimoteCommandQueue::pop(QWiimoteReportHandle &command, quint32 &id)
+{
+	Cell * cell = &this->cells[this->dequeue_position & this->mask];
+	int difference = (int)((uint)cell->sequence.fetchAndAddAcquire(0) - ((uint)this->dequeue_position + 1));
+	if (difference < 0) return false;
+
+	command = cell->command;
+	id = cell->id;
+	cell->command.reset();
+
+	/* Give the cell back to the producers for the next lap. */
+	cell->sequence.fetchAndStoreRelease((int)((uint)this->dequeue_position + this->mask + 1));
+	this->dequeue_position = (int)((uint)this->dequeue_position + 1);
+	return true;
+}
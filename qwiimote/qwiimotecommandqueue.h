@@ -0,0 +1,67 @@
+/*
+ * This file is part of QWiimote.
+ *
+ * QWiimote is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QWiimote is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QWiimote. If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file qwiimotecommandqueue.h
+ *
+ * Header file for the QWiimoteCommandQueue class.
+ *
+ * QWiimoteCommandQueue moves output reports from any thread to the thread of a transport.
+ */
+
+#ifndef QWIIMOTECOMMANDQUEUE_H
+#define QWIIMOTECOMMANDQUEUE_H
+
+#include <QAtomicInt>
+#include "qwiimotereport.h"
+
+/**
+ * Bounded lock-free queue of output reports with many producers and a single consumer.
+ * Any thread may call push(). Only one thread may call pop().
+ * Each command is encoded into its own #QWiimoteReport slot before being pushed, so producers
+ * never share a buffer, and commands are popped in the order in which their push() completed.
+ */
+class QWiimoteCommandQueue {
+public:
+	QWiimoteCommandQueue(int capacity = 32);
+	~QWiimoteCommandQueue();
+
+	bool push(const QWiimoteReportHandle &command, quint32 id);
+	bool pop(QWiimoteReportHandle &command, quint32 &id);
+
+	/**
+	 * Number of commands the queue can hold.
+	 * @return Capacity of the queue.
+	 */
+	int capacity() const { return this->mask + 1; }
+
+private:
+	/**
+	 * Position of the queue. Its sequence tells whether it is ready to be written or read.
+	 */
+	struct Cell {
+		QAtomicInt sequence;          ///< Enqueue position this cell waits for, or that position plus one once it is filled.
+		QWiimoteReportHandle command; ///< Encoded output report.
+		quint32 id;                   ///< Identifier of the command.
+	};
+
+	Cell * cells;                     ///< Storage of the queue.
+	int mask;                         ///< Capacity minus one. The capacity is a power of two.
+	QAtomicInt enqueue_position;      ///< Next position to push. Claimed by producers with compare and swap.
+	int dequeue_position;             ///< Next position to pop. Only used by the consumer.
+};
+
+#endif // QWIIMOTECOMMANDQUEUE_H
@@ -0,0 +1,123 @@
+/*
+ * This file is part of QWiimote.
+ *
+ * QWiimote is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QWiimote is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QWiimote. If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file qwiimotediscovery.cpp
+ *
+ * Source file for the QWiimoteDiscovery class. Platform specific parts are at
+ * qwiimotediscovery_linux.cpp and qwiimotediscovery_win.cpp.
+ */
+
+#include <QMutex>
+#include <QMutexLocker>
+#include <QFileSystemWatcher>
+#include "qwiimotediscovery.h"
+
+/**
+ * Device paths found by every QWiimoteDiscovery instance.
+ */
+struct QWiimoteDeviceCache {
+	QMutex mutex;      ///< The cache can be used from any thread.
+	QStringList paths; ///< Known device paths.
+};
+
+Q_GLOBAL_STATIC(QWiimoteDeviceCache, device_cache)
+
+/**
+ * Creates a new QWiimoteDiscovery object. No scan is done until rescan() is called.
+ * @param parent The parent of this instance.
+ */
+QWiimoteDiscovery::QWiimoteDiscovery(QObject * parent) : QObject(parent)
+{
+	this->device_directory = "/dev";
+	this->watcher = NULL;
+}
+
+/**
+ * Changes the directory where device nodes are looked for. Only used under Linux.
+ * Devices found at the previous directory are forgotten.
+ * @param directory New device directory.
+ */
+void QWiimoteDiscovery::setDeviceDirectory(const QString &directory)
+{
+	if (directory == this->device_directory) return;
+
+	bool watching = this->isWatching();
+	this->setWatching(false);
+
+	for (int i = 0; i < this->device_paths.size(); i++) {
+		QWiimoteDiscovery::forgetDevice(this->device_paths[i]);
+		emit this->deviceRemoved(this->device_paths[i]);
+	}
+	this->device_paths.clear();
+	this->device_directory = directory;
+
+	this->setWatching(watching);
+}
+
+/**
+ * Paths of every wiimote found by any QWiimoteDiscovery, most recently found first.
+ * Can be called from any thread.
+ * @return Known device paths.
+ */
+QStringList QWiimoteDiscovery::knownDevices()
+{
+	QWiimoteDeviceCache * cache = device_cache();
+	QMutexLocker locker(&cache->mutex);
+	return cache->paths;
+}
+
+/**
+ * Looks for connected wiimotes. Devices which are already known are not probed again.
+ * deviceAdded and deviceRemoved are emmited for every change since the last scan.
+ */
+void QWiimoteDiscovery::rescan()
+{
+	QStringList found = this->findDevices();
+	QStringList previous = this->device_paths;
+	this->device_paths = found;
+
+	for (int i = 0; i < previous.size(); i++) {
+		if (!found.contains(previous[i])) {
+			QWiimoteDiscovery::forgetDevice(previous[i]);
+			emit this->deviceRemoved(previous[i]);
+		}
+	}
+
+	QWiimoteDeviceCache * cache = device_cache();
+	for (int i = 0; i < found.size(); i++) {
+		if (!previous.contains(found[i])) {
+			cache->mutex.lock();
+			cache->paths.removeAll(found[i]);
+			cache->paths.prepend(found[i]);
+			cache->mutex.unlock();
+			emit this->deviceAdded(found[i]);
+		}
+	}
+}
+
+/* Private functions */
+
+/**
+ * Removes a device path from the process-wide cache.
+ * @param device_path Path to remove.
+ */
+void QWiimoteDiscovery::forgetDevice(const QString &device_path)
+{
+	QWiimoteDeviceCache * cache = device_cache();
+	QMutexLocker locker(&cache->mutex);
+	cache->paths.removeAll(device_path);
+}
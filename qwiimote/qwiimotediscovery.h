@@ -0,0 +1,101 @@
+/*
+ * This file is part of QWiimote.
+ *
+ * QWiimote is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QWiimote is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QWiimote. If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file qwiimotediscovery.h
+ *
+ * Header file for the QWiimoteDiscovery class.
+ *
+ * QWiimoteDiscovery finds the device paths of connected wiimotes.
+ */
+
+#ifndef QWIIMOTEDISCOVERY_H
+#define QWIIMOTEDISCOVERY_H
+
+#include <QObject>
+#include <QStringList>
+
+class QFileSystemWatcher;
+
+/**
+ * Finds connected wiimotes and remembers their device paths.
+ *
+ * A full scan only probes devices which are not already known, so scanning again is cheap.
+ * Every path found by any instance is also stored in a process-wide cache (see knownDevices()),
+ * which #QIOWiimote tries before scanning.
+ *
+ * Under Linux, wiimotes are the hidraw nodes of a device directory (/dev by default).
+ * The directory can be watched, so deviceAdded and deviceRemoved are emmited as soon as
+ * nodes appear or disappear. A directory of fake nodes can be used for testing.
+ * Under Windows, devices are found by enumerating the HID interfaces, and watching is not supported.
+ */
+class QWiimoteDiscovery : public QObject
+{
+	Q_OBJECT
+public:
+	QWiimoteDiscovery(QObject * parent = NULL);
+
+	/**
+	 * Device paths of the wiimotes found by the last scan.
+	 * @return Known device paths.
+	 */
+	QStringList devices() const { return this->device_paths; }
+
+	void setDeviceDirectory(const QString &directory);
+
+	/**
+	 * Directory where device nodes are looked for. Only used under Linux.
+	 * @return Device directory.
+	 */
+	QString deviceDirectory() const { return this->device_directory; }
+
+	bool setWatching(bool watch);
+
+	/**
+	 * Checks if the device directory is being watched.
+	 * @return True iff devices are detected as soon as they appear or disappear.
+	 */
+	bool isWatching() const { return this->watcher != NULL; }
+
+	static QStringList knownDevices();
+	static bool isWiimote(const QString &device_path);
+
+public slots:
+	void rescan();
+
+signals:
+	/**
+	 * This signal is emmited when a new wiimote is found.
+	 * @param device_path Path of the wiimote.
+	 */
+	void deviceAdded(const QString &device_path);
+
+	/**
+	 * This signal is emmited when a known wiimote disappears.
+	 * @param device_path Path of the wiimote.
+	 */
+	void deviceRemoved(const QString &device_path);
+
+private:
+	QString device_directory;       ///< Directory where device nodes are looked for.
+	QStringList device_paths;       ///< Paths of the wiimotes found by the last scan.
+	QFileSystemWatcher * watcher;   ///< Watches device_directory, if enabled.
+
+	QStringList findDevices() const;
+	static void forgetDevice(const QString &device_path);
+};
+
+#endif // QWIIMOTEDISCOVERY_H
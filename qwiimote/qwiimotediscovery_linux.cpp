@@ -0,0 +1,105 @@
+/*
+ * This file is part of QWiimote.
+ *
+ * QWiimote is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QWiimote is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QWiimote. If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+  * @file qwiimotediscovery_linux.cpp
+  *
+  * Linux implementation of the QWiimoteDiscovery class, based on hidraw nodes.
+  */
+
+#include <QDir>
+#include <QFile>
+#include <QFileSystemWatcher>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/hidraw.h>
+#include "qwiimotediscovery.h"
+#include "qiowiimote.h"
+
+/* Public functions */
+
+/**
+ * Starts or stops watching the device directory for nodes which appear or disappear.
+ * A scan is done when watching starts, and whenever the directory changes.
+ * @param watch True to start watching, false to stop.
+ * @return True if the directory is being watched as requested.
+ */
+bool QWiimoteDiscovery::setWatching(bool watch)
+{
+	if (watch == this->isWatching()) return true;
+
+	if (!watch) {
+		delete this->watcher;
+		this->watcher = NULL;
+		return true;
+	}
+
+	this->watcher = new QFileSystemWatcher(this);
+	this->watcher->addPath(this->device_directory);
+	if (this->watcher->directories().isEmpty()) {
+		/* The directory does not exist or can't be watched. */
+		delete this->watcher;
+		this->watcher = NULL;
+		return false;
+	}
+	connect(this->watcher, SIGNAL(directoryChanged(QString)), this, SLOT(rescan()));
+
+	this->rescan();
+	return true;
+}
+
+/**
+ * Checks if a device node belongs to a wiimote.
+ * Nodes which are not hidraw devices are accepted, as #QIOWiimote does, so fake devices can be used for testing.
+ * @param device_path Path of the device node.
+ * @return True if the node can be opened and it is not a different HID device.
+ */
+bool QWiimoteDiscovery::isWiimote(const QString &device_path)
+{
+	int descriptor = ::open(QFile::encodeName(device_path).constData(), O_RDWR | O_NONBLOCK);
+	if (descriptor < 0) return false;
+
+	struct hidraw_devinfo info;
+	bool wiimote = ioctl(descriptor, HIDIOCGRAWINFO, &info) < 0 ||
+			((quint16)info.vendor == QIOWiimote::WIIMOTE_VENDOR_ID && (quint16)info.product == QIOWiimote::WIIMOTE_PRODUCT_ID);
+
+	::close(descriptor);
+	return wiimote;
+}
+
+/* Private functions */
+
+/**
+ * Lists the wiimote nodes of the device directory. Only nodes which are not known are probed.
+ * Nodes which can't be opened yet (for example, before udev sets their permissions) are probed again by the next scan.
+ * @return Device paths of the wiimotes.
+ */
+QStringList QWiimoteDiscovery::findDevices() const
+{
+	QDir device_dir(this->device_directory);
+	QStringList nodes = device_dir.entryList(QStringList("hidraw*"), QDir::System | QDir::Files, QDir::Name);
+
+	QStringList found;
+	for (int i = 0; i < nodes.size(); i++) {
+		QString device_path = device_dir.filePath(nodes[i]);
+		if (this->device_paths.contains(device_path) || QWiimoteDiscovery::isWiimote(device_path)) {
+			found.append(device_path);
+		}
+	}
+
+	return found;
+}
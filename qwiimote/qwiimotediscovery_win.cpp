@@ -0,0 +1,105 @@
+/*
+ * This file is part of QWiimote.
+ *
+ * QWiimote is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QWiimote is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QWiimote. If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+  * @file qwiimotediscovery_win.cpp
+  *
+  * Windows implementation of the QWiimoteDiscovery class, based on the HID interface enumeration.
+  */
+
+#include "qwiimotediscovery.h"
+#include "qiowiimote.h"
+
+/* Public functions */
+
+/**
+ * Watching for devices is not supported under Windows. Call rescan() instead.
+ * @param watch True to start watching, false to stop.
+ * @return True only if watch is false.
+ */
+bool QWiimoteDiscovery::setWatching(bool watch)
+{
+	return !watch;
+}
+
+/**
+ * Checks if a HID device interface belongs to a wiimote.
+ * Only the attributes of the device are queried; no report is sent.
+ * @param device_path Device interface path.
+ * @return True if the vendor and product IDs are those of a wiimote.
+ */
+bool QWiimoteDiscovery::isWiimote(const QString &device_path)
+{
+	/* Attributes can be queried without read or write access. */
+	HANDLE handle = CreateFile((LPCTSTR)device_path.utf16(), 0,
+							   (FILE_SHARE_READ | FILE_SHARE_WRITE),
+							   NULL, OPEN_EXISTING, 0, NULL);
+	if (handle == INVALID_HANDLE_VALUE) return false;
+
+	HIDD_ATTRIBUTES attributes;
+	attributes.Size = sizeof(attributes);
+	bool wiimote = HidD_GetAttributes(handle, &attributes) &&
+			attributes.VendorID == QIOWiimote::WIIMOTE_VENDOR_ID &&
+			attributes.ProductID == QIOWiimote::WIIMOTE_PRODUCT_ID;
+
+	CloseHandle(handle);
+	return wiimote;
+}
+
+/* Private functions */
+
+/**
+ * Lists the HID interfaces which belong to a wiimote. Only interfaces which are not known are probed.
+ * @return Device paths of the wiimotes.
+ */
+QStringList QWiimoteDiscovery::findDevices() const
+{
+	QStringList found;
+
+	/* Get the GUID of the HID class. */
+	GUID guid;
+	HidD_GetHidGuid(&guid);
+
+	/* Get info of the devices which are present. */
+	HDEVINFO device_info = SetupDiGetClassDevs(&guid, NULL, NULL, DIGCF_DEVICEINTERFACE | DIGCF_PRESENT);
+	if (device_info == INVALID_HANDLE_VALUE) return found;
+
+	SP_DEVICE_INTERFACE_DATA device_interface_data;
+	device_interface_data.cbSize = sizeof(device_interface_data);
+
+	for (DWORD index = 0; SetupDiEnumDeviceInterfaces(device_info, NULL, &guid, index, &device_interface_data); index++) {
+		/* Get the required size. */
+		DWORD required_size = 0;
+		SetupDiGetDeviceInterfaceDetail(device_info, &device_interface_data, NULL, 0, &required_size, NULL);
+
+		/* Assign the required number of bytes. */
+		PSP_DEVICE_INTERFACE_DETAIL_DATA device_interface_detail = PSP_DEVICE_INTERFACE_DETAIL_DATA(new quint8[required_size]);
+		device_interface_detail->cbSize = sizeof(SP_DEVICE_INTERFACE_DETAIL_DATA);
+
+		if (SetupDiGetDeviceInterfaceDetail
+				(device_info, &device_interface_data, device_interface_detail, required_size, NULL, NULL)) {
+			QString device_path = QString::fromUtf16((const ushort *)device_interface_detail->DevicePath);
+			if (this->device_paths.contains(device_path) || QWiimoteDiscovery::isWiimote(device_path)) {
+				found.append(device_path);
+			}
+		}
+
+		delete[] (quint8 *)device_interface_detail;
+	}
+
+	SetupDiDestroyDeviceInfoList(device_info);
+	return found;
+}
@@ -0,0 +1,139 @@
+/*
+ * This file is part of QWiimote.
+ *
+ * QWiimote is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QWiimote is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QWiimote. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file qwiimoteextension.cpp
+ *
+ * Source file for the QWiimoteExtension class.
+ */
+
+#include "qwiimoteextension.h"
+
+/* Public functions */
+
+/**
+ * Identifies an extension from the 6 bytes read at 0xA400FA.
+ * @param identifier Bytes read at 0xA400FA.
+ * @return Kind of extension.
+ */
+QWiimoteExtension::Type QWiimoteExtension::identify(const QByteArray &identifier)
+{
+	if (identifier.size() < 6) return QWiimoteExtension::None;
+	if ((identifier[2] & 0xFF) != 0xA4 || (identifier[3] & 0xFF) != 0x20) return QWiimoteExtension::Unknown;
+
+	quint8 id4 = identifier[4] & 0xFF;
+	quint8 id5 = identifier[5] & 0xFF;
+	if (id4 == 0x00 && id5 == 0x00) return QWiimoteExtension::Nunchuk;
+	if (id4 == 0x01 && id5 == 0x01) return QWiimoteExtension::Classic;
+	/* Active MotionPlus: alone (0x04), or in Nunchuk (0x05) or Classic Controller (0x07) passthrough mode. */
+	if ((id4 == 0x04 || id4 == 0x05 || id4 == 0x07) && id5 == 0x05) return QWiimoteExtension::MotionPlus;
+	return QWiimoteExtension::Unknown;
+}
+
+/**
+ * Value to write to 0xA600FE for activating the MotionPlus with an extension plugged into it.
+ * @param type Extension plugged into the MotionPlus.
+ * @return Passthrough mode for a Nunchuk or a Classic Controller, or the mode without passthrough.
+ */
+quint8 QWiimoteExtension::passthroughMode(QWiimoteExtension::Type type)
+{
+	switch (type) {
+		case QWiimoteExtension::Nunchuk: return 0x05;
+		case QWiimoteExtension::Classic: return 0x07;
+		default:                         return 0x04;
+	}
+}
+
+/**
+ * Decodes the data of an extension.
+ * @param type Kind of extension which wrote the data.
+ * @param data The 6 extension bytes of an input report.
+ * @param passthrough True if the data is an extension frame of a MotionPlus passthrough mode.
+ * @param state Decoded state.
+ * @return True if the extension can be decoded.
+ */
+bool QWiimoteExtension::decode(QWiimoteExtension::Type type, const char * data, bool passthrough, QWiimoteExtensionState &state)
+{
+	switch (type) {
+		case QWiimoteExtension::Nunchuk:
+			QWiimoteExtension::decodeNunchuk(data, passthrough, state);
+			return true;
+
+		case QWiimoteExtension::Classic:
+			QWiimoteExtension::decodeClassic(data, passthrough, state);
+			return true;
+
+		default:
+			return false;
+	}
+}
+
+/**
+ * Decodes the data of a Nunchuk. The stick and the acceleration are written, and the right stick and the triggers are cleared.
+ * In passthrough frames the lowest bit of every axis is lost, and z loses its second lowest bit too.
+ * @param data The 6 extension bytes of an input report.
+ * @param passthrough True if the data is an extension frame of a MotionPlus passthrough mode.
+ * @param state Decoded state.
+ */
+void QWiimoteExtension::decodeNunchuk(const char * data, bool passthrough, QWiimoteExtensionState &state)
+{
+	state.left_stick[0] = data[0] & 0xFF;
+	state.left_stick[1] = data[1] & 0xFF;
+	state.right_stick[0] = state.right_stick[1] = 0;
+	state.triggers[0] = state.triggers[1] = 0;
+
+	if (passthrough) {
+		state.acceleration[0] = ((data[2] & 0xFF) << 2) | ((data[5] & 0x10) >> 3);
+		state.acceleration[1] = ((data[3] & 0xFF) << 2) | ((data[5] & 0x20) >> 4);
+		state.acceleration[2] = ((data[4] & 0xFE) << 2) | ((data[5] & 0xC0) >> 5);
+		/* Buttons are active low. */
+		state.buttons = ((data[5] & 0x04) ? 0 : QWiimoteExtensionState::NunchukZ) |
+							 ((data[5] & 0x08) ? 0 : QWiimoteExtensionState::NunchukC);
+	} else {
+		state.acceleration[0] = ((data[2] & 0xFF) << 2) | ((data[5] & 0x0C) >> 2);
+		state.acceleration[1] = ((data[3] & 0xFF) << 2) | ((data[5] & 0x30) >> 4);
+		state.acceleration[2] = ((data[4] & 0xFF) << 2) | ((data[5] & 0xC0) >> 6);
+		state.buttons = ((data[5] & 0x01) ? 0 : QWiimoteExtensionState::NunchukZ) |
+							 ((data[5] & 0x02) ? 0 : QWiimoteExtensionState::NunchukC);
+	}
+}
+
+/**
+ * Decodes the data of a Classic Controller. The sticks, the triggers and the buttons are written, and the acceleration is cleared.
+ * In passthrough frames the lowest bit of the left stick is lost, and the Up and Left buttons are moved.
+ * @param data The 6 extension bytes of an input report.
+ * @param passthrough True if the data is an extension frame of a MotionPlus passthrough mode.
+ * @param state Decoded state.
+ */
+void QWiimoteExtension::decodeClassic(const char * data, bool passthrough, QWiimoteExtensionState &state)
+{
+	state.left_stick[0]  =   data[0] & (passthrough ? 0x3E : 0x3F);
+	state.left_stick[1]  =   data[1] & (passthrough ? 0x3E : 0x3F);
+	state.right_stick[0] = ((data[0] & 0xC0) >> 3) | ((data[1] & 0xC0) >> 5) | ((data[2] & 0x80) >> 7);
+	state.right_stick[1] =   data[2] & 0x1F;
+	state.triggers[0]    = ((data[2] & 0x60) >> 2) | ((data[3] & 0xE0) >> 5);
+	state.triggers[1]    =   data[3] & 0x1F;
+	state.acceleration[0] = state.acceleration[1] = state.acceleration[2] = 0;
+
+	/* Buttons are active low. The lowest bit of byte 4 is not a button. */
+	quint16 released = ((data[4] & 0xFF) << 8) | (data[5] & 0xFF);
+	if (passthrough) {
+		/* The Up and Left buttons are moved to the lowest bits of the stick bytes. */
+		released = (released & 0xFFFC) | (data[0] & 0x01) | ((data[1] & 0x01) << 1);
+	}
+	state.buttons = ~released & 0xFEFF;
+}
@@ -0,0 +1,103 @@
+/*
+ * This file is part of QWiimote.
+ *
+ * QWiimote is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QWiimote is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QWiimote. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file qwiimoteextension.h
+ *
+ * Header file for the QWiimoteExtension class.
+ *
+ * QWiimoteExtension identifies extensions and decodes the data of the Nunchuk and the Classic Controller.
+ */
+
+#ifndef QWIIMOTEEXTENSION_H
+#define QWIIMOTEEXTENSION_H
+
+#include <QByteArray>
+
+/**
+ * Decoded state of a Nunchuk or a Classic Controller. Every value is raw.
+ */
+struct QWiimoteExtensionState
+{
+	/** Flags of the Nunchuk buttons. */
+	enum NunchukButton {
+		NunchukZ = 0x0001, ///< Z button.
+		NunchukC = 0x0002, ///< C button.
+	};
+
+	/** Flags of the Classic Controller buttons. */
+	enum ClassicButton {
+		ClassicUp    = 0x0001, ///< Up button of the D-pad.
+		ClassicLeft  = 0x0002, ///< Left button of the D-pad.
+		ClassicZR    = 0x0004, ///< ZR button.
+		ClassicX     = 0x0008, ///< X button.
+		ClassicA     = 0x0010, ///< A button.
+		ClassicY     = 0x0020, ///< Y button.
+		ClassicB     = 0x0040, ///< B button.
+		ClassicZL    = 0x0080, ///< ZL button.
+		ClassicR     = 0x0200, ///< R button, at the end of the right trigger.
+		ClassicPlus  = 0x0400, ///< Plus button.
+		ClassicHome  = 0x0800, ///< Home button.
+		ClassicMinus = 0x1000, ///< Minus button.
+		ClassicL     = 0x2000, ///< L button, at the end of the left trigger.
+		ClassicDown  = 0x4000, ///< Down button of the D-pad.
+		ClassicRight = 0x8000, ///< Right button of the D-pad.
+	};
+
+	quint16 buttons;         ///< Pressed buttons, as #NunchukButton or #ClassicButton flags.
+	quint8 left_stick[2];    ///< X and Y of the Nunchuk stick (8 bits), or of the left Classic Controller stick (6 bits).
+	quint8 right_stick[2];   ///< X and Y of the right Classic Controller stick (5 bits).
+	quint8 triggers[2];      ///< Left and right analog triggers of the Classic Controller (5 bits).
+	quint16 acceleration[3]; ///< Nunchuk acceleration in x, y and z, with a 10-bit scale.
+};
+
+/**
+ * Identification and decoding of extensions.
+ * Extensions are read unencrypted, after writing 0x55 to 0xA400F0 and 0x00 to 0xA400FB.
+ * Each extension writes 6 bytes in the extension part of the input reports. In the MotionPlus
+ * passthrough modes, the MotionPlus alternates its own frames with frames of the extension plugged
+ * into it. Those extension frames lose a few bits to mark which kind of frame they are.
+ * @see http://wiibrew.org/wiki/Wiimote/Extension_Controllers
+ */
+class QWiimoteExtension
+{
+public:
+	/** Kind of extension. */
+	enum Type {
+		None,       ///< No extension, or it has not been identified.
+		Nunchuk,    ///< Nunchuk.
+		Classic,    ///< Classic Controller or Classic Controller Pro.
+		MotionPlus, ///< Active MotionPlus.
+		Unknown,    ///< Extension which can't be decoded.
+	};
+
+	static Type identify(const QByteArray &identifier);
+	static quint8 passthroughMode(Type type);
+
+	/**
+	 * Checks if 6 extension bytes received in a MotionPlus passthrough mode are a MotionPlus frame.
+	 * @param data Extension bytes.
+	 * @return True for a MotionPlus frame, false for a frame of the extension plugged into the MotionPlus.
+	 */
+	static bool isMotionPlusFrame(const char * data) { return (data[5] & 0x02) != 0; }
+
+	static bool decode(Type type, const char * data, bool passthrough, QWiimoteExtensionState &state);
+	static void decodeNunchuk(const char * data, bool passthrough, QWiimoteExtensionState &state);
+	static void decodeClassic(const char * data, bool passthrough, QWiimoteExtensionState &state);
+};
+
+#endif // QWIIMOTEEXTENSION_H
@@ -0,0 +1,147 @@
+/*
+ * This file is part of QWiimote.
+ *
+ * QWiimote is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QWiimote is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QWiimote. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file qwiimotehistory.cpp
+ *
+ * Source file for the QWiimoteHistory class.
+ */
+
+#include "qwiimotehistory.h"
+
+/**
+ * Creates a new empty history.
+ * @param capacity Maximum number of states stored. Must be at least 1.
+ */
+QWiimoteHistory::QWiimoteHistory(int capacity) : states(qMax(capacity, 1)), first(0), count(0)
+{
+}
+
+/**
+ * Changes the maximum number of states stored. Every stored state is removed.
+ * @param capacity New capacity. Must be at least 1.
+ */
+void QWiimoteHistory::setCapacity(int capacity)
+{
+	this->states.resize(qMax(capacity, 1));
+	this->clear();
+}
+
+/**
+ * Removes every stored state.
+ */
+void QWiimoteHistory::clear()
+{
+	this->first = 0;
+	this->count = 0;
+}
+
+/**
+ * Stores a new state, replacing the oldest one if the history is full.
+ * @param state State to store. It must be newer than every stored state.
+ * @return false if the state was not stored because it was not newer than the newest state.
+ */
+bool QWiimoteHistory::append(const QWiimoteState &state)
+{
+	if (state.time.isNull()) return false;
+	if (this->count > 0 && state.time <= this->at(this->count - 1).time) return false;
+
+	if (this->count < this->states.size()) {
+		this->states[(this->first + this->count) % this->states.size()] = state;
+		this->count++;
+	} else {
+		this->states[this->first] = state;
+		this->first = (this->first + 1) % this->states.size();
+	}
+
+	return true;
+}
+
+/**
+ * Gets the oldest stored state.
+ * @return Oldest state, or a state with a null time if the history is empty.
+ */
+QWiimoteState QWiimoteHistory::oldest() const
+{
+	return (this->count > 0) ? this->at(0) : QWiimoteState();
+}
+
+/**
+ * Gets the newest stored state.
+ * @return Newest state, or a state with a null time if the history is empty.
+ */
+QWiimoteState QWiimoteHistory::newest() const
+{
+	return (this->count > 0) ? this->at(this->count - 1) : QWiimoteState();
+}
+
+/**
+ * Gets the state of the wiimote at a certain time, interpolating between the stored states.
+ * Times older than the oldest state or newer than the newest one get that state.
+ * @param time Device time to query.
+ * @return State at the requested time, or a state with a null time if the history is empty.
+ */
+QWiimoteState QWiimoteHistory::stateAt(const QPreciseTime &time) const
+{
+	if (this->count == 0) return QWiimoteState();
+	if (time <= this->at(0).time) return this->at(0);
+	if (time >= this->at(this->count - 1).time) return this->at(this->count - 1);
+
+	/* Binary search of the first state newer than the requested time. */
+	int low = 1, high = this->count - 1;
+	while (low < high) {
+		int middle = low + (high - low) / 2;
+		if (this->at(middle).time > time) high = middle;
+		else low = middle + 1;
+	}
+
+	const QWiimoteState &before = this->at(low - 1);
+	const QWiimoteState &after  = this->at(low);
+	qreal fraction = (qreal)(time - before.time).nanoseconds() / (after.time - before.time).nanoseconds();
+
+	QWiimoteState state;
+	state.time = time;
+	state.orientation = QQuaternion::slerp(before.orientation, after.orientation, fraction);
+	state.acceleration = before.acceleration + (after.acceleration - before.acceleration) * fraction;
+	return state;
+}
+
+/**
+ * Resamples the stored states at a fixed rate.
+ * @param from Time of the first sample. Older times are moved forward to the oldest stored state, in steps of period.
+ * @param period Time between samples. Must be positive.
+ * @return States at from, from + period, from + 2 * period... up to the newest stored state.
+ */
+QList<QWiimoteState> QWiimoteHistory::resample(const QPreciseTime &from, const QPreciseDuration &period) const
+{
+	QList<QWiimoteState> samples;
+	if (this->count == 0 || period.nanoseconds() <= 0) return samples;
+
+	QPreciseTime time = from;
+	QPreciseTime oldest_time = this->at(0).time;
+	if (time < oldest_time) {
+		qint64 steps = ((oldest_time - time).nanoseconds() + period.nanoseconds() - 1) / period.nanoseconds();
+		time = time + period * steps;
+	}
+
+	QPreciseTime newest_time = this->at(this->count - 1).time;
+	for (; time <= newest_time; time = time + period) {
+		samples.append(this->stateAt(time));
+	}
+
+	return samples;
+}
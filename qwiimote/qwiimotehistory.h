@@ -0,0 +1,92 @@
+/*
+ * This file is part of QWiimote.
+ *
+ * QWiimote is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QWiimote is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QWiimote. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file qwiimotehistory.h
+ *
+ * Header file for the QWiimoteHistory class.
+ *
+ * QWiimoteHistory stores recent wiimote states, so they can be queried at arbitrary times.
+ */
+
+#ifndef QWIIMOTEHISTORY_H
+#define QWIIMOTEHISTORY_H
+
+#include <QMetaType>
+#include <QQuaternion>
+#include <QVector3D>
+#include <QVector>
+#include "qprecisetime.h"
+
+/**
+ * State of the wiimote at a certain time.
+ */
+struct QWiimoteState
+{
+	QPreciseTime time;       ///< Device time of the state. Null if the state is not valid.
+	QQuaternion orientation; ///< Fused orientation. See #QWiimote::orientation.
+	QVector3D acceleration;  ///< Calibrated acceleration. See #QWiimote::acceleration.
+};
+
+Q_DECLARE_METATYPE(QWiimoteState)
+
+/**
+ * Bounded history of wiimote states, ordered by time.
+ * When the history is full, the oldest state is replaced. States between two stored states are
+ * interpolated: orientation with slerp, acceleration linearly. States are never extrapolated.
+ */
+class QWiimoteHistory
+{
+public:
+	QWiimoteHistory(int capacity = 256);
+
+	void setCapacity(int capacity);
+
+	/**
+	 * Maximum number of states stored.
+	 * @return Capacity of the history.
+	 */
+	int capacity() const { return this->states.size(); }
+
+	/**
+	 * Number of states stored.
+	 * @return Size of the history.
+	 */
+	int size() const { return this->count; }
+
+	void clear();
+	bool append(const QWiimoteState &state);
+
+	QWiimoteState oldest() const;
+	QWiimoteState newest() const;
+	QWiimoteState stateAt(const QPreciseTime &time) const;
+	QList<QWiimoteState> resample(const QPreciseTime &from, const QPreciseDuration &period) const;
+
+private:
+	QVector<QWiimoteState> states; ///< Storage of the history.
+	int first;                     ///< Position of the oldest state.
+	int count;                     ///< Number of states stored.
+
+	/**
+	 * Gets a stored state by its age.
+	 * @param index 0 for the oldest state, size() - 1 for the newest one.
+	 * @return Stored state.
+	 */
+	const QWiimoteState &at(int index) const { return this->states[(this->first + index) % this->states.size()]; }
+};
+
+#endif // QWIIMOTEHISTORY_H
@@ -0,0 +1,296 @@
+/*
+ * This file is part of QWiimote.
+ *
+ * QWiimote is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QWiimote is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QWiimote. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file qwiimotememoryrequests.cpp
+ *
+ * Source file for the QWiimoteMemoryRequests class.
+ */
+
+#include "qwiimotememoryrequests.h"
+#include "qwiimote.h"
+
+/**
+ * Creates an empty set of requests.
+ */
+QWiimoteMemoryRequests::QWiimoteMemoryRequests()
+{
+	this->next_id = 1;
+}
+
+/* Public functions */
+
+/**
+ * Starts a memory read. Its 0x17 report is given by nextReport().
+ * @param registers True to read the register space, false to read the EEPROM.
+ * @param address First address to read.
+ * @param size Number of bytes to read.
+ * @return Identifier of the read.
+ */
+int QWiimoteMemoryRequests::read(bool registers, quint32 address, quint16 size)
+{
+	Request request;
+	request.result.id = this->next_id++;
+	request.result.write = false;
+	request.result.registers = registers;
+	request.result.address = address;
+	request.result.error = QWiimote::MemoryNoError;
+	request.size = size;
+	request.sent = 0;
+	request.transferred = 0;
+
+	QByteArray command(7, 0);
+	command[0] = (char)0x17;                      // Report type.
+	command[1] = (char)(registers ? 0x04 : 0x00); // Read from the registers or the EEPROM.
+	command[2] = (char)(address >> 16);           // Memory position.
+	command[3] = (char)(address >> 8);
+	command[4] = (char)address;
+	command[5] = (char)(size >> 8);               // Data size.
+	command[6] = (char)size;
+	request.reports.append(command);
+
+	this->requests.append(request);
+	return request.result.id;
+}
+
+/**
+ * Starts a memory write. Its 0x16 reports are given by nextReport().
+ * @param registers True to write the register space, false to write the EEPROM.
+ * @param address First address to write.
+ * @param data Data to write.
+ * @return Identifier of the write.
+ */
+int QWiimoteMemoryRequests::write(bool registers, quint32 address, const QByteArray &data)
+{
+	Request request;
+	request.result.id = this->next_id++;
+	request.result.write = true;
+	request.result.registers = registers;
+	request.result.address = address;
+	request.result.error = QWiimote::MemoryNoError;
+	request.size = data.size();
+	request.sent = 0;
+	request.transferred = 0;
+
+	int offset = 0;
+	do {
+		int chunk = qMin(data.size() - offset, CHUNK_SIZE);
+		quint32 chunk_address = address + offset;
+
+		QByteArray command(6 + chunk, 0);
+		command[0] = (char)0x16;                      // Report type.
+		command[1] = (char)(registers ? 0x04 : 0x00); // Write to the registers or the EEPROM.
+		command[2] = (char)(chunk_address >> 16);     // Memory position.
+		command[3] = (char)(chunk_address >> 8);
+		command[4] = (char)chunk_address;
+		command[5] = (char)chunk;                     // Data size.
+		command.replace(6, chunk, data.mid(offset, chunk));
+		request.reports.append(command);
+
+		offset += chunk;
+	} while (offset < data.size());
+
+	this->requests.append(request);
+	return request.result.id;
+}
+
+/**
+ * Gets the next report which can be sent. It stays the next one until reportSent() is called.
+ * @param report Filled with the report. The rumble bit is not set.
+ * @return False if every report has been sent, or if the next one must wait for an earlier read to finish.
+ */
+bool QWiimoteMemoryRequests::nextReport(QByteArray &report) const
+{
+	int index = this->nextUnsent();
+	if (index < 0 || this->collides(index)) return false;
+
+	report = this->requests[index].reports.first();
+	return true;
+}
+
+/**
+ * Marks the report given by nextReport() as handled.
+ * If it could not be sent, the rest of its request is not sent either. The request then fails
+ * with #QWiimote::MemorySendFailed once the reports already sent have been answered.
+ * @param success True if the report was sent.
+ * @param result Filled with the request, if it finished.
+ * @return True if the request finished because the report could not be sent.
+ */
+bool QWiimoteMemoryRequests::reportSent(bool success, QWiimoteMemoryResult &result)
+{
+	int index = this->nextUnsent();
+	Q_ASSERT_X(index >= 0, "QWiimoteMemoryRequests::reportSent", "There is no report to send.");
+
+	Request &request = this->requests[index];
+	QByteArray report = request.reports.takeFirst();
+	request.last_activity = QPreciseTime::currentTime();
+
+	if (success) {
+		request.sent += request.result.write ? (report[5] & 0xFF) : request.size;
+		return false;
+	}
+
+	/* Only the reports already sent will be answered. */
+	request.reports.clear();
+	request.result.error = QWiimote::MemorySendFailed;
+	request.size = request.sent;
+	if (request.transferred < request.size) return false;
+
+	result = request.result;
+	this->requests.removeAt(index);
+	return true;
+}
+
+/**
+ * Matches a 0x21 report to the pending read which expects its address and its size.
+ * @param report Received 0x21 report.
+ * @param result Filled with the read, if it finished.
+ * @return True if a read finished, either because all its data arrived or because it failed.
+ */
+bool QWiimoteMemoryRequests::readReply(const char * report, QWiimoteMemoryResult &result)
+{
+	quint16 address = ((report[4] & 0xFF) << 8) | (report[5] & 0xFF);
+	quint8 error = report[3] & 0x0F;
+	int chunk = ((report[3] & 0xF0) >> 4) + 1;
+
+	for (int i = 0; i < this->requests.size(); i++) {
+		Request &request = this->requests[i];
+		if (request.result.write || request.sent == 0) continue;
+		if (((request.result.address + request.transferred) & 0xFFFF) != address) continue;
+		if (error == QWiimote::MemoryNoError && chunk != qMin(request.size - request.transferred, CHUNK_SIZE)) continue;
+
+		request.last_activity = QPreciseTime::currentTime();
+		if (error == QWiimote::MemoryNoError) {
+			request.result.data.append(report + 6, chunk);
+			request.transferred += chunk;
+		} else {
+			/* The wiimote stops answering a read after an error. */
+			request.result.error = error;
+		}
+
+		if (request.transferred < request.size && request.result.error == QWiimote::MemoryNoError) return false;
+
+		result = request.result;
+		this->requests.removeAt(i);
+		return true;
+	}
+
+	return false;
+}
+
+/**
+ * Matches a 0x22 report to the oldest pending write.
+ * Acknowledgements of other output reports are ignored.
+ * @param report Received 0x22 report.
+ * @param result Filled with the write, if it finished.
+ * @return True if a write finished. A failed write only finishes once all its sent reports have been acknowledged.
+ */
+bool QWiimoteMemoryRequests::writeAcknowledged(const char * report, QWiimoteMemoryResult &result)
+{
+	if ((report[3] & 0xFF) != 0x16) return false;
+
+	for (int i = 0; i < this->requests.size(); i++) {
+		Request &request = this->requests[i];
+		if (!request.result.write || request.transferred >= request.sent) continue;
+
+		quint8 error = report[4] & 0xFF;
+		if (request.result.error == QWiimote::MemoryNoError) request.result.error = error;
+		request.transferred += qMin(request.size - request.transferred, CHUNK_SIZE);
+		request.last_activity = QPreciseTime::currentTime();
+
+		if (request.transferred < request.size) return false;
+
+		result = request.result;
+		this->requests.removeAt(i);
+		return true;
+	}
+
+	return false;
+}
+
+/**
+ * Ends the requests whose reports have been sent, but which got no answer for #TIMEOUT milliseconds.
+ * Dropping a write whose acknowledgement was lost keeps the later acknowledgements matched to their writes.
+ * @return The expired requests, with the error #QWiimote::MemoryTimeout.
+ */
+QList<QWiimoteMemoryResult> QWiimoteMemoryRequests::expire()
+{
+	QList<QWiimoteMemoryResult> results;
+	for (int i = 0; i < this->requests.size(); i++) {
+		Request &request = this->requests[i];
+		if (!request.reports.isEmpty() || request.last_activity.elapsed() <= TIMEOUT) continue;
+
+		request.result.error = QWiimote::MemoryTimeout;
+		results.append(request.result);
+		this->requests.removeAt(i--);
+	}
+	return results;
+}
+
+/**
+ * Forgets every pending request, such as when the connection is closed.
+ * @return The pending requests, with the error #QWiimote::MemoryAborted.
+ */
+QList<QWiimoteMemoryResult> QWiimoteMemoryRequests::abort()
+{
+	QList<QWiimoteMemoryResult> results;
+	for (int i = 0; i < this->requests.size(); i++) {
+		results.append(this->requests[i].result);
+		results.last().error = QWiimote::MemoryAborted;
+	}
+
+	this->requests.clear();
+	return results;
+}
+
+/* Private functions */
+
+/**
+ * Finds the oldest request with reports not sent yet. Every later request has not been sent either.
+ * @return Index of the request, or -1 if every report has been sent.
+ */
+int QWiimoteMemoryRequests::nextUnsent() const
+{
+	for (int i = 0; i < this->requests.size(); i++) {
+		if (!this->requests[i].reports.isEmpty()) return i;
+	}
+	return -1;
+}
+
+/**
+ * Checks if the replies of a read could be mistaken for those of an earlier read still in flight,
+ * because both expect replies at the same low 16 bits of address.
+ * @param index Index of the request to check.
+ * @return True if the request is a read which must wait.
+ */
+bool QWiimoteMemoryRequests::collides(int index) const
+{
+	const Request &request = this->requests[index];
+	if (request.result.write) return false;
+
+	quint32 begin = request.result.address & 0xFFFF;
+	quint32 end = begin + request.size;
+	for (int i = 0; i < index; i++) {
+		const Request &other = this->requests[i];
+		if (other.result.write) continue;
+
+		quint32 other_begin = ((other.result.address & 0xFFFF) + other.transferred);
+		quint32 other_end = (other.result.address & 0xFFFF) + other.size;
+		if (begin < other_end && other_begin < end) return true;
+	}
+	return false;
+}
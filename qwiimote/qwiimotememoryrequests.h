@@ -0,0 +1,99 @@
+/*
+ * This file is part of QWiimote.
+ *
+ * QWiimote is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QWiimote is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QWiimote. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file qwiimotememoryrequests.h
+ *
+ * Header file for the QWiimoteMemoryRequests class.
+ *
+ * QWiimoteMemoryRequests builds memory read and write reports and matches the replies of the wiimote to them.
+ */
+
+#ifndef QWIIMOTEMEMORYREQUESTS_H
+#define QWIIMOTEMEMORYREQUESTS_H
+
+#include <QByteArray>
+#include <QList>
+#include "qprecisetime.h"
+
+/**
+ * Finished memory read or write.
+ */
+struct QWiimoteMemoryResult {
+	int id;             ///< Identifier returned when the request was made.
+	bool write;         ///< True for a write, false for a read.
+	bool registers;     ///< True for the register space, false for the EEPROM.
+	quint32 address;    ///< First address of the transfer.
+	quint8 error;       ///< Error code, as in #QWiimote::MemoryError.
+	QByteArray data;    ///< Data read, which is shorter than requested if the read failed. Empty for writes.
+};
+
+/**
+ * Memory reads and writes waiting for the wiimote to answer.
+ * Any number of requests can be in flight. Their reports are taken with nextReport() and reportSent(),
+ * in the order in which the requests were made. A read is sent as a single 0x17 report, and the wiimote
+ * answers it with one 0x21 report for every 16 bytes. A 0x21 report only carries the low 16 bits of its
+ * address, so a read is held back, together with every later request, while an earlier read in flight
+ * expects replies at the same low addresses. Each reply then matches a single read, by its next expected
+ * address and chunk size. Writes are split into 0x16 reports of up to 16 bytes. Their 0x22
+ * acknowledgements carry no address, but they arrive in the order in which the writes were sent.
+ * Requests which get no answer for #TIMEOUT milliseconds are ended by expire().
+ */
+class QWiimoteMemoryRequests
+{
+public:
+	static const int CHUNK_SIZE = 16;  ///< Bytes carried by a single 0x16 or 0x21 report.
+	static const int TIMEOUT = 1000;   ///< Milliseconds without an answer before a request fails.
+
+	QWiimoteMemoryRequests();
+
+	int read(bool registers, quint32 address, quint16 size);
+	int write(bool registers, quint32 address, const QByteArray &data);
+	bool nextReport(QByteArray &report) const;
+	bool reportSent(bool success, QWiimoteMemoryResult &result);
+	bool readReply(const char * report, QWiimoteMemoryResult &result);
+	bool writeAcknowledged(const char * report, QWiimoteMemoryResult &result);
+	QList<QWiimoteMemoryResult> expire();
+	QList<QWiimoteMemoryResult> abort();
+
+	/**
+	 * Number of requests waiting to be sent or for the wiimote to answer.
+	 * @return Pending reads and writes.
+	 */
+	int pending() const { return this->requests.size(); }
+
+private:
+	/**
+	 * Read or write in flight.
+	 */
+	struct Request {
+		QWiimoteMemoryResult result; ///< Result being built.
+		QList<QByteArray> reports;   ///< Reports not sent yet. The rumble bit is not set.
+		int size;                    ///< Number of bytes to transfer.
+		int sent;                    ///< Bytes whose reports have been sent.
+		int transferred;             ///< Bytes read, or bytes whose write has been acknowledged.
+		QPreciseTime last_activity;  ///< Time of the last report sent or answered for this request.
+	};
+
+	QList<Request> requests;         ///< Pending reads and writes, oldest first.
+	int next_id;                     ///< Identifier of the next request.
+
+	int nextUnsent() const;
+	bool collides(int index) const;
+};
+
+#endif // QWIIMOTEMEMORYREQUESTS_H
@@ -0,0 +1,153 @@
+/*
+ * This file is part of QWiimote.
+ *
+ * QWiimote is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QWiimote is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QWiimote. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file qwiimotereport.cpp
+ *
+ * Source file for the QWiimoteReportHandle and QWiimoteReportPool classes.
+ */
+
+#include "qwiimotereport.h"
+
+#define POOL_INDEX_MASK 0x0000FFFFu///< Bits of QWiimoteReportPool::free_head which store the slot.
+#define POOL_TAG_MASK   0xFFFF0000u///< Bits of QWiimoteReportPool::free_head which store the ABA tag.
+#define POOL_TAG_STEP   0x00010000u///< Increment of the ABA tag.
+
+/* QWiimoteReportHandle */
+
+/**
+ * Creates a new handle to the same report as other.
+ * @param other Handle to copy.
+ */
+QWiimoteReportHandle::QWiimoteReportHandle(const QWiimoteReportHandle &other) : report(other.report)
+{
+	if (this->report != NULL) this->report->ref_count.ref();
+}
+
+/**
+ * Releases the report of this handle.
+ */
+QWiimoteReportHandle::~QWiimoteReportHandle()
+{
+	this->reset();
+}
+
+/**
+ * Makes this handle point to the same report as other.
+ * @param other Handle to copy.
+ * @return Reference to this handle.
+ */
+QWiimoteReportHandle &QWiimoteReportHandle::operator=(const QWiimoteReportHandle &other)
+{
+	if (other.report != NULL) other.report->ref_count.ref();
+	this->reset();
+	this->report = other.report;
+	return *this;
+}
+
+/**
+ * Releases the report of this handle, which becomes a null handle.
+ */
+void QWiimoteReportHandle::reset()
+{
+	if (this->report != NULL && !this->report->ref_count.deref()) {
+		this->report->pool->release(this->report);
+	}
+	this->report = NULL;
+}
+
+/* QWiimoteReportPool */
+
+/**
+ * Creates a new pool. The creator owns one reference, which must be released with deref().
+ * @param capacity Number of slots. It must be between 1 and 65535.
+ */
+QWiimoteReportPool::QWiimoteReportPool(int capacity) : ref_count(1), failed_acquisitions(0)
+{
+	Q_ASSERT_X(capacity > 0 && capacity <= 0xFFFF, "QWiimoteReportPool", "Invalid capacity.");
+
+	this->slot_count = capacity;
+	this->report_slots = new QWiimoteReport[capacity];
+
+	/* Chain every slot into the free list. */
+	for (int i = 0; i < capacity; i++) {
+		this->report_slots[i].pool = this;
+		this->report_slots[i].size = 0;
+		this->report_slots[i].next_free = (i + 1 < capacity) ? i + 2 : 0;
+	}
+	this->free_head = 1;
+}
+
+/**
+ * Frees the slab.
+ */
+QWiimoteReportPool::~QWiimoteReportPool()
+{
+	delete[] this->report_slots;
+}
+
+/**
+ * Releases a reference to the pool. The pool is destroyed when no references are left.
+ */
+void QWiimoteReportPool::deref()
+{
+	if (!this->ref_count.deref()) delete this;
+}
+
+/**
+ * Takes a free slot from the pool.
+ * @return Handle to the slot, or a null handle if every slot is in use.
+ */
+QWiimoteReportHandle QWiimoteReportPool::acquire()
+{
+	forever {
+		int head = this->free_head;
+		int index = (int)(head & POOL_INDEX_MASK) - 1;
+		if (index < 0) {
+			this->failed_acquisitions.ref();
+			return QWiimoteReportHandle();
+		}
+
+		/* The tag changes on every update, so a stale next_free is never installed. */
+		int new_head = (int)(((uint)head + POOL_TAG_STEP) & POOL_TAG_MASK) | this->report_slots[index].next_free;
+		if (this->free_head.testAndSetAcquire(head, new_head)) {
+			QWiimoteReport * report = &this->report_slots[index];
+			report->ref_count = 1;
+			report->size = 0;
+			this->ref();
+			return QWiimoteReportHandle(report);
+		}
+	}
+}
+
+/**
+ * Gives a slot back to the pool. Called when the last handle of a report is released.
+ * @param report Report to release.
+ */
+void QWiimoteReportPool::release(QWiimoteReport * report)
+{
+	int index = report - this->report_slots;
+
+	forever {
+		int head = this->free_head;
+		report->next_free = (int)(head & POOL_INDEX_MASK);
+		int new_head = (int)(((uint)head + POOL_TAG_STEP) & POOL_TAG_MASK) | (index + 1);
+		if (this->free_head.testAndSetRelease(head, new_head)) break;
+	}
+
+	this->deref();
+}
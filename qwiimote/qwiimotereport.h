@@ -21,14 +21,21 @@
  * Header file for the QWiimoteReport struct.
  *
  * This data structure stores a report along with its arrival time.
+ * Reports live in the fixed slots of a #QWiimoteReportPool and are
+ * passed around through reference counted #QWiimoteReportHandle objects.
  */
 
 #ifndef QWIIMOTEREPORT_H
 #define QWIIMOTEREPORT_H
 
-#include <QByteArray>
+#include <QAtomicInt>
+#include <QMetaType>
 #include "qprecisetime.h"
 
+#define MAX_REPORT_SIZE 22 ///< Maximum size of a report.
+
+class QWiimoteReportPool;
+
 /**
  * Stores a received Wiimote report until it is processed.
  * QTime can't be used because its precision under Windows systems is too low (10-16 milliseconds).
@@ -36,8 +43,101 @@
  */
 class QWiimoteReport {
 public:
-	QPreciseTime time; ///< Time of arrival of the report.
-	QByteArray data;   ///< Data of the report.
+	QPreciseTime time;          ///< Time of arrival of the report.
+	char data[MAX_REPORT_SIZE]; ///< Data of the report.
+	int size;                   ///< Number of valid bytes in data.
+
+private:
+	friend class QWiimoteReportPool;
+	friend class QWiimoteReportHandle;
+
+	QAtomicInt ref_count;       ///< Number of handles pointing to this report.
+	QWiimoteReportPool * pool;  ///< Pool which owns this report.
+	int next_free;              ///< Next free slot of the pool (plus one) while this slot is free.
+};
+
+/**
+ * Reference counted handle to a #QWiimoteReport.
+ * Copying a handle never copies the report. The report goes back to its pool when its last handle is destroyed,
+ * so handles can be kept or sent through queued connections safely.
+ */
+class QWiimoteReportHandle {
+public:
+	/** Creates a null handle. */
+	QWiimoteReportHandle() : report(NULL) {}
+	QWiimoteReportHandle(const QWiimoteReportHandle &other);
+	~QWiimoteReportHandle();
+	QWiimoteReportHandle &operator=(const QWiimoteReportHandle &other);
+
+	/**
+	 * Checks if this handle points to a report.
+	 * @return True iff there is no report.
+	 */
+	bool isNull() const { return this->report == NULL; }
+
+	/**
+	 * Checks if this is the only handle pointing to its report.
+	 * @return True iff the report can be modified without affecting other handles.
+	 */
+	bool isDetached() const { return this->report != NULL && this->report->ref_count == 1; }
+
+	/** Member access to the report. @return Report. */
+	QWiimoteReport * operator->() const { return this->report; }
+	/** Dereferences the report. @return Report. */
+	QWiimoteReport & operator*() const { return *this->report; }
+
+	void reset();
+
+private:
+	friend class QWiimoteReportPool;
+
+	/** Adopts a report which already has a reference for this handle. */
+	explicit QWiimoteReportHandle(QWiimoteReport * adopted) : report(adopted) {}
+
+	QWiimoteReport * report; ///< Report pointed to by this handle.
+};
+
+Q_DECLARE_METATYPE(QWiimoteReportHandle)
+
+/**
+ * Preallocated slab of fixed size report slots.
+ * Slots are handed out by acquire() and come back when their last handle is released.
+ * acquire() and release are lock free, so any thread can use them. The pool stays alive
+ * until its owner calls deref() and every handle has been released.
+ */
+class QWiimoteReportPool {
+public:
+	QWiimoteReportPool(int capacity = 256);
+
+	QWiimoteReportHandle acquire();
+
+	/** Adds a reference to the pool. */
+	void ref() { this->ref_count.ref(); }
+	void deref();
+
+	/**
+	 * Number of slots of the pool.
+	 * @return Capacity of the pool.
+	 */
+	int capacity() const { return this->slot_count; }
+
+	/**
+	 * Number of times acquire() failed because every slot was in use.
+	 * @return Number of failed acquisitions.
+	 */
+	quint32 exhaustions() const { return this->failed_acquisitions; }
+
+private:
+	~QWiimoteReportPool();
+	void release(QWiimoteReport * report);
+
+	friend class QWiimoteReportHandle;
+
+	QWiimoteReport * report_slots; ///< Slab of reports.
+	int slot_count;                ///< Number of reports in the slab.
+	QAtomicInt free_head;          ///< Tag (high 16 bits) and first free slot plus one (low 16 bits).
+	QAtomicInt ref_count;          ///< Owner reference plus one reference for each acquired slot.
+	QAtomicInt failed_acquisitions;///< Number of failed acquisitions.
 };
 
 #endif // QWIIMOTEREPORT_H
@@ -0,0 +1,148 @@
+/*
+ * This file is part of QWiimote.
+ *
+ * QWiimote is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QWiimote is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QWiimote. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file qwiimotereportclock.cpp
+ *
+ * Source file for the QWiimoteReportClock class.
+ */
+
+#include "qwiimotereportclock.h"
+
+/**
+ * Creates a new clock estimator.
+ * @param nominal_period Period at which the wiimote is expected to send reports.
+ */
+QWiimoteReportClock::QWiimoteReportClock(const QPreciseDuration &nominal_period)
+{
+	this->nominal_period = nominal_period.nanoseconds();
+	this->estimated_period = this->nominal_period;
+	this->reset();
+}
+
+/**
+ * Forgets every stored arrival. The current period estimate is kept.
+ * Must be called whenever the wiimote may have restarted its reports, such as after
+ * changing the reporting mode.
+ */
+void QWiimoteReportClock::reset()
+{
+	this->count = 0;
+	this->position = 0;
+	this->last_index = 0;
+	this->last_device_time = 0;
+}
+
+/**
+ * Registers the arrival of a continuous report and computes its device timestamp.
+ * @param arrival Time of arrival of the report.
+ * @return Estimated time at which the wiimote sent the report.
+ */
+QPreciseTime QWiimoteReportClock::deviceTime(const QPreciseTime &arrival)
+{
+	qint64 arrival_time = arrival.nanoseconds();
+
+	if (this->count > 0 &&
+		 arrival_time - this->last_device_time > RESYNC_PERIODS * this->estimated_period) {
+		this->reset();
+	}
+
+	if (this->count == 0) {
+		/* First report of a stream: it defines the phase until more reports arrive. */
+		this->store(0, arrival_time);
+		this->last_device_time = arrival_time;
+		return arrival;
+	}
+
+	qint64 index = ++this->last_index;
+	this->store(index, arrival_time);
+	this->fitPeriod();
+
+	/* Lower envelope of the arrival times, relative to the fitted period. */
+	qreal phase = this->arrivals[0] - this->estimated_period * this->indices[0];
+	for (int i = 1; i < this->count; i++) {
+		qreal candidate = this->arrivals[i] - this->estimated_period * this->indices[i];
+		if (candidate < phase) phase = candidate;
+	}
+
+	/* Slew towards the estimate, so timestamps stay increasing even if the phase jumps. */
+	qreal predicted = this->last_device_time + this->estimated_period;
+	qreal correction = phase + this->estimated_period * index - predicted;
+	qreal max_correction = this->estimated_period / 16;
+	if (correction >  max_correction) correction =  max_correction;
+	if (correction < -max_correction) correction = -max_correction;
+
+	this->last_device_time = (qint64)(predicted + correction);
+	return QPreciseTime::fromNanoseconds(this->last_device_time);
+}
+
+/* Private functions */
+
+/**
+ * Stores an arrival, replacing the oldest one if the window is full.
+ * @param index Report index.
+ * @param arrival Arrival time, in nanoseconds.
+ */
+void QWiimoteReportClock::store(qint64 index, qint64 arrival)
+{
+	this->indices[this->position] = index;
+	this->arrivals[this->position] = arrival;
+	this->position = (this->position + 1) % WINDOW_SIZE;
+	if (this->count < WINDOW_SIZE) this->count++;
+}
+
+/**
+ * Updates the estimated period with a least squares fit of the stored arrivals.
+ * Delayed arrivals would bias the fit, so it is repeated using only the arrivals which were not later
+ * than the first fit. The nominal period is used until #MIN_FIT_SIZE arrivals are stored, and fits
+ * far away from it are discarded.
+ */
+void QWiimoteReportClock::fitPeriod()
+{
+	if (this->count < MIN_FIT_SIZE) return;
+
+	/* Values are taken relative to the first stored arrival to keep their precision. */
+	int first = (this->count < WINDOW_SIZE) ? 0 : this->position;
+	qint64 base_index = this->indices[first];
+	qint64 base_arrival = this->arrivals[first];
+
+	qreal slope = 0, intercept = 0;
+	for (int pass = 0; pass < 2; pass++) {
+		qreal sum_index = 0, sum_arrival = 0, sum_index_index = 0, sum_index_arrival = 0;
+		int used = 0;
+
+		for (int i = 0; i < this->count; i++) {
+			qreal index = this->indices[i] - base_index;
+			qreal arrival = this->arrivals[i] - base_arrival;
+			if (pass > 0 && arrival > intercept + slope * index) continue;
+
+			sum_index += index;
+			sum_arrival += arrival;
+			sum_index_index += index * index;
+			sum_index_arrival += index * arrival;
+			used++;
+		}
+
+		qreal variance = used * sum_index_index - sum_index * sum_index;
+		if (used < 2 || variance <= 0) return;
+
+		slope = (used * sum_index_arrival - sum_index * sum_arrival) / variance;
+		intercept = (sum_arrival - slope * sum_index) / used;
+	}
+
+	if (slope > this->nominal_period / 2 && slope < this->nominal_period * 2) this->estimated_period = slope;
+}
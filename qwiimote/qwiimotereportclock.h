@@ -0,0 +1,78 @@
+/*
+ * This file is part of QWiimote.
+ *
+ * QWiimote is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QWiimote is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QWiimote. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file qwiimotereportclock.h
+ *
+ * Header file for the QWiimoteReportClock class.
+ *
+ * QWiimoteReportClock reconstructs the clock of the wiimote from the arrival times of its reports.
+ */
+
+#ifndef QWIIMOTEREPORTCLOCK_H
+#define QWIIMOTEREPORTCLOCK_H
+
+#include "qprecisetime.h"
+
+/**
+ * Estimates the period and phase at which the wiimote samples its sensors, and gives each
+ * continuous report a smoothed device timestamp.
+ *
+ * Bluetooth delivers reports late and in bursts, but never before they were sampled. The period is
+ * the least squares slope of the arrival times against the report index, over the last #WINDOW_SIZE
+ * reports, refitted without the arrivals which were later than the first fit. The phase is the lower
+ * envelope of the arrival times, so delayed reports don't move it.
+ * Timestamps are slewed towards the estimate by at most a sixteenth of a period per report, so
+ * consecutive timestamps are always increasing and the estimate never adds latency.
+ * Reports lost by the link are not detected; a gap longer than #RESYNC_PERIODS periods restarts
+ * the estimation, keeping the last known period.
+ */
+class QWiimoteReportClock
+{
+public:
+	QWiimoteReportClock(const QPreciseDuration &nominal_period);
+
+	QPreciseTime deviceTime(const QPreciseTime &arrival);
+	void reset();
+
+	/**
+	 * Current estimate of the time between reports.
+	 * @return Estimated period.
+	 */
+	QPreciseDuration period() const { return QPreciseDuration((qint64)this->estimated_period); }
+
+private:
+	static const int WINDOW_SIZE = 128;   ///< Number of arrivals used by the regression.
+	static const int MIN_FIT_SIZE = 16;   ///< Arrivals required before the nominal period is replaced.
+	static const int RESYNC_PERIODS = 25; ///< Periods without reports which restart the estimation.
+
+	qreal nominal_period;                 ///< Period used until enough reports have arrived, in nanoseconds.
+	qreal estimated_period;               ///< Estimated period, in nanoseconds.
+
+	qint64 indices[WINDOW_SIZE];          ///< Report index of each stored arrival.
+	qint64 arrivals[WINDOW_SIZE];         ///< Stored arrival times, in nanoseconds.
+	int count;                            ///< Number of stored arrivals.
+	int position;                         ///< Position where the next arrival is stored.
+
+	qint64 last_index;                    ///< Index of the last report.
+	qint64 last_device_time;              ///< Timestamp given to the last report, in nanoseconds.
+
+	void store(qint64 index, qint64 arrival);
+	void fitPeriod();
+};
+
+#endif // QWIIMOTEREPORTCLOCK_H
@@ -0,0 +1,129 @@
+/*
+ * This file is part of QWiimote.
+ *
+ * QWiimote is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QWiimote is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QWiimote. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file qwiimotereportlayout.cpp
+ *
+ * Source file for the QWiimoteReportLayout struct.
+ */
+
+#include "qwiimotereportlayout.h"
+
+/**
+ * Layouts of every input reporting mode, sorted by report type.
+ */
+static const QWiimoteReportLayout REPORT_LAYOUTS[] = {
+	/* type  size  buttons  acceleration format                            acc.  IR  size  ext.  size */
+	{  0x30,    3,       1, QWiimoteReportLayout::AccelerationNone,         -1,  -1,    0,   -1,    0 }, // Buttons.
+	{  0x31,    6,       1, QWiimoteReportLayout::AccelerationFull,          3,  -1,    0,   -1,    0 }, // Buttons, acceleration.
+	{  0x32,   11,       1, QWiimoteReportLayout::AccelerationNone,         -1,  -1,    0,    3,    8 }, // Buttons, 8 extension bytes.
+	{  0x33,   18,       1, QWiimoteReportLayout::AccelerationFull,          3,   6,   12,   -1,    0 }, // Buttons, acceleration, 12 IR bytes.
+	{  0x34,   22,       1, QWiimoteReportLayout::AccelerationNone,         -1,  -1,    0,    3,   19 }, // Buttons, 19 extension bytes.
+	{  0x35,   22,       1, QWiimoteReportLayout::AccelerationFull,          3,  -1,    0,    6,   16 }, // Buttons, acceleration, 16 extension bytes.
+	{  0x36,   22,       1, QWiimoteReportLayout::AccelerationNone,         -1,   3,   10,   13,    9 }, // Buttons, 10 IR bytes, 9 extension bytes.
+	{  0x37,   22,       1, QWiimoteReportLayout::AccelerationFull,          3,   6,   10,   16,    6 }, // Buttons, acceleration, 10 IR bytes, 6 extension bytes.
+	{  0x3D,   22,      -1, QWiimoteReportLayout::AccelerationNone,         -1,  -1,    0,    1,   21 }, // 21 extension bytes.
+	{  0x3E,   22,       1, QWiimoteReportLayout::AccelerationInterleavedX,  3,   4,   18,   -1,    0 }, // Interleaved buttons, acceleration, 36 IR bytes.
+	{  0x3F,   22,       1, QWiimoteReportLayout::AccelerationInterleavedZ,  3,   4,   18,   -1,    0 }, // Second half of 0x3e.
+};
+
+static const int REPORT_LAYOUT_COUNT = sizeof(REPORT_LAYOUTS) / sizeof(REPORT_LAYOUTS[0]); ///< Number of reporting modes.
+
+/* Public functions */
+
+/**
+ * Finds the layout of an input report.
+ * @param type Report type.
+ * @return Layout of the report, or NULL if it is not a data report.
+ */
+const QWiimoteReportLayout * QWiimoteReportLayout::find(int type)
+{
+	for (int i = 0; i < REPORT_LAYOUT_COUNT; i++) {
+		if (REPORT_LAYOUTS[i].type == type) return &REPORT_LAYOUTS[i];
+	}
+	return NULL;
+}
+
+/**
+ * Picks the smallest reporting mode which carries the requested data. The interleaved modes
+ * are never picked, because they need two reports for a single acceleration sample.
+ * @param acceleration True if full acceleration data is needed.
+ * @param extension_size Number of extension bytes needed.
+ * @param ir_size Number of IR camera bytes needed.
+ * @return Layout of the mode to use, or NULL if no mode carries all the data.
+ */
+const QWiimoteReportLayout * QWiimoteReportLayout::select(bool acceleration, int extension_size, int ir_size)
+{
+	const QWiimoteReportLayout * best = NULL;
+	for (int i = 0; i < REPORT_LAYOUT_COUNT; i++) {
+		const QWiimoteReportLayout &layout = REPORT_LAYOUTS[i];
+		if (acceleration && layout.acceleration_format != AccelerationFull) continue;
+		if (layout.acceleration_format == AccelerationInterleavedX || layout.acceleration_format == AccelerationInterleavedZ) continue;
+		if (layout.extension_size < extension_size || layout.ir_size < ir_size) continue;
+
+		/* Modes are sorted by type, so ties keep the lowest type. */
+		if (best == NULL || layout.size < best->size) best = &layout;
+	}
+	return best;
+}
+
+/**
+ * Reads the buttons of a report. Bits which are used for other data are cleared.
+ * @param report Report of this layout.
+ * @return Button flags, as in #QWiimote::WiimoteButton. 0 if the mode carries no buttons.
+ */
+quint16 QWiimoteReportLayout::decodeButtons(const char * report) const
+{
+	if (this->buttons < 0) return 0;
+	return (((report[this->buttons + 1] & 0xFF) << 8) | (report[this->buttons] & 0xFF)) & BUTTON_MASK;
+}
+
+/**
+ * Reads the raw acceleration of a report, with a 10-bit scale.
+ * The interleaved modes carry half of a sample each. 0x3e must be decoded before 0x3f
+ * into the same array, and the sample is complete after 0x3f.
+ * @param report Report of this layout.
+ * @param acceleration Raw x, y and z acceleration. Only the axes carried by the report are changed.
+ * @return True if acceleration holds a complete sample.
+ */
+bool QWiimoteReportLayout::decodeAcceleration(const char * report, quint16 acceleration[3]) const
+{
+	/* The low bits of the accelerometer, or half of an axis, are stored in bits 5 and 6 of the button bytes. */
+	quint8 low_bits  = (report[1] & 0x60) >> 5;
+	quint8 high_bits = (report[2] & 0x60) >> 5;
+
+	switch (this->acceleration_format) {
+		case AccelerationFull:
+			acceleration[0] = ((report[this->acceleration] & 0xFF) << 2)     + low_bits;
+			acceleration[1] = ((report[this->acceleration + 2] & 0xFF) << 2) + ((high_bits & 0x02) >> 0);
+			acceleration[2] = ((report[this->acceleration + 1] & 0xFF) << 2) + ((high_bits & 0x01) << 1);
+			return true;
+
+		case AccelerationInterleavedX:
+			acceleration[0] = (report[this->acceleration] & 0xFF) << 2;
+			acceleration[1] = (acceleration[1] & 0x03C) | (((high_bits << 2) | low_bits) << 6);
+			return false;
+
+		case AccelerationInterleavedZ:
+			acceleration[2] = (report[this->acceleration] & 0xFF) << 2;
+			acceleration[1] = (acceleration[1] & 0x3C0) | (((high_bits << 2) | low_bits) << 2);
+			return true;
+
+		default:
+			return false;
+	}
+}
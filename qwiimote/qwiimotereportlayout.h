@@ -0,0 +1,70 @@
+/*
+ * This file is part of QWiimote.
+ *
+ * QWiimote is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QWiimote is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QWiimote. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file qwiimotereportlayout.h
+ *
+ * Header file for the QWiimoteReportLayout struct.
+ *
+ * QWiimoteReportLayout describes where each kind of data is stored in the input reports of every reporting mode.
+ */
+
+#ifndef QWIIMOTEREPORTLAYOUT_H
+#define QWIIMOTEREPORTLAYOUT_H
+
+#include <QtGlobal>
+
+/**
+ * Layout of the input reports of a reporting mode.
+ * The layouts of every mode are kept in a constant table, which is initialized at compile time.
+ * Offsets count the report type as byte 0, and are -1 when the data is not present.
+ */
+struct QWiimoteReportLayout {
+	/** How the accelerometer is stored in a report. */
+	enum AccelerationFormat {
+		AccelerationNone,         ///< No acceleration.
+		AccelerationFull,         ///< One byte per axis, plus their low bits in the button bytes. 10 bits per axis.
+		AccelerationInterleavedX, ///< 0x3e: the x axis, and the high half of the y axis in the button bytes. 8 bits per axis.
+		AccelerationInterleavedZ, ///< 0x3f: the z axis, and the low half of the y axis in the button bytes. 8 bits per axis.
+	};
+
+	static const quint16 BUTTON_MASK = 0x9F1F; ///< Bits of the button bytes which are buttons.
+
+	quint8 type;                ///< Report type.
+	quint8 size;                ///< Size of the report, including its type.
+	qint8  buttons;             ///< Offset of the two button bytes.
+	quint8 acceleration_format; ///< How the acceleration is stored, as #AccelerationFormat.
+	qint8  acceleration;        ///< Offset of the acceleration bytes.
+	qint8  ir;                  ///< Offset of the IR camera bytes.
+	quint8 ir_size;             ///< Number of IR camera bytes.
+	qint8  extension;           ///< Offset of the extension bytes.
+	quint8 extension_size;      ///< Number of extension bytes.
+
+	static const QWiimoteReportLayout * find(int type);
+	static const QWiimoteReportLayout * select(bool acceleration, int extension_size, int ir_size = 0);
+
+	/**
+	 * Checks if the reports of this mode carry any data besides buttons, so they are sent continuously.
+	 * @return True iff the mode needs continuous reporting.
+	 */
+	bool isContinuous() const { return this->acceleration >= 0 || this->ir >= 0 || this->extension >= 0; }
+
+	quint16 decodeButtons(const char * report) const;
+	bool decodeAcceleration(const char * report, quint16 acceleration[3]) const;
+};
+
+#endif // QWIIMOTEREPORTLAYOUT_H
@@ -0,0 +1,96 @@
+/*
+ * This file is part of QWiimote.
+ *
+ * QWiimote is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QWiimote is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QWiimote. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file qwiimotereportring.cpp
+ *
+ * Source file for the QWiimoteReportRing class.
+ */
+
+#include "qwiimotereportring.h"
+
+/**
+ * Creates a new empty ring.
+ * @param capacity Requested capacity. It is rounded up to a power of two.
+ */
+QWiimoteReportRing::QWiimoteReportRing(int capacity) : head(0), tail(0), overflow_count(0), high_water(0)
+{
+	int size = 1;
+	while (size < capacity) size <<= 1;
+
+	this->mask = size - 1;
+	this->reports = new QWiimoteReportHandle[size];
+}
+
+/**
+ * Releases every report still stored in the ring.
+ */
+QWiimoteReportRing::~QWiimoteReportRing()
+{
+	delete[] this->reports;
+}
+
+/**
+ * Adds a report at the end of the ring. Must only be called by the producer thread.
+ * @param report Report to add.
+ * @return false if the ring was full and the report was dropped.
+ */
+bool QWiimoteReportRing::push(const QWiimoteReportHandle &report)
+{
+	int current_tail = this->tail;
+	/* Positions wrap around, so the difference is computed without sign. */
+	int fill = (int)((uint)current_tail - (uint)this->head.fetchAndAddAcquire(0));
+
+	if (fill > this->mask) {
+		this->overflow_count.ref();
+		return false;
+	}
+
+	this->reports[current_tail & this->mask] = report;
+	/* Publish the report to the consumer. */
+	this->tail.fetchAndStoreRelease((int)((uint)current_tail + 1));
+
+	if (fill + 1 > this->high_water) this->high_water = fill + 1;
+	return true;
+}
+
+/**
+ * Takes the first report of the ring. Must only be called by the consumer thread.
+ * @param report Set to the first report.
+ * @return false if the ring was empty.
+ */
+bool QWiimoteReportRing::pop(QWiimoteReportHandle &report)
+{
+	int current_head = this->head;
+	if (current_head == this->tail.fetchAndAddAcquire(0)) return false;
+
+	QWiimoteReportHandle &stored = this->reports[current_head & this->mask];
+	report = stored;
+	stored.reset();
+	/* Give the position back to the producer. */
+	this->head.fetchAndStoreRelease((int)((uint)current_head + 1));
+	return true;
+}
+
+/**
+ * Checks if there are reports waiting in the ring.
+ * @return True iff the ring is empty.
+ */
+bool QWiimoteReportRing::isEmpty()
+{
+	return this->head.fetchAndAddAcquire(0) == this->tail.fetchAndAddAcquire(0);
+}
@@ -0,0 +1,73 @@
+/*
+ * This file is part of QWiimote.
+ *
+ * QWiimote is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QWiimote is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QWiimote. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file qwiimotereportring.h
+ *
+ * Header file for the QWiimoteReportRing class.
+ *
+ * QWiimoteReportRing moves report handles from the I/O thread to the thread that processes them.
+ */
+
+#ifndef QWIIMOTEREPORTRING_H
+#define QWIIMOTEREPORTRING_H
+
+#include <QAtomicInt>
+#include "qwiimotereport.h"
+
+/**
+ * Bounded lock-free ring of report handles with a single producer and a single consumer.
+ * Only one thread may call push() and only one thread may call pop().
+ * Reports pushed while the ring is full are dropped and counted.
+ */
+class QWiimoteReportRing {
+public:
+	QWiimoteReportRing(int capacity = 1024);
+	~QWiimoteReportRing();
+
+	bool push(const QWiimoteReportHandle &report);
+	bool pop(QWiimoteReportHandle &report);
+	bool isEmpty();
+
+	/**
+	 * Number of reports the ring can hold.
+	 * @return Capacity of the ring.
+	 */
+	int capacity() const { return this->mask + 1; }
+
+	/**
+	 * Number of reports dropped because the ring was full.
+	 * @return Number of overflows.
+	 */
+	quint32 overflows() const { return this->overflow_count; }
+
+	/**
+	 * Highest number of reports that were waiting in the ring at the same time.
+	 * @return Highest fill level.
+	 */
+	int highWater() const { return this->high_water; }
+
+private:
+	QWiimoteReportHandle * reports; ///< Storage of the ring.
+	int mask;                       ///< Capacity minus one. The capacity is a power of two.
+	QAtomicInt head;                ///< Next position to pop. Only written by the consumer.
+	QAtomicInt tail;                ///< Next position to push. Only written by the producer.
+	QAtomicInt overflow_count;      ///< Number of reports dropped because the ring was full.
+	QAtomicInt high_water;          ///< Highest fill level seen by the producer.
+};
+
+#endif // QWIIMOTEREPORTRING_H
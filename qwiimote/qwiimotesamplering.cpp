@@ -0,0 +1,59 @@
+/*
+ * This file is part of QWiimote.
+ *
+ * QWiimote is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QWiimote is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QWiimote. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file qwiimotesamplering.cpp
+ *
+ * Source file for the QWiimoteSampleRing class.
+ */
+
+#include "qwiimotesamplering.h"
+
+/**
+ * Creates a new empty ring.
+ * @param capacity Maximum number of samples stored. Must be at least 1.
+ */
+QWiimoteSampleRing::QWiimoteSampleRing(int capacity) : samples(NULL), sample_capacity(0), newest(0), count(0)
+{
+	this->setCapacity(capacity);
+}
+
+/**
+ * Releases the storage of the ring.
+ */
+QWiimoteSampleRing::~QWiimoteSampleRing()
+{
+	delete[] this->samples;
+}
+
+/**
+ * Changes the maximum number of samples stored. Every stored sample is removed.
+ * This is the only function which allocates memory, so it should only be called while configuring.
+ * @param capacity New capacity. Must be at least 1.
+ */
+void QWiimoteSampleRing::setCapacity(int capacity)
+{
+	capacity = qMax(capacity, 1);
+	if (capacity != this->sample_capacity) {
+		delete[] this->samples;
+		this->samples = new QAccelerationSample[capacity];
+		this->sample_capacity = capacity;
+	}
+
+	this->newest = 0;
+	this->count = 0;
+}
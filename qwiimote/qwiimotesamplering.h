@@ -0,0 +1,114 @@
+/*
+ * This file is part of QWiimote.
+ *
+ * QWiimote is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QWiimote is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QWiimote. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file qwiimotesamplering.h
+ *
+ * Header file for the QWiimoteSampleRing class.
+ *
+ * QWiimoteSampleRing stores the most recent acceleration samples used for smoothing.
+ */
+
+#ifndef QWIIMOTESAMPLERING_H
+#define QWIIMOTESAMPLERING_H
+
+#include <QVector3D>
+#include "qprecisetime.h"
+
+/**
+ * Stores an acceleration sample.
+ * @see #QPreciseTime.
+ */
+struct QAccelerationSample
+{
+	QPreciseTime time;                  ///< Time of the report, reconstructed from its arrival time.
+	QVector3D calibrated_acceleration;  ///< Acceleration values.
+};
+
+/**
+ * Fixed-capacity ring of acceleration samples, stored contiguously.
+ * Samples are indexed by age, 0 being the newest one. Newer samples are stored at lower
+ * addresses, so walking from the newest sample to the oldest one reads memory forwards.
+ * Adding a sample never allocates memory; only setCapacity() does.
+ */
+class QWiimoteSampleRing
+{
+public:
+	QWiimoteSampleRing(int capacity);
+	~QWiimoteSampleRing();
+
+	void setCapacity(int capacity);
+
+	/**
+	 * Maximum number of samples stored.
+	 * @return Capacity of the ring.
+	 */
+	int capacity() const { return this->sample_capacity; }
+
+	/**
+	 * Number of samples stored.
+	 * @return Size of the ring.
+	 */
+	int size() const { return this->count; }
+
+	/**
+	 * Checks if no samples are stored.
+	 * @return True iff the ring is empty.
+	 */
+	bool isEmpty() const { return this->count == 0; }
+
+	/**
+	 * Removes every stored sample.
+	 */
+	void clear() { this->count = 0; }
+
+	/**
+	 * Stores a new sample, replacing the oldest one if the ring is full.
+	 * @param sample Sample to store.
+	 */
+	void prepend(const QAccelerationSample &sample)
+	{
+		this->newest = (this->newest == 0) ? this->sample_capacity - 1 : this->newest - 1;
+		this->samples[this->newest] = sample;
+		if (this->count < this->sample_capacity) this->count++;
+	}
+
+	/**
+	 * Gets a stored sample by its age.
+	 * @param age 0 for the newest sample, size() - 1 for the oldest one.
+	 * @return Stored sample.
+	 */
+	const QAccelerationSample &at(int age) const
+	{
+		int index = this->newest + age;
+		if (index >= this->sample_capacity) index -= this->sample_capacity;
+		return this->samples[index];
+	}
+
+	/** @return Newest sample. The ring must not be empty. */
+	const QAccelerationSample &first() const { return this->samples[this->newest]; }
+	/** @return Oldest sample. The ring must not be empty. */
+	const QAccelerationSample &last() const { return this->at(this->count - 1); }
+
+private:
+	QAccelerationSample * samples; ///< Storage of the ring.
+	int sample_capacity;           ///< Number of samples which can be stored.
+	int newest;                    ///< Position of the newest sample.
+	int count;                     ///< Number of samples stored.
+};
+
+#endif // QWIIMOTESAMPLERING_H
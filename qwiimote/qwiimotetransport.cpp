@@ -0,0 +1,318 @@
+/*
+ * This file is part of QWiimote.
+ *
+ * QWiimote is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QWiimote is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QWiimote. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file qwiimotetransport.cpp
+ *
+ * Source file for the QWiimoteTransport class.
+ */
+
+#include <cstring>
+#include <QRunnable>
+#include "qwiimotetransport.h"
+#include "qwiimotecommandqueue.h"
+
+/**
+ * Task of the writer thread, which writes the reports queued in a transport.
+ */
+class QWiimoteWriteTask : public QRunnable
+{
+public:
+	/**
+	 * Creates a new task.
+	 * @param transport Transport whose queued reports will be written.
+	 */
+	QWiimoteWriteTask(QWiimoteTransport * transport) : transport(transport) {}
+
+	/** Writes the queued reports. */
+	void run() { this->transport->flushWriteQueue(); }
+
+private:
+	QWiimoteTransport * transport; ///< Transport whose queued reports are written.
+};
+
+/**
+ * Creates a new QWiimoteTransport object.
+ * @param parent The parent of this instance. Usually it will be a #QWiimote.
+ */
+QWiimoteTransport::QWiimoteTransport(QObject * parent) : QObject(parent)
+{
+	qRegisterMetaType<QWiimoteReportHandle>("QWiimoteReportHandle");
+	this->report_pool = new QWiimoteReportPool();
+
+	this->write_queue_depth = 32;
+	this->command_queue = new QWiimoteCommandQueue(this->write_queue_depth);
+	/* Commands are kept while they are queued and while their batch is being written. */
+	this->command_pool = new QWiimoteReportPool(2 * this->command_queue->capacity());
+	this->next_write_id = 1;
+	this->reporting_mode_size = 0;
+	this->rumble_state = -1;
+
+	/* A single thread keeps the batches in order. It exits while there is nothing to write. */
+	this->write_pool.setMaxThreadCount(1);
+	this->writer_thread = false;
+}
+
+/**
+ * Destroys the QWiimoteTransport object.
+ * Its report pool stays alive until every report handle has been released.
+ */
+QWiimoteTransport::~QWiimoteTransport()
+{
+	this->write_pool.waitForDone();
+	delete this->command_queue;
+	this->command_pool->deref();
+	this->report_pool->deref();
+}
+
+/**
+ * Sends a report to the Wiimote.
+ * Overloaded function.
+ * @param data Report that will be sent to the wiimote.
+ * @return true if the report was sent.
+ */
+bool QWiimoteTransport::writeReport(const QByteArray data)
+{
+	return this->writeReport(data.constData(), data.size());
+}
+
+/**
+ * Closes the connection if it is opened, and opens it again.
+ * Meant to be invoked with a queued connection, so the caller does not wait for the device to be found.
+ * If opensFromAnyThread() is true and the connection is already closed, it can be run by a worker thread instead.
+ * #reopened is emmited with the result.
+ */
+void QWiimoteTransport::reopen()
+{
+	this->close();
+	emit this->reopened(this->open());
+}
+
+/**
+ * Queues a report to be sent to the Wiimote without blocking. Can be called from any thread.
+ * The report is encoded into its own slot and pushed into a lock-free queue; no lock is taken.
+ * The report is written later by the writer thread (see setWriterThread()), or else by the thread
+ * of the transport.
+ * A LED report replaces the previous report if it is a LED report still waiting to be written. A reporting mode report
+ * identical to the one in effect, or to one waiting to be written, is merged with it.
+ * #reportWritten is emmited with the returned identifier once the report has been handled.
+ * @param data Report that will be sent to the wiimote.
+ * @param size Size of the report. Using a size greater than #MAX_REPORT_SIZE is not allowed.
+ * @return Identifier of the write, or 0 if the write queue is full.
+ */
+quint32 QWiimoteTransport::queueReport(const char * data, int size)
+{
+	Q_ASSERT_X(size > 0 && size <= MAX_REPORT_SIZE, "QWiimoteTransport::queueReport", "Invalid report size.");
+
+	QWiimoteReportHandle command = this->command_pool->acquire();
+	if (command.isNull()) {
+		this->writes_rejected.ref();
+		return 0;
+	}
+	memcpy(command->data, data, size);
+	command->size = size;
+	command->time = QPreciseTime::currentTime();
+
+	quint32 id;
+	do {
+		id = (quint32)this->next_write_id.fetchAndAddRelaxed(1);
+	} while (id == 0);
+
+	if (!this->command_queue->push(command, id)) {
+		this->writes_rejected.ref();
+		return 0;
+	}
+
+	/* Wake up the writer thread or the transport's thread unless a flush is already pending. */
+	if (this->write_flush_scheduled.testAndSetOrdered(0, 1)) {
+		if (this->writer_thread && this->writesBlock()) {
+			this->write_pool.start(new QWiimoteWriteTask(this));
+		} else {
+			QMetaObject::invokeMethod(this, "flushWriteQueue", Qt::QueuedConnection);
+		}
+	}
+
+	return id;
+}
+
+/**
+ * Forgets the reporting mode in effect, so the next reporting mode report is always sent.
+ * The wiimote requires the reporting mode to be sent again after unsolicited status reports.
+ * Can be called from any thread.
+ */
+void QWiimoteTransport::invalidateReportingMode()
+{
+	this->reporting_mode_invalid.fetchAndStoreRelease(1);
+}
+
+/**
+ * Changes the maximum number of reports waiting in the write queue.
+ * Must not be called while other threads may call queueReport().
+ * @param depth Maximum number of reports. Must be at least 1. It is rounded up to a power of two.
+ */
+void QWiimoteTransport::setWriteQueueDepth(int depth)
+{
+	Q_ASSERT_X(depth >= 1, "QWiimoteTransport::setWriteQueueDepth", "The write queue must hold at least one report.");
+
+	/* Reports still waiting in the old queue are written first. */
+	this->flushWriteQueue();
+
+	QMutexLocker locker(&this->write_mutex);
+	delete this->command_queue;
+	this->command_pool->deref();
+
+	this->write_queue_depth = depth;
+	this->command_queue = new QWiimoteCommandQueue(depth);
+	this->command_pool = new QWiimoteReportPool(2 * this->command_queue->capacity());
+}
+
+/**
+ * Replaces the pool where received reports are stored.
+ * Reports already received keep their slots in the old pool until they are released.
+ * Must be called while the connection is closed.
+ * @param capacity Number of slots. It must be between 1 and 65535.
+ */
+void QWiimoteTransport::setReportPoolCapacity(int capacity)
+{
+	this->report_pool->deref();
+	this->report_pool = new QWiimoteReportPool(capacity);
+}
+
+/**
+ * Makes a writer thread write the queued reports when the writes of this transport block.
+ * The writer thread is only started while there are reports to write.
+ * Must be called before the connection is opened.
+ * @param enabled True to write from the writer thread, false to write from the thread of the transport.
+ */
+void QWiimoteTransport::setWriterThread(bool enabled)
+{
+	this->writer_thread = enabled;
+}
+
+/**
+ * Writes every report in the write queue, in order. Runs in the writer thread or in the thread of the transport.
+ * Reports are taken from the queue in batches, and superseded reports of a batch are merged.
+ */
+void QWiimoteTransport::flushWriteQueue()
+{
+	QList<QWiimoteWrite> batch;
+	QList<quint32> unneeded;
+	QWiimoteReportHandle command;
+	quint32 id;
+
+	/* Reports queued from now on schedule a new flush. */
+	this->write_flush_scheduled.fetchAndStoreOrdered(0);
+
+	forever {
+		/* Flushes from different threads, and opening or closing the connection, don't overlap.
+		 * Signals are emitted without the lock, so their receivers may close the connection. */
+		this->write_mutex.lock();
+		while (batch.size() < this->command_queue->capacity() && this->command_queue->pop(command, id)) {
+			this->mergeWrite(batch, unneeded, command, id);
+		}
+
+		for (int i = 0; i < batch.size(); i++) {
+			QWiimoteWrite &write = batch[i];
+			write.success = this->writeReport(write.command->data, write.command->size);
+
+			if (write.success) this->rumble_state = write.command->data[1] & 0x01;
+
+			/* A reporting mode is only in effect once it has been written. */
+			if (write.command->data[0] == (char)0x12) {
+				if (write.success) {
+					memcpy(this->reporting_mode, write.command->data, write.command->size);
+					this->reporting_mode_size = write.command->size;
+				} else {
+					this->reporting_mode_size = 0;
+				}
+			}
+		}
+		this->write_mutex.unlock();
+
+		if (batch.isEmpty() && unneeded.isEmpty()) return;
+
+		for (int i = 0; i < unneeded.size(); i++) {
+			emit this->reportWritten(unneeded[i], true);
+		}
+		for (int i = 0; i < batch.size(); i++) {
+			for (int j = 0; j < batch[i].ids.size(); j++) {
+				emit this->reportWritten(batch[i].ids[j], batch[i].success);
+			}
+		}
+		batch.clear();
+		unneeded.clear();
+	}
+}
+
+/* Protected functions */
+
+/**
+ * Waits until the writer thread has written the reports it has taken.
+ * Subclasses call it before closing the connection, and must not hold write_mutex.
+ */
+void QWiimoteTransport::waitForWrites()
+{
+	this->write_pool.waitForDone();
+}
+
+/* Private functions */
+
+/**
+ * Adds a command to a batch of writes, merging it with superseded or identical writes.
+ * @param batch Writes waiting to be done, in order.
+ * @param unneeded Identifiers of the commands which don't have to be written at all.
+ * @param command Encoded report.
+ * @param id Identifier of the command.
+ */
+void QWiimoteTransport::mergeWrite(QList<QWiimoteWrite> &batch, QList<quint32> &unneeded, const QWiimoteReportHandle &command, quint32 id)
+{
+	if (command->data[0] == (char)0x11) {
+		/* Only the latest LED and rumble state matters. Every output report carries the rumble flag,
+		 * so a LED report can only replace the previous write if that write is a LED report too. */
+		if (!batch.isEmpty() && batch.last().command->data[0] == (char)0x11) {
+			batch.last().command = command;
+			batch.last().ids.append(id);
+			this->writes_merged.ref();
+			return;
+		}
+	} else if (command->data[0] == (char)0x12) {
+		if (this->reporting_mode_invalid.fetchAndStoreAcquire(0) != 0) this->reporting_mode_size = 0;
+
+		/* As with LED reports, only the previous write can be merged, because it sets the same rumble state. */
+		if (!batch.isEmpty()) {
+			const QWiimoteReportHandle &pending_command = batch.last().command;
+			if (command->size == pending_command->size && memcmp(command->data, pending_command->data, command->size) == 0) {
+				this->writes_merged.ref();
+				batch.last().ids.append(id);
+				return;
+			}
+		} else if (command->size == this->reporting_mode_size &&
+				   memcmp(command->data, this->reporting_mode, command->size) == 0 &&
+				   (command->data[1] & 0x01) == this->rumble_state) {
+			/* The reporting mode and the rumble state are already the requested ones. */
+			this->writes_merged.ref();
+			unneeded.append(id);
+			return;
+		}
+	}
+
+	QWiimoteWrite write;
+	write.command = command;
+	write.ids.append(id);
+	write.success = false;
+	batch.append(write);
+}
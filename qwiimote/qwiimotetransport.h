@@ -0,0 +1,201 @@
+/*
+ * This file is part of QWiimote.
+ *
+ * QWiimote is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QWiimote is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QWiimote. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file qwiimotetransport.h
+ *
+ * Header file for the QWiimoteTransport class.
+ *
+ * QWiimoteTransport is the interface used by QWiimote to exchange reports with a wiimote.
+ */
+
+#ifndef QWIIMOTETRANSPORT_H
+#define QWIIMOTETRANSPORT_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QList>
+#include <QAtomicInt>
+#include <QMutex>
+#include <QThreadPool>
+#include "qwiimotereport.h"
+
+class QWiimoteCommandQueue;
+
+/**
+ * Output report about to be written by a #QWiimoteTransport.
+ */
+struct QWiimoteWrite {
+	QWiimoteReportHandle command; ///< Report to send.
+	QList<quint32> ids;           ///< Identifiers of the queued writes completed by this report, including merged ones.
+	bool success;                 ///< True once the report has been written.
+};
+
+/**
+ * Abstract channel through which raw reports are sent to and received from a wiimote.
+ * #QWiimote only talks to a wiimote through this interface, so any implementation can be injected.
+ * Received reports are stored in the slots of the transport's #QWiimoteReportPool.
+ *
+ * Output reports can also be sent asynchronously from any thread with queueReport(). Queued
+ * reports are written from the event loop of the transport's thread, and superseded reports
+ * are merged: a LED report replaces a LED report queued right before it, and a reporting mode
+ * report identical to the one in effect is not sent again. Queued reports are written by the
+ * transport's thread, or by a writer thread if setWriterThread() is enabled and the writes of the
+ * transport block (see writesBlock()). #QWiimote enables the writer thread unless the transport
+ * already runs in a thread of its own, so the blocking writes never block its thread.
+ * @see #QIOWiimote and #QLoopbackWiimote.
+ */
+class QWiimoteTransport : public QObject
+{
+	Q_OBJECT
+public:
+	QWiimoteTransport(QObject * parent = NULL);
+	virtual ~QWiimoteTransport();
+
+	/**
+	 * Opens the connection to a wiimote.
+	 * @return true if the connection was successfully opened. false otherwise.
+	 */
+	Q_INVOKABLE virtual bool open() = 0;
+
+	/**
+	 * Checks if communication with the Wiimote is opened.
+	 * @return True iff the Wiimote can be accessed.
+	 */
+	virtual bool isOpened() = 0;
+
+	/** Closes the connection to the Wiimote. */
+	Q_INVOKABLE virtual void close() = 0;
+
+	Q_INVOKABLE void reopen();
+
+	/**
+	 * Sends a report to the Wiimote.
+	 * @param data Report that will be sent to the wiimote.
+	 * @param max_size Size of the report. Using a size greater than #MAX_REPORT_SIZE is not allowed.
+	 * @return true if the report was sent.
+	 */
+	virtual bool writeReport(const char * data, const qint64 max_size) = 0;
+	Q_INVOKABLE bool writeReport(const QByteArray data);
+
+	quint32 queueReport(const char * data, int size);
+	void invalidateReportingMode();
+	void setWriteQueueDepth(int depth);
+	void setReportPoolCapacity(int capacity);
+	void setWriterThread(bool enabled);
+
+	/**
+	 * Checks if writeReport() waits for the device.
+	 * Only then are queued reports written by the writer thread.
+	 * @return True iff writes block.
+	 */
+	virtual bool writesBlock() const { return false; }
+
+	/**
+	 * Checks if open() may be called from a thread other than the thread of the transport.
+	 * Only then does #QWiimote reconnect from a worker thread when the transport shares its thread.
+	 * @return True iff open() can be called from any thread.
+	 */
+	virtual bool opensFromAnyThread() const { return false; }
+
+	/**
+	 * Number of pool slots the transport itself holds while reports are being read.
+	 * The pool must have this many slots beyond those kept by the receivers of the reports.
+	 * @return Number of slots.
+	 */
+	virtual int readBatchSize() const { return 1; }
+
+	/**
+	 * Maximum number of reports waiting in the write queue.
+	 * @return Depth of the write queue.
+	 */
+	int writeQueueDepth() const { return this->write_queue_depth; }
+
+	/**
+	 * Number of queued writes which were rejected because the write queue was full.
+	 * @return Number of rejected writes.
+	 */
+	quint32 writesRejected() const { return this->writes_rejected; }
+
+	/**
+	 * Number of queued writes which were merged with another write instead of being sent.
+	 * @return Number of merged writes.
+	 */
+	quint32 writesMerged() const { return this->writes_merged; }
+
+	/**
+	 * Pool where received reports are stored.
+	 * @return Report pool of this transport.
+	 */
+	QWiimoteReportPool * reportPool() const { return this->report_pool; }
+
+	/**
+	 * Identity of the connected wiimote, such as its Bluetooth address or its serial number.
+	 * Set by open(), so it must be read after open() has returned.
+	 * @return Identity of the wiimote, or an empty string if it is unknown.
+	 */
+	QString deviceIdentity() const { return this->device_identity; }
+
+protected:
+	QWiimoteReportPool * report_pool; ///< Pool where received reports are stored.
+	QString device_identity;          ///< Identity of the connected wiimote. Set by subclasses when opening.
+	QMutex write_mutex;               ///< Held while flushWriteQueue() writes. Subclasses hold it while they open or close the connection.
+
+	void waitForWrites();
+
+private:
+	QWiimoteCommandQueue * command_queue;  ///< Reports waiting to be written.
+	QWiimoteReportPool * command_pool;     ///< Slots into which queued reports are encoded.
+	int write_queue_depth;                 ///< Requested capacity of command_queue.
+	QAtomicInt write_flush_scheduled;      ///< 1 if flushWriteQueue() has been scheduled and has not started yet.
+	QAtomicInt next_write_id;              ///< Identifier of the next queued write.
+	QAtomicInt reporting_mode_invalid;     ///< 1 if reporting_mode must be forgotten.
+	char reporting_mode[MAX_REPORT_SIZE];  ///< Last reporting mode report written successfully. Only used by the transport's thread.
+	int reporting_mode_size;               ///< Size of reporting_mode, or 0 if it is unknown.
+	int rumble_state;                      ///< Rumble flag of the last report written, or -1 if it is unknown. Only used by the thread which writes.
+	QAtomicInt writes_rejected;            ///< Number of writes rejected because the queue was full.
+	QAtomicInt writes_merged;              ///< Number of writes merged with another one.
+	QThreadPool write_pool;                ///< Runs flushWriteQueue() when the writer thread is enabled. It has a single thread.
+	bool writer_thread;                    ///< True if queued reports are written by write_pool.
+
+	void mergeWrite(QList<QWiimoteWrite> &batch, QList<quint32> &unneeded, const QWiimoteReportHandle &command, quint32 id);
+
+public slots:
+	void flushWriteQueue();
+
+signals:
+	/**
+	 * This signal is emmited whenever a new report is ready for being processed.
+	 * The handle can be kept or used with queued connections.
+	 */
+	void reportReady(const QWiimoteReportHandle &report);
+	/** This signal is emmited whenever an error is found at a received report. */
+	void reportError();
+	/**
+	 * This signal is emmited when a report queued with queueReport() has been written.
+	 * @param id Identifier returned by queueReport().
+	 * @param success True if the report was written, or if it was not needed.
+	 */
+	void reportWritten(quint32 id, bool success);
+	/**
+	 * This signal is emmited when reopen() finishes.
+	 * @param success True if the connection was opened again.
+	 */
+	void reopened(bool success);
+};
+
+#endif // QWIIMOTETRANSPORT_H
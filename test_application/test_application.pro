@@ -27,8 +27,10 @@ HEADERS += wmainwindow.h \
 
 FORMS += wmainwindow.ui
 
-LIBS += libsetupapi \
-	libhid
+win32 {
+	LIBS += libsetupapi \
+		libhid
+}
 
 # Use a different library for Debug/Release.
 if debug {
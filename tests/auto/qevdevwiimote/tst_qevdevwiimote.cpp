@@ -0,0 +1,301 @@
+/*
+ * This file is part of QWiimote.
+ *
+ * QWiimote is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QWiimote is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QWiimote. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file tst_qevdevwiimote.cpp
+ *
+ * Tests of the input reports synthesized by QEvdevWiimote from recorded hid-wiimote events.
+ */
+
+#include <QtTest>
+#include <QCoreApplication>
+#include <QFile>
+#include <QTemporaryFile>
+#include <cstring>
+#include <linux/input.h>
+#include "qevdevwiimote.h"
+#include "qwiimote.h"
+
+/* Older kernel headers only have the timeval member. */
+#if !defined(input_event_sec)
+#	define input_event_sec time.tv_sec
+#	define input_event_usec time.tv_usec
+#endif
+
+/**
+ * Names of the event types and codes used by the recordings.
+ */
+static const struct {
+	const char * name;
+	int value;
+} EventNames[] = {
+	{"EV_SYN",     EV_SYN},
+	{"EV_KEY",     EV_KEY},
+	{"EV_ABS",     EV_ABS},
+	{"SYN_REPORT", SYN_REPORT},
+	{"BTN_A",      BTN_A},
+	{"BTN_B",      BTN_B},
+	{"ABS_RX",     ABS_RX},
+	{"ABS_RY",     ABS_RY},
+	{"ABS_RZ",     ABS_RZ},
+};
+
+/** Times of the synthesized reports, in milliseconds since the first one. */
+static const int ReportTimes[] = {0, 10, 15, 20, 30, 35, 40};
+/** Number of reports synthesized from the recordings. */
+static const int ReportCount = sizeof(ReportTimes) / sizeof(ReportTimes[0]);
+/** Raw acceleration of each report. The lowest bit of y and z is not sent. */
+static const quint16 ReportAccelerations[ReportCount][3] = {
+	{512, 512, 616}, {522, 492, 612}, {522, 492, 612}, {616, 512, 512},
+	{408, 517, 509}, {408, 517, 509}, {512, 512, 616},
+};
+/** True if A is pressed in each report. */
+static const bool ReportButtonA[ReportCount] = {false, false, true, true, true, false, false};
+/** Raw MotionPlus speeds (yaw, roll, pitch) of each report. */
+static const quint16 ReportSpeeds[ReportCount][3] = {
+	{8192, 8192, 8192}, {8292, 7992, 8202}, {8292, 7992, 8202}, {10636, 8192, 5748},
+	{8192, 8192, 8192}, {8192, 8192, 8192}, {8192, 8192, 8192},
+};
+/** Slow mode flags (yaw, roll, pitch) of each report. */
+static const bool ReportSlow[ReportCount][3] = {
+	{true, true, true}, {true, true, true}, {true, true, true}, {false, true, false},
+	{true, true, true}, {true, true, true}, {true, true, true},
+};
+
+class TestQEvdevWiimote : public QObject
+{
+	Q_OBJECT
+public slots:
+	void storeReport(const QWiimoteReportHandle &report);
+
+private slots:
+	void init();
+	void cleanup();
+
+	void accelerometerReports();
+	void motionPlusReports();
+	void closingStopsTheReplay();
+
+private:
+	static bool convertRecording(const QString &name, QTemporaryFile &binary);
+	bool waitForReports(int count);
+	void checkReports(quint8 type);
+
+	QEvdevWiimote * wiimote;             ///< Transport under test.
+	QList<QWiimoteReportHandle> reports; ///< Input reports received, without replies.
+	QPreciseTime opened;                 ///< Time when the replay was opened.
+	QTemporaryFile * buttons;            ///< Binary recording of the buttons node.
+	QTemporaryFile * accelerometer;      ///< Binary recording of the accelerometer node.
+	QTemporaryFile * motionplus;         ///< Binary recording of the MotionPlus node.
+};
+
+/**
+ * Converts a text recording of the data directory to the struct input_event sequence read by
+ * QEvdevWiimote. The text form is used because the binary one depends on the architecture.
+ * @param name File name of the recording.
+ * @param binary Open file where the events are written.
+ * @return True iff every line could be converted.
+ */
+bool TestQEvdevWiimote::convertRecording(const QString &name, QTemporaryFile &binary)
+{
+	QFile text(QString(SRCDIR "data/") + name);
+	if (!text.open(QIODevice::ReadOnly | QIODevice::Text)) return false;
+
+	while (!text.atEnd()) {
+		QString line = QString::fromLatin1(text.readLine()).trimmed();
+		if (line.isEmpty() || line.startsWith('#')) continue;
+
+		QStringList fields = line.split(' ', QString::SkipEmptyParts);
+		QStringList time = fields.value(0).split('.');
+		if (fields.size() != 4 || time.size() != 2) return false;
+
+		struct input_event event;
+		memset(&event, 0, sizeof(event));
+		event.input_event_sec = time[0].toLong();
+		event.input_event_usec = time[1].toLong();
+		event.value = fields[3].toInt();
+
+		int found = 0;
+		for (uint i = 0; i < sizeof(EventNames) / sizeof(EventNames[0]); i++) {
+			if (fields[1] == EventNames[i].name) {
+				event.type = EventNames[i].value;
+				found++;
+			}
+			if (fields[2] == EventNames[i].name) {
+				event.code = EventNames[i].value;
+				found++;
+			}
+		}
+		if (found != 2) return false;
+
+		if (binary.write((const char *)&event, sizeof(event)) != sizeof(event)) return false;
+	}
+
+	return binary.flush();
+}
+
+/**
+ * Keeps the input reports emitted by the transport. Replies to requests are ignored.
+ * @param report Report emitted.
+ */
+void TestQEvdevWiimote::storeReport(const QWiimoteReportHandle &report)
+{
+	if ((report->data[0] & 0xF0) == 0x30) this->reports.append(report);
+}
+
+/**
+ * Processes events until a number of input reports have been received.
+ * @param count Number of reports to wait for.
+ * @return True iff at least count reports were received.
+ */
+bool TestQEvdevWiimote::waitForReports(int count)
+{
+	for (int waited = 0; this->reports.size() < count && waited < 3000; waited += 10) {
+		QTest::qWait(10);
+	}
+
+	return this->reports.size() >= count;
+}
+
+/**
+ * Compares the received reports with the expected ones.
+ * @param type Expected report type, 0x31 or 0x35.
+ */
+void TestQEvdevWiimote::checkReports(quint8 type)
+{
+	QCOMPARE(this->reports.size(), ReportCount);
+
+	/* The replay starts when it is opened, and the recorded intervals are kept exactly. */
+	QPreciseTime first = this->reports[0]->time;
+	QVERIFY(qAbs((first - this->opened).nanoseconds()) < Q_INT64_C(1000000000));
+
+	for (int i = 0; i < ReportCount; i++) {
+		const QWiimoteReport &report = *this->reports[i];
+		const quint8 * data = (const quint8 *)report.data;
+		QCOMPARE(data[0], type);
+		QCOMPARE(report.size, (type == 0x35) ? 22 : 6);
+		QCOMPARE((report.time - first).nanoseconds(), ReportTimes[i] * Q_INT64_C(1000000));
+
+		quint16 buttons = data[1] | (data[2] << 8);
+		QCOMPARE((buttons & QWiimote::ButtonA) != 0, ReportButtonA[i]);
+
+		quint16 x = (data[3] << 2) | ((data[1] >> 5) & 0x03);
+		quint16 y = (data[4] << 2) | ((data[2] >> 4) & 0x02);
+		quint16 z = (data[5] << 2) | ((data[2] >> 5) & 0x02);
+		QCOMPARE(x, ReportAccelerations[i][0]);
+		QCOMPARE(y, (quint16)(ReportAccelerations[i][1] & ~0x01));
+		QCOMPARE(z, (quint16)(ReportAccelerations[i][2] & ~0x01));
+
+		if (type != 0x35) continue;
+		const quint8 * extension = data + 6;
+		QCOMPARE((quint16)(extension[0] | ((extension[3] & 0xFC) << 6)), ReportSpeeds[i][0]);
+		QCOMPARE((quint16)(extension[1] | ((extension[4] & 0xFC) << 6)), ReportSpeeds[i][1]);
+		QCOMPARE((quint16)(extension[2] | ((extension[5] & 0xFC) << 6)), ReportSpeeds[i][2]);
+		QCOMPARE((extension[3] & 0x02) != 0, ReportSlow[i][0]);
+		QCOMPARE((extension[4] & 0x02) != 0, ReportSlow[i][1]);
+		QCOMPARE((extension[3] & 0x01) != 0, ReportSlow[i][2]);
+		/* MotionPlus data flag. */
+		QVERIFY(extension[5] & 0x02);
+	}
+}
+
+void TestQEvdevWiimote::init()
+{
+	this->wiimote = new QEvdevWiimote();
+	connect(this->wiimote, SIGNAL(reportReady(QWiimoteReportHandle)), this, SLOT(storeReport(QWiimoteReportHandle)));
+
+	this->buttons = new QTemporaryFile();
+	this->accelerometer = new QTemporaryFile();
+	this->motionplus = new QTemporaryFile();
+	QVERIFY(this->buttons->open() && this->accelerometer->open() && this->motionplus->open());
+	QVERIFY(convertRecording("buttons.txt", *this->buttons));
+	QVERIFY(convertRecording("accelerometer.txt", *this->accelerometer));
+	QVERIFY(convertRecording("motionplus.txt", *this->motionplus));
+}
+
+void TestQEvdevWiimote::cleanup()
+{
+	delete this->wiimote;
+	this->wiimote = NULL;
+	this->reports.clear();
+	delete this->buttons;
+	delete this->accelerometer;
+	delete this->motionplus;
+}
+
+/**
+ * With continuous 0x31 reports, each accelerometer batch and each button change produces a report.
+ */
+void TestQEvdevWiimote::accelerometerReports()
+{
+	this->opened = QPreciseTime::currentTime();
+	QVERIFY(this->wiimote->openReplay(this->buttons->fileName(), this->accelerometer->fileName()));
+
+	/* The replay starts from the event loop, so the reporting mode is set before the first event. */
+	char mode[] = {0x12, 0x04, 0x31};
+	QVERIFY(this->wiimote->writeReport(mode, 3));
+
+	QVERIFY(this->waitForReports(ReportCount));
+	QTest::qWait(50);
+	this->checkReports(0x31);
+}
+
+/**
+ * With continuous 0x35 reports and an active MotionPlus, each MotionPlus batch and each
+ * button change produces a report carrying the last state of both nodes.
+ */
+void TestQEvdevWiimote::motionPlusReports()
+{
+	this->opened = QPreciseTime::currentTime();
+	QVERIFY(this->wiimote->openReplay(this->buttons->fileName(), this->accelerometer->fileName(),
+									  this->motionplus->fileName()));
+
+	/* Activate the MotionPlus by writing 0x04 to 0xA600FE, then request 0x35 reports. */
+	char activation[22] = {0x16, 0x04, (char)0xA6, 0x00, (char)0xFE, 0x01, 0x04};
+	QVERIFY(this->wiimote->writeReport(activation, sizeof(activation)));
+	char mode[] = {0x12, 0x04, 0x35};
+	QVERIFY(this->wiimote->writeReport(mode, 3));
+
+	QVERIFY(this->waitForReports(ReportCount));
+	QTest::qWait(50);
+	this->checkReports(0x35);
+}
+
+/**
+ * No report is synthesized once the replay has been closed.
+ */
+void TestQEvdevWiimote::closingStopsTheReplay()
+{
+	QVERIFY(this->wiimote->openReplay(this->buttons->fileName(), this->accelerometer->fileName()));
+	char mode[] = {0x12, 0x04, 0x31};
+	QVERIFY(this->wiimote->writeReport(mode, 3));
+	this->wiimote->close();
+	QVERIFY(!this->wiimote->isOpened());
+
+	QTest::qWait(100);
+	QCOMPARE(this->reports.size(), 0);
+}
+
+/* The replay is paced by timers, which need an event loop but no display. */
+int main(int argc, char ** argv)
+{
+	QCoreApplication app(argc, argv);
+	TestQEvdevWiimote test;
+	return QTest::qExec(&test, argc, argv);
+}
+
+#include "tst_qevdevwiimote.moc"
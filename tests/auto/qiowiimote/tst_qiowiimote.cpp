@@ -0,0 +1,370 @@
+/*
+ * This file is part of QWiimote.
+ *
+ * QWiimote is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QWiimote is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QWiimote. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file tst_qiowiimote.cpp
+ *
+ * Tests of the Linux QIOWiimote backend, which is fed through one end of a socketpair.
+ */
+
+#include <QtTest>
+#include <QCoreApplication>
+#include <QtConcurrentRun>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "qiowiimote.h"
+
+class TestQIOWiimote : public QObject
+{
+	Q_OBJECT
+private slots:
+	void init();
+	void cleanup();
+
+	void openWritesAnEmptyLedReport();
+	void readsInBatches_data();
+	void readsInBatches();
+	void openFromAnotherThread();
+	void keptReportsAreNotOverwritten();
+	void writes();
+	void queuedWrites();
+	void writerThread();
+	void disconnection();
+	void closeStopsReading();
+
+public slots:
+	void receiveReport(const QWiimoteReportHandle &report);
+
+private:
+	static QByteArray report(int index);
+	bool sendToWiimote(const QByteArray &report);
+	QByteArray receiveFromWiimote();
+	bool waitForReports(int count, int timeout = 3000);
+
+	QIOWiimote * iowiimote;             ///< Backend under test.
+	int peer;                           ///< End of the socketpair which plays the wiimote.
+	bool keep_handles;                  ///< True if received handles are kept instead of copied.
+	QList<QByteArray> received;         ///< Contents of the received reports, in order.
+	QList<QWiimoteReportHandle> kept;   ///< Received handles, if keep_handles is set.
+};
+
+/**
+ * Builds an input report which can be recognized after being received.
+ * Sizes change from report to report, so every report must be read on its own.
+ * @param index Number of the report.
+ * @return Report.
+ */
+QByteArray TestQIOWiimote::report(int index)
+{
+	QByteArray data(4 + index % 3, 0);
+	data[0] = (char)0x30;
+	data[1] = (char)(index >> 8);
+	data[2] = (char)index;
+	for (int i = 3; i < data.size(); i++) data[i] = (char)(index + i);
+	return data;
+}
+
+/**
+ * Sends an input report from the emulated wiimote.
+ * @param report Report.
+ * @return True iff the whole report was sent.
+ */
+bool TestQIOWiimote::sendToWiimote(const QByteArray &report)
+{
+	return ::write(this->peer, report.constData(), report.size()) == report.size();
+}
+
+/**
+ * Takes the next output report written by the backend, without blocking.
+ * @return Report, or an empty array if nothing was written.
+ */
+QByteArray TestQIOWiimote::receiveFromWiimote()
+{
+	char buffer[MAX_REPORT_SIZE + 1];
+	ssize_t size = ::read(this->peer, buffer, sizeof(buffer));
+	return size > 0 ? QByteArray(buffer, size) : QByteArray();
+}
+
+/**
+ * Processes events until a number of reports have been received.
+ * @param count Number of reports to wait for.
+ * @param timeout Maximum time to wait in milliseconds.
+ * @return True iff at least count reports were received.
+ */
+bool TestQIOWiimote::waitForReports(int count, int timeout)
+{
+	for (int waited = 0; this->received.size() < count && waited < timeout; waited += 10) {
+		QTest::qWait(10);
+	}
+
+	return this->received.size() >= count;
+}
+
+/**
+ * Stores a report emitted by the backend.
+ * @param report Received report.
+ */
+void TestQIOWiimote::receiveReport(const QWiimoteReportHandle &report)
+{
+	this->received.append(QByteArray(report->data, report->size));
+	if (this->keep_handles) this->kept.append(report);
+}
+
+void TestQIOWiimote::init()
+{
+	/* Sequenced packets keep the boundaries of the reports, as a hidraw node does. */
+	int descriptors[2];
+	QVERIFY(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, descriptors) == 0);
+	this->peer = descriptors[1];
+	fcntl(this->peer, F_SETFL, fcntl(this->peer, F_GETFL) | O_NONBLOCK);
+
+	this->keep_handles = false;
+	this->received.clear();
+	this->kept.clear();
+
+	this->iowiimote = new QIOWiimote();
+	connect(this->iowiimote, SIGNAL(reportReady(QWiimoteReportHandle)), this, SLOT(receiveReport(QWiimoteReportHandle)));
+	if (!this->iowiimote->openDescriptor(descriptors[0])) {
+		::close(descriptors[0]);
+		QFAIL("The socket could not be opened.");
+	}
+}
+
+void TestQIOWiimote::cleanup()
+{
+	this->kept.clear();
+	delete this->iowiimote;
+	this->iowiimote = NULL;
+	if (this->peer >= 0) ::close(this->peer);
+}
+
+/**
+ * Opening the descriptor checks the connection with an empty LED report.
+ */
+void TestQIOWiimote::openWritesAnEmptyLedReport()
+{
+	QVERIFY(this->iowiimote->isOpened());
+	QCOMPARE(this->receiveFromWiimote(), QByteArray("\x11\x00", 2));
+	QCOMPARE(this->receiveFromWiimote(), QByteArray());
+}
+
+void TestQIOWiimote::readsInBatches_data()
+{
+	QTest::addColumn<int>("depth");
+	QTest::addColumn<int>("count");
+	QTest::addColumn<int>("overruns");
+
+	/* A batch which fills every buffer counts as an overrun, even if nothing else was waiting. */
+	QTest::newRow("one report per read") << 1 << 5  << 5;
+	QTest::newRow("partial batch")       << 8 << 3  << 0;
+	QTest::newRow("full batches")        << 4 << 8  << 2;
+	QTest::newRow("full and partial")    << 4 << 10 << 2;
+}
+
+/**
+ * The connection can be opened by a worker thread; reads are still done by the thread of the backend.
+ */
+void TestQIOWiimote::openFromAnotherThread()
+{
+	int descriptors[2];
+	QVERIFY(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, descriptors) == 0);
+	::close(this->peer);
+	this->peer = descriptors[1];
+	fcntl(this->peer, F_SETFL, fcntl(this->peer, F_GETFL) | O_NONBLOCK);
+
+	/* The connection is closed by the thread which owns the backend, as QWiimote does. */
+	this->iowiimote->close();
+	QFuture<bool> opened = QtConcurrent::run(this->iowiimote, &QIOWiimote::openDescriptor, descriptors[0]);
+	QVERIFY(opened.result());
+	QVERIFY(this->iowiimote->isOpened());
+	QCOMPARE(this->receiveFromWiimote(), QByteArray("\x11\x00", 2));
+
+	for (int i = 0; i < 3; i++) QVERIFY(this->sendToWiimote(report(i)));
+	QVERIFY(this->waitForReports(3));
+	for (int i = 0; i < 3; i++) QCOMPARE(this->received[i], report(i));
+}
+
+/**
+ * Every report waiting in the socket is read in batches of #readQueueDepth reports, and emitted in order.
+ */
+void TestQIOWiimote::readsInBatches()
+{
+	QFETCH(int, depth);
+	QFETCH(int, count);
+	QFETCH(int, overruns);
+
+	/* The depth is used when the descriptor is opened. */
+	int descriptors[2];
+	QVERIFY(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, descriptors) == 0);
+	::close(this->peer);
+	this->peer = descriptors[1];
+	fcntl(this->peer, F_SETFL, fcntl(this->peer, F_GETFL) | O_NONBLOCK);
+	this->iowiimote->setReadQueueDepth(depth);
+	QVERIFY(this->iowiimote->openDescriptor(descriptors[0]));
+	QCOMPARE(this->iowiimote->readQueueDepth(), depth);
+
+	/* Every report is waiting before the event loop notices the first one. */
+	for (int i = 0; i < count; i++) QVERIFY(this->sendToWiimote(report(i)));
+
+	QVERIFY(this->waitForReports(count));
+	QTest::qWait(50);
+	QCOMPARE(this->received.size(), count);
+	for (int i = 0; i < count; i++) QCOMPARE(this->received[i], report(i));
+	QCOMPARE(this->iowiimote->readQueueOverruns(), (quint32)overruns);
+}
+
+/**
+ * Slots kept by the receiver are not reused for later reads.
+ */
+void TestQIOWiimote::keptReportsAreNotOverwritten()
+{
+	this->keep_handles = true;
+	for (int i = 0; i < 20; i++) QVERIFY(this->sendToWiimote(report(i)));
+	QVERIFY(this->waitForReports(20));
+
+	QCOMPARE(this->kept.size(), 20);
+	for (int i = 0; i < 20; i++) {
+		QCOMPARE(QByteArray(this->kept[i]->data, this->kept[i]->size), report(i));
+	}
+	QCOMPARE(this->iowiimote->reportPool()->exhaustions(), (quint32)0);
+}
+
+/**
+ * writeReport() sends exactly the given bytes, one report per write.
+ */
+void TestQIOWiimote::writes()
+{
+	this->receiveFromWiimote();
+
+	QByteArray leds("\x11\x50", 2);
+	QByteArray mode("\x12\x00\x31", 3);
+	QVERIFY(this->iowiimote->writeReport(leds));
+	QVERIFY(this->iowiimote->writeReport(mode.constData(), mode.size()));
+
+	QCOMPARE(this->receiveFromWiimote(), leds);
+	QCOMPARE(this->receiveFromWiimote(), mode);
+	QCOMPARE(this->receiveFromWiimote(), QByteArray());
+}
+
+/**
+ * Queued reports are written from the event loop, in order, and their writes are signalled.
+ */
+void TestQIOWiimote::queuedWrites()
+{
+	this->receiveFromWiimote();
+	QSignalSpy spy(this->iowiimote, SIGNAL(reportWritten(quint32, bool)));
+
+	QByteArray mode("\x12\x00\x31", 3);
+	QByteArray status("\x15\x00", 2);
+	quint32 first = this->iowiimote->queueReport(mode.constData(), mode.size());
+	quint32 second = this->iowiimote->queueReport(status.constData(), status.size());
+	QVERIFY(first != 0 && second != 0);
+
+	for (int waited = 0; spy.count() < 2 && waited < 3000; waited += 10) QTest::qWait(10);
+	QCOMPARE(spy.count(), 2);
+	QCOMPARE(spy[0][0].toUInt(), first);
+	QCOMPARE(spy[1][0].toUInt(), second);
+	QVERIFY(spy[0][1].toBool() && spy[1][1].toBool());
+
+	QCOMPARE(this->receiveFromWiimote(), mode);
+	QCOMPARE(this->receiveFromWiimote(), status);
+	QCOMPARE(this->receiveFromWiimote(), QByteArray());
+}
+
+/**
+ * With the writer thread, queued reports are written while this thread does not process events.
+ */
+void TestQIOWiimote::writerThread()
+{
+	this->receiveFromWiimote();
+	QVERIFY(this->iowiimote->writesBlock());
+	this->iowiimote->setWriterThread(true);
+
+	QByteArray mode("\x12\x00\x31", 3);
+	QByteArray leds("\x11\x10", 2);
+	QVERIFY(this->iowiimote->queueReport(mode.constData(), mode.size()) != 0);
+	QVERIFY(this->iowiimote->queueReport(leds.constData(), leds.size()) != 0);
+
+	QByteArray first;
+	for (int waited = 0; first.isEmpty() && waited < 3000; waited += 10) {
+		QTest::qSleep(10);
+		first = this->receiveFromWiimote();
+	}
+	QCOMPARE(first, mode);
+	QTest::qSleep(100);
+	QCOMPARE(this->receiveFromWiimote(), leds);
+
+	/* close() waits for the writer thread, and its LED report is the last one. */
+	QVERIFY(this->iowiimote->queueReport(leds.constData(), leds.size()) != 0);
+	this->iowiimote->close();
+	QByteArray last;
+	for (QByteArray report = this->receiveFromWiimote(); !report.isEmpty(); report = this->receiveFromWiimote()) {
+		last = report;
+	}
+	QCOMPARE(last, QByteArray("\x11\x00", 2));
+}
+
+/**
+ * Closing the other end is reported as an error, and reading stops.
+ */
+void TestQIOWiimote::disconnection()
+{
+	QSignalSpy spy(this->iowiimote, SIGNAL(reportError()));
+	QVERIFY(this->sendToWiimote(report(0)));
+	QVERIFY(this->waitForReports(1));
+
+	::close(this->peer);
+	this->peer = -1;
+	for (int waited = 0; spy.count() < 1 && waited < 3000; waited += 10) QTest::qWait(10);
+	QCOMPARE(spy.count(), 1);
+
+	/* The notifier is disabled, so the error is not reported again. */
+	QTest::qWait(100);
+	QCOMPARE(spy.count(), 1);
+	QCOMPARE(this->received.size(), 1);
+}
+
+/**
+ * close() turns the LEDs off and no more reports are read.
+ */
+void TestQIOWiimote::closeStopsReading()
+{
+	this->receiveFromWiimote();
+	this->iowiimote->close();
+	QVERIFY(!this->iowiimote->isOpened());
+	QCOMPARE(this->receiveFromWiimote(), QByteArray("\x11\x00", 2));
+
+	/* The descriptor has been closed, so the emulated wiimote can't send anything. */
+	QVERIFY(!this->sendToWiimote(report(0)));
+	QTest::qWait(100);
+	QCOMPARE(this->received.size(), 0);
+	QVERIFY(!this->iowiimote->writeReport(QByteArray("\x11\x00", 2)));
+}
+
+/* QTEST_MAIN would need a display for the QApplication of QtGui. */
+int main(int argc, char ** argv)
+{
+	QCoreApplication app(argc, argv);
+	/* Writing to a socket whose other end is closed must fail instead of killing the test. */
+	signal(SIGPIPE, SIG_IGN);
+	TestQIOWiimote test;
+	return QTest::qExec(&test, argc, argv);
+}
+
+#include "tst_qiowiimote.moc"
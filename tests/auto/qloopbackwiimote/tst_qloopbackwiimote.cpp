@@ -0,0 +1,245 @@
+/*
+ * This file is part of QWiimote.
+ *
+ * QWiimote is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QWiimote is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QWiimote. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file tst_qloopbackwiimote.cpp
+ *
+ * Tests of the samples of QLoopbackWiimote, as decoded by QWiimote, and of the writes it receives.
+ */
+
+#include <QtTest>
+#include <QCoreApplication>
+#include "qwiimote.h"
+#include "qloopbackwiimote.h"
+
+class TestQLoopbackWiimote : public QObject
+{
+	Q_OBJECT
+private slots:
+	void init();
+	void cleanup();
+
+	void acceleration_data();
+	void acceleration();
+	void consecutiveLedReportsAreMerged();
+	void rumbleFollowsTheLastWrite();
+	void repliesWaitForTheLatency();
+
+private:
+	bool pumpUntil(QSignalSpy &spy, quint8 reporting_mode, int timeout = 3000);
+	void queue(const char * report, int size);
+
+	QLoopbackWiimote * transport; ///< Emulated wiimote, owned by the wiimote.
+	QWiimote * wiimote;           ///< Wiimote under test.
+};
+
+/**
+ * Generates input reports until the acceleration has been updated and a reporting mode is in effect.
+ * @param spy Spy of #QWiimote::updatedAcceleration.
+ * @param reporting_mode Reporting mode to wait for.
+ * @param timeout Maximum time to wait in milliseconds.
+ * @return True iff both happened.
+ */
+bool TestQLoopbackWiimote::pumpUntil(QSignalSpy &spy, quint8 reporting_mode, int timeout)
+{
+	for (int waited = 0; waited < timeout; waited += 10) {
+		if (spy.count() > 0 && this->transport->reportingMode() == reporting_mode) return true;
+		this->transport->pump(1);
+		QTest::qWait(10);
+	}
+
+	return false;
+}
+
+/**
+ * Queues a report to be written to the emulated wiimote.
+ * @param report Report.
+ * @param size Size of the report.
+ */
+void TestQLoopbackWiimote::queue(const char * report, int size)
+{
+	QVERIFY(this->transport->queueReport(report, size) != 0);
+}
+
+void TestQLoopbackWiimote::init()
+{
+	/* Every axis has its own calibration, so swapped axes can't give the expected values. */
+	const quint16 zero[3] = {500, 510, 520};
+	const quint16 gravity[3] = {600, 614, 628};
+
+	this->transport = new QLoopbackWiimote();
+	this->transport->setAccelerationCalibration(zero, gravity);
+	/* Reports are only generated by pump(). */
+	this->transport->setReportRate(0);
+
+	this->wiimote = new QWiimote(this->transport);
+	this->wiimote->setCalibrationCacheEnabled(false);
+}
+
+void TestQLoopbackWiimote::cleanup()
+{
+	delete this->wiimote;
+	this->wiimote = NULL;
+	this->transport = NULL;
+}
+
+void TestQLoopbackWiimote::acceleration_data()
+{
+	QTest::addColumn<int>("data_types");
+	QTest::addColumn<int>("reporting_mode");
+	QTest::addColumn<int>("raw_x");
+	QTest::addColumn<int>("raw_y");
+	QTest::addColumn<int>("raw_z");
+	QTest::addColumn<qreal>("x");
+	QTest::addColumn<qreal>("y");
+	QTest::addColumn<qreal>("z");
+
+	const int accelerometer = QWiimote::AccelerometerData;
+	const int motionplus = QWiimote::AccelerometerData | QWiimote::MotionPlusData;
+
+	/* The lowest bit of y and z is not sent, so they are even. */
+	QTest::newRow("0x31 x")     << accelerometer << 0x31 << 600 << 510 << 520 << 1.0 << 0.0 << 0.0;
+	QTest::newRow("0x31 y")     << accelerometer << 0x31 << 500 << 614 << 520 << 0.0 << 1.0 << 0.0;
+	QTest::newRow("0x31 z")     << accelerometer << 0x31 << 500 << 510 << 628 << 0.0 << 0.0 << 1.0;
+	QTest::newRow("0x31 mixed") << accelerometer << 0x31 << 550 << 562 << 466 << 0.5 << 0.5 << -0.5;
+	QTest::newRow("0x35 mixed") << motionplus    << 0x35 << 550 << 562 << 466 << 0.5 << 0.5 << -0.5;
+	QTest::newRow("0x35 odd x") << motionplus    << 0x35 << 451 << 458 << 574 << -0.49 << -0.5 << 0.5;
+}
+
+/**
+ * A sample comes out of QWiimote with the same axes, and is calibrated with the records of the emulated EEPROM.
+ */
+void TestQLoopbackWiimote::acceleration()
+{
+	QFETCH(int, data_types);
+	QFETCH(int, reporting_mode);
+	QFETCH(int, raw_x);
+	QFETCH(int, raw_y);
+	QFETCH(int, raw_z);
+	QFETCH(qreal, x);
+	QFETCH(qreal, y);
+	QFETCH(qreal, z);
+
+	QSignalSpy spy(this->wiimote, SIGNAL(updatedAcceleration()));
+	QVERIFY(this->wiimote->start((QWiimote::DataTypes)data_types));
+	this->wiimote->setAccelerationSmoothing(QWiimote::SmoothingNone);
+
+	/* The default sample of a wiimote lying face up is sent until the reporting mode is in effect. */
+	QVERIFY(this->pumpUntil(spy, reporting_mode));
+	QVERIFY((this->wiimote->acceleration() - QVector3D(0.12, 0.019, 0.889)).length() < 0.01);
+
+	QLoopbackSample sample;
+	sample.buttons = 0;
+	sample.acceleration[0] = raw_x;
+	sample.acceleration[1] = raw_y;
+	sample.acceleration[2] = raw_z;
+	for (int i = 0; i < 3; i++) {
+		sample.motionplus[i] = 8000;
+		sample.motionplus_slow[i] = true;
+	}
+	this->transport->setScript(QList<QLoopbackSample>() << sample);
+
+	spy.clear();
+	this->transport->pump(1);
+	QCOMPARE(spy.count(), 1);
+	QCOMPARE(this->wiimote->rawAcceleration(), QVector3D(raw_x, raw_y, raw_z));
+	QCOMPARE(this->wiimote->acceleration(), QVector3D(x, y, z));
+}
+
+/**
+ * A LED report replaces the LED report queued right before it.
+ */
+void TestQLoopbackWiimote::consecutiveLedReportsAreMerged()
+{
+	QVERIFY(this->transport->open());
+	this->queue("\x11\x10", 2);
+	this->queue("\x11\x20", 2);
+	this->transport->flushWriteQueue();
+
+	QCOMPARE(this->transport->writesMerged(), (quint32)1);
+	QCOMPARE(this->transport->leds(), (quint8)0x20);
+}
+
+/**
+ * Every output report carries the rumble flag, so writes are not merged across a report of another type.
+ */
+void TestQLoopbackWiimote::rumbleFollowsTheLastWrite()
+{
+	QVERIFY(this->transport->open());
+
+	/* LED reports with a reporting mode in between. */
+	this->queue("\x11\x01", 2);
+	this->queue("\x12\x05\x31", 3);
+	this->queue("\x11\x00", 2);
+	this->transport->flushWriteQueue();
+	QCOMPARE(this->transport->writesMerged(), (quint32)0);
+	QCOMPARE(this->transport->leds() & 0x01, 0);
+
+	/* Identical reporting modes with a LED report in between. */
+	this->queue("\x12\x04\x31", 3);
+	this->queue("\x11\x01", 2);
+	this->queue("\x12\x04\x31", 3);
+	this->transport->flushWriteQueue();
+	QCOMPARE(this->transport->writesMerged(), (quint32)0);
+	QCOMPARE(this->transport->leds() & 0x01, 0);
+
+	/* The reporting mode in effect is not sent again while the rumble state is the same. */
+	this->queue("\x12\x04\x31", 3);
+	this->transport->flushWriteQueue();
+	QCOMPARE(this->transport->writesMerged(), (quint32)1);
+	this->queue("\x11\x01", 2);
+	this->transport->flushWriteQueue();
+	this->queue("\x12\x04\x31", 3);
+	this->transport->flushWriteQueue();
+	QCOMPARE(this->transport->writesMerged(), (quint32)1);
+	QCOMPARE(this->transport->leds() & 0x01, 0);
+	QCOMPARE(this->transport->reportingMode(), (quint8)0x31);
+}
+
+/**
+ * Replies are delivered in order, once the reply latency has passed since their request.
+ */
+void TestQLoopbackWiimote::repliesWaitForTheLatency()
+{
+	QVERIFY(this->transport->open());
+	this->transport->setReplyLatency(200);
+	QCOMPARE(this->transport->replyLatency(), 200);
+	QSignalSpy spy(this->transport, SIGNAL(reportReady(QWiimoteReportHandle)));
+
+	/* A status request is answered with a status report, a memory read with a data report. */
+	QPreciseTime sent = QPreciseTime::currentTime();
+	QVERIFY(this->transport->writeReport(QByteArray("\x15\x00", 2)));
+	QVERIFY(this->transport->writeReport(QByteArray("\x17\x00\x00\x00\x16\x00\x01", 7)));
+	QTest::qWait(50);
+	QCOMPARE(spy.count(), 0);
+
+	for (int waited = 0; spy.count() < 2 && waited < 2000; waited += 10) QTest::qWait(10);
+	QVERIFY(sent.elapsed() >= 200);
+	QCOMPARE(spy.count(), 2);
+	QCOMPARE((quint8)spy[0][0].value<QWiimoteReportHandle>()->data[0], (quint8)0x20);
+	QCOMPARE((quint8)spy[1][0].value<QWiimoteReportHandle>()->data[0], (quint8)0x21);
+}
+
+/* QTEST_MAIN would need a display for the QApplication of QtGui. */
+int main(int argc, char ** argv)
+{
+	QCoreApplication app(argc, argv);
+	TestQLoopbackWiimote test;
+	return QTest::qExec(&test, argc, argv);
+}
+
+#include "tst_qloopbackwiimote.moc"
@@ -0,0 +1,247 @@
+/*
+ * This file is part of QWiimote.
+ *
+ * QWiimote is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QWiimote is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QWiimote. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file tst_qwiimotediscovery.cpp
+ *
+ * Tests of QWiimoteDiscovery on a directory of fake device nodes.
+ */
+
+#include <QtTest>
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include "qwiimotediscovery.h"
+
+class TestQWiimoteDiscovery : public QObject
+{
+	Q_OBJECT
+private slots:
+	void initTestCase();
+	void init();
+	void cleanup();
+
+	void findsHidrawNodes();
+	void knownNodesAreNotProbedAgain();
+	void unopenableNodesAreProbedAgain();
+	void removedNodes();
+	void changingTheDirectoryForgetsDevices();
+	void watching();
+
+private:
+	QString nodePath(const QString &name) const;
+	void createNode(const QString &name);
+	void createDanglingNode(const QString &name);
+
+	QString directory; ///< Directory of fake device nodes, created for each test.
+};
+
+/**
+ * Path of a fake device node.
+ * @param name File name of the node.
+ * @return Path as built by QWiimoteDiscovery.
+ */
+QString TestQWiimoteDiscovery::nodePath(const QString &name) const
+{
+	return QDir(this->directory).filePath(name);
+}
+
+/**
+ * Creates a fake device node, which is accepted as a wiimote because it is not a hidraw device.
+ * @param name File name of the node.
+ */
+void TestQWiimoteDiscovery::createNode(const QString &name)
+{
+	QFile node(this->nodePath(name));
+	QVERIFY(node.open(QIODevice::WriteOnly));
+	node.close();
+}
+
+/**
+ * Creates a node which can't be opened, even by root: a link to a file which does not exist.
+ * @param name File name of the node.
+ */
+void TestQWiimoteDiscovery::createDanglingNode(const QString &name)
+{
+	QVERIFY(QFile::link(this->nodePath("target-" + name), this->nodePath(name)));
+}
+
+void TestQWiimoteDiscovery::initTestCase()
+{
+#ifndef Q_OS_LINUX
+	QSKIP("Device directories are only used under Linux.", SkipAll);
+#endif
+}
+
+void TestQWiimoteDiscovery::init()
+{
+	this->directory = QDir::tempPath() + QString("/tst_qwiimotediscovery-%1").arg(QCoreApplication::applicationPid());
+	QVERIFY(QDir().mkpath(this->directory));
+
+	this->createNode("hidraw0");
+	this->createNode("hidraw1");
+	this->createNode("event0");
+	QVERIFY(QDir(this->directory).mkdir("hidraw9"));
+}
+
+void TestQWiimoteDiscovery::cleanup()
+{
+	QDir dir(this->directory);
+	QStringList entries = dir.entryList(QDir::AllEntries | QDir::System | QDir::NoDotAndDotDot);
+	for (int i = 0; i < entries.size(); i++) {
+		if (!dir.remove(entries[i])) dir.rmdir(entries[i]);
+	}
+	QDir().rmdir(this->directory);
+}
+
+/**
+ * Only the hidraw files of the directory are found, and each one is announced once.
+ */
+void TestQWiimoteDiscovery::findsHidrawNodes()
+{
+	QWiimoteDiscovery discovery;
+	discovery.setDeviceDirectory(this->directory);
+	QSignalSpy added(&discovery, SIGNAL(deviceAdded(QString)));
+
+	discovery.rescan();
+	QCOMPARE(discovery.devices(), QStringList() << this->nodePath("hidraw0") << this->nodePath("hidraw1"));
+	QCOMPARE(added.count(), 2);
+	QVERIFY(QWiimoteDiscovery::knownDevices().contains(this->nodePath("hidraw0")));
+	QVERIFY(QWiimoteDiscovery::knownDevices().contains(this->nodePath("hidraw1")));
+
+	discovery.rescan();
+	QCOMPARE(added.count(), 2);
+}
+
+/**
+ * A known node is kept without being opened again, while a new node is probed.
+ */
+void TestQWiimoteDiscovery::knownNodesAreNotProbedAgain()
+{
+	QWiimoteDiscovery discovery;
+	discovery.setDeviceDirectory(this->directory);
+	discovery.rescan();
+
+	/* The known node can't be opened any more, so it would be rejected if it was probed. */
+	QVERIFY(QFile::remove(this->nodePath("hidraw1")));
+	this->createDanglingNode("hidraw1");
+	this->createDanglingNode("hidraw2");
+	QSignalSpy added(&discovery, SIGNAL(deviceAdded(QString)));
+	QSignalSpy removed(&discovery, SIGNAL(deviceRemoved(QString)));
+
+	discovery.rescan();
+	QCOMPARE(discovery.devices(), QStringList() << this->nodePath("hidraw0") << this->nodePath("hidraw1"));
+	QCOMPARE(added.count(), 0);
+	QCOMPARE(removed.count(), 0);
+	QVERIFY(!QWiimoteDiscovery::knownDevices().contains(this->nodePath("hidraw2")));
+}
+
+/**
+ * A node which can't be opened yet is found by a later scan once it can be opened.
+ */
+void TestQWiimoteDiscovery::unopenableNodesAreProbedAgain()
+{
+	QWiimoteDiscovery discovery;
+	discovery.setDeviceDirectory(this->directory);
+	this->createDanglingNode("hidraw2");
+	discovery.rescan();
+	QVERIFY(!discovery.devices().contains(this->nodePath("hidraw2")));
+
+	this->createNode("target-hidraw2");
+	QSignalSpy added(&discovery, SIGNAL(deviceAdded(QString)));
+	discovery.rescan();
+	QVERIFY(discovery.devices().contains(this->nodePath("hidraw2")));
+	QCOMPARE(added.count(), 1);
+	QCOMPARE(added.at(0).at(0).toString(), this->nodePath("hidraw2"));
+}
+
+/**
+ * Nodes which disappear are announced and forgotten by the process-wide cache.
+ */
+void TestQWiimoteDiscovery::removedNodes()
+{
+	QWiimoteDiscovery discovery;
+	discovery.setDeviceDirectory(this->directory);
+	discovery.rescan();
+
+	QVERIFY(QFile::remove(this->nodePath("hidraw0")));
+	QSignalSpy removed(&discovery, SIGNAL(deviceRemoved(QString)));
+	discovery.rescan();
+	QCOMPARE(discovery.devices(), QStringList() << this->nodePath("hidraw1"));
+	QCOMPARE(removed.count(), 1);
+	QCOMPARE(removed.at(0).at(0).toString(), this->nodePath("hidraw0"));
+	QVERIFY(!QWiimoteDiscovery::knownDevices().contains(this->nodePath("hidraw0")));
+	QVERIFY(QWiimoteDiscovery::knownDevices().contains(this->nodePath("hidraw1")));
+}
+
+/**
+ * Devices of the previous directory are removed when the directory changes.
+ */
+void TestQWiimoteDiscovery::changingTheDirectoryForgetsDevices()
+{
+	QWiimoteDiscovery discovery;
+	discovery.setDeviceDirectory(this->directory);
+	discovery.rescan();
+
+	QSignalSpy removed(&discovery, SIGNAL(deviceRemoved(QString)));
+	discovery.setDeviceDirectory(this->nodePath("hidraw9"));
+	QCOMPARE(discovery.deviceDirectory(), this->nodePath("hidraw9"));
+	QVERIFY(discovery.devices().isEmpty());
+	QCOMPARE(removed.count(), 2);
+	QVERIFY(!QWiimoteDiscovery::knownDevices().contains(this->nodePath("hidraw0")));
+	QVERIFY(!QWiimoteDiscovery::knownDevices().contains(this->nodePath("hidraw1")));
+}
+
+/**
+ * A watched directory is scanned when watching starts and whenever a node appears or disappears.
+ */
+void TestQWiimoteDiscovery::watching()
+{
+	QWiimoteDiscovery discovery;
+	discovery.setDeviceDirectory(this->nodePath("missing"));
+	QVERIFY(!discovery.setWatching(true));
+	QVERIFY(!discovery.isWatching());
+
+	discovery.setDeviceDirectory(this->directory);
+	QVERIFY(discovery.setWatching(true));
+	QVERIFY(discovery.isWatching());
+	QCOMPARE(discovery.devices().size(), 2);
+
+	QSignalSpy added(&discovery, SIGNAL(deviceAdded(QString)));
+	QSignalSpy removed(&discovery, SIGNAL(deviceRemoved(QString)));
+	this->createNode("hidraw3");
+	for (int waited = 0; added.count() == 0 && waited < 5000; waited += 50) QTest::qWait(50);
+	QCOMPARE(added.count(), 1);
+	QCOMPARE(added.at(0).at(0).toString(), this->nodePath("hidraw3"));
+
+	QVERIFY(QFile::remove(this->nodePath("hidraw3")));
+	for (int waited = 0; removed.count() == 0 && waited < 5000; waited += 50) QTest::qWait(50);
+	QCOMPARE(removed.count(), 1);
+
+	QVERIFY(discovery.setWatching(false));
+	QVERIFY(!discovery.isWatching());
+}
+
+/* The watcher needs an event loop, but no display. */
+int main(int argc, char ** argv)
+{
+	QCoreApplication app(argc, argv);
+	TestQWiimoteDiscovery test;
+	return QTest::qExec(&test, argc, argv);
+}
+
+#include "tst_qwiimotediscovery.moc"
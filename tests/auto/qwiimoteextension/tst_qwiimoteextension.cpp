@@ -0,0 +1,245 @@
+/*
+ * This file is part of QWiimote.
+ *
+ * QWiimote is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QWiimote is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QWiimote. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file tst_qwiimoteextension.cpp
+ *
+ * Unit tests of the QWiimoteExtension class.
+ */
+
+#include <QtTest>
+#include <cstring>
+#include "qwiimoteextension.h"
+
+class TestQWiimoteExtension : public QObject
+{
+	Q_OBJECT
+private slots:
+	void identify_data();
+	void identify();
+	void passthroughMode_data();
+	void passthroughMode();
+	void decodeNunchuk_data();
+	void decodeNunchuk();
+	void decodeClassic_data();
+	void decodeClassic();
+
+private:
+	static QByteArray bytes(quint8 b0, quint8 b1, quint8 b2, quint8 b3, quint8 b4, quint8 b5);
+	static QWiimoteExtensionState filledState();
+};
+
+/**
+ * Builds 6 extension bytes.
+ * @return Bytes.
+ */
+QByteArray TestQWiimoteExtension::bytes(quint8 b0, quint8 b1, quint8 b2, quint8 b3, quint8 b4, quint8 b5)
+{
+	QByteArray data(6, 0);
+	data[0] = (char)b0;
+	data[1] = (char)b1;
+	data[2] = (char)b2;
+	data[3] = (char)b3;
+	data[4] = (char)b4;
+	data[5] = (char)b5;
+	return data;
+}
+
+/**
+ * Builds a state where every value is set, to check that decoding clears what it does not write.
+ * @return State.
+ */
+QWiimoteExtensionState TestQWiimoteExtension::filledState()
+{
+	QWiimoteExtensionState state;
+	memset(&state, 0xFF, sizeof(state));
+	return state;
+}
+
+void TestQWiimoteExtension::identify_data()
+{
+	QTest::addColumn<QByteArray>("identifier");
+	QTest::addColumn<int>("type");
+
+	QTest::newRow("nunchuk")               << bytes(0x00, 0x00, 0xA4, 0x20, 0x00, 0x00) << (int)QWiimoteExtension::Nunchuk;
+	QTest::newRow("classic")               << bytes(0x00, 0x00, 0xA4, 0x20, 0x01, 0x01) << (int)QWiimoteExtension::Classic;
+	QTest::newRow("classic pro")           << bytes(0x01, 0x00, 0xA4, 0x20, 0x01, 0x01) << (int)QWiimoteExtension::Classic;
+	QTest::newRow("motionplus 0x04")       << bytes(0x00, 0x00, 0xA4, 0x20, 0x04, 0x05) << (int)QWiimoteExtension::MotionPlus;
+	QTest::newRow("motionplus 0x05")       << bytes(0x00, 0x00, 0xA4, 0x20, 0x05, 0x05) << (int)QWiimoteExtension::MotionPlus;
+	QTest::newRow("motionplus 0x07")       << bytes(0x00, 0x00, 0xA4, 0x20, 0x07, 0x05) << (int)QWiimoteExtension::MotionPlus;
+	QTest::newRow("motionplus 0x06")       << bytes(0x00, 0x00, 0xA4, 0x20, 0x06, 0x05) << (int)QWiimoteExtension::Unknown;
+	QTest::newRow("inactive motionplus")   << bytes(0x00, 0x00, 0xA6, 0x20, 0x00, 0x05) << (int)QWiimoteExtension::Unknown;
+	QTest::newRow("balance board")         << bytes(0x00, 0x00, 0xA4, 0x20, 0x04, 0x02) << (int)QWiimoteExtension::Unknown;
+	QTest::newRow("partially inserted")    << bytes(0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF) << (int)QWiimoteExtension::Unknown;
+	QTest::newRow("short")                 << QByteArray(5, 0)                          << (int)QWiimoteExtension::None;
+}
+
+void TestQWiimoteExtension::identify()
+{
+	QFETCH(QByteArray, identifier);
+	QFETCH(int, type);
+	QCOMPARE((int)QWiimoteExtension::identify(identifier), type);
+}
+
+void TestQWiimoteExtension::passthroughMode_data()
+{
+	QTest::addColumn<int>("type");
+	QTest::addColumn<int>("mode");
+
+	QTest::newRow("none")       << (int)QWiimoteExtension::None       << 0x04;
+	QTest::newRow("nunchuk")    << (int)QWiimoteExtension::Nunchuk    << 0x05;
+	QTest::newRow("classic")    << (int)QWiimoteExtension::Classic    << 0x07;
+	QTest::newRow("motionplus") << (int)QWiimoteExtension::MotionPlus << 0x04;
+	QTest::newRow("unknown")    << (int)QWiimoteExtension::Unknown    << 0x04;
+}
+
+void TestQWiimoteExtension::passthroughMode()
+{
+	QFETCH(int, type);
+	QFETCH(int, mode);
+	QCOMPARE((int)QWiimoteExtension::passthroughMode((QWiimoteExtension::Type)type), mode);
+
+	/* The MotionPlus answers to each mode with the identifier of the same number. */
+	QByteArray identifier = bytes(0x00, 0x00, 0xA4, 0x20, mode, 0x05);
+	QCOMPARE(QWiimoteExtension::identify(identifier), QWiimoteExtension::MotionPlus);
+}
+
+void TestQWiimoteExtension::decodeNunchuk_data()
+{
+	QTest::addColumn<QByteArray>("data");
+	QTest::addColumn<bool>("passthrough");
+	QTest::addColumn<int>("buttons");
+	QTest::addColumn<int>("stick_x");
+	QTest::addColumn<int>("stick_y");
+	QTest::addColumn<int>("acceleration_x");
+	QTest::addColumn<int>("acceleration_y");
+	QTest::addColumn<int>("acceleration_z");
+
+	const int z = QWiimoteExtensionState::NunchukZ;
+	const int c = QWiimoteExtensionState::NunchukC;
+
+	/* Normal frames: the low bits of the axes are in bits 2-7 of byte 5, and the buttons in bits 0-1. */
+	QTest::newRow("normal released")  << bytes(0x80, 0x7F, 0x81, 0x82, 0xB3, 0xE7) << false << 0     << 0x80 << 0x7F << 0x205 << 0x20A << 0x2CF;
+	QTest::newRow("normal pressed")   << bytes(0x80, 0x7F, 0x81, 0x82, 0xB3, 0x00) << false << (z|c) << 0x80 << 0x7F << 0x204 << 0x208 << 0x2CC;
+	QTest::newRow("normal c")         << bytes(0x00, 0xFF, 0x00, 0xFF, 0x00, 0x01) << false << c     << 0x00 << 0xFF << 0x000 << 0x3FC << 0x000;
+	QTest::newRow("normal z")         << bytes(0xFF, 0x00, 0xFF, 0x00, 0xFF, 0xFE) << false << z     << 0xFF << 0x00 << 0x3FF << 0x003 << 0x3FF;
+
+	/* Passthrough frames: bits 0-1 of byte 5 mark the frame, the buttons move to bits 2-3,
+	   and the lowest bit of every axis and of byte 4 is lost. */
+	QTest::newRow("passthrough released") << bytes(0x80, 0x7F, 0x81, 0x82, 0xB3, 0xFC) << true << 0     << 0x80 << 0x7F << 0x206 << 0x20A << 0x2CE;
+	QTest::newRow("passthrough pressed")  << bytes(0x80, 0x7F, 0x81, 0x82, 0xB3, 0x00) << true << (z|c) << 0x80 << 0x7F << 0x204 << 0x208 << 0x2C8;
+	QTest::newRow("passthrough z")        << bytes(0x00, 0xFF, 0x00, 0xFF, 0x00, 0x08) << true << z     << 0x00 << 0xFF << 0x000 << 0x3FC << 0x000;
+	QTest::newRow("passthrough c")        << bytes(0xFF, 0x00, 0xFF, 0x00, 0xFF, 0xF5) << true << c     << 0xFF << 0x00 << 0x3FE << 0x002 << 0x3FE;
+}
+
+void TestQWiimoteExtension::decodeNunchuk()
+{
+	QFETCH(QByteArray, data);
+	QFETCH(bool, passthrough);
+	QFETCH(int, buttons);
+	QFETCH(int, stick_x);
+	QFETCH(int, stick_y);
+	QFETCH(int, acceleration_x);
+	QFETCH(int, acceleration_y);
+	QFETCH(int, acceleration_z);
+
+	if (passthrough) QVERIFY(!QWiimoteExtension::isMotionPlusFrame(data.constData()));
+
+	QWiimoteExtensionState state = filledState();
+	QWiimoteExtension::decodeNunchuk(data.constData(), passthrough, state);
+	QCOMPARE((int)state.buttons, buttons);
+	QCOMPARE((int)state.left_stick[0], stick_x);
+	QCOMPARE((int)state.left_stick[1], stick_y);
+	QCOMPARE((int)state.acceleration[0], acceleration_x);
+	QCOMPARE((int)state.acceleration[1], acceleration_y);
+	QCOMPARE((int)state.acceleration[2], acceleration_z);
+	QCOMPARE((int)state.right_stick[0], 0);
+	QCOMPARE((int)state.right_stick[1], 0);
+	QCOMPARE((int)state.triggers[0], 0);
+	QCOMPARE((int)state.triggers[1], 0);
+
+	/* decode() dispatches to the same function. */
+	QWiimoteExtensionState dispatched = filledState();
+	QVERIFY(QWiimoteExtension::decode(QWiimoteExtension::Nunchuk, data.constData(), passthrough, dispatched));
+	QCOMPARE(memcmp(&dispatched, &state, sizeof(state)), 0);
+}
+
+void TestQWiimoteExtension::decodeClassic_data()
+{
+	QTest::addColumn<QByteArray>("data");
+	QTest::addColumn<bool>("passthrough");
+	QTest::addColumn<int>("buttons");
+	QTest::addColumn<int>("left_x");
+	QTest::addColumn<int>("left_y");
+	QTest::addColumn<int>("right_x");
+	QTest::addColumn<int>("right_y");
+	QTest::addColumn<int>("left_trigger");
+	QTest::addColumn<int>("right_trigger");
+
+	const int all = 0xFEFF;
+	const int up_left = QWiimoteExtensionState::ClassicUp | QWiimoteExtensionState::ClassicLeft;
+	const int a_home = QWiimoteExtensionState::ClassicA | QWiimoteExtensionState::ClassicHome;
+
+	/* The right stick x is split over bytes 0, 1 and 2, and the left trigger over bytes 2 and 3. */
+	QTest::newRow("normal released")  << bytes(0xA0, 0x21, 0x0F, 0xBB, 0xFF, 0xFF) << false << 0       << 0x20 << 0x21 << 0x10 << 0x0F << 0x05 << 0x1B;
+	QTest::newRow("normal pressed")   << bytes(0xFF, 0xC0, 0xE0, 0xE0, 0x01, 0x00) << false << all     << 0x3F << 0x00 << 0x1F << 0x00 << 0x1F << 0x00;
+	QTest::newRow("normal a home")    << bytes(0xA0, 0x21, 0x0F, 0xBB, 0xF7, 0xEF) << false << a_home  << 0x20 << 0x21 << 0x10 << 0x0F << 0x05 << 0x1B;
+	QTest::newRow("normal up left")   << bytes(0xA0, 0x21, 0x0F, 0xBB, 0xFF, 0xFC) << false << up_left << 0x20 << 0x21 << 0x10 << 0x0F << 0x05 << 0x1B;
+
+	/* Passthrough frames: Up and Left move to the lowest bits of bytes 0 and 1,
+	   where the left stick loses its lowest bit, and bits 0-1 of byte 5 mark the frame. */
+	QTest::newRow("passthrough released") << bytes(0xA1, 0x23, 0x0F, 0xBB, 0xFF, 0xFC) << true << 0       << 0x20 << 0x22 << 0x10 << 0x0F << 0x05 << 0x1B;
+	QTest::newRow("passthrough up left")  << bytes(0xA0, 0x22, 0x0F, 0xBB, 0xFF, 0xFC) << true << up_left << 0x20 << 0x22 << 0x10 << 0x0F << 0x05 << 0x1B;
+	QTest::newRow("passthrough pressed")  << bytes(0xFE, 0xC0, 0xE0, 0xE0, 0x01, 0x00) << true << all     << 0x3E << 0x00 << 0x1F << 0x00 << 0x1F << 0x00;
+	QTest::newRow("passthrough a home")   << bytes(0xA1, 0x23, 0x0F, 0xBB, 0xF7, 0xEC) << true << a_home  << 0x20 << 0x22 << 0x10 << 0x0F << 0x05 << 0x1B;
+}
+
+void TestQWiimoteExtension::decodeClassic()
+{
+	QFETCH(QByteArray, data);
+	QFETCH(bool, passthrough);
+	QFETCH(int, buttons);
+	QFETCH(int, left_x);
+	QFETCH(int, left_y);
+	QFETCH(int, right_x);
+	QFETCH(int, right_y);
+	QFETCH(int, left_trigger);
+	QFETCH(int, right_trigger);
+
+	if (passthrough) QVERIFY(!QWiimoteExtension::isMotionPlusFrame(data.constData()));
+
+	QWiimoteExtensionState state = filledState();
+	QWiimoteExtension::decodeClassic(data.constData(), passthrough, state);
+	QCOMPARE((int)state.buttons, buttons);
+	QCOMPARE((int)state.left_stick[0], left_x);
+	QCOMPARE((int)state.left_stick[1], left_y);
+	QCOMPARE((int)state.right_stick[0], right_x);
+	QCOMPARE((int)state.right_stick[1], right_y);
+	QCOMPARE((int)state.triggers[0], left_trigger);
+	QCOMPARE((int)state.triggers[1], right_trigger);
+	QCOMPARE((int)state.acceleration[0], 0);
+	QCOMPARE((int)state.acceleration[1], 0);
+	QCOMPARE((int)state.acceleration[2], 0);
+
+	/* decode() dispatches to the same function. */
+	QWiimoteExtensionState dispatched = filledState();
+	QVERIFY(QWiimoteExtension::decode(QWiimoteExtension::Classic, data.constData(), passthrough, dispatched));
+	QCOMPARE(memcmp(&dispatched, &state, sizeof(state)), 0);
+}
+
+QTEST_APPLESS_MAIN(TestQWiimoteExtension)
+#include "tst_qwiimoteextension.moc"
@@ -0,0 +1,367 @@
+/*
+ * This file is part of QWiimote.
+ *
+ * QWiimote is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QWiimote is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QWiimote. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file tst_qwiimotememoryrequests.cpp
+ *
+ * Unit tests of the QWiimoteMemoryRequests class.
+ */
+
+#include <QtTest>
+#include "qwiimotememoryrequests.h"
+#include "qwiimote.h"
+
+class TestQWiimoteMemoryRequests : public QObject
+{
+	Q_OBJECT
+private slots:
+	void readReport();
+	void writeReports();
+	void repliesMatchedByAddress();
+	void collidingReadsAreSerialized();
+	void laterRequestsWaitForACollidingRead();
+	void repliesMatchedByChunkSize();
+	void readError();
+	void writeAcknowledgementsInOrder();
+	void sendFailure();
+	void abort();
+	void expire();
+
+private:
+	static QList<QByteArray> sendAll(QWiimoteMemoryRequests &requests);
+	static QByteArray readReplyReport(quint16 address, const QByteArray &data, quint8 error = 0);
+	static QByteArray acknowledgementReport(quint8 report_type, quint8 error = 0);
+	static QByteArray bytes(int size, int first);
+};
+
+/**
+ * Sends every report which can be sent.
+ * @param requests Requests to send.
+ * @return Reports sent.
+ */
+QList<QByteArray> TestQWiimoteMemoryRequests::sendAll(QWiimoteMemoryRequests &requests)
+{
+	QList<QByteArray> reports;
+	QByteArray report;
+	QWiimoteMemoryResult result;
+	while (requests.nextReport(report)) {
+		reports.append(report);
+		requests.reportSent(true, result);
+	}
+	return reports;
+}
+
+/**
+ * Builds a 0x21 report, as sent by the wiimote for every 16 bytes of a read.
+ * @param address Address of the data. Only its low 16 bits are sent.
+ * @param data Data read, up to 16 bytes. Its size is sent even if there is an error.
+ * @param error Error code.
+ * @return Report.
+ */
+QByteArray TestQWiimoteMemoryRequests::readReplyReport(quint16 address, const QByteArray &data, quint8 error)
+{
+	QByteArray report(22, 0);
+	report[0] = (char)0x21;
+	report[3] = (char)((qMax(data.size(), 1) - 1) << 4 | error);
+	report[4] = (char)(address >> 8);
+	report[5] = (char)address;
+	report.replace(6, data.size(), data);
+	return report;
+}
+
+/**
+ * Builds a 0x22 report, which acknowledges an output report.
+ * @param report_type Type of the acknowledged report.
+ * @param error Error code.
+ * @return Report.
+ */
+QByteArray TestQWiimoteMemoryRequests::acknowledgementReport(quint8 report_type, quint8 error)
+{
+	QByteArray report(5, 0);
+	report[0] = (char)0x22;
+	report[3] = (char)report_type;
+	report[4] = (char)error;
+	return report;
+}
+
+/**
+ * Builds recognizable data.
+ * @param size Number of bytes.
+ * @param first Value of the first byte. Each byte is one more than the previous one.
+ * @return Data.
+ */
+QByteArray TestQWiimoteMemoryRequests::bytes(int size, int first)
+{
+	QByteArray data(size, 0);
+	for (int i = 0; i < size; i++) data[i] = (char)(first + i);
+	return data;
+}
+
+/**
+ * A read is sent as a single 0x17 report.
+ */
+void TestQWiimoteMemoryRequests::readReport()
+{
+	QWiimoteMemoryRequests requests;
+	int id = requests.read(true, 0xA400FA, 6);
+	QVERIFY(id > 0);
+	QCOMPARE(requests.pending(), 1);
+
+	QList<QByteArray> reports = sendAll(requests);
+	QCOMPARE(reports.size(), 1);
+	QCOMPARE(reports[0], QByteArray("\x17\x04\xA4\x00\xFA\x00\x06", 7));
+	QCOMPARE(requests.pending(), 1);
+}
+
+/**
+ * A write is split into 0x16 reports of up to 16 bytes.
+ */
+void TestQWiimoteMemoryRequests::writeReports()
+{
+	QWiimoteMemoryRequests requests;
+	QByteArray data = bytes(20, 1);
+	requests.write(false, 0x0016, data);
+
+	QList<QByteArray> reports = sendAll(requests);
+	QCOMPARE(reports.size(), 2);
+	QCOMPARE(reports[0].left(6), QByteArray("\x16\x00\x00\x00\x16\x10", 6));
+	QCOMPARE(reports[0].mid(6), data.left(16));
+	QCOMPARE(reports[1].left(6), QByteArray("\x16\x00\x00\x00\x26\x04", 6));
+	QCOMPARE(reports[1].mid(6), data.mid(16));
+}
+
+/**
+ * Reads in flight at different low addresses get their replies in any order.
+ */
+void TestQWiimoteMemoryRequests::repliesMatchedByAddress()
+{
+	QWiimoteMemoryRequests requests;
+	int calibration = requests.read(false, 0x0016, 10);
+	int identifier = requests.read(true, 0xA600FA, 6);
+	QCOMPARE(sendAll(requests).size(), 2);
+
+	QWiimoteMemoryResult result;
+	QVERIFY(requests.readReply(readReplyReport(0x00FA, bytes(6, 0x40)).constData(), result));
+	QCOMPARE(result.id, identifier);
+	QVERIFY(!result.write);
+	QVERIFY(result.registers);
+	QCOMPARE(result.address, (quint32)0xA600FA);
+	QCOMPARE(result.error, (quint8)QWiimote::MemoryNoError);
+	QCOMPARE(result.data, bytes(6, 0x40));
+
+	QVERIFY(requests.readReply(readReplyReport(0x0016, bytes(10, 0x10)).constData(), result));
+	QCOMPARE(result.id, calibration);
+	QCOMPARE(result.data, bytes(10, 0x10));
+	QCOMPARE(requests.pending(), 0);
+}
+
+/**
+ * Reads of 0xA400FA and 0xA600FA share their low 16 bits, so their replies can't be told apart.
+ * The second one is only sent once the first one has finished, and each gets its own data.
+ */
+void TestQWiimoteMemoryRequests::collidingReadsAreSerialized()
+{
+	QWiimoteMemoryRequests requests;
+	int extension = requests.read(true, 0xA400FA, 6);
+	int motionplus = requests.read(true, 0xA600FA, 6);
+
+	QList<QByteArray> reports = sendAll(requests);
+	QCOMPARE(reports.size(), 1);
+	QCOMPARE((quint8)reports[0][2], (quint8)0xA4);
+
+	QWiimoteMemoryResult result;
+	QVERIFY(requests.readReply(readReplyReport(0x00FA, bytes(6, 0x20)).constData(), result));
+	QCOMPARE(result.id, extension);
+	QCOMPARE(result.data, bytes(6, 0x20));
+
+	reports = sendAll(requests);
+	QCOMPARE(reports.size(), 1);
+	QCOMPARE((quint8)reports[0][2], (quint8)0xA6);
+
+	QVERIFY(requests.readReply(readReplyReport(0x00FA, bytes(6, 0x30)).constData(), result));
+	QCOMPARE(result.id, motionplus);
+	QCOMPARE(result.data, bytes(6, 0x30));
+	QCOMPARE(requests.pending(), 0);
+}
+
+/**
+ * Requests are sent in order, so a held read holds every later request too.
+ */
+void TestQWiimoteMemoryRequests::laterRequestsWaitForACollidingRead()
+{
+	QWiimoteMemoryRequests requests;
+	requests.read(false, 0x0010, 32);
+	requests.read(false, 0x0020, 4);
+	requests.write(true, 0xA400F0, QByteArray(1, 0x55));
+	QCOMPARE(sendAll(requests).size(), 1);
+
+	/* The overlap ends when the first read has received the data at the address of the second. */
+	QWiimoteMemoryResult result;
+	QVERIFY(!requests.readReply(readReplyReport(0x0010, bytes(16, 0)).constData(), result));
+	QCOMPARE(sendAll(requests).size(), 0);
+	QVERIFY(requests.readReply(readReplyReport(0x0020, bytes(16, 16)).constData(), result));
+	QCOMPARE(result.data, bytes(32, 0));
+
+	QList<QByteArray> reports = sendAll(requests);
+	QCOMPARE(reports.size(), 2);
+	QCOMPARE((quint8)reports[0][0], (quint8)0x17);
+	QCOMPARE((quint8)reports[1][0], (quint8)0x16);
+}
+
+/**
+ * A reply at the expected address, but with a different size, belongs to another read.
+ */
+void TestQWiimoteMemoryRequests::repliesMatchedByChunkSize()
+{
+	QWiimoteMemoryRequests requests;
+	int id = requests.read(false, 0x0016, 20);
+	sendAll(requests);
+
+	QWiimoteMemoryResult result;
+	QVERIFY(!requests.readReply(readReplyReport(0x0016, bytes(10, 0)).constData(), result));
+	QVERIFY(!requests.readReply(readReplyReport(0x0016, bytes(16, 0)).constData(), result));
+	QCOMPARE(requests.pending(), 1);
+	QVERIFY(!requests.readReply(readReplyReport(0x0026, bytes(16, 16)).constData(), result));
+	QVERIFY(requests.readReply(readReplyReport(0x0026, bytes(4, 16)).constData(), result));
+	QCOMPARE(result.id, id);
+	QCOMPARE(result.data, bytes(20, 0));
+
+	/* Replies to no read at all are ignored. */
+	QVERIFY(!requests.readReply(readReplyReport(0x0016, bytes(16, 0)).constData(), result));
+}
+
+/**
+ * An error ends a read, keeping the data received before it.
+ */
+void TestQWiimoteMemoryRequests::readError()
+{
+	QWiimoteMemoryRequests requests;
+	int id = requests.read(true, 0xA40020, 32);
+	sendAll(requests);
+
+	QWiimoteMemoryResult result;
+	QVERIFY(!requests.readReply(readReplyReport(0x0020, bytes(16, 0)).constData(), result));
+	QVERIFY(requests.readReply(readReplyReport(0x0030, QByteArray(16, 0), QWiimote::MemoryWriteOnly).constData(), result));
+	QCOMPARE(result.id, id);
+	QCOMPARE(result.error, (quint8)QWiimote::MemoryWriteOnly);
+	QCOMPARE(result.data, bytes(16, 0));
+	QCOMPARE(requests.pending(), 0);
+}
+
+/**
+ * Acknowledgements carry no address, so they are matched to the writes in the order they were sent.
+ */
+void TestQWiimoteMemoryRequests::writeAcknowledgementsInOrder()
+{
+	QWiimoteMemoryRequests requests;
+	int first = requests.write(true, 0xA400F0, bytes(20, 0));
+	int second = requests.write(true, 0xA600FE, QByteArray(1, 0x04));
+	QCOMPARE(sendAll(requests).size(), 3);
+
+	QWiimoteMemoryResult result;
+	QVERIFY(!requests.writeAcknowledged(acknowledgementReport(0x12).constData(), result));
+	QVERIFY(!requests.writeAcknowledged(acknowledgementReport(0x16).constData(), result));
+	QVERIFY(requests.writeAcknowledged(acknowledgementReport(0x16).constData(), result));
+	QCOMPARE(result.id, first);
+	QVERIFY(result.write);
+	QCOMPARE(result.error, (quint8)QWiimote::MemoryNoError);
+	QVERIFY(result.data.isEmpty());
+
+	QVERIFY(requests.writeAcknowledged(acknowledgementReport(0x16, QWiimote::MemoryNonexistent).constData(), result));
+	QCOMPARE(result.id, second);
+	QCOMPARE(result.error, (quint8)QWiimote::MemoryNonexistent);
+
+	/* Acknowledgements of writes which are not pending are ignored. */
+	QVERIFY(!requests.writeAcknowledged(acknowledgementReport(0x16).constData(), result));
+}
+
+/**
+ * A request fails when one of its reports can't be sent, once its sent reports have been answered.
+ */
+void TestQWiimoteMemoryRequests::sendFailure()
+{
+	QWiimoteMemoryRequests requests;
+	QByteArray report;
+	QWiimoteMemoryResult result;
+
+	/* Nothing was sent, so the read fails at once. */
+	int read = requests.read(false, 0x0016, 10);
+	QVERIFY(requests.nextReport(report));
+	QVERIFY(requests.reportSent(false, result));
+	QCOMPARE(result.id, read);
+	QCOMPARE(result.error, (quint8)QWiimote::MemorySendFailed);
+	QCOMPARE(requests.pending(), 0);
+
+	/* The first half of the write was sent, so it fails when that half is acknowledged. */
+	int write = requests.write(true, 0xA400F0, bytes(20, 0));
+	QVERIFY(requests.nextReport(report));
+	QVERIFY(!requests.reportSent(true, result));
+	QVERIFY(requests.nextReport(report));
+	QVERIFY(!requests.reportSent(false, result));
+	QVERIFY(!requests.nextReport(report));
+	QCOMPARE(requests.pending(), 1);
+
+	QVERIFY(requests.writeAcknowledged(acknowledgementReport(0x16).constData(), result));
+	QCOMPARE(result.id, write);
+	QCOMPARE(result.error, (quint8)QWiimote::MemorySendFailed);
+	QCOMPARE(requests.pending(), 0);
+}
+
+/**
+ * Aborting ends every request, sent or not.
+ */
+void TestQWiimoteMemoryRequests::abort()
+{
+	QWiimoteMemoryRequests requests;
+	int first = requests.read(true, 0xA400FA, 6);
+	int second = requests.read(true, 0xA600FA, 6);
+	int third = requests.write(false, 0x0000, QByteArray(1, 0));
+	sendAll(requests);
+
+	QList<QWiimoteMemoryResult> results = requests.abort();
+	QCOMPARE(results.size(), 3);
+	QCOMPARE(results[0].id, first);
+	QCOMPARE(results[1].id, second);
+	QCOMPARE(results[2].id, third);
+	for (int i = 0; i < results.size(); i++) QCOMPARE(results[i].error, (quint8)QWiimote::MemoryAborted);
+	QCOMPARE(requests.pending(), 0);
+}
+
+/**
+ * Requests which were sent but got no answer expire. Requests not sent yet don't.
+ */
+void TestQWiimoteMemoryRequests::expire()
+{
+	QWiimoteMemoryRequests requests;
+	int sent = requests.read(true, 0xA400FA, 6);
+	requests.read(true, 0xA600FA, 6);
+	QCOMPARE(sendAll(requests).size(), 1);
+	QVERIFY(requests.expire().isEmpty());
+
+	QTest::qSleep(QWiimoteMemoryRequests::TIMEOUT + 100);
+	QList<QWiimoteMemoryResult> results = requests.expire();
+	QCOMPARE(results.size(), 1);
+	QCOMPARE(results[0].id, sent);
+	QCOMPARE(results[0].error, (quint8)QWiimote::MemoryTimeout);
+
+	/* The held read can be sent now. */
+	QCOMPARE(requests.pending(), 1);
+	QCOMPARE(sendAll(requests).size(), 1);
+}
+
+QTEST_APPLESS_MAIN(TestQWiimoteMemoryRequests)
+#include "tst_qwiimotememoryrequests.moc"
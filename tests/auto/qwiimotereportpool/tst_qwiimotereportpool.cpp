@@ -0,0 +1,235 @@
+/*
+ * This file is part of QWiimote.
+ *
+ * QWiimote is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QWiimote is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QWiimote. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file tst_qwiimotereportpool.cpp
+ *
+ * Unit tests of the QWiimoteReportPool and QWiimoteReportHandle classes.
+ */
+
+#include <QtTest>
+#include <QThread>
+#include "qwiimotereport.h"
+
+/**
+ * Acquires and releases slots of a shared pool as fast as possible.
+ */
+class PoolStressThread : public QThread
+{
+public:
+	PoolStressThread(QWiimoteReportPool * pool, int iterations) : pool(pool), iterations(iterations), failures(0) {}
+
+	QWiimoteReportPool * pool; ///< Pool shared by every thread.
+	int iterations;            ///< Number of slots to acquire.
+	int failures;              ///< Number of slots which were not released with the same content.
+
+protected:
+	void run()
+	{
+		for (int i = 0; i < this->iterations; i++) {
+			QWiimoteReportHandle report = this->pool->acquire();
+			if (report.isNull()) continue;
+
+			/* No other thread may use the slot while this handle is alive. */
+			report->size = i;
+			report->data[0] = (char)i;
+			QWiimoteReportHandle copy = report;
+			if (copy->size != i || copy->data[0] != (char)i) this->failures++;
+		}
+	}
+};
+
+class TestQWiimoteReportPool : public QObject
+{
+	Q_OBJECT
+private slots:
+	void acquireDistinctSlots();
+	void exhaustion();
+	void copiesKeepTheSlot();
+	void assignmentReleasesTheSlot();
+	void detached();
+	void poolOutlivesItsOwner();
+	void concurrentAcquireAndRelease();
+};
+
+/**
+ * Every acquired handle points to its own slot.
+ */
+void TestQWiimoteReportPool::acquireDistinctSlots()
+{
+	QWiimoteReportPool * pool = new QWiimoteReportPool(4);
+	QList<QWiimoteReportHandle> reports;
+	for (int i = 0; i < 4; i++) {
+		reports.append(pool->acquire());
+		QVERIFY(!reports.last().isNull());
+		for (int j = 0; j < i; j++) QVERIFY(&*reports[j] != &*reports[i]);
+	}
+
+	reports.clear();
+	pool->deref();
+}
+
+/**
+ * acquire() fails once every slot is in use, and counts the failure.
+ */
+void TestQWiimoteReportPool::exhaustion()
+{
+	QWiimoteReportPool * pool = new QWiimoteReportPool(2);
+	QWiimoteReportHandle first = pool->acquire();
+	QWiimoteReportHandle second = pool->acquire();
+	QCOMPARE(pool->exhaustions(), (quint32)0);
+
+	QVERIFY(pool->acquire().isNull());
+	QCOMPARE(pool->exhaustions(), (quint32)1);
+
+	/* A released slot can be acquired again. */
+	second.reset();
+	QVERIFY(second.isNull());
+	QVERIFY(!pool->acquire().isNull());
+	QCOMPARE(pool->exhaustions(), (quint32)1);
+
+	first.reset();
+	pool->deref();
+}
+
+/**
+ * A slot only goes back to the pool when its last handle is released.
+ */
+void TestQWiimoteReportPool::copiesKeepTheSlot()
+{
+	QWiimoteReportPool * pool = new QWiimoteReportPool(1);
+	QWiimoteReportHandle report = pool->acquire();
+	report->size = 5;
+
+	QWiimoteReportHandle copy(report);
+	QCOMPARE(&*copy, &*report);
+	report.reset();
+	QVERIFY(pool->acquire().isNull());
+	QCOMPARE(copy->size, 5);
+
+	copy.reset();
+	QWiimoteReportHandle again = pool->acquire();
+	QVERIFY(!again.isNull());
+	QCOMPARE(again->size, 0);
+
+	again.reset();
+	pool->deref();
+}
+
+/**
+ * Assigning a handle releases the slot it pointed to. Self-assignment keeps the slot.
+ */
+void TestQWiimoteReportPool::assignmentReleasesTheSlot()
+{
+	QWiimoteReportPool * pool = new QWiimoteReportPool(2);
+	QWiimoteReportHandle first = pool->acquire();
+	QWiimoteReportHandle second = pool->acquire();
+	QWiimoteReport * first_slot = &*first;
+
+	second = first;
+	QCOMPARE(&*second, first_slot);
+	QVERIFY(!pool->acquire().isNull());
+
+	first = first;
+	QCOMPARE(&*first, first_slot);
+	first.reset();
+	QCOMPARE(&*second, first_slot);
+
+	second = QWiimoteReportHandle();
+	QVERIFY(second.isNull());
+
+	QWiimoteReportHandle third = pool->acquire();
+	QWiimoteReportHandle fourth = pool->acquire();
+	QVERIFY(!third.isNull() && !fourth.isNull());
+
+	third.reset();
+	fourth.reset();
+	pool->deref();
+}
+
+/**
+ * A handle is detached only while no other handle points to its slot.
+ */
+void TestQWiimoteReportPool::detached()
+{
+	QWiimoteReportPool * pool = new QWiimoteReportPool(1);
+	QWiimoteReportHandle report = pool->acquire();
+	QVERIFY(report.isDetached());
+
+	{
+		QWiimoteReportHandle copy = report;
+		QVERIFY(!report.isDetached());
+		QVERIFY(!copy.isDetached());
+	}
+	QVERIFY(report.isDetached());
+	QVERIFY(!QWiimoteReportHandle().isDetached());
+
+	report.reset();
+	pool->deref();
+}
+
+/**
+ * Handles stay valid after the owner of the pool releases it.
+ */
+void TestQWiimoteReportPool::poolOutlivesItsOwner()
+{
+	QWiimoteReportPool * pool = new QWiimoteReportPool(2);
+	QWiimoteReportHandle report = pool->acquire();
+	pool->deref();
+
+	report->size = 3;
+	report->data[0] = 0x30;
+	QWiimoteReportHandle copy = report;
+	report.reset();
+	QCOMPARE(copy->size, 3);
+	QCOMPARE(copy->data[0], (char)0x30);
+
+	/* The pool is destroyed here. */
+	copy.reset();
+}
+
+/**
+ * Slots acquired and released from several threads at once are never shared or lost.
+ */
+void TestQWiimoteReportPool::concurrentAcquireAndRelease()
+{
+	const int capacity = 8;
+	QWiimoteReportPool * pool = new QWiimoteReportPool(capacity);
+
+	QList<PoolStressThread *> threads;
+	for (int i = 0; i < 4; i++) threads.append(new PoolStressThread(pool, 100000));
+	for (int i = 0; i < threads.size(); i++) threads[i]->start();
+	for (int i = 0; i < threads.size(); i++) {
+		QVERIFY(threads[i]->wait(30000));
+		QCOMPARE(threads[i]->failures, 0);
+	}
+	qDeleteAll(threads);
+
+	/* Every slot is back in the pool. */
+	QList<QWiimoteReportHandle> reports;
+	for (int i = 0; i < capacity; i++) {
+		reports.append(pool->acquire());
+		QVERIFY(!reports.last().isNull());
+	}
+	QVERIFY(pool->acquire().isNull());
+
+	reports.clear();
+	pool->deref();
+}
+
+QTEST_APPLESS_MAIN(TestQWiimoteReportPool)
+#include "tst_qwiimotereportpool.moc"
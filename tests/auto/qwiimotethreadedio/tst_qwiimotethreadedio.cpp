@@ -0,0 +1,246 @@
+/*
+ * This file is part of QWiimote.
+ *
+ * QWiimote is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QWiimote is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QWiimote. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file tst_qwiimotethreadedio.cpp
+ *
+ * Tests of QWiimote with threaded I/O, driven by the loopback transport.
+ */
+
+#include <QtTest>
+#include <QCoreApplication>
+#include <QPointer>
+#include <QThread>
+#include "qwiimote.h"
+#include "qloopbackwiimote.h"
+
+class TestQWiimoteThreadedIO : public QObject
+{
+	Q_OBJECT
+private slots:
+	void init();
+	void cleanup();
+
+	void transportRunsInItsOwnThread();
+	void reportsArrive();
+	void ringOverflowsAreCounted();
+	void dataTypesChangeWhileRunning();
+	void stopAndRestart();
+	void destructionDeletesTheTransport();
+
+private:
+	static bool waitForSignals(QSignalSpy &spy, int count, int timeout = 3000);
+	static bool isScriptAcceleration(const QVector3D &acceleration);
+	void startAcceleration();
+
+	QLoopbackWiimote * transport; ///< Emulated wiimote, owned by the wiimote.
+	QWiimote * wiimote;           ///< Wiimote under test.
+};
+
+/**
+ * Processes events until a signal has been emitted a number of times.
+ * @param spy Spy of the signal.
+ * @param count Number of emissions to wait for.
+ * @param timeout Maximum time to wait in milliseconds.
+ * @return True iff the signal was emitted at least count times.
+ */
+bool TestQWiimoteThreadedIO::waitForSignals(QSignalSpy &spy, int count, int timeout)
+{
+	for (int waited = 0; spy.count() < count && waited < timeout; waited += 10) {
+		QTest::qWait(10);
+	}
+
+	return spy.count() >= count;
+}
+
+/**
+ * Checks if an acceleration is one of the two produced by the script of the test.
+ * @param acceleration Calibrated acceleration.
+ * @return True iff it is the acceleration of one of the samples.
+ */
+bool TestQWiimoteThreadedIO::isScriptAcceleration(const QVector3D &acceleration)
+{
+	return (acceleration - QVector3D(0, 0, 1)).length() < 0.001 ||
+			 (acceleration - QVector3D(1, 0, 0)).length() < 0.001;
+}
+
+/**
+ * Starts the wiimote with accelerometer data, without smoothing.
+ */
+void TestQWiimoteThreadedIO::startAcceleration()
+{
+	QVERIFY(this->wiimote->start(QWiimote::AccelerometerData));
+	this->wiimote->setAccelerationSmoothing(QWiimote::SmoothingNone);
+}
+
+void TestQWiimoteThreadedIO::init()
+{
+	/* Each sample tilts the wiimote by 90 degrees, so every report updates the acceleration. */
+	QLoopbackSample flat;
+	flat.buttons = 0;
+	flat.acceleration[0] = 512;
+	flat.acceleration[1] = 512;
+	flat.acceleration[2] = 616;
+	for (int i = 0; i < 3; i++) {
+		flat.motionplus[i] = 8000;
+		flat.motionplus_slow[i] = true;
+	}
+	QLoopbackSample tilted = flat;
+	tilted.acceleration[0] = 616;
+	tilted.acceleration[2] = 512;
+
+	this->transport = new QLoopbackWiimote();
+	this->transport->setScript(QList<QLoopbackSample>() << flat << tilted);
+	this->transport->setReportRate(100);
+
+	this->wiimote = new QWiimote(this->transport);
+	this->wiimote->setCalibrationCacheEnabled(false);
+	this->wiimote->setThreadedIO(true, 64);
+}
+
+void TestQWiimoteThreadedIO::cleanup()
+{
+	delete this->wiimote;
+	this->wiimote = NULL;
+	this->transport = NULL;
+}
+
+/**
+ * start() moves the transport to a thread of its own, and it stays there.
+ */
+void TestQWiimoteThreadedIO::transportRunsInItsOwnThread()
+{
+	QVERIFY(this->wiimote->threadedIO());
+	QCOMPARE(this->transport->thread(), QThread::currentThread());
+
+	this->startAcceleration();
+	QThread * io_thread = this->transport->thread();
+	QVERIFY(io_thread != QThread::currentThread());
+	QVERIFY(io_thread->isRunning());
+	QVERIFY(this->transport->parent() == NULL);
+	/* The ring of 64 reports fills up before the report pool. */
+	QVERIFY(this->transport->reportPool()->capacity() > 64);
+	QCOMPARE(this->wiimote->thread(), QThread::currentThread());
+
+	/* Threaded I/O can't be turned off once the thread exists. */
+	this->wiimote->setThreadedIO(false);
+	QVERIFY(this->wiimote->threadedIO());
+	this->wiimote->stop();
+	QCOMPARE(this->transport->thread(), io_thread);
+}
+
+/**
+ * Reports generated by the timer of the transport in the I/O thread reach the wiimote.
+ */
+void TestQWiimoteThreadedIO::reportsArrive()
+{
+	QSignalSpy spy(this->wiimote, SIGNAL(updatedAcceleration()));
+	this->startAcceleration();
+
+	QVERIFY(waitForSignals(spy, 20));
+	QVERIFY(isScriptAcceleration(this->wiimote->acceleration()));
+	QVERIFY(!this->wiimote->isStalled());
+	QCOMPARE(this->wiimote->reportRingOverflows(), (quint32)0);
+	QCOMPARE(this->wiimote->reportPoolExhaustions(), (quint32)0);
+}
+
+/**
+ * Reports which don't fit in the ring while the owner thread is busy are counted as ring overflows,
+ * and the report pool is never exhausted.
+ */
+void TestQWiimoteThreadedIO::ringOverflowsAreCounted()
+{
+	QSignalSpy spy(this->wiimote, SIGNAL(updatedAcceleration()));
+	this->transport->setReportRate(2000);
+	this->startAcceleration();
+	QVERIFY(waitForSignals(spy, 5));
+
+	/* The I/O thread keeps generating reports while this thread does not process any. */
+	QTest::qSleep(500);
+	QVERIFY(this->wiimote->reportRingOverflows() > 0);
+	QCOMPARE(this->wiimote->reportPoolExhaustions(), (quint32)0);
+
+	/* The ring is drained once this thread processes events again. */
+	spy.clear();
+	QVERIFY(waitForSignals(spy, 5));
+}
+
+/**
+ * The reporting mode can be changed from the thread of the wiimote while reports arrive.
+ */
+void TestQWiimoteThreadedIO::dataTypesChangeWhileRunning()
+{
+	QSignalSpy spy(this->wiimote, SIGNAL(updatedAcceleration()));
+	this->startAcceleration();
+	QVERIFY(waitForSignals(spy, 5));
+
+	this->wiimote->setDataTypes(QWiimote::DefaultData);
+	QTest::qWait(200);
+	spy.clear();
+	QTest::qWait(200);
+	QCOMPARE(spy.count(), 0);
+
+	this->wiimote->setDataTypes(QWiimote::AccelerometerData);
+	QVERIFY(waitForSignals(spy, 5));
+}
+
+/**
+ * stop() closes the transport in its thread, and the wiimote can be started again.
+ */
+void TestQWiimoteThreadedIO::stopAndRestart()
+{
+	QSignalSpy spy(this->wiimote, SIGNAL(updatedAcceleration()));
+	this->startAcceleration();
+	QVERIFY(waitForSignals(spy, 5));
+
+	this->wiimote->stop();
+	QVERIFY(!this->transport->isOpened());
+	/* The queued write of the default reporting mode is flushed before closing. */
+	QCOMPARE(this->transport->reportingMode(), (quint8)0x30);
+	spy.clear();
+	QTest::qWait(200);
+	QCOMPARE(spy.count(), 0);
+
+	this->startAcceleration();
+	QVERIFY(this->transport->isOpened());
+	QVERIFY(waitForSignals(spy, 5));
+}
+
+/**
+ * Destroying the wiimote stops the I/O thread and deletes the transport.
+ */
+void TestQWiimoteThreadedIO::destructionDeletesTheTransport()
+{
+	QPointer<QLoopbackWiimote> transport = this->transport;
+	this->startAcceleration();
+	QPointer<QThread> io_thread = this->transport->thread();
+
+	delete this->wiimote;
+	this->wiimote = NULL;
+	QVERIFY(transport.isNull());
+	QVERIFY(io_thread.isNull());
+}
+
+/* QTEST_MAIN would need a display for the QApplication of QtGui. */
+int main(int argc, char ** argv)
+{
+	QCoreApplication app(argc, argv);
+	TestQWiimoteThreadedIO test;
+	return QTest::qExec(&test, argc, argv);
+}
+
+#include "tst_qwiimotethreadedio.moc"
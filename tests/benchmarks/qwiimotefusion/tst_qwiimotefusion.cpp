@@ -0,0 +1,266 @@
+/*
+ * This file is part of QWiimote.
+ *
+ * QWiimote is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QWiimote is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QWiimote. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file tst_qwiimotefusion.cpp
+ *
+ * Benchmark of the orientation modes which use the MotionPlus: accuracy against a simulated
+ * ground truth, and processing time per report.
+ */
+
+#include <QtTest>
+#include <QCoreApplication>
+#include <QVector>
+#include <cmath>
+#include "../tracewiimote.h"
+
+#define MOTIONPLUS_ZERO  8000              ///< Raw MotionPlus value at rest, as in TraceWiimote::stillSample().
+#define MOTIONPLUS_SCALE (8192.0 / 595.0)  ///< Raw MotionPlus units per degree per second in slow mode, as used by QWiimote.
+#define MOTIONPLUS_GAIN  0.65              ///< Factor applied by QWiimote to the MotionPlus speeds.
+
+class TestQWiimoteFusion : public QObject
+{
+	Q_OBJECT
+public slots:
+	void storeMotionPlusState(QWiimote::MotionPlusStates state);
+
+private slots:
+	void initTestCase();
+	void cleanupTestCase();
+
+	void accuracy_data();
+	void accuracy();
+	void updateCost_data();
+	void updateCost();
+
+private:
+	static const int TRACE_LENGTH = 2000; ///< Reports of the trace: 20 seconds at 100 Hz.
+	static const int SUBSTEPS = 20;       ///< Integration steps of the ground truth between two reports.
+
+	static QVector3D bodyRate(qreal time);
+	static int noiseValue(int amplitude);
+	QLoopbackSample sample(int index, int noise, int bias) const;
+
+	QVector<QQuaternion> truth;  ///< True orientation at each report.
+	QVector<QVector3D> rates;    ///< True angular rate around the axes of the wiimote at each report, in radians per second.
+	TraceWiimote * transport;    ///< Transport playing the trace.
+	QWiimote * wiimote;          ///< Wiimote under test.
+	int motionplus_state;        ///< Last #QWiimote::MotionPlusState emitted.
+};
+
+/**
+ * Angular rate of the simulated motion around the axes of the wiimote, as used by QWiimote for
+ * integrating orientation. Each axis follows a sine of a different frequency, so every axis
+ * combination happens.
+ * @param time Seconds since the start of the trace.
+ * @return Angular rate, in radians per second.
+ */
+QVector3D TestQWiimoteFusion::bodyRate(qreal time)
+{
+	return QVector3D(60 * sin(2 * QW_PI * 0.5 * time),
+					 90 * sin(2 * QW_PI * 0.3 * time),
+					 45 * sin(2 * QW_PI * 0.7 * time)) * (QW_PI / 180);
+}
+
+/**
+ * Uniform sensor noise, from the sequence started by qsrand().
+ * @param amplitude Largest noise, in raw units.
+ * @return Noise, in raw units.
+ */
+int TestQWiimoteFusion::noiseValue(int amplitude)
+{
+	return (amplitude > 0) ? qrand() % (2 * amplitude + 1) - amplitude : 0;
+}
+
+/**
+ * Raw sample of a report of the trace.
+ * @param index Report of the trace.
+ * @param noise Largest sensor noise of the accelerometer and the MotionPlus, in raw units.
+ * @param bias Drift of the MotionPlus yaw and pitch zeros since they were calibrated, in raw units.
+ * @return Sample measuring the true gravity and angular rate.
+ */
+QLoopbackSample TestQWiimoteFusion::sample(int index, int noise, int bias) const
+{
+	QLoopbackSample sample = TraceWiimote::stillSample();
+
+	/* The accelerometer measures the reaction to gravity, which points up (y). TraceWiimote reads 104 raw units per g. */
+	QVector3D up = this->truth[index].conjugate().rotatedVector(QVector3D(0.0, 1.0, 0.0));
+	qreal acceleration[3] = {up.x(), up.y(), up.z()};
+	for (int i = 0; i < 3; i++) {
+		sample.acceleration[i] = (quint16)qBound(0, qRound(512 + 104 * acceleration[i]) + noiseValue(noise), 0x3FF);
+	}
+
+	/* QWiimote takes x from -pitch, y from yaw and z from roll. */
+	QVector3D speed = this->rates[index] * (180 / QW_PI / MOTIONPLUS_GAIN) * MOTIONPLUS_SCALE;
+	qreal raw_speeds[3] = {speed.y(), speed.z(), -speed.x()};
+	int biases[3] = {bias, 0, bias};
+	for (int i = 0; i < 3; i++) {
+		sample.motionplus[i] = (quint16)qBound(0, MOTIONPLUS_ZERO + qRound(raw_speeds[i]) + biases[i] + noiseValue(noise), 0x3FFF);
+	}
+
+	return sample;
+}
+
+/**
+ * Keeps the state of the MotionPlus.
+ * @param state New state.
+ */
+void TestQWiimoteFusion::storeMotionPlusState(QWiimote::MotionPlusStates state)
+{
+	this->motionplus_state = (int)state;
+}
+
+/**
+ * Integrates the ground truth and starts the wiimote with a calibrated MotionPlus.
+ */
+void TestQWiimoteFusion::initTestCase()
+{
+	qreal period = TraceWiimote::REPORT_PERIOD / 1000.0;
+	QQuaternion orientation;
+	for (int i = 0; i < TRACE_LENGTH; i++) {
+		this->truth.append(orientation);
+		this->rates.append(bodyRate(i * period));
+
+		/* Exact rotations of the rate at the middle of each substep, applied in the frame of the wiimote. */
+		for (int step = 0; step < SUBSTEPS; step++) {
+			QVector3D rate = bodyRate((i + (step + 0.5) / SUBSTEPS) * period);
+			qreal angle = rate.length() * period / SUBSTEPS;
+			if (angle > 0) orientation = orientation * QQuaternion::fromAxisAndAngle(rate.normalized(), angle * 180 / QW_PI);
+		}
+		orientation.normalize();
+	}
+
+	this->motionplus_state = QWiimote::MotionPlusInactive;
+	this->transport = new TraceWiimote();
+	this->wiimote = new QWiimote(this->transport);
+	this->wiimote->setCalibrationCacheEnabled(false);
+	connect(this->wiimote, SIGNAL(motionPlusState(QWiimote::MotionPlusStates)),
+			this, SLOT(storeMotionPlusState(QWiimote::MotionPlusStates)));
+	QVERIFY(this->wiimote->start(QWiimote::MotionPlusData));
+	QVERIFY(this->transport->waitForCalibration(this->wiimote));
+
+	/* The MotionPlus is activated by polling, and its zeros are estimated from still reports. */
+	for (int waited = 0; this->motionplus_state != QWiimote::MotionPlusCalibrated && waited < 5000;
+		 waited += TraceWiimote::REPORT_PERIOD) {
+		QTest::qWait(TraceWiimote::REPORT_PERIOD);
+		this->transport->play(TraceWiimote::stillSample());
+	}
+	QCOMPARE(this->motionplus_state, (int)QWiimote::MotionPlusCalibrated);
+}
+
+void TestQWiimoteFusion::cleanupTestCase()
+{
+	delete this->wiimote;
+}
+
+void TestQWiimoteFusion::accuracy_data()
+{
+	QTest::addColumn<int>("mode");
+	QTest::addColumn<int>("noise");
+	QTest::addColumn<int>("bias");
+
+	QTest::newRow("Raw exact")     << (int)QWiimote::OrientationModeRaw    << 0 << 0;
+	QTest::newRow("Fusion exact")  << (int)QWiimote::OrientationModeFusion << 0 << 0;
+	QTest::newRow("Raw noisy")     << (int)QWiimote::OrientationModeRaw    << 2 << 0;
+	QTest::newRow("Fusion noisy")  << (int)QWiimote::OrientationModeFusion << 2 << 0;
+	QTest::newRow("Raw biased")    << (int)QWiimote::OrientationModeRaw    << 2 << 40;
+	QTest::newRow("Fusion biased") << (int)QWiimote::OrientationModeFusion << 2 << 40;
+}
+
+/**
+ * Compares the orientation given by each mode with the ground truth along the trace.
+ * The tilt error is the angle between the true and the estimated direction of gravity, which the
+ * accelerometer can correct. The rotation error is the whole angle between both orientations,
+ * including yaw, which only the MotionPlus measures. Results are printed, since they are not times.
+ */
+void TestQWiimoteFusion::accuracy()
+{
+	QFETCH(int, mode);
+	QFETCH(int, noise);
+	QFETCH(int, bias);
+
+	this->wiimote->setOrientationMode((QWiimote::OrientationMode)mode);
+	this->wiimote->resetOrientation();
+	qsrand(1);
+
+	qreal tilt_squares = 0, max_tilt = 0, rotation_squares = 0, rotation = 0;
+	for (int i = 0; i < TRACE_LENGTH; i++) {
+		this->transport->play(this->sample(i, noise, bias));
+
+		QMatrix4x4 estimated = this->wiimote->orientation();
+		QMatrix4x4 expected;
+		expected.rotate(this->truth[i]);
+
+		/* Gravity in the frame of the wiimote is the second row of each rotation. */
+		QVector3D estimated_up(estimated(1, 0), estimated(1, 1), estimated(1, 2));
+		QVector3D expected_up(expected(1, 0), expected(1, 1), expected(1, 2));
+		qreal cosine = QVector3D::dotProduct(estimated_up.normalized(), expected_up.normalized());
+		qreal tilt = acos(qBound((qreal)-1.0, cosine, (qreal)1.0)) * 180 / QW_PI;
+
+		/* Angle of the rotation between both orientations, from the trace of the product of both matrices. */
+		qreal trace = 0;
+		for (int row = 0; row < 3; row++) {
+			for (int column = 0; column < 3; column++) trace += estimated(row, column) * expected(row, column);
+		}
+		rotation = acos(qBound((qreal)-1.0, (trace - 1) / 2, (qreal)1.0)) * 180 / QW_PI;
+
+		tilt_squares += tilt * tilt;
+		max_tilt = qMax(max_tilt, tilt);
+		rotation_squares += rotation * rotation;
+	}
+
+	qDebug("%-14s tilt RMS %6.2f deg, max %6.2f deg; rotation RMS %6.2f deg, final %6.2f deg",
+		   QTest::currentDataTag(), sqrt(tilt_squares / TRACE_LENGTH), max_tilt,
+		   sqrt(rotation_squares / TRACE_LENGTH), rotation);
+}
+
+void TestQWiimoteFusion::updateCost_data()
+{
+	QTest::addColumn<int>("mode");
+
+	QTest::newRow("None")   << (int)QWiimote::OrientationModeNone;
+	QTest::newRow("Raw")    << (int)QWiimote::OrientationModeRaw;
+	QTest::newRow("Fusion") << (int)QWiimote::OrientationModeFusion;
+}
+
+/**
+ * Time needed to process the reports of the whole trace. Divide by #TRACE_LENGTH for the cost of a
+ * report; the difference with None is the cost of the orientation update.
+ */
+void TestQWiimoteFusion::updateCost()
+{
+	QFETCH(int, mode);
+
+	QVector<QLoopbackSample> samples;
+	for (int i = 0; i < TRACE_LENGTH; i++) samples.append(this->sample(i, 0, 0));
+	this->wiimote->setOrientationMode((QWiimote::OrientationMode)mode);
+	this->wiimote->resetOrientation();
+
+	QBENCHMARK {
+		for (int i = 0; i < TRACE_LENGTH; i++) this->transport->play(samples[i]);
+	}
+}
+
+/* QWiimote needs an event loop for activating the MotionPlus, but no display. */
+int main(int argc, char ** argv)
+{
+	QCoreApplication app(argc, argv);
+	TestQWiimoteFusion test;
+	return QTest::qExec(&test, argc, argv);
+}
+
+#include "tst_qwiimotefusion.moc"
@@ -0,0 +1,200 @@
+/*
+ * This file is part of QWiimote.
+ *
+ * QWiimote is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QWiimote is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QWiimote. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file tst_qwiimotesmoothing.cpp
+ *
+ * Benchmark of the acceleration smoothing methods of QWiimote: lag and jitter on a synthetic
+ * trace, and processing time per report.
+ */
+
+#include <QtTest>
+#include <QCoreApplication>
+#include <QVector>
+#include <cmath>
+#include "../tracewiimote.h"
+
+class TestQWiimoteSmoothing : public QObject
+{
+	Q_OBJECT
+private slots:
+	void initTestCase();
+	void cleanupTestCase();
+
+	void quality_data();
+	void quality();
+	void updateCost_data();
+	void updateCost();
+
+private:
+	static const int TRACE_LENGTH = 1000;  ///< Reports of the trace: 10 seconds at 100 Hz.
+	static const int MOTION_START = 200;   ///< First report of the motion.
+	static const int MOTION_END = 500;     ///< First report after the motion.
+	static const int SETTLING = 100;       ///< Reports ignored after each change before measuring jitter.
+	static const int MAX_LAG = 30;         ///< Largest lag looked for, in reports.
+
+	void addMethods();
+	QLoopbackSample sample(int index) const;
+
+	QVector<qreal> truth;        ///< True acceleration along x of each report, in g.
+	QVector<quint16> raw;        ///< Noisy raw acceleration along x of each report.
+	TraceWiimote * transport;    ///< Transport playing the trace.
+	QWiimote * wiimote;          ///< Wiimote under test.
+};
+
+/**
+ * Builds the trace and starts the wiimote.
+ * The trace is 2 seconds still, 3 periods of a 1 Hz sine of 1 g along x, and a 0.5 g hold.
+ * Sensor noise is triangular, up to 6 raw counts (about 0.06 g) from the true value.
+ */
+void TestQWiimoteSmoothing::initTestCase()
+{
+	/* The same noise is used by every run. */
+	qsrand(1);
+	for (int i = 0; i < TRACE_LENGTH; i++) {
+		qreal value = 0;
+		if (i >= MOTION_END) {
+			value = 0.5;
+		} else if (i >= MOTION_START) {
+			value = sin(2 * QW_PI * (i - MOTION_START) * TraceWiimote::REPORT_PERIOD / 1000.0);
+		}
+		int noise = (qrand() % 7 - 3) + (qrand() % 7 - 3);
+
+		this->truth.append(value);
+		this->raw.append((quint16)qBound(0, qRound(512 + 104 * value) + noise, 0x3FF));
+	}
+
+	this->transport = new TraceWiimote();
+	this->wiimote = new QWiimote(this->transport);
+	this->wiimote->setCalibrationCacheEnabled(false);
+	QVERIFY(this->wiimote->start(QWiimote::AccelerometerData));
+	QVERIFY(this->transport->waitForCalibration(this->wiimote));
+}
+
+void TestQWiimoteSmoothing::cleanupTestCase()
+{
+	delete this->wiimote;
+}
+
+/**
+ * Adds a row for each smoothing method.
+ */
+void TestQWiimoteSmoothing::addMethods()
+{
+	QTest::addColumn<int>("method");
+	QTest::newRow("None") << (int)QWiimote::SmoothingNone;
+	QTest::newRow("EMA") << (int)QWiimote::SmoothingEMA;
+	QTest::newRow("TimeEMA") << (int)QWiimote::SmoothingTimeEMA;
+	QTest::newRow("OneEuro") << (int)QWiimote::SmoothingOneEuro;
+	QTest::newRow("Kalman") << (int)QWiimote::SmoothingKalman;
+}
+
+/**
+ * Raw sample of a report of the trace.
+ * @param index Report of the trace.
+ * @return Sample with the noisy acceleration along x, and 1 g along y.
+ */
+QLoopbackSample TestQWiimoteSmoothing::sample(int index) const
+{
+	QLoopbackSample sample = TraceWiimote::stillSample();
+	sample.acceleration[0] = this->raw[index];
+	return sample;
+}
+
+void TestQWiimoteSmoothing::quality_data()
+{
+	this->addMethods();
+}
+
+/**
+ * Measures the lag of each method during the motion, and its jitter while still.
+ * The lag is the delay of the true signal which best matches the output. The jitter is the
+ * RMS difference between the output and the true value, once the output has settled.
+ * Results are printed, since they are not times.
+ */
+void TestQWiimoteSmoothing::quality()
+{
+	QFETCH(int, method);
+	this->wiimote->setAccelerationSmoothing((QWiimote::AccelerationSmoothing)method);
+
+	/* Start from a settled output. */
+	for (int i = 0; i < SETTLING; i++) this->transport->play(this->sample(0));
+
+	QVector<qreal> output;
+	for (int i = 0; i < TRACE_LENGTH; i++) {
+		this->transport->play(this->sample(i));
+		output.append(this->wiimote->acceleration().x());
+	}
+
+	qreal still_error = 0;
+	int still_count = 0;
+	for (int i = 0; i < TRACE_LENGTH; i++) {
+		if (i < MOTION_START || i >= MOTION_END + SETTLING) {
+			still_error += (output[i] - this->truth[i]) * (output[i] - this->truth[i]);
+			still_count++;
+		}
+	}
+	qreal jitter = sqrt(still_error / still_count);
+
+	int lag = 0;
+	qreal lag_error = 0;
+	for (int delay = 0; delay <= MAX_LAG; delay++) {
+		qreal error = 0;
+		for (int i = MOTION_START + MAX_LAG; i < MOTION_END; i++) {
+			error += (output[i] - this->truth[i - delay]) * (output[i] - this->truth[i - delay]);
+		}
+		error = sqrt(error / (MOTION_END - MOTION_START - MAX_LAG));
+		if (delay == 0 || error < lag_error) {
+			lag = delay;
+			lag_error = error;
+		}
+	}
+
+	qDebug("%-8s lag %3d ms, residual error %.4f g, jitter %.4f g",
+		   QTest::currentDataTag(), lag * TraceWiimote::REPORT_PERIOD, lag_error, jitter);
+	/* A smoothing method which fails to follow a 1 Hz motion is broken. */
+	QVERIFY(lag < MAX_LAG);
+}
+
+void TestQWiimoteSmoothing::updateCost_data()
+{
+	this->addMethods();
+}
+
+/**
+ * Time needed to process the reports of the whole trace, from the report to the smoothed acceleration.
+ * Divide by #TRACE_LENGTH for the cost of a report.
+ */
+void TestQWiimoteSmoothing::updateCost()
+{
+	QFETCH(int, method);
+	this->wiimote->setAccelerationSmoothing((QWiimote::AccelerationSmoothing)method);
+
+	QBENCHMARK {
+		for (int i = 0; i < TRACE_LENGTH; i++) this->transport->play(this->sample(i));
+	}
+}
+
+/* QWiimote needs an event loop for its start-up requests, but no display. */
+int main(int argc, char ** argv)
+{
+	QCoreApplication app(argc, argv);
+	TestQWiimoteSmoothing test;
+	return QTest::qExec(&test, argc, argv);
+}
+
+#include "tst_qwiimotesmoothing.moc"
@@ -0,0 +1,148 @@
+/*
+ * This file is part of QWiimote.
+ *
+ * QWiimote is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QWiimote is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QWiimote. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file tst_qwiimotestartup.cpp
+ *
+ * Benchmark of the start-up latency of QWiimote on the loopback transport: time from start() to
+ * the first calibrated acceleration, or to a working MotionPlus.
+ */
+
+#include <QtTest>
+#include <QCoreApplication>
+#include <QEventLoop>
+#include <QTimer>
+#include "qwiimote.h"
+#include "qloopbackwiimote.h"
+
+class TestQWiimoteStartup : public QObject
+{
+	Q_OBJECT
+public slots:
+	void setReady();
+	void checkMotionPlusState(QWiimote::MotionPlusStates state);
+
+private slots:
+	void firstAcceleration_data();
+	void firstAcceleration();
+
+private:
+	QEventLoop * loop; ///< Loop of the start being measured.
+	bool ready;        ///< True once the start being measured has finished.
+};
+
+/**
+ * The start being measured has finished.
+ */
+void TestQWiimoteStartup::setReady()
+{
+	this->ready = true;
+	this->loop->quit();
+}
+
+/**
+ * A start with the MotionPlus finishes once the MotionPlus is working.
+ * @param state New state of the MotionPlus.
+ */
+void TestQWiimoteStartup::checkMotionPlusState(QWiimote::MotionPlusStates state)
+{
+	if (state == QWiimote::MotionPlusWorking) this->setReady();
+}
+
+void TestQWiimoteStartup::firstAcceleration_data()
+{
+	QTest::addColumn<bool>("threaded");
+	QTest::addColumn<int>("data_types");
+	QTest::addColumn<int>("latency");
+
+	const int accelerometer = QWiimote::AccelerometerData;
+	const int motionplus = QWiimote::MotionPlusData;
+
+	QTest::newRow("Direct")           << false << accelerometer << 0;
+	QTest::newRow("Threaded")         << true  << accelerometer << 0;
+	QTest::newRow("Direct 20 ms")     << false << accelerometer << 20;
+	QTest::newRow("Threaded 20 ms")   << true  << accelerometer << 20;
+	QTest::newRow("MotionPlus")       << false << motionplus    << 0;
+	QTest::newRow("MotionPlus 20 ms") << false << motionplus    << 20;
+}
+
+/**
+ * Starts the wiimote and waits for its first acceleration, which needs the calibration read made
+ * by start() and a continuous report. With MotionPlusData, waits until the MotionPlus is working
+ * instead, which also needs its identifier to be read and its activation to be written.
+ * The loopback answers every request after the given latency, as a wiimote over Bluetooth does, and
+ * sends 100 reports per second, so about half a report period is spent waiting for a report. With
+ * pipelined requests, the time is a few latencies, not one latency per request.
+ * The benchmarked time includes stop(); the latency up to the end of the start is printed.
+ */
+void TestQWiimoteStartup::firstAcceleration()
+{
+	QFETCH(bool, threaded);
+	QFETCH(int, data_types);
+	QFETCH(int, latency);
+
+	QLoopbackWiimote * transport = new QLoopbackWiimote();
+	transport->setReportRate(100);
+	transport->setReplyLatency(latency);
+	QWiimote wiimote(transport);
+	wiimote.setCalibrationCacheEnabled(false);
+	wiimote.setThreadedIO(threaded);
+
+	QEventLoop loop;
+	this->loop = &loop;
+	QTimer timeout;
+	timeout.setSingleShot(true);
+	if (data_types & QWiimote::MotionPlusData) {
+		connect(&wiimote, SIGNAL(motionPlusState(QWiimote::MotionPlusStates)),
+				this, SLOT(checkMotionPlusState(QWiimote::MotionPlusStates)));
+	} else {
+		connect(&wiimote, SIGNAL(updatedAcceleration()), this, SLOT(setReady()));
+	}
+	connect(&timeout, SIGNAL(timeout()), &loop, SLOT(quit()));
+
+	qreal total_latency = 0, min_latency = 0, max_latency = 0;
+	int starts = 0;
+	QBENCHMARK {
+		QPreciseTime started = QPreciseTime::currentTime();
+		this->ready = false;
+		QVERIFY(wiimote.start((QWiimote::DataTypes)data_types));
+		timeout.start(2000);
+		if (!this->ready) loop.exec();
+		qreal latency = started.elapsed();
+		timeout.stop();
+		wiimote.stop();
+		QVERIFY(this->ready);
+
+		total_latency += latency;
+		min_latency = (starts == 0) ? latency : qMin(min_latency, latency);
+		max_latency = qMax(max_latency, latency);
+		starts++;
+	}
+
+	qDebug("%-16s ready after %.2f ms on average, %.2f ms at least, %.2f ms at most (%d starts)",
+		   QTest::currentDataTag(), total_latency / starts, min_latency, max_latency, starts);
+}
+
+/* QWiimote needs an event loop for its start-up requests, but no display. */
+int main(int argc, char ** argv)
+{
+	QCoreApplication app(argc, argv);
+	TestQWiimoteStartup test;
+	return QTest::qExec(&test, argc, argv);
+}
+
+#include "tst_qwiimotestartup.moc"
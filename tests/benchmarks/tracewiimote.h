@@ -0,0 +1,113 @@
+/*
+ * This file is part of QWiimote.
+ *
+ * QWiimote is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QWiimote is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QWiimote. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file tracewiimote.h
+ *
+ * Loopback transport which plays synthetic traces for the benchmarks.
+ */
+
+#ifndef TRACEWIIMOTE_H
+#define TRACEWIIMOTE_H
+
+#include <QtTest>
+#include "qloopbackwiimote.h"
+#include "qwiimote.h"
+
+#define QW_PI (3.141592653589793238462643) ///< Pi constant.
+
+/**
+ * Loopback wiimote whose input reports are given one by one by the benchmark.
+ * Each report is timestamped one #REPORT_PERIOD after the previous one, so a trace is processed
+ * as fast as possible while #QWiimote sees reports sampled at 100 Hz.
+ */
+class TraceWiimote : public QLoopbackWiimote
+{
+public:
+	static const int REPORT_PERIOD = 10; ///< Milliseconds between the timestamps of consecutive reports.
+
+	TraceWiimote(QObject * parent = NULL) : QLoopbackWiimote(parent)
+	{
+		this->played_reports = 0;
+		/* Reports are only generated by play(). */
+		this->setReportRate(0);
+		/* Every axis reads 512 at 0 g and 104 more per g, which is how the benchmarks encode acceleration. */
+		const quint16 zero[3] = {512, 512, 512};
+		const quint16 gravity[3] = {616, 616, 616};
+		this->setAccelerationCalibration(zero, gravity);
+	}
+
+	/**
+	 * Sample of a wiimote lying still and flat, with the MotionPlus at rest.
+	 * Gravity is measured along y, the up axis of QWiimote.
+	 * @return Raw sample.
+	 */
+	static QLoopbackSample stillSample()
+	{
+		QLoopbackSample sample;
+		sample.buttons = 0;
+		sample.acceleration[0] = 512;
+		sample.acceleration[1] = 616;
+		sample.acceleration[2] = 512;
+		for (int i = 0; i < 3; i++) {
+			sample.motionplus[i] = 8000;
+			sample.motionplus_slow[i] = true;
+		}
+		return sample;
+	}
+
+	/**
+	 * Emits an input report of the current reporting mode. It is processed before returning.
+	 * @param sample Raw state of the wiimote.
+	 */
+	void play(const QLoopbackSample &sample)
+	{
+		if (this->played_reports == 0) this->first_report = QPreciseTime::currentTime();
+		this->emitInputReport(sample, this->first_report +
+							  QPreciseDuration::fromMilliseconds((qint64)REPORT_PERIOD * this->played_reports));
+		this->played_reports++;
+	}
+
+	/**
+	 * Plays still samples while processing events, until the wiimote has received the calibration
+	 * requested by start() and a report has updated its acceleration.
+	 * @param wiimote Started wiimote using this transport.
+	 * @return True iff the acceleration was updated within two seconds.
+	 */
+	bool waitForCalibration(QWiimote * wiimote)
+	{
+		QSignalSpy spy(wiimote, SIGNAL(updatedAcceleration()));
+		for (int waited = 0; spy.count() == 0 && waited < 2000; waited += REPORT_PERIOD) {
+			QTest::qWait(REPORT_PERIOD);
+			this->play(stillSample());
+		}
+
+		return spy.count() > 0;
+	}
+
+	/**
+	 * Number of reports emitted by play().
+	 * @return Number of reports.
+	 */
+	qint64 playedReports() const { return this->played_reports; }
+
+private:
+	QPreciseTime first_report; ///< Time given to the first report.
+	qint64 played_reports;     ///< Number of reports emitted by play().
+};
+
+#endif // TRACEWIIMOTE_H
@@ -0,0 +1,34 @@
+# This file is part of QWiimote.
+#
+# QWiimote is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# QWiimote is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with QWiimote. If not, see <http://www.gnu.org/licenses/>.
+
+# Settings shared by every test and benchmark. Each one is a QtTest executable linked
+# to the QWiimote static library, which must be built first in ../qwiimote.
+TEMPLATE = app
+QT += testlib
+CONFIG += console testcase
+CONFIG -= app_bundle
+
+INCLUDEPATH += $$PWD/../qwiimote
+DEPENDPATH += $$PWD/../qwiimote
+
+# The library is found in the build directory of ../qwiimote, next to the one of the tests.
+QWIIMOTE_BUILD_DIR = $$OUT_PWD/../../../qwiimote
+LIBS += -L$$QWIIMOTE_BUILD_DIR -L$$QWIIMOTE_BUILD_DIR/debug -L$$QWIIMOTE_BUILD_DIR/release
+LIBS += -l$$qtLibraryTarget(QWiimote)
+
+win32 {
+    LIBS += C:/WinDDK/lib/wxp/i386/setupapi.lib
+    LIBS += C:/WinDDK/lib/wxp/i386/hid.lib
+}